@@ -1,9 +1,21 @@
+#define _GNU_SOURCE
 #include "analyzer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define SOCKET_PATH "/tmp/mapd_socket"
+#define RING_POLL_MS 10
+#define REORDER_QUIET_MS 50
+#define REORDER_CAPACITY 16384
 
 static int client_counter = 0;
 pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+static ClientContext* clients = NULL;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
 AnalyzerOptions* analyzer_options = NULL;
 
 /**
@@ -60,11 +72,27 @@ static void* server_socket_thread(void* arg)
         }
 
         ctx->client_fd = client_fd;
+        ctx->received_fd = -1;
+        ctx->ring = NULL;
+        ctx->ring_size = 0;
+        ctx->ring_slots = 0;
+        ctx->has_parked = 0;
+        ctx->sampled_live_bytes = 0;
+        ctx->clock_offset_ns = 0;
+        stack_table_init(&ctx->stacks, 0);
+        reorder_init(&ctx->reorder, REORDER_CAPACITY);
+        ctx->accepts_control = 0;
+        ctx->latency = NULL;
+        ctx->counters = NULL;
+        ctx->counters_size = 0;
+        ctx->counter_slots = 0;
+        ctx->next = NULL;
 
         // Assign unique client number (thread-safe)
         pthread_mutex_lock(&counter_lock);
         ctx->client_number = ++client_counter;
         pthread_mutex_unlock(&counter_lock);
+        leak_summary_init(&ctx->leaks, ctx->client_number);
 
         // Spawn detached thread to handle client communication
         pthread_t tid;
@@ -100,25 +128,210 @@ void analyzer_init(AnalyzerOptions* options)
 }
 
 /**
- * handle_client:
+ * register_client:
  *
- * Handles communication with a single connected client. Receives JSON messages from the client, parses them, and
- * enqueues them for processing.
+ * Adds a client to the list reachable by analyzer_send_control().
+ */
+static void register_client(ClientContext* ctx)
+{
+    pthread_mutex_lock(&clients_lock);
+    ctx->next = clients;
+    clients = ctx;
+    pthread_mutex_unlock(&clients_lock);
+}
+
+/**
+ * unregister_client:
  *
- * @param arg: Pointer to ClientContext containing connection information.
- * @return: NULL when thread exits.
+ * Removes a client from the list. Once this returns no control frame is being written to it.
  */
-void* handle_client(void* arg) {
-    ClientContext* ctx = (ClientContext*)arg;
+static void unregister_client(ClientContext* ctx)
+{
+    pthread_mutex_lock(&clients_lock);
+    for (ClientContext** link = &clients; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == ctx)
+        {
+            *link = ctx->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+}
+
+/**
+ * send_to_client:
+ *
+ * Writes a complete frame to a client that accepts control frames.
+ *
+ * @param client_number: Client number, or -1 for every such client
+ * @return: 0 if at least one client got the frame, -1 otherwise
+ */
+static int send_to_client(int client_number, const void* frame, size_t size)
+{
+    int result = -1;
+
+    // The list lock keeps the client alive and serializes writers
+    pthread_mutex_lock(&clients_lock);
+    for (ClientContext* ctx = clients; ctx != NULL; ctx = ctx->next)
+    {
+        if (client_number != -1 && ctx->client_number != client_number) continue;
+        if (ctx->accepts_control && send(ctx->client_fd, frame, size, MSG_NOSIGNAL) == (ssize_t)size)
+            result = 0;
+        if (client_number != -1) break;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return result;
+}
+
+int analyzer_send_control(int client_number, ControlCommand command, uint64_t value)
+{
+    const struct {
+        FrameHeader header;
+        ControlFrame control;
+    } frame = {
+        .header = { .kind = FRAME_CONTROL, .length = sizeof(ControlFrame) },
+        .control = { .command = command, .value = value }
+    };
+    return send_to_client(client_number, &frame, sizeof(frame));
+}
+
+int analyzer_send_filter(int client_number, const FilterFrame* filter)
+{
+    struct {
+        FrameHeader header;
+        FilterFrame filter;
+    } frame;
+    const int count = filter->site_count < PROTOCOL_MAX_FILTER_SITES ? filter->site_count : PROTOCOL_MAX_FILTER_SITES;
+    const uint32_t length = (uint32_t)(offsetof(FilterFrame, sites) + PROTOCOL_FILTER_SITE_LENGTH * (size_t)count);
+
+    frame.header = (FrameHeader){ .kind = FRAME_FILTER, .length = length };
+    memcpy(&frame.filter, filter, length);
+    frame.filter.site_count = (uint16_t)count;
+    return send_to_client(client_number, &frame, sizeof(FrameHeader) + length);
+}
+
+/**
+ * info_log_event_mask:
+ *
+ * Event types a wrapper has to send given the info log option: malloc and free are only shown with info logs.
+ */
+static uint64_t info_log_event_mask(void)
+{
+    if (analyzer_options != NULL && analyzer_options->info_logs_enabled == 0)
+        return PROTOCOL_ERROR_EVENTS;
+    return ~0ull;
+}
+
+void analyzer_info_logs_changed(void)
+{
+    analyzer_send_control(-1, CONTROL_SET_EVENT_MASK, info_log_event_mask());
+}
+
+int analyzer_list_clients(int* numbers, int max)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&clients_lock);
+    for (ClientContext* ctx = clients; ctx != NULL && count < max; ctx = ctx->next)
+    {
+        if (ctx->accepts_control) numbers[count++] = ctx->client_number;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return count;
+}
+
+int analyzer_read_counters(int client_number, CountersTotals* totals)
+{
+    int result = -1;
+
+    // The list lock keeps the page mapped while it is read
+    pthread_mutex_lock(&clients_lock);
+    for (ClientContext* ctx = clients; ctx != NULL; ctx = ctx->next)
+    {
+        if (ctx->client_number != client_number) continue;
+        if (ctx->counters && counters_page_read(ctx->counters, ctx->counter_slots, totals) == 0)
+            result = 0;
+        break;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return result;
+}
+
+/**
+ * is_suppressed_event:
+ *
+ * Tells whether a message type is hidden while info logs are disabled. Binary wrappers are told to stop sending these
+ * (see analyzer_info_logs_changed()), so this only catches JSON clients and events already in flight.
+ *
+ * @param type: Message type string
+ * @return: 1 if the message should be dropped, 0 otherwise
+ */
+static int is_suppressed_event(const char* type)
+{
+    if (analyzer_options == NULL || analyzer_options->info_logs_enabled != 0)
+        return 0;
+
+    return strcmp(type, "malloc") == 0 ||
+           strcmp(type, "free") == 0 ||
+           strcmp(type, "realloc") == 0 ||
+           strlen(type) == 0;
+}
+
+/**
+ * account_sample:
+ *
+ * Updates the client's estimated live heap with a weighted event from the sampling mode and describes the estimate
+ * in the message. Runs before suppression, so the estimate stays right while info logs are off, as long as the
+ * wrapper still sends malloc and free; binary wrappers stop sending them then, and the estimate only covers the
+ * time info logs were on.
+ *
+ * @param ctx: Client connection
+ * @param type: Event type name
+ * @param weight: Bytes the sampled block stands for, 0 for unsampled events
+ * @param msg: Message to describe, may be NULL
+ */
+static void account_sample(ClientContext* ctx, const char* type, size_t weight, Message* msg)
+{
+    if (weight == 0) return;
+
+    if (strcmp(type, "malloc") == 0)
+        ctx->sampled_live_bytes += (long long)weight;
+    else if (strcmp(type, "free") == 0)
+        ctx->sampled_live_bytes -= (long long)weight;
+
+    if (msg)
+        snprintf(msg->description, sizeof(msg->description), "Sampled, weight %zu bytes; est. live heap %lld bytes",
+            weight, ctx->sampled_live_bytes);
+}
+
+/**
+ * handle_json_stream:
+ *
+ * Receive loop for clients speaking newline-delimited JSON (wrappers without binary protocol support).
+ *
+ * @param ctx: Client connection
+ * @param pending: Bytes already read from the socket that belong to the JSON stream
+ * @param pending_len: Number of bytes in pending
+ */
+static void handle_json_stream(ClientContext* ctx, const char* pending, size_t pending_len)
+{
     char buffer[1024];
     ssize_t bytes_read;
 
-    printf("[Analyzer] New connection: Client #%d (fd = %d)\n",
-        ctx->client_number, ctx->client_fd);
-    create_connection_message(ctx->client_number, "connection");
+    if (pending_len > 0)
+    {
+        if (pending_len > sizeof(buffer) - 1) pending_len = sizeof(buffer) - 1;
+        memcpy(buffer, pending, pending_len);
+        bytes_read = (ssize_t)pending_len;
+    }
+    else
+    {
+        bytes_read = read(ctx->client_fd, buffer, sizeof(buffer) - 1);
+    }
 
     // Main receive loop
-    while ((bytes_read = read(ctx->client_fd, buffer, sizeof(buffer) - 1)) > 0)
+    while (bytes_read > 0)
     {
         buffer[bytes_read] = '\0';
 
@@ -134,29 +347,546 @@ void* handle_client(void* arg) {
 
             // Parse JSON message and enqueue for processing
             Message msg = parse_json_to_message(line, ctx->client_number);
+            account_sample(ctx, msg.type, msg.weight, &msg);
+
+            if (!is_suppressed_event(msg.type))
+                enqueue_message(&msg);
+            line = strtok(NULL, "\n");
+        }
+        bytes_read = read(ctx->client_fd, buffer, sizeof(buffer) - 1);
+    }
+}
+
+/**
+ * memfd_sealed:
+ *
+ * Checks that a memfd received from a client can no longer change size, so that the client cannot truncate it under
+ * the analyzer's mapping and fault the analyzer on its next access.
+ */
+static int memfd_sealed(const int fd)
+{
+    const int required = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+    const int seals = fcntl(fd, F_GET_SEALS);
+    return seals != -1 && (seals & required) == required;
+}
+
+/**
+ * map_client_ring:
+ *
+ * Maps the EventRing memfd a client attached to its hello, once its size is sealed, and validates its header.
+ *
+ * @param ctx: Client connection holding the received descriptor
+ * @return: 1 if the ring is ready to be drained, 0 otherwise
+ */
+static int map_client_ring(ClientContext* ctx)
+{
+    struct stat st;
+    if (ctx->received_fd == -1) return 0;
+    if (!memfd_sealed(ctx->received_fd) || fstat(ctx->received_fd, &st) == -1 || st.st_size <= 0)
+    {
+        close(ctx->received_fd);
+        ctx->received_fd = -1;
+        return 0;
+    }
+
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->received_fd, 0);
+    close(ctx->received_fd);
+    ctx->received_fd = -1;
+    if (mapping == MAP_FAILED) return 0;
+
+    if (!event_ring_valid(mapping, (size_t)st.st_size, &ctx->ring_slots))
+    {
+        munmap(mapping, (size_t)st.st_size);
+        return 0;
+    }
+
+    ctx->ring = mapping;
+    ctx->ring_size = (size_t)st.st_size;
+    return 1;
+}
+
+/**
+ * map_client_counters:
+ *
+ * Maps the live counters page whose memfd came with a FRAME_COUNTERS, read-only, once its size is sealed.
+ *
+ * @param ctx: Client connection holding the received descriptor
+ * @param frame: The FRAME_COUNTERS payload
+ */
+static void map_client_counters(ClientContext* ctx, const CountersFrame* frame)
+{
+    struct stat st;
+    const int fd = ctx->received_fd;
+    ctx->received_fd = -1;
+    if (fd == -1) return;
+    if (ctx->counters || !memfd_sealed(fd) || fstat(fd, &st) == -1 || st.st_size <= 0 ||
+        (uint64_t)st.st_size < frame->size)
+    {
+        close(fd);
+        return;
+    }
+
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+    uint32_t slot_count;
+    if (!counters_page_valid(mapping, (size_t)st.st_size, &slot_count))
+    {
+        munmap(mapping, (size_t)st.st_size);
+        return;
+    }
+
+    pthread_mutex_lock(&clients_lock);
+    ctx->counters = mapping;
+    ctx->counters_size = (size_t)st.st_size;
+    ctx->counter_slots = slot_count;
+    pthread_mutex_unlock(&clients_lock);
+}
+
+/**
+ * send_hello_ack:
+ *
+ * Answers a client hello with the format and transport the client has to use. If the ack cannot be written, the
+ * ring is dropped again and the client is read from the socket only.
+ *
+ * @param ctx: Client connection
+ * @param hello: Hello frame received from the client
+ * @return: Negotiated ProtocolFormat
+ */
+static ProtocolFormat send_hello_ack(ClientContext* ctx, const HelloFrame* hello)
+{
+    const ProtocolFormat format = (hello->formats & PROTOCOL_FORMAT_BINARY)
+        ? PROTOCOL_FORMAT_BINARY : PROTOCOL_FORMAT_JSON;
+    const ProtocolTransport transport = (format == PROTOCOL_FORMAT_BINARY &&
+        (hello->transports & PROTOCOL_TRANSPORT_RING) && map_client_ring(ctx))
+        ? PROTOCOL_TRANSPORT_RING : PROTOCOL_TRANSPORT_SOCKET;
+
+    struct {
+        FrameHeader header;
+        HelloAckFrame ack;
+    } frame = {
+        .header = { .kind = FRAME_HELLO_ACK, .length = sizeof(HelloAckFrame) },
+        .ack = {
+            .magic = PROTOCOL_MAGIC,
+            .version = PROTOCOL_VERSION,
+            .format = format,
+            .client_id = ctx->client_number,
+            .transport = transport
+        }
+    };
+    size_t sent = 0;
+    while (sent < sizeof(frame))
+    {
+        const ssize_t written = send(ctx->client_fd, (const char*)&frame + sent, sizeof(frame) - sent, MSG_NOSIGNAL);
+        if (written > 0) sent += (size_t)written;
+        else if (written == -1 && errno == EINTR) continue;
+        else break;
+    }
+
+    // A client that never saw the ack does not use the ring
+    if (sent < sizeof(frame) && ctx->ring)
+    {
+        munmap(ctx->ring, ctx->ring_size);
+        ctx->ring = NULL;
+        ctx->ring_size = 0;
+        ctx->ring_slots = 0;
+    }
+    return format;
+}
+
+/**
+ * copy_payload:
+ *
+ * Copies a frame payload into a fixed-size struct. Shorter payloads (older peers) are zero-filled, longer ones
+ * (newer peers) are truncated.
+ */
+static void copy_payload(void* dst, size_t dst_size, const char* payload, uint32_t length)
+{
+    memset(dst, 0, dst_size);
+    memcpy(dst, payload, length < dst_size ? length : dst_size);
+}
+
+/**
+ * process_event_record:
+ *
+ * Converts one binary event into a Message and enqueues it, unless it is suppressed.
+ */
+static void process_event_record(ClientContext* ctx, const EventRecord* record)
+{
+    // Check the raw type before building a Message so suppressed events cost nothing
+    if (is_suppressed_event(protocol_event_name(record->type)))
+    {
+        account_sample(ctx, protocol_event_name(record->type), record->weight, NULL);
+        return;
+    }
+
+    Message msg = parse_event_record(record, ctx->client_number, ctx->clock_offset_ns);
+    account_sample(ctx, msg.type, msg.weight, &msg);
+    const char* stack = stack_table_lookup(&ctx->stacks, record->stack_id);
+    if (stack) strncpy(msg.stack, stack, sizeof(msg.stack) - 1);
+    enqueue_message(&msg);
+}
+
+/**
+ * release_ordered:
+ *
+ * Processes the records the reorder stage lets go.
+ *
+ * @param ctx: Client connection
+ * @param force: Release every held record, giving up on missing sequence numbers
+ */
+static void release_ordered(ClientContext* ctx, const int force)
+{
+    EventRecord record;
+    while (reorder_pop(&ctx->reorder, &record, force))
+        process_event_record(ctx, &record);
+}
+
+/**
+ * order_event_record:
+ *
+ * Passes a binary event through the client's reorder stage, so events reach process_event_record() in the order
+ * they happened in the client.
+ */
+static void order_event_record(ClientContext* ctx, const EventRecord* record)
+{
+    if (!reorder_push(&ctx->reorder, record))
+    {
+        process_event_record(ctx, record);
+        return;
+    }
+    release_ordered(ctx, 0);
+}
+
+/**
+ * stack_pending:
+ *
+ * Tells whether a record refers to a stack the client has not announced yet.
+ */
+static int stack_pending(const ClientContext* ctx, const EventRecord* record)
+{
+    return record->stack_id != 0 && stack_table_lookup(&ctx->stacks, record->stack_id) == NULL;
+}
+
+/**
+ * drain_ring:
+ *
+ * Processes every record currently published in the client's shared ring. Stacks travel on the socket, so a record
+ * can overtake the FRAME_STACK it refers to; such a record is parked and draining stops until the socket was read.
+ *
+ * @param ctx: Client connection
+ * @param force: Process a parked record even if its stack is still unknown
+ */
+static void drain_ring(ClientContext* ctx, const int force)
+{
+    if (ctx->has_parked)
+    {
+        if (!force && stack_pending(ctx, &ctx->parked)) return;
+        order_event_record(ctx, &ctx->parked);
+        ctx->has_parked = 0;
+    }
+
+    EventRecord record;
+    while (event_ring_pop(ctx->ring, ctx->ring_slots, &record))
+    {
+        if (!force && stack_pending(ctx, &record))
+        {
+            ctx->parked = record;
+            ctx->has_parked = 1;
+            return;
+        }
+        order_event_record(ctx, &record);
+    }
+}
+
+/**
+ * process_leak_summary:
+ *
+ * Adds a FRAME_LEAK_SUMMARY part to the client's leak summary. A complete summary goes to the summary store, and only
+ * a single leak_summary message naming it goes through the message queue. Ring events published before the summary
+ * are processed first.
+ */
+static void process_leak_summary(ClientContext* ctx, const char* payload, uint32_t length)
+{
+    if (leak_summary_add_part(&ctx->leaks, payload, length, &ctx->stacks, ctx->clock_offset_ns) != 1) return;
 
-            if (analyzer_options != NULL && analyzer_options->info_logs_enabled == 0)
+    if (ctx->ring) drain_ring(ctx, 0);
+    // Published first, so the message never names a report that is not there yet
+    const LeakSummary complete = ctx->leaks;
+    leak_summary_publish(&ctx->leaks);
+    create_leak_summary_message(ctx->client_number, complete.report, complete.blocks, complete.bytes,
+        complete.site_count, complete.timestamp_ns);
+}
+
+/**
+ * process_latency:
+ *
+ * Turns a FRAME_LATENCY into one latency message per metric with values since the client's previous report. Reports
+ * carry totals, so a lost one only widens the next interval.
+ */
+static void process_latency(ClientContext* ctx, const char* payload, uint32_t length)
+{
+    LatencyReport* report = malloc(sizeof(LatencyReport));
+    if (!report) return;
+    if (latency_report_parse(payload, length, ctx->clock_offset_ns, report) != 0)
+    {
+        free(report);
+        return;
+    }
+
+    for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++)
+    {
+        LatencyHistogram interval;
+        if (ctx->latency)
+            latency_histogram_since(&report->metrics[metric], &ctx->latency->metrics[metric], &interval);
+        else
+            interval = report->metrics[metric];
+        if (interval.count == 0) continue;
+
+        char summary[128];
+        latency_histogram_format(&interval, summary, sizeof(summary));
+        create_latency_message(ctx->client_number, report->report, protocol_latency_metric_name(metric),
+            interval.count, summary, report->timestamp_ns);
+    }
+    free(ctx->latency);
+    ctx->latency = report;
+}
+
+/**
+ * wait_for_socket:
+ *
+ * With a ring, drains it and only returns once the socket has data. The consumer_waiting flag tells producers to
+ * send a FRAME_WAKEUP; the short poll timeout covers a wakeup that races with arming the flag. A parked record
+ * waits one poll interval for its stack and is then shown without it.
+ *
+ * Records held by the reorder stage for a sequence number that has not arrived are released once the client stays
+ * quiet for REORDER_QUIET_MS, which is longer than the wrapper's default flush interval; socket clients without held
+ * records just block in the next read.
+ *
+ * @param ctx: Client connection
+ * @return: 1 if the socket is readable, 0 on error
+ */
+static int wait_for_socket(ClientContext* ctx)
+{
+    int quiet_ms = 0;
+
+    while (1)
+    {
+        if (ctx->ring)
+        {
+            drain_ring(ctx, 0);
+
+            if (!ctx->has_parked)
             {
-                if (strcmp(msg.type, "malloc") == 0 ||
-                    strcmp(msg.type, "free") == 0 ||
-                    strcmp(msg.type, "realloc") == 0 ||
-                    strlen(msg.type) == 0)
+                atomic_store(&ctx->ring->consumer_waiting, 1);
+                if (!event_ring_empty(ctx->ring, ctx->ring_slots))
                 {
-                    // Suppress message entirely
-                    line = strtok(NULL, "\n");
+                    atomic_store(&ctx->ring->consumer_waiting, 0);
+                    quiet_ms = 0;
                     continue;
                 }
             }
+        }
+        else if (ctx->reorder.count == 0)
+        {
+            return 1;
+        }
 
-            enqueue_message(&msg);
-            line = strtok(NULL, "\n");
+        const int timeout = ctx->ring ? RING_POLL_MS : REORDER_QUIET_MS;
+        struct pollfd pfd = { .fd = ctx->client_fd, .events = POLLIN };
+        const int ready = poll(&pfd, 1, timeout);
+        if (ready > 0) return 1;
+        if (ready < 0) return 0;
+
+        if (ctx->has_parked)
+            drain_ring(ctx, 1);
+        quiet_ms += timeout;
+        if (quiet_ms >= REORDER_QUIET_MS)
+        {
+            release_ordered(ctx, 1);
+            quiet_ms = 0;
         }
     }
+}
+
+/**
+ * receive_frames:
+ *
+ * Reads from the client socket, keeping a file descriptor passed with SCM_RIGHTS (the ring memfd, or the counters
+ * page memfd after the handshake).
+ *
+ * @return: Bytes read, 0 on disconnect, -1 on error
+ */
+static ssize_t receive_frames(ClientContext* ctx, char* buffer, size_t capacity)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = buffer, .iov_len = capacity };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    const ssize_t bytes_read = recvmsg(ctx->client_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (bytes_read <= 0) return bytes_read;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        if (ctx->received_fd == -1)
+            ctx->received_fd = fd;
+        else
+            close(fd);
+    }
+    return bytes_read;
+}
+
+/**
+ * handle_binary_stream:
+ *
+ * Receive loop for clients that opened with a FRAME_HELLO. Frames may be split across reads, so incomplete frames
+ * are kept at the front of the buffer until the rest arrives. Clients on the ring transport only send wakeups here;
+ * their events are drained from shared memory.
+ *
+ * @param ctx: Client connection
+ */
+static void handle_binary_stream(ClientContext* ctx)
+{
+    char buffer[65536];
+    size_t filled = 0;
+    ssize_t bytes_read;
+
+    while (wait_for_socket(ctx) &&
+           (bytes_read = receive_frames(ctx, buffer + filled, sizeof(buffer) - filled)) > 0)
+    {
+        filled += (size_t)bytes_read;
+        size_t offset = 0;
+
+        while (filled - offset >= sizeof(FrameHeader))
+        {
+            FrameHeader header;
+            memcpy(&header, buffer + offset, sizeof(header));
+            if (header.length > sizeof(buffer) - sizeof(header))
+            {
+                fprintf(stderr, "[Analyzer] Client #%d sent oversized frame, closing.\n", ctx->client_number);
+                return;
+            }
+            if (filled - offset < sizeof(header) + header.length) break;
+
+            const char* payload = buffer + offset + sizeof(header);
+            offset += sizeof(header) + header.length;
+
+            if (header.kind == FRAME_HELLO)
+            {
+                HelloFrame hello;
+                copy_payload(&hello, sizeof(hello), payload, header.length);
+                if (hello.magic != PROTOCOL_MAGIC) return;
+                stack_table_init(&ctx->stacks, (pid_t)hello.pid);
+                ctx->clock_offset_ns = hello.realtime_ns - hello.monotonic_ns;
+                ctx->pid = (pid_t)hello.pid;
+                ctx->parent_client_number = hello.parent_client_id;
+                if (hello.parent_client_id > 0)
+                {
+                    printf("[Analyzer] Client #%d (pid %u) %s client #%d.\n", ctx->client_number, hello.pid,
+                        hello.parent_pid == hello.pid ? "was exec()ed by" : "is a child of", hello.parent_client_id);
+                    create_lineage_message(ctx->client_number, hello.parent_client_id, hello.pid, hello.parent_pid);
+                }
+                if (send_hello_ack(ctx, &hello) == PROTOCOL_FORMAT_JSON)
+                {
+                    handle_json_stream(ctx, buffer + offset, filled - offset);
+                    return;
+                }
+                pthread_mutex_lock(&clients_lock);
+                ctx->accepts_control = 1;
+                pthread_mutex_unlock(&clients_lock);
+                // Stop routine events at the source rather than dropping them here
+                if (info_log_event_mask() != ~0ull)
+                    analyzer_send_control(ctx->client_number, CONTROL_SET_EVENT_MASK, info_log_event_mask());
+            }
+            else if (header.kind == FRAME_EVENT)
+            {
+                EventRecord record;
+                copy_payload(&record, sizeof(record), payload, header.length);
+                order_event_record(ctx, &record);
+            }
+            else if (header.kind == FRAME_STACK)
+            {
+                StackTrace trace;
+                copy_payload(&trace, sizeof(trace), payload, header.length);
+                stack_table_add(&ctx->stacks, &trace);
+            }
+            else if (header.kind == FRAME_LEAK_SUMMARY)
+            {
+                process_leak_summary(ctx, payload, header.length);
+            }
+            else if (header.kind == FRAME_LATENCY)
+            {
+                process_latency(ctx, payload, header.length);
+            }
+            else if (header.kind == FRAME_COUNTERS)
+            {
+                CountersFrame counters;
+                copy_payload(&counters, sizeof(counters), payload, header.length);
+                map_client_counters(ctx, &counters);
+            }
+        }
+
+        memmove(buffer, buffer + offset, filled - offset);
+        filled -= offset;
+    }
+
+    // Events published right before the client exited
+    if (ctx->ring) drain_ring(ctx, 1);
+    release_ordered(ctx, 1);
+}
+
+/**
+ * handle_client:
+ *
+ * Handles communication with a single connected client. Detects whether the client speaks the binary protocol
+ * (it opens with a hello frame) or legacy JSON, then receives, parses and enqueues its messages.
+ *
+ * @param arg: Pointer to ClientContext containing connection information.
+ * @return: NULL when thread exits.
+ */
+void* handle_client(void* arg) {
+    ClientContext* ctx = (ClientContext*)arg;
+
+    printf("[Analyzer] New connection: Client #%d (fd = %d)\n",
+        ctx->client_number, ctx->client_fd);
+    create_connection_message(ctx->client_number, "connection");
+    register_client(ctx);
+
+    // JSON clients start with '{', binary clients with a FrameHeader whose first byte is never '{'
+    char first;
+    if (recv(ctx->client_fd, &first, 1, MSG_PEEK) == 1)
+    {
+        if (first == '{')
+            handle_json_stream(ctx, NULL, 0);
+        else
+            handle_binary_stream(ctx);
+    }
 
     printf("[Analyzer] Client #%d disconnected.\n", ctx->client_number);
+    if (ctx->reorder.skipped > 0)
+        printf("[Analyzer] Client #%d: %llu events never arrived.\n", ctx->client_number,
+            (unsigned long long)ctx->reorder.skipped);
     create_connection_message(ctx->client_number, "disconnection");
 
     // Clean
+    unregister_client(ctx);
+    if (ctx->ring) munmap(ctx->ring, ctx->ring_size);
+    if (ctx->counters) munmap((void*)ctx->counters, ctx->counters_size);
+    if (ctx->received_fd != -1) close(ctx->received_fd);
+    stack_table_free(&ctx->stacks);
+    reorder_free(&ctx->reorder);
+    leak_summary_free(&ctx->leaks);
+    free(ctx->latency);
     close(ctx->client_fd);
     free(ctx);
     return NULL;
@@ -193,13 +923,34 @@ void* gui_consumer_thread(const void* arg)
         }
 
         // Format time into human readable string
-        char time_buf[32];
-        struct tm *tm_info = localtime(&msg.timestamp);
-        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+        char time_buf[40];
+        message_format_time(&msg, time_buf, sizeof(time_buf));
 
         // Always print remaining messages
         printf("[GUI] Client %d | %-12s | Addr: %-12s | Size: %-5zu | Thread: %lu | Time: %s\n",
             msg.client_id, msg.type, msg.addr, msg.size, msg.thread, time_buf);
+        if (msg.stack[0] != '\0')
+            printf("[GUI]     at %s\n", msg.stack);
+        if (msg.weight != 0)
+            printf("[GUI]     %s\n", msg.description);
+
+        if (strcmp(msg.type, "latency") == 0)
+            printf("[GUI]     %s\n", msg.description);
+
+        // The sites of a leak summary are kept out of the queue
+        if (strcmp(msg.type, "leak_summary") != 0) continue;
+        printf("[GUI]     %s\n", msg.description);
+        LeakSummary summary;
+        if (leak_summary_take(msg.client_id, (uint32_t)msg.seq, &summary))
+        {
+            for (size_t i = 0; i < summary.site_count; i++)
+            {
+                char line[1024];
+                leak_summary_format_site(&summary.sites[i], line, sizeof(line));
+                printf("[GUI]     %s\n", line);
+            }
+            leak_summary_free(&summary);
+        }
     }
     return NULL;
 }
\ No newline at end of file
@@ -3,7 +3,13 @@
 
 #include <pthread.h>
 #include "message.h"
+#include "event_ring.h"
+#include "counters_page.h"
 #include "fragmentation.h"
+#include "stack_table.h"
+#include "reorder.h"
+#include "leak_summary.h"
+#include "latency_stats.h"
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
@@ -26,12 +32,41 @@ typedef struct {
 /**
  * ClientContext:
  *
- * Per-client information used by handle_client() to manage an active connection.
+ * Per-client information used by handle_client() to manage an active connection. `ring` is set when the client
+ * delivers its events through a shared EventRing instead of the socket; `ring_slots` is its slot count as validated
+ * when it was mapped, since the client can still write the ring's header. `parked` holds a ring event whose stack
+ * has not arrived on the socket yet. `sampled_live_bytes` is the live heap estimated from weighted samples.
+ * `clock_offset_ns` converts the client's monotonic event timestamps to wall-clock time. `reorder` restores the
+ * client's event order before binary events are processed. `accepts_control` is set once a binary client finished
+ * its handshake and can receive control frames; `next` links the list of connected clients. `pid` and
+ * `parent_client_number` come from the hello, the latter naming the client that forked or exec()ed this one, 0 if none.
+ * `leaks` collects the parts of a leak summary until its last part arrives. `latency` is the client's last latency
+ * report, NULL until one arrives. `counters` is the client's live counters page, mapped read-only once its
+ * FRAME_COUNTERS arrived, and `counter_slots` its slot count as validated then.
  */
-typedef struct {
+typedef struct ClientContext {
     int client_fd;
     pthread_t thread_id;
     int client_number;
+    int received_fd;
+    EventRing* ring;
+    size_t ring_size;
+    uint32_t ring_slots;
+    StackTable stacks;
+    EventRecord parked;
+    int has_parked;
+    long long sampled_live_bytes;
+    int64_t clock_offset_ns;
+    ReorderBuffer reorder;
+    int accepts_control;
+    pid_t pid;
+    int parent_client_number;
+    LeakSummary leaks;
+    LatencyReport* latency;
+    const CountersPage* counters;
+    size_t counters_size;
+    uint32_t counter_slots;
+    struct ClientContext* next;
 } ClientContext;
 
 /**
@@ -58,4 +93,59 @@ void analyzer_init(AnalyzerOptions* options);
  */
 void* handle_client(void* arg);
 
+/**
+ * analyzer_send_control:
+ *
+ * Sends a control command to a connected client, to retune its wrapper while it runs. Safe to call from any thread.
+ *
+ * @param client_number Client number as shown in messages, or -1 for every client
+ * @param command Command to send
+ * @param value Argument of the command, see ControlCommand
+ * @return 0 on success, -1 if the client is gone or does not speak the binary protocol
+ */
+int analyzer_send_control(int client_number, ControlCommand command, uint64_t value);
+
+/**
+ * analyzer_send_filter:
+ *
+ * Replaces the block filter of a connected client's wrapper, which then stops sending the malloc, free and leak
+ * events of blocks outside the given size range or allocation sites. Safe to call from any thread.
+ *
+ * @param client_number Client number as shown in messages, or -1 for every client
+ * @param filter Filter to apply; only `site_count` sites are sent
+ * @return 0 on success, -1 if the client is gone or does not speak the binary protocol
+ */
+int analyzer_send_filter(int client_number, const FilterFrame* filter);
+
+/**
+ * analyzer_info_logs_changed:
+ *
+ * Tells every connected wrapper whether to send malloc and free events, following
+ * analyzer_options->info_logs_enabled. New clients get the setting when they connect.
+ */
+void analyzer_info_logs_changed(void);
+
+/**
+ * analyzer_list_clients:
+ *
+ * Lists the connected clients that accept control commands.
+ *
+ * @param numbers Receives up to `max` client numbers
+ * @param max Capacity of numbers
+ * @return Number of entries written
+ */
+int analyzer_list_clients(int* numbers, int max);
+
+/**
+ * analyzer_read_counters:
+ *
+ * Reads the live counters of a connected client straight from the page it shares with the analyzer, without any
+ * message. Safe to call from any thread, as often as needed.
+ *
+ * @param client_number Client number as shown in messages
+ * @param totals Receives the client's counts summed over its threads
+ * @return 0 on success, -1 if the client is gone or shares no counters page
+ */
+int analyzer_read_counters(int client_number, CountersTotals* totals);
+
 #endif
@@ -62,7 +62,8 @@ void *fragmentation_thread(void *arg)
                 strncpy(msg.addr, "system", sizeof(msg.addr));
                 msg.size = small_blocks;
                 msg.thread = (unsigned long) pthread_self();
-                msg.timestamp = time(NULL);
+                msg.timestamp_ns = protocol_clock_ns(CLOCK_REALTIME);
+                msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
                 strncpy(msg.severity, "warning", sizeof(msg.severity));
                 strncpy(msg.description, "System memory fragmentation detected.", sizeof(msg.description));
 
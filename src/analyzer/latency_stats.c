@@ -0,0 +1,139 @@
+#include "latency_stats.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * get_histogram:
+ *
+ * Unpacks one metric of a LatencyFrame at `*cursor`, advancing it past the metric.
+ *
+ * @param metric: Receives the LatencyMetric the histogram belongs to
+ * @return: 0 on success, -1 if the metric is truncated or its buckets are out of range
+ */
+static int get_histogram(const uint8_t** cursor, const uint8_t* end, uint64_t* metric, LatencyHistogram* histogram)
+{
+    uint64_t count;
+    uint64_t fields[PROTOCOL_LATENCY_FIELDS] = {0};
+    if (protocol_get_varint(cursor, end, &count) != 0) return -1;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint64_t value;
+        if (protocol_get_varint(cursor, end, &value) != 0) return -1;
+        if (i < PROTOCOL_LATENCY_FIELDS) fields[i] = value;
+    }
+
+    memset(histogram, 0, sizeof(*histogram));
+    *metric = fields[0];
+    histogram->count = fields[1];
+    histogram->sum_ns = fields[2];
+    histogram->max_ns = fields[3];
+
+    uint64_t bucket = (uint64_t)-1;
+    for (uint64_t i = 0; i < fields[4]; i++)
+    {
+        uint64_t distance, value;
+        if (protocol_get_varint(cursor, end, &distance) != 0 || protocol_get_varint(cursor, end, &value) != 0)
+            return -1;
+        bucket += distance;
+        if (distance == 0 || bucket >= PROTOCOL_LATENCY_BUCKETS) return -1;
+        histogram->buckets[bucket] = value;
+    }
+    return 0;
+}
+
+int latency_report_parse(const char* payload, uint32_t length, int64_t clock_offset_ns, LatencyReport* report)
+{
+    LatencyFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    memcpy(&frame, payload, length < sizeof(frame) ? length : sizeof(frame));
+    if (frame.entries_offset > length) return -1;
+
+    memset(report, 0, sizeof(*report));
+    report->report = frame.report;
+    report->threads = frame.threads;
+    report->timestamp_ns = frame.timestamp + clock_offset_ns;
+
+    const uint8_t* cursor = (const uint8_t*)payload + frame.entries_offset;
+    const uint8_t* end = (const uint8_t*)payload + length;
+    for (uint32_t i = 0; i < frame.metric_count; i++)
+    {
+        uint64_t metric;
+        LatencyHistogram histogram;
+        if (get_histogram(&cursor, end, &metric, &histogram) != 0) return -1;
+        if (metric < LATENCY_METRIC_COUNT) report->metrics[metric] = histogram;
+    }
+    return 0;
+}
+
+void latency_histogram_since(const LatencyHistogram* now, const LatencyHistogram* before, LatencyHistogram* out)
+{
+    // Totals only grow; anything else means the wrapper started over
+    if (now->count < before->count)
+    {
+        *out = *now;
+        return;
+    }
+    out->count = now->count - before->count;
+    out->sum_ns = now->sum_ns - before->sum_ns;
+    out->max_ns = 0;
+    for (unsigned i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++)
+    {
+        out->buckets[i] = now->buckets[i] >= before->buckets[i] ? now->buckets[i] - before->buckets[i] : 0;
+        if (out->buckets[i])
+            out->max_ns = i + 1 < PROTOCOL_LATENCY_BUCKETS ? protocol_latency_bucket_low(i + 1) - 1 : now->max_ns;
+    }
+    if (out->max_ns > now->max_ns) out->max_ns = now->max_ns;
+}
+
+uint64_t latency_histogram_percentile(const LatencyHistogram* histogram, double percent)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++)
+        total += histogram->buckets[i];
+    if (total == 0) return 0;
+
+    // Rank of the value sought, counted from 1
+    uint64_t rank = (uint64_t)(percent / 100.0 * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen < rank) continue;
+        if (i + 1 == PROTOCOL_LATENCY_BUCKETS) return histogram->max_ns;
+        const uint64_t high = protocol_latency_bucket_low(i + 1) - 1;
+        return histogram->max_ns && high > histogram->max_ns ? histogram->max_ns : high;
+    }
+    return histogram->max_ns;
+}
+
+/**
+ * format_duration:
+ *
+ * Writes a duration with three significant digits at most, in ns, us, ms or s.
+ */
+static void format_duration(uint64_t ns, char* buffer, size_t size)
+{
+    if (ns < 1000)
+        snprintf(buffer, size, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000)
+        snprintf(buffer, size, "%.3gus", (double)ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(buffer, size, "%.3gms", (double)ns / 1e6);
+    else
+        snprintf(buffer, size, "%.3gs", (double)ns / 1e9);
+}
+
+void latency_histogram_format(const LatencyHistogram* histogram, char* buffer, size_t size)
+{
+    char mean[16], p50[16], p99[16], p999[16], max[16];
+    format_duration(histogram->count ? histogram->sum_ns / histogram->count : 0, mean, sizeof(mean));
+    format_duration(latency_histogram_percentile(histogram, 50.0), p50, sizeof(p50));
+    format_duration(latency_histogram_percentile(histogram, 99.0), p99, sizeof(p99));
+    format_duration(latency_histogram_percentile(histogram, 99.9), p999, sizeof(p999));
+    format_duration(histogram->max_ns, max, sizeof(max));
+    snprintf(buffer, size, "%llu samples, mean %s, p50 %s, p99 %s, p99.9 %s, max %s",
+        (unsigned long long)histogram->count, mean, p50, p99, p999, max);
+}
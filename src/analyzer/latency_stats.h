@@ -0,0 +1,67 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/**
+ * LatencyHistogram:
+ *
+ * One metric of a FRAME_LATENCY, unpacked: `buckets` as described at PROTOCOL_LATENCY_BUCKETS.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[PROTOCOL_LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * LatencyReport:
+ *
+ * The histograms of a client's FRAME_LATENCY, totals since the wrapper started measuring. `timestamp_ns` is wall-clock
+ * time.
+ */
+typedef struct {
+    uint32_t report;
+    uint32_t threads;
+    int64_t timestamp_ns;
+    LatencyHistogram metrics[LATENCY_METRIC_COUNT];
+} LatencyReport;
+
+/**
+ * latency_report_parse:
+ *
+ * Unpacks the payload of a FRAME_LATENCY. Metrics the analyzer does not know are skipped.
+ *
+ * @param clock_offset_ns: CLOCK_REALTIME minus CLOCK_MONOTONIC of the client
+ * @return: 0 on success, -1 if the payload is malformed
+ */
+int latency_report_parse(const char* payload, uint32_t length, int64_t clock_offset_ns, LatencyReport* report);
+
+/**
+ * latency_histogram_since:
+ *
+ * Histogram of the values recorded between two reports of the same client: `now` minus `before`. Reports only carry
+ * the maximum of all values, so the interval's maximum is the upper end of its highest bucket, or that maximum if
+ * lower.
+ */
+void latency_histogram_since(const LatencyHistogram* now, const LatencyHistogram* before, LatencyHistogram* out);
+
+/**
+ * latency_histogram_percentile:
+ *
+ * Value below which `percent` percent of the values lie, as the upper end of the bucket holding it, and never more
+ * than the maximum.
+ */
+uint64_t latency_histogram_percentile(const LatencyHistogram* histogram, double percent);
+
+/**
+ * latency_histogram_format:
+ *
+ * Describes a histogram on one line, e.g. "12034 samples, mean 61ns, p50 48ns, p99 1.1us, p99.9 8.2us, max 40us".
+ */
+void latency_histogram_format(const LatencyHistogram* histogram, char* buffer, size_t size);
+
+#endif
@@ -0,0 +1,172 @@
+#include "leak_summary.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_STORED_SUMMARIES 64
+
+static LeakSummary* store = NULL;
+static size_t stored = 0;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void leak_summary_init(LeakSummary* summary, const int client_number)
+{
+    memset(summary, 0, sizeof(*summary));
+    summary->client_number = client_number;
+}
+
+void leak_summary_free(LeakSummary* summary)
+{
+    for (size_t i = 0; i < summary->site_count; i++)
+        free(summary->sites[i].stack);
+    free(summary->sites);
+    leak_summary_init(summary, summary->client_number);
+}
+
+/**
+ * add_site:
+ *
+ * Appends a site, growing the array on demand.
+ *
+ * @return: 0 on success, -1 if out of memory
+ */
+static int add_site(LeakSummary* summary, const LeakSummaryEntry* entry, const StackTable* stacks)
+{
+    if (summary->site_count == summary->capacity)
+    {
+        const size_t capacity = summary->capacity ? summary->capacity * 2 : 64;
+        LeakSite* grown = realloc(summary->sites, capacity * sizeof(LeakSite));
+        if (!grown) return -1;
+        summary->sites = grown;
+        summary->capacity = capacity;
+    }
+
+    const char* stack = entry->stack_id ? stack_table_lookup(stacks, entry->stack_id) : NULL;
+    LeakSite* site = &summary->sites[summary->site_count++];
+    site->entry = *entry;
+    site->stack = stack ? strdup(stack) : NULL;
+    return 0;
+}
+
+static int compare_sites(const void* a, const void* b)
+{
+    const uint64_t left = ((const LeakSite*)a)->entry.bytes;
+    const uint64_t right = ((const LeakSite*)b)->entry.bytes;
+    return (left < right) - (left > right);
+}
+
+int leak_summary_add_part(LeakSummary* summary, const char* payload, uint32_t length, const StackTable* stacks,
+                          int64_t clock_offset_ns)
+{
+    LeakSummaryFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    memcpy(&frame, payload, length < sizeof(frame) ? length : sizeof(frame));
+    if (frame.entries_offset > length) return -1;
+
+    // A new report, or a part of the current one went missing
+    if (frame.report != summary->report || frame.part != summary->next_part)
+    {
+        leak_summary_free(summary);
+        if (frame.part != 0) return 0;
+        summary->report = frame.report;
+    }
+
+    const uint8_t* cursor = (const uint8_t*)payload + frame.entries_offset;
+    const uint8_t* end = (const uint8_t*)payload + length;
+    for (uint32_t i = 0; i < frame.entry_count; i++)
+    {
+        LeakSummaryEntry entry;
+        if (protocol_get_summary_entry(&cursor, end, &entry) != 0 || add_site(summary, &entry, stacks) != 0)
+        {
+            leak_summary_free(summary);
+            return -1;
+        }
+    }
+
+    summary->next_part = frame.part + 1u;
+    summary->blocks = frame.blocks;
+    summary->bytes = frame.bytes;
+    summary->timestamp_ns = frame.timestamp + clock_offset_ns;
+    if (!frame.last) return 0;
+
+    qsort(summary->sites, summary->site_count, sizeof(LeakSite), compare_sites);
+    return 1;
+}
+
+void leak_summary_publish(LeakSummary* summary)
+{
+    LeakSummary* copy = malloc(sizeof(LeakSummary));
+    if (copy)
+    {
+        *copy = *summary;
+        copy->next = NULL;
+    }
+    else
+    {
+        leak_summary_free(summary);
+    }
+    leak_summary_init(summary, summary->client_number);
+    if (!copy) return;
+
+    pthread_mutex_lock(&store_lock);
+    LeakSummary** link = &store;
+    while (*link != NULL) link = &(*link)->next;
+    *link = copy;
+    stored++;
+
+    // Reports nobody asked for, e.g. because their message was dropped, go first
+    LeakSummary* oldest = NULL;
+    if (stored > MAX_STORED_SUMMARIES)
+    {
+        oldest = store;
+        store = oldest->next;
+        stored--;
+    }
+    pthread_mutex_unlock(&store_lock);
+
+    if (oldest)
+    {
+        leak_summary_free(oldest);
+        free(oldest);
+    }
+}
+
+int leak_summary_take(int client_number, uint32_t report, LeakSummary* out)
+{
+    LeakSummary* found = NULL;
+
+    pthread_mutex_lock(&store_lock);
+    for (LeakSummary** link = &store; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->client_number == client_number && (*link)->report == report)
+        {
+            found = *link;
+            *link = found->next;
+            stored--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+
+    if (!found) return 0;
+    *out = *found;
+    out->next = NULL;
+    free(found);
+    return 1;
+}
+
+void leak_summary_format_site(const LeakSite* site, char* buffer, size_t size)
+{
+    const LeakSummaryEntry* entry = &site->entry;
+    char sizes[64];
+    if (entry->min_size == entry->max_size)
+        snprintf(sizes, sizeof(sizes), "%llu bytes each", (unsigned long long)entry->min_size);
+    else
+        snprintf(sizes, sizeof(sizes), "%llu to %llu bytes", (unsigned long long)entry->min_size,
+            (unsigned long long)entry->max_size);
+
+    snprintf(buffer, size, "%s: %llu blocks, %llu bytes (%s) at %s", protocol_event_name(entry->type),
+        (unsigned long long)entry->count, (unsigned long long)entry->bytes, sizes,
+        site->stack ? site->stack : "unknown site");
+}
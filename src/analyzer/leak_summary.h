@@ -0,0 +1,92 @@
+#ifndef LEAK_SUMMARY_H
+#define LEAK_SUMMARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "stack_table.h"
+
+/**
+ * LeakSite:
+ *
+ * One aggregate of a leak summary, with its allocation stack as symbolized when the summary arrived (NULL if none).
+ */
+typedef struct {
+    LeakSummaryEntry entry;
+    char* stack;
+} LeakSite;
+
+/**
+ * LeakSummary:
+ *
+ * A client's leak report, assembled from the parts of its FRAME_LEAK_SUMMARY frames. Once complete, its sites are
+ * sorted by bytes, largest first, and it is kept for the message consumers instead of travelling through the message
+ * queue: the queue only carries one leak_summary message naming the report (see leak_summary_take()).
+ */
+typedef struct LeakSummary {
+    int client_number;
+    uint32_t report;
+    uint32_t next_part;
+    uint64_t blocks;
+    uint64_t bytes;
+    int64_t timestamp_ns;
+    LeakSite* sites;
+    size_t site_count;
+    size_t capacity;
+    struct LeakSummary* next;
+} LeakSummary;
+
+/**
+ * leak_summary_init:
+ *
+ * Prepares an empty summary for the client `client_number`.
+ */
+void leak_summary_init(LeakSummary* summary, int client_number);
+
+/**
+ * leak_summary_add_part:
+ *
+ * Adds the payload of a FRAME_LEAK_SUMMARY. A part out of sequence starts the summary over, so a report whose
+ * earlier parts were lost is dropped rather than shown incomplete.
+ *
+ * @param stacks: Stacks of the client, to symbolize the sites
+ * @param clock_offset_ns: CLOCK_REALTIME minus CLOCK_MONOTONIC of the client
+ * @return: 1 once the last part arrived, 0 while parts are missing, -1 if the payload is malformed
+ */
+int leak_summary_add_part(LeakSummary* summary, const char* payload, uint32_t length, const StackTable* stacks,
+                          int64_t clock_offset_ns);
+
+/**
+ * leak_summary_publish:
+ *
+ * Hands a complete summary over to the store read by leak_summary_take(), leaving `summary` empty for the next
+ * report. The store keeps the most recent reports only.
+ */
+void leak_summary_publish(LeakSummary* summary);
+
+/**
+ * leak_summary_take:
+ *
+ * Removes a published report from the store. Safe to call from any thread.
+ *
+ * @param report: Report number, as in the leak_summary message's `seq`
+ * @param out: Receives the report; release it with leak_summary_free()
+ * @return: 1 if the report was found, 0 otherwise
+ */
+int leak_summary_take(int client_number, uint32_t report, LeakSummary* out);
+
+/**
+ * leak_summary_format_site:
+ *
+ * Describes one site on a line, e.g. "memory_leak: 12 blocks, 384 bytes (32 bytes each) at app+0x1234 ...".
+ */
+void leak_summary_format_site(const LeakSite* site, char* buffer, size_t size);
+
+/**
+ * leak_summary_free:
+ *
+ * Releases the sites of a summary and empties it.
+ */
+void leak_summary_free(LeakSummary* summary);
+
+#endif
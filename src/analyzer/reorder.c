@@ -0,0 +1,87 @@
+#include "reorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 256
+
+void reorder_init(ReorderBuffer* buffer, const size_t capacity)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->capacity = capacity;
+    buffer->next_seq = 1;
+}
+
+static void swap_records(EventRecord* a, EventRecord* b)
+{
+    const EventRecord tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+int reorder_push(ReorderBuffer* buffer, const EventRecord* record)
+{
+    if (buffer->count == buffer->allocated)
+    {
+        if (buffer->allocated == buffer->capacity) return 0;
+        size_t allocated = buffer->allocated ? buffer->allocated * 2 : INITIAL_CAPACITY;
+        if (allocated > buffer->capacity) allocated = buffer->capacity;
+        EventRecord* heap = realloc(buffer->heap, allocated * sizeof(EventRecord));
+        if (!heap) return 0;
+        buffer->heap = heap;
+        buffer->allocated = allocated;
+    }
+
+    // Sift up
+    size_t i = buffer->count++;
+    buffer->heap[i] = *record;
+    while (i > 0)
+    {
+        const size_t parent = (i - 1) / 2;
+        if (buffer->heap[parent].seq <= buffer->heap[i].seq) break;
+        swap_records(&buffer->heap[parent], &buffer->heap[i]);
+        i = parent;
+    }
+    return 1;
+}
+
+int reorder_pop(ReorderBuffer* buffer, EventRecord* record, const int force)
+{
+    if (buffer->count == 0) return 0;
+
+    const uint64_t seq = buffer->heap[0].seq;
+    if (seq > buffer->next_seq)
+    {
+        if (!force && buffer->count < buffer->capacity) return 0;
+        buffer->skipped += seq - buffer->next_seq;
+    }
+    if (seq >= buffer->next_seq)
+        buffer->next_seq = seq + 1;
+    else if (seq != 0 && buffer->skipped > 0)
+        buffer->skipped--;  // arrived after all
+
+    *record = buffer->heap[0];
+    buffer->heap[0] = buffer->heap[--buffer->count];
+
+    // Sift down
+    size_t i = 0;
+    while (1)
+    {
+        const size_t left = 2 * i + 1;
+        const size_t right = left + 1;
+        size_t smallest = i;
+        if (left < buffer->count && buffer->heap[left].seq < buffer->heap[smallest].seq) smallest = left;
+        if (right < buffer->count && buffer->heap[right].seq < buffer->heap[smallest].seq) smallest = right;
+        if (smallest == i) break;
+        swap_records(&buffer->heap[smallest], &buffer->heap[i]);
+        i = smallest;
+    }
+    return 1;
+}
+
+void reorder_free(ReorderBuffer* buffer)
+{
+    free(buffer->heap);
+    buffer->heap = NULL;
+    buffer->count = 0;
+    buffer->allocated = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/**
+ * ReorderBuffer:
+ *
+ * Bounded per-client stage that puts binary events back into the order given by their `seq`. Staging buffers and
+ * ring slots let events of different threads overtake each other, so a free can arrive before the malloc of the same
+ * address from another thread. Records are kept in a min-heap on `seq` and released once every earlier number has
+ * been released.
+ *
+ * A number that never arrives (an event dropped under backpressure) would stall the stage, so it gives up waiting
+ * when `capacity` records are held or when the caller forces it after the client went quiet. Numbers given up on are
+ * counted in `skipped` until they turn up late, in which case they are released at once. The heap grows on demand up
+ * to `capacity` records.
+ */
+typedef struct {
+    EventRecord* heap;
+    size_t count;
+    size_t allocated;
+    size_t capacity;
+    uint64_t next_seq;
+    uint64_t skipped;
+} ReorderBuffer;
+
+/**
+ * reorder_init:
+ *
+ * Prepares an empty stage holding at most `capacity` records. The heap is allocated on the first push.
+ */
+void reorder_init(ReorderBuffer* buffer, size_t capacity);
+
+/**
+ * reorder_push:
+ *
+ * Adds a record. Callers release ready records with reorder_pop() after each push, which keeps room for the next.
+ * Records without a sequence number (older wrappers) are released first.
+ *
+ * @return: 1 if the record was stored, 0 if the heap could not grow and the caller has to process it directly
+ */
+int reorder_push(ReorderBuffer* buffer, const EventRecord* record);
+
+/**
+ * reorder_pop:
+ *
+ * Takes the next record in sequence order if it may be released: it is the next expected number, the stage is full,
+ * or `force` is set.
+ *
+ * @return: 1 if a record was copied to `record`, 0 otherwise
+ */
+int reorder_pop(ReorderBuffer* buffer, EventRecord* record, int force);
+
+/**
+ * reorder_free:
+ *
+ * Releases the heap. Records still held are discarded; drain them with a forced reorder_pop() first.
+ */
+void reorder_free(ReorderBuffer* buffer);
+
+#endif
@@ -0,0 +1,151 @@
+#include "stack_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define MAX_STACK_IDS (1u << 24)
+#define STACK_TEXT_SIZE 512
+
+void stack_table_init(StackTable* table, const pid_t pid)
+{
+    memset(table, 0, sizeof(*table));
+    table->pid = pid;
+}
+
+/**
+ * load_modules:
+ *
+ * (Re)reads the executable mappings of the client. Called lazily and again whenever a frame falls outside every
+ * known mapping, which happens after the client dlopen()s a library.
+ */
+static void load_modules(StackTable* table)
+{
+    free(table->modules);
+    table->modules = NULL;
+    table->module_count = 0;
+    if (table->pid <= 0) return;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)table->pid);
+    FILE* fp = fopen(path, "r");
+    if (!fp) return;
+
+    size_t capacity = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp))
+    {
+        uint64_t start, end, offset;
+        char perms[8];
+        char name[256] = "";
+        if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %*s %*s %255s",
+                   &start, &end, perms, &offset, name) < 4 || perms[2] != 'x')
+            continue;
+
+        if (table->module_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 32;
+            ModuleMapping* grown = realloc(table->modules, capacity * sizeof(ModuleMapping));
+            if (!grown) break;
+            table->modules = grown;
+        }
+
+        ModuleMapping* module = &table->modules[table->module_count++];
+        module->start = start;
+        module->end = end;
+        module->offset = offset;
+        const char* base = strrchr(name, '/');
+        strncpy(module->name, base ? base + 1 : (name[0] ? name : "?"), sizeof(module->name) - 1);
+        module->name[sizeof(module->name) - 1] = '\0';
+    }
+    fclose(fp);
+}
+
+static const ModuleMapping* find_module(const StackTable* table, const uint64_t pc)
+{
+    for (size_t i = 0; i < table->module_count; i++)
+    {
+        if (pc >= table->modules[i].start && pc < table->modules[i].end)
+            return &table->modules[i];
+    }
+    return NULL;
+}
+
+/**
+ * format_frame:
+ *
+ * Writes one frame as "module+0xoffset" (a file offset, ready for addr2line), or as the raw address if no mapping
+ * contains it.
+ */
+static int format_frame(StackTable* table, uint64_t pc, char* out, const size_t size, int* reloaded)
+{
+    // Return addresses point after the call; step back into it so the offset names the call site
+    if (pc > 0) pc--;
+
+    const ModuleMapping* module = find_module(table, pc);
+    if (!module && !*reloaded)
+    {
+        load_modules(table);
+        *reloaded = 1;
+        module = find_module(table, pc);
+    }
+
+    if (!module)
+        return snprintf(out, size, "0x%" PRIx64, pc);
+    return snprintf(out, size, "%s+0x%" PRIx64, module->name, pc - module->start + module->offset);
+}
+
+void stack_table_add(StackTable* table, const StackTrace* trace)
+{
+    const uint32_t id = trace->stack_id;
+    if (id == 0 || id >= MAX_STACK_IDS) return;
+
+    if (id >= table->capacity)
+    {
+        size_t capacity = table->capacity ? table->capacity : 256;
+        while (capacity <= id) capacity *= 2;
+        char** grown = realloc(table->stacks, capacity * sizeof(char*));
+        if (!grown) return;
+        memset(grown + table->capacity, 0, (capacity - table->capacity) * sizeof(char*));
+        table->stacks = grown;
+        table->capacity = capacity;
+    }
+    if (table->stacks[id]) return;
+
+    char* text = malloc(STACK_TEXT_SIZE);
+    if (!text) return;
+
+    int reloaded = 0;
+    if (!table->modules)
+    {
+        load_modules(table);
+        reloaded = 1;
+    }
+
+    // Innermost frame first; frames that do not fit are cut off
+    size_t used = 0;
+    const int depth = trace->depth < PROTOCOL_MAX_STACK_DEPTH ? trace->depth : PROTOCOL_MAX_STACK_DEPTH;
+    text[0] = '\0';
+    for (int i = 0; i < depth && used < STACK_TEXT_SIZE - 1; i++)
+    {
+        if (i > 0) used += (size_t)snprintf(text + used, STACK_TEXT_SIZE - used, " < ");
+        if (used >= STACK_TEXT_SIZE - 1) break;
+        used += (size_t)format_frame(table, trace->frames[i], text + used, STACK_TEXT_SIZE - used, &reloaded);
+    }
+    table->stacks[id] = text;
+}
+
+const char* stack_table_lookup(const StackTable* table, const uint32_t stack_id)
+{
+    if (stack_id == 0 || stack_id >= table->capacity) return NULL;
+    return table->stacks[stack_id];
+}
+
+void stack_table_free(StackTable* table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+        free(table->stacks[i]);
+    free(table->stacks);
+    free(table->modules);
+    memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,63 @@
+#ifndef STACK_TABLE_H
+#define STACK_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "protocol.h"
+
+/**
+ * ModuleMapping:
+ *
+ * One executable mapping of the client process, read from /proc/<pid>/maps.
+ */
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    char name[64];
+} ModuleMapping;
+
+/**
+ * StackTable:
+ *
+ * Per-client symbolized stacks indexed by the wrapper's stack id. Ids are handed out densely from 1, so a plain
+ * array grown on demand is enough.
+ */
+typedef struct {
+    pid_t pid;
+    char** stacks;
+    size_t capacity;
+    ModuleMapping* modules;
+    size_t module_count;
+} StackTable;
+
+/**
+ * stack_table_init:
+ *
+ * Prepares an empty table for the client process `pid` (0 if unknown; frames then print as raw addresses).
+ */
+void stack_table_init(StackTable* table, pid_t pid);
+
+/**
+ * stack_table_add:
+ *
+ * Symbolizes a FRAME_STACK payload as "module+0xoffset" frames and stores it under its id.
+ */
+void stack_table_add(StackTable* table, const StackTrace* trace);
+
+/**
+ * stack_table_lookup:
+ *
+ * @return: The formatted stack for `stack_id`, or NULL if it has not been announced
+ */
+const char* stack_table_lookup(const StackTable* table, uint32_t stack_id);
+
+/**
+ * stack_table_free:
+ *
+ * Releases all stacks and the cached module list.
+ */
+void stack_table_free(StackTable* table);
+
+#endif
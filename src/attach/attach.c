@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/user.h>
+
+/*
+ * mapd-attach:
+ *
+ * Loads the memwrap library into a process that is already running, for programs that cannot be restarted under
+ * LD_PRELOAD. The target is stopped with ptrace(), made to call setenv() for every MAPD_* variable of this tool's
+ * environment and then dlopen() on the library, and let go. The library's constructor connects to the analyzer and
+ * redirects the process's malloc family to itself (see interpose.c).
+ *
+ *     MAPD_TRACK=1 mapd-attach [--lib path/to/libmem_wrap.so] <pid>
+ *
+ * Remote functions are found at the same offset in the target's libc as in ours, so both must map the same file.
+ * The calls run on the thread that was stopped: if it held the allocator or loader lock at that moment, the target
+ * deadlocks. Only x86-64 is supported.
+ */
+
+#define SCRATCH_OFFSET 4096  // below the stopped thread's stack pointer, well past the red zone
+#define SCRATCH_SIZE 2048
+
+#if defined(__x86_64__)
+
+/**
+ * usage:
+ *
+ * Prints the command line and returns the exit status for a wrong one.
+ */
+static int usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [--lib path/to/libmem_wrap.so] <pid>\n", name);
+    return 2;
+}
+
+/**
+ * default_library:
+ *
+ * The wrapper next to this executable, as the build puts them.
+ */
+static int default_library(char* path, const size_t size)
+{
+    char exe[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (length < 0) return -1;
+    exe[length] = '\0';
+    const int written = snprintf(path, size, "%s/libmem_wrap.so", dirname(exe));
+    return written < 0 || (size_t)written >= size ? -1 : 0;
+}
+
+/**
+ * module_base:
+ *
+ * Load address of the file `path` in process `pid`, from the mapping of its first page.
+ *
+ * @return: the address, 0 if the file is not mapped
+ */
+static uintptr_t module_base(const pid_t pid, const char* path)
+{
+    char maps[64];
+    snprintf(maps, sizeof(maps), "/proc/%d/maps", (int)pid);
+    FILE* file = fopen(maps, "r");
+    if (!file) return 0;
+
+    char line[PATH_MAX + 128];
+    uintptr_t base = 0;
+    while (!base && fgets(line, sizeof(line), file))
+    {
+        unsigned long start, offset;
+        char mapped[PATH_MAX] = "";
+        if (sscanf(line, "%lx-%*x %*s %lx %*s %*s %4095s", &start, &offset, mapped) < 2) continue;
+        if (offset == 0 && strcmp(mapped, path) == 0) base = start;
+    }
+    fclose(file);
+    return base;
+}
+
+/**
+ * remote_symbol:
+ *
+ * Address of one of our own functions in the target: the same offset into the same file.
+ *
+ * @return: the address, 0 if the target does not map the file
+ */
+static uintptr_t remote_symbol(const pid_t pid, const char* name)
+{
+    void* local = dlsym(RTLD_DEFAULT, name);
+    Dl_info info;
+    if (!local || !dladdr(local, &info) || !info.dli_fname) return 0;
+
+    char path[PATH_MAX];
+    if (!realpath(info.dli_fname, path)) return 0;
+    const uintptr_t base = module_base(pid, path);
+    if (!base)
+    {
+        fprintf(stderr, "mapd-attach: %s is not loaded in %d\n", path, (int)pid);
+        return 0;
+    }
+    return base + ((uintptr_t)local - (uintptr_t)info.dli_fbase);
+}
+
+static int write_remote(const int mem, const uintptr_t addr, const void* data, const size_t size)
+{
+    return pwrite(mem, data, size, (off_t)addr) == (ssize_t)size ? 0 : -1;
+}
+
+/**
+ * remote_call:
+ *
+ * Calls func(a, b, c) on the stopped thread. The call returns to address 0, and the resulting fault hands control
+ * back; other signals arriving meanwhile are passed on. The thread's registers are restored afterwards.
+ *
+ * @return: 0 with the return value in `result`, -1 if the target did not come back
+ */
+static int remote_call(const pid_t pid, const int mem, const struct user_regs_struct* saved, const uintptr_t func,
+                       const uint64_t a, const uint64_t b, const uint64_t c, uint64_t* result)
+{
+    struct user_regs_struct regs = *saved;
+    regs.rsp = ((saved->rsp - SCRATCH_OFFSET - SCRATCH_SIZE) & ~(uint64_t)15) - 8;
+    const uint64_t return_address = 0;
+    if (write_remote(mem, regs.rsp, &return_address, sizeof(return_address)) != 0) return -1;
+    regs.rip = func;
+    regs.rdi = a;
+    regs.rsi = b;
+    regs.rdx = c;
+    regs.rax = 0;
+    regs.orig_rax = (uint64_t)-1;  // no system call to restart
+    if (ptrace(PTRACE_SETREGS, pid, NULL, &regs) != 0) return -1;
+
+    int forward = 0;
+    while (1)
+    {
+        if (ptrace(PTRACE_CONT, pid, NULL, (void*)(uintptr_t)forward) != 0) return -1;
+        int status;
+        if (waitpid(pid, &status, __WALL) != pid) return -1;
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            fprintf(stderr, "mapd-attach: target exited during the call\n");
+            return -1;
+        }
+        const int sig = WSTOPSIG(status);
+        if (sig == SIGSEGV)
+        {
+            if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) != 0) return -1;
+            if (regs.rip != 0)
+            {
+                fprintf(stderr, "mapd-attach: target crashed during the call\n");
+                ptrace(PTRACE_SETREGS, pid, NULL, saved);
+                return -1;
+            }
+            *result = regs.rax;
+            break;
+        }
+        forward = sig == SIGSTOP ? 0 : sig;
+    }
+    return ptrace(PTRACE_SETREGS, pid, NULL, saved) == 0 ? 0 : -1;
+}
+
+/**
+ * remote_string:
+ *
+ * Copies a string into the scratch area at `*cursor` and moves the cursor past it.
+ *
+ * @return: the string's address in the target, 0 if it does not fit
+ */
+static uintptr_t remote_string(const int mem, uintptr_t* cursor, const uintptr_t end, const char* string)
+{
+    const size_t size = strlen(string) + 1;
+    if (*cursor + size > end || write_remote(mem, *cursor, string, size) != 0) return 0;
+    const uintptr_t addr = *cursor;
+    *cursor += (size + 15) & ~(size_t)15;
+    return addr;
+}
+
+/**
+ * inject:
+ *
+ * Runs setenv() for each MAPD_* variable and then dlopen() on `library` inside the stopped target.
+ */
+static int inject(const pid_t pid, const char* library)
+{
+    const uintptr_t remote_setenv = remote_symbol(pid, "setenv");
+    const uintptr_t remote_dlopen = remote_symbol(pid, "dlopen");
+    const uintptr_t remote_dlerror = remote_symbol(pid, "dlerror");
+    if (!remote_setenv || !remote_dlopen || !remote_dlerror) return -1;
+
+    char mem_path[64];
+    snprintf(mem_path, sizeof(mem_path), "/proc/%d/mem", (int)pid);
+    const int mem = open(mem_path, O_RDWR);
+    if (mem < 0)
+    {
+        perror("mapd-attach: open /proc/pid/mem");
+        return -1;
+    }
+
+    struct user_regs_struct saved;
+    if (ptrace(PTRACE_GETREGS, pid, NULL, &saved) != 0)
+    {
+        close(mem);
+        return -1;
+    }
+    const uintptr_t scratch = saved.rsp - SCRATCH_OFFSET - SCRATCH_SIZE;
+    const uintptr_t scratch_end = saved.rsp - SCRATCH_OFFSET;
+
+    int status = 0;
+    uint64_t result;
+    extern char** environ;
+    for (char** env = environ; *env && status == 0; env++)
+    {
+        if (strncmp(*env, "MAPD_", 5) != 0) continue;
+        char name[256];
+        const char* equals = strchr(*env, '=');
+        if (!equals || (size_t)(equals - *env) >= sizeof(name)) continue;
+        memcpy(name, *env, equals - *env);
+        name[equals - *env] = '\0';
+
+        uintptr_t cursor = scratch;
+        const uintptr_t remote_name = remote_string(mem, &cursor, scratch_end, name);
+        const uintptr_t remote_value = remote_string(mem, &cursor, scratch_end, equals + 1);
+        if (!remote_name || !remote_value) continue;
+        if (remote_call(pid, mem, &saved, remote_setenv, remote_name, remote_value, 1, &result) != 0) status = -1;
+    }
+
+    uintptr_t cursor = scratch;
+    const uintptr_t remote_library = remote_string(mem, &cursor, scratch_end, library);
+    if (status == 0 && remote_library &&
+        remote_call(pid, mem, &saved, remote_dlopen, remote_library, RTLD_NOW, 0, &result) == 0)
+    {
+        if (!result)
+        {
+            char message[256] = "unknown error";
+            if (remote_call(pid, mem, &saved, remote_dlerror, 0, 0, 0, &result) == 0 && result)
+            {
+                const ssize_t length = pread(mem, message, sizeof(message) - 1, (off_t)result);
+                message[length > 0 ? length : 0] = '\0';
+            }
+            fprintf(stderr, "mapd-attach: dlopen failed in %d: %s\n", (int)pid, message);
+            status = -1;
+        }
+    }
+    else
+        status = -1;
+
+    close(mem);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    char library[PATH_MAX] = "";
+    const char* pid_arg = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--lib") == 0 && i + 1 < argc)
+        {
+            if (!realpath(argv[++i], library))
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else if (!pid_arg)
+            pid_arg = argv[i];
+        else
+            return usage(argv[0]);
+    }
+    if (!pid_arg) return usage(argv[0]);
+
+    char* end;
+    const long pid = strtol(pid_arg, &end, 10);
+    if (*end != '\0' || pid <= 0) return usage(argv[0]);
+    if (!library[0] && default_library(library, sizeof(library)) != 0) return 1;
+    if (access(library, R_OK) != 0)
+    {
+        perror(library);
+        return 1;
+    }
+
+    if (ptrace(PTRACE_ATTACH, (pid_t)pid, NULL, NULL) != 0)
+    {
+        perror("mapd-attach: ptrace");
+        if (errno == EPERM) fprintf(stderr, "mapd-attach: check /proc/sys/kernel/yama/ptrace_scope\n");
+        return 1;
+    }
+    int status;
+    if (waitpid((pid_t)pid, &status, __WALL) != (pid_t)pid || !WIFSTOPPED(status))
+    {
+        perror("mapd-attach: waitpid");
+        return 1;
+    }
+
+    const int injected = inject((pid_t)pid, library);
+    ptrace(PTRACE_DETACH, (pid_t)pid, NULL, NULL);
+    if (injected != 0) return 1;
+
+    printf("mapd-attach: loaded %s into %ld\n", library, pid);
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    fprintf(stderr, "mapd-attach: only x86-64 is supported\n");
+    return 1;
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include "main_controller.h"
 
+#define MAX_SHOWN_LEAK_SITES 100
+#define MAX_SHOWN_COUNTER_CLIENTS 5
+#define COUNTERS_REFRESH_MS 1000
+
 MainController* global_main_controller = NULL;
 
 typedef struct {
@@ -15,6 +19,62 @@ gboolean update_fragmentation_label(gpointer data) {
     return G_SOURCE_REMOVE;
 }
 
+/**
+ * format_bytes:
+ *
+ * Writes a byte count in B, KiB, MiB or GiB.
+ */
+static void format_bytes(int64_t bytes, char *buffer, size_t size)
+{
+    const char *units[] = { "B", "KiB", "MiB", "GiB" };
+    double value = (double)bytes;
+    int unit = 0;
+    while ((value >= 1024.0 || value <= -1024.0) && unit < 3)
+    {
+        value /= 1024.0;
+        unit++;
+    }
+    if (unit == 0)
+        snprintf(buffer, size, "%lld B", (long long)bytes);
+    else
+        snprintf(buffer, size, "%.1f %s", value, units[unit]);
+}
+
+/**
+ * refresh_live_counters:
+ *
+ * Shows the live heap of the connected clients, read straight from their counters pages without any message.
+ * Runs on the GTK main thread every COUNTERS_REFRESH_MS.
+ *
+ * @param user_data Pointer to the MainController
+ * @return G_SOURCE_CONTINUE to keep refreshing
+ */
+static gboolean refresh_live_counters(gpointer user_data)
+{
+    MainController *controller = user_data;
+    int clients[MAX_CONTROL_CLIENTS];
+    const int count = analyzer_list_clients(clients, MAX_CONTROL_CLIENTS);
+
+    GString *text = g_string_new(NULL);
+    int shown = 0;
+    for (int i = 0; i < count && shown < MAX_SHOWN_COUNTER_CLIENTS; i++)
+    {
+        CountersTotals totals;
+        if (analyzer_read_counters(clients[i], &totals) != 0) continue;
+
+        char live[32], peak[32];
+        format_bytes(totals.live_bytes, live, sizeof(live));
+        format_bytes(totals.peak_live_bytes, peak, sizeof(peak));
+        g_string_append_printf(text, "%sClient %d: %s live (peak %s), %llu allocations, %llu frees",
+            shown ? "\n" : "", clients[i], live, peak,
+            (unsigned long long)totals.total_allocs, (unsigned long long)totals.total_frees);
+        shown++;
+    }
+    gtk_label_set_text(GTK_LABEL(controller->view->live_counters_label), shown ? text->str : "<No Clients>");
+    g_string_free(text, TRUE);
+    return G_SOURCE_CONTINUE;
+}
+
 /**
  * on_logo_image_clicked:
  *
@@ -173,6 +233,43 @@ static void on_launch_clicked(GtkButton *button, gpointer user_data)
     launch_client_with_memwrap(file_path, args_text);
 }
 
+/**
+ * insert_leak_summary:
+ *
+ * Appends the sites of a leak summary to the log, largest first, after the message announcing it. Only the first
+ * MAX_SHOWN_LEAK_SITES sites are listed.
+ *
+ * @param buffer: Log buffer
+ * @param msg: leak_summary message
+ */
+static void insert_leak_summary(GtkTextBuffer *buffer, const Message *msg)
+{
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gchar *header = g_strdup_printf("    %s\n", msg->description);
+    gtk_text_buffer_insert(buffer, &end, header, -1);
+    g_free(header);
+
+    LeakSummary summary;
+    if (!leak_summary_take(msg->client_id, (uint32_t)msg->seq, &summary)) return;
+
+    for (size_t i = 0; i < summary.site_count && i < MAX_SHOWN_LEAK_SITES; i++)
+    {
+        char line[1024];
+        leak_summary_format_site(&summary.sites[i], line, sizeof(line));
+        gchar *site_line = g_strdup_printf("    %s\n", line);
+        gtk_text_buffer_insert(buffer, &end, site_line, -1);
+        g_free(site_line);
+    }
+    if (summary.site_count > MAX_SHOWN_LEAK_SITES)
+    {
+        gchar *more = g_strdup_printf("    ... and %zu more sites\n", summary.site_count - MAX_SHOWN_LEAK_SITES);
+        gtk_text_buffer_insert(buffer, &end, more, -1);
+        g_free(more);
+    }
+    leak_summary_free(&summary);
+}
+
 /**
  * update_gui_from_message:
  *
@@ -188,14 +285,15 @@ static gboolean update_gui_from_message(gpointer user_data)
     Message* msg = data->message;
     MainController* controller = data->controller;
 
-    char time_buf[32];
-    struct tm *tm_info = localtime(&msg->timestamp);
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+    char time_buf[40];
+    message_format_time(msg, time_buf, sizeof(time_buf));
 
-    // Build the log string from Message
+    // Build the log string from Message, with the call stack and the sampling estimate on extra lines
     gchar *log_line = g_strdup_printf(
-        "Client %d | %s | Addr: %s | Size: %zu | Thread: %lu | Time: %s\n",
-        msg->client_id, msg->type, msg->addr, msg->size, msg->thread, time_buf);
+        "Client %d | %s | Addr: %s | Size: %zu | Thread: %lu | Time: %s\n%s%s%s%s%s%s",
+        msg->client_id, msg->type, msg->addr, msg->size, msg->thread, time_buf,
+        msg->stack[0] ? "    at " : "", msg->stack, msg->stack[0] ? "\n" : "",
+        msg->weight ? "    " : "", msg->weight ? msg->description : "", msg->weight ? "\n" : "");
 
     // Append log line to TextView
     GtkTextBuffer* buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(controller->view->log_text_view));
@@ -205,6 +303,15 @@ static gboolean update_gui_from_message(gpointer user_data)
     // Insert text
     gtk_text_buffer_insert(buffer, &end, log_line, -1);
     g_free(log_line);
+    if (strcmp(msg->type, "leak_summary") == 0)
+        insert_leak_summary(buffer, msg);
+    else if (strcmp(msg->type, "latency") == 0)
+    {
+        gchar *summary = g_strdup_printf("    %s\n", msg->description);
+        gtk_text_buffer_get_end_iter(buffer, &end);
+        gtk_text_buffer_insert(buffer, &end, summary, -1);
+        g_free(summary);
+    }
 
     // Re-fetch end iter after insert to scroll to end
     gtk_text_buffer_get_end_iter(buffer, &end);
@@ -242,11 +349,73 @@ static void* analyzer_consumer_thread(void* arg)
     return NULL;
 }
 
+/**
+ * push_client_commands:
+ *
+ * Sends the client settings of the options dialog to the selected client's wrapper.
+ *
+ * @param data: Dialog widgets
+ */
+static void push_client_commands(OptionsDialogData *data)
+{
+    const guint selected = gtk_drop_down_get_selected(data->client_dropdown);
+    if (selected == 0 || selected == GTK_INVALID_LIST_POSITION) return;
+    const int client = data->client_numbers[selected - 1];
+
+    // Dropdown entries follow ControlMode, after "Unchanged"
+    const guint mode = gtk_drop_down_get_selected(data->mode_dropdown);
+    if (mode > 0 && mode != GTK_INVALID_LIST_POSITION)
+        analyzer_send_control(client, CONTROL_SET_MODE, mode - 1);
+
+    const guint tracking = gtk_drop_down_get_selected(data->tracking_dropdown);
+    if (tracking == 1 || tracking == 2)
+        analyzer_send_control(client, CONTROL_SET_TRACKING, tracking == 1);
+
+    const int sample_bytes = gtk_spin_button_get_value_as_int(data->sample_spin);
+    if (sample_bytes > 0) analyzer_send_control(client, CONTROL_SET_SAMPLE_BYTES, (uint64_t)sample_bytes);
+    const int depth = gtk_spin_button_get_value_as_int(data->depth_spin);
+    if (depth >= 0) analyzer_send_control(client, CONTROL_SET_STACK_DEPTH, (uint64_t)depth);
+    const int guard_rate = gtk_spin_button_get_value_as_int(data->guard_spin);
+    if (guard_rate >= 0) analyzer_send_control(client, CONTROL_SET_GUARD_RATE, (uint64_t)guard_rate);
+    const int latency_ms = gtk_spin_button_get_value_as_int(data->latency_spin);
+    if (latency_ms >= 0) analyzer_send_control(client, CONTROL_SET_LATENCY, (uint64_t)latency_ms);
+
+    const guint events = gtk_drop_down_get_selected(data->events_dropdown);
+    if (events == 1)
+        analyzer_send_control(client, CONTROL_SET_EVENT_MASK, ~0ull);
+    else if (events == 2)
+        analyzer_send_control(client, CONTROL_SET_EVENT_MASK, PROTOCOL_ERROR_EVENTS);
+
+    // Dropdown entries follow FilterSitePolicy, after "Unchanged"
+    const guint filter_policy = gtk_drop_down_get_selected(data->filter_dropdown);
+    if (filter_policy > 0 && filter_policy != GTK_INVALID_LIST_POSITION)
+    {
+        FilterFrame filter = {0};
+        filter.min_size = (uint64_t)gtk_spin_button_get_value(data->min_size_spin);
+        filter.max_size = (uint64_t)gtk_spin_button_get_value(data->max_size_spin);
+        filter.site_policy = (uint16_t)(filter_policy - 1);
+        if (filter.site_policy != FILTER_SITES_ANY)
+            protocol_filter_add_sites(&filter, gtk_editable_get_text(GTK_EDITABLE(data->sites_entry)));
+        analyzer_send_filter(client, &filter);
+    }
+
+    if (gtk_check_button_get_active(data->snapshot_check))
+        analyzer_send_control(client, CONTROL_SNAPSHOT, CONTROL_SNAPSHOT_EVENTS);
+    if (gtk_check_button_get_active(data->scan_check))
+        analyzer_send_control(client, CONTROL_SCAN, 0);
+    if (gtk_check_button_get_active(data->leak_scan_check))
+        analyzer_send_control(client, CONTROL_LEAK_SCAN, 0);
+    if (gtk_check_button_get_active(data->snapshot_file_check))
+        analyzer_send_control(client, CONTROL_SNAPSHOT, CONTROL_SNAPSHOT_FILE);
+    g_print("Sent settings to client %d\n", client);
+}
+
 /**
  * on_options_dialog_response:
  *
  * Callback for the response signal of the options dialog.
- * If user accepts (OK), updates analyzer options based on dialog input fields.
+ * If user accepts (OK), updates analyzer options based on dialog input fields and pushes the client settings to the
+ * selected client.
  *
  * @param dialog: Pointer to Options dialog
  * @param response_id: Pointer to dialog response ID (OK, Cancel, etc.)
@@ -261,6 +430,7 @@ static void on_options_dialog_response(GtkDialog *dialog, gint response_id, gpoi
         double small_threshold = gtk_spin_button_get_value(data->small_thresh_spin);
         double large_threshold = gtk_spin_button_get_value(data->large_thresh_spin);
         gboolean info_log = gtk_switch_get_active(data->info_log_switch);
+        const gboolean info_log_changed = info_log != data->controller->options->info_logs_enabled;
 
         data->controller->options->small_threshold = (int)small_threshold;
         data->controller->options->large_threshold = (int)large_threshold;
@@ -268,6 +438,9 @@ static void on_options_dialog_response(GtkDialog *dialog, gint response_id, gpoi
         g_print("Threshold Large Blocks: %.2f\n", large_threshold);
         g_print("Threshold Small Blocks: %.2f\n", small_threshold);
         g_print("Info Logs: %s\n", info_log ? "enabled" : "disabled");
+        // Before the client settings, so an explicit event choice for the selected client wins
+        if (info_log_changed) analyzer_info_logs_changed();
+        push_client_commands(data);
     }
 
     g_free(data);
@@ -328,15 +501,134 @@ static void on_options_button_clicked(GtkButton *button, gpointer user_data)
     gtk_grid_attach(GTK_GRID(grid), log_switch, 1, 2, 1, 1);
     gtk_widget_set_halign(log_switch, GTK_ALIGN_END);
 
+    // Client settings, sent to the selected client's wrapper
+    GtkWidget *client_label = gtk_label_new("Client");
+    gtk_widget_set_halign(client_label, GTK_ALIGN_START);
+    int client_numbers[MAX_CONTROL_CLIENTS];
+    const int client_count = analyzer_list_clients(client_numbers, MAX_CONTROL_CLIENTS);
+    GtkStringList *client_list = gtk_string_list_new(NULL);
+    gtk_string_list_append(client_list, "None");
+    for (int i = 0; i < client_count; i++)
+    {
+        gchar *name = g_strdup_printf("Client %d", client_numbers[i]);
+        gtk_string_list_append(client_list, name);
+        g_free(name);
+    }
+    GtkWidget *client_dropdown = gtk_drop_down_new(G_LIST_MODEL(client_list), NULL);
+    gtk_grid_attach(GTK_GRID(grid), client_label, 0, 3, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), client_dropdown, 1, 3, 1, 1);
+
+    GtkWidget *mode_label = gtk_label_new("Mode");
+    gtk_widget_set_halign(mode_label, GTK_ALIGN_START);
+    const char *modes[] = { "Unchanged", "Debug", "Test", "Perf", "Sample", "Count", NULL };
+    GtkWidget *mode_dropdown = gtk_drop_down_new_from_strings(modes);
+    gtk_grid_attach(GTK_GRID(grid), mode_label, 0, 4, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), mode_dropdown, 1, 4, 1, 1);
+
+    GtkWidget *tracking_label = gtk_label_new("Tracking");
+    gtk_widget_set_halign(tracking_label, GTK_ALIGN_START);
+    const char *tracking_choices[] = { "Unchanged", "On", "Off", NULL };
+    GtkWidget *tracking_dropdown = gtk_drop_down_new_from_strings(tracking_choices);
+    gtk_grid_attach(GTK_GRID(grid), tracking_label, 0, 5, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), tracking_dropdown, 1, 5, 1, 1);
+
+    GtkWidget *sample_label = gtk_label_new("Sample Interval (bytes)");
+    gtk_widget_set_halign(sample_label, GTK_ALIGN_START);
+    GtkWidget *sample_spin = gtk_spin_button_new_with_range(-1, 1 << 30, 4096);
+    gtk_grid_attach(GTK_GRID(grid), sample_label, 0, 6, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), sample_spin, 1, 6, 1, 1);
+
+    GtkWidget *depth_label = gtk_label_new("Stack Depth");
+    gtk_widget_set_halign(depth_label, GTK_ALIGN_START);
+    GtkWidget *depth_spin = gtk_spin_button_new_with_range(-1, PROTOCOL_MAX_STACK_DEPTH, 1);
+    gtk_grid_attach(GTK_GRID(grid), depth_label, 0, 7, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), depth_spin, 1, 7, 1, 1);
+
+    GtkWidget *guard_label = gtk_label_new("Guard Sample Rate");
+    gtk_widget_set_halign(guard_label, GTK_ALIGN_START);
+    GtkWidget *guard_spin = gtk_spin_button_new_with_range(-1, 1000000, 100);
+    gtk_grid_attach(GTK_GRID(grid), guard_label, 0, 8, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), guard_spin, 1, 8, 1, 1);
+
+    GtkWidget *events_label = gtk_label_new("Events");
+    gtk_widget_set_halign(events_label, GTK_ALIGN_START);
+    const char *event_choices[] = { "Unchanged", "All", "Errors only", NULL };
+    GtkWidget *events_dropdown = gtk_drop_down_new_from_strings(event_choices);
+    gtk_grid_attach(GTK_GRID(grid), events_label, 0, 9, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), events_dropdown, 1, 9, 1, 1);
+
+    GtkWidget *filter_label = gtk_label_new("Block Filter");
+    gtk_widget_set_halign(filter_label, GTK_ALIGN_START);
+    const char *filter_choices[] = { "Unchanged", "Sizes only", "Sizes, allow sites", "Sizes, deny sites", NULL };
+    GtkWidget *filter_dropdown = gtk_drop_down_new_from_strings(filter_choices);
+    gtk_grid_attach(GTK_GRID(grid), filter_label, 0, 10, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), filter_dropdown, 1, 10, 1, 1);
+
+    GtkWidget *min_size_label = gtk_label_new("Minimum Block Size");
+    gtk_widget_set_halign(min_size_label, GTK_ALIGN_START);
+    GtkWidget *min_size_spin = gtk_spin_button_new_with_range(0, 1 << 30, 64);
+    gtk_grid_attach(GTK_GRID(grid), min_size_label, 0, 11, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), min_size_spin, 1, 11, 1, 1);
+
+    GtkWidget *max_size_label = gtk_label_new("Maximum Block Size (0: none)");
+    gtk_widget_set_halign(max_size_label, GTK_ALIGN_START);
+    GtkWidget *max_size_spin = gtk_spin_button_new_with_range(0, 1 << 30, 64);
+    gtk_grid_attach(GTK_GRID(grid), max_size_label, 0, 12, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), max_size_spin, 1, 12, 1, 1);
+
+    GtkWidget *sites_label = gtk_label_new("Sites");
+    gtk_widget_set_halign(sites_label, GTK_ALIGN_START);
+    GtkWidget *sites_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(sites_entry), "libfoo.so, app+0x1200-0x1400");
+    gtk_grid_attach(GTK_GRID(grid), sites_label, 0, 13, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), sites_entry, 1, 13, 1, 1);
+
+    GtkWidget *snapshot_check = gtk_check_button_new_with_label("Report live blocks");
+    GtkWidget *scan_check = gtk_check_button_new_with_label("Check heap now");
+    gtk_grid_attach(GTK_GRID(grid), snapshot_check, 0, 14, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), scan_check, 1, 14, 1, 1);
+
+    GtkWidget *leak_scan_check = gtk_check_button_new_with_label("Find leaks now");
+    GtkWidget *snapshot_file_check = gtk_check_button_new_with_label("Write heap snapshot file");
+    gtk_grid_attach(GTK_GRID(grid), leak_scan_check, 0, 15, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), snapshot_file_check, 1, 15, 1, 1);
+
+    GtkWidget *latency_label = gtk_label_new("Latency Report Interval (ms, 0: off)");
+    gtk_widget_set_halign(latency_label, GTK_ALIGN_START);
+    GtkWidget *latency_spin = gtk_spin_button_new_with_range(-1, 3600000, 100);
+    gtk_grid_attach(GTK_GRID(grid), latency_label, 0, 16, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), latency_spin, 1, 16, 1, 1);
+
     // Set initial values from controller options
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(small_spin), controller->options->small_threshold);
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(large_spin), controller->options->large_threshold);
     gtk_switch_set_active(GTK_SWITCH(log_switch), controller->options->info_logs_enabled);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(sample_spin), -1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(depth_spin), -1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(guard_spin), -1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(latency_spin), -1);
 
     OptionsDialogData *data = g_malloc(sizeof(OptionsDialogData));
     data->small_thresh_spin = GTK_SPIN_BUTTON(small_spin);
     data->large_thresh_spin = GTK_SPIN_BUTTON(large_spin);
     data->info_log_switch = GTK_SWITCH(log_switch);
+    data->client_dropdown = GTK_DROP_DOWN(client_dropdown);
+    memcpy(data->client_numbers, client_numbers, sizeof(int) * (size_t)client_count);
+    data->mode_dropdown = GTK_DROP_DOWN(mode_dropdown);
+    data->tracking_dropdown = GTK_DROP_DOWN(tracking_dropdown);
+    data->sample_spin = GTK_SPIN_BUTTON(sample_spin);
+    data->depth_spin = GTK_SPIN_BUTTON(depth_spin);
+    data->guard_spin = GTK_SPIN_BUTTON(guard_spin);
+    data->latency_spin = GTK_SPIN_BUTTON(latency_spin);
+    data->events_dropdown = GTK_DROP_DOWN(events_dropdown);
+    data->filter_dropdown = GTK_DROP_DOWN(filter_dropdown);
+    data->min_size_spin = GTK_SPIN_BUTTON(min_size_spin);
+    data->max_size_spin = GTK_SPIN_BUTTON(max_size_spin);
+    data->sites_entry = GTK_ENTRY(sites_entry);
+    data->snapshot_check = GTK_CHECK_BUTTON(snapshot_check);
+    data->scan_check = GTK_CHECK_BUTTON(scan_check);
+    data->leak_scan_check = GTK_CHECK_BUTTON(leak_scan_check);
+    data->snapshot_file_check = GTK_CHECK_BUTTON(snapshot_file_check);
     data->controller = controller;
 
     g_signal_connect(dialog, "response", G_CALLBACK(on_options_dialog_response), data);
@@ -400,6 +692,8 @@ MainController* main_controller_new(GtkApplication *app)
     g_signal_connect(controller->view->options_button, "clicked", G_CALLBACK(on_options_button_clicked), controller);
     g_signal_connect(controller->view->help_button, "clicked", G_CALLBACK(on_help_button_clicked), controller);
 
+    g_timeout_add(COUNTERS_REFRESH_MS, refresh_live_counters, controller);
+
     // Starts consumer thread for messages
     pthread_t consumer_thread;
     pthread_create(&consumer_thread, NULL, analyzer_consumer_thread, controller);
@@ -33,15 +33,37 @@ typedef struct {
     Message* message;
 } GuiUpdateData;
 
+#define MAX_CONTROL_CLIENTS 64
+
 /**
  * OptionsDialogData:
  *
- * Holds widget pointers and controller to pass to the options dialog response callback.
+ * Holds widget pointers and controller to pass to the options dialog response callback. The client widgets retune
+ * the wrapper of the client selected in client_dropdown, whose entries map to client_numbers; spin buttons left at
+ * -1 and dropdowns left at their first entry send nothing. The filter widgets are sent together as one FilterFrame
+ * once filter_dropdown leaves "Unchanged".
  */
 typedef struct {
     GtkSpinButton *small_thresh_spin;
     GtkSpinButton *large_thresh_spin;
     GtkSwitch *info_log_switch;
+    GtkDropDown *client_dropdown;
+    int client_numbers[MAX_CONTROL_CLIENTS];
+    GtkDropDown *mode_dropdown;
+    GtkDropDown *tracking_dropdown;
+    GtkSpinButton *sample_spin;
+    GtkSpinButton *depth_spin;
+    GtkSpinButton *guard_spin;
+    GtkSpinButton *latency_spin;
+    GtkDropDown *events_dropdown;
+    GtkDropDown *filter_dropdown;
+    GtkSpinButton *min_size_spin;
+    GtkSpinButton *max_size_spin;
+    GtkEntry *sites_entry;
+    GtkCheckButton *snapshot_check;
+    GtkCheckButton *scan_check;
+    GtkCheckButton *leak_scan_check;
+    GtkCheckButton *snapshot_file_check;
     MainController *controller;
 } OptionsDialogData;
 
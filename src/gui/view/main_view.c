@@ -47,6 +47,7 @@ MainView* main_view_new(GtkApplication *app)
     view->title_label = GTK_WIDGET(gtk_builder_get_object(builder, "title_label"));
     view->logo_image = GTK_WIDGET(gtk_builder_get_object(builder, "logo_image"));
     view->curr_frag_label = GTK_WIDGET(gtk_builder_get_object(builder, "curr_frag_label"));
+    view->live_counters_label = GTK_WIDGET(gtk_builder_get_object(builder, "live_counters_label"));
     gtk_window_set_application(GTK_WINDOW(view->window), app);
     gtk_window_present(GTK_WINDOW(view->window));
 
@@ -20,6 +20,7 @@ typedef struct {
     GtkWidget *log_text_view;
     GtkWidget *options_button;
     GtkWidget *curr_frag_label;
+    GtkWidget *live_counters_label;
     GtkWidget *help_button;
     GtkWidget *title_label;
     GtkWidget *logo_image;
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "alloc_table.h"
+#include "leak_scan.h"
+#include "latency.h"
+
+#define HASH_MULTIPLIER 11400714819323198485llu  // 2⁶⁴ / golden ratio
+#define SHARD_BITS 6
+#define SHARD_COUNT (1u << SHARD_BITS)
+#define INITIAL_BITS 8
+#define MAX_LOAD_PERCENT 70
+#define MIGRATE_STEP 64
+#define TOMBSTONE ((void*)1)
+
+/**
+ * @file alloc_table.c
+ * @brief Tracking table for live allocations, sharded by address hash.
+ *
+ * The top SHARD_BITS of the Fibonacci hash select one of SHARD_COUNT shards, each with
+ * its own lock, so threads touching different addresses rarely contend. Inside a shard
+ * the next bits index an open-addressed, linearly probed table whose size is a runtime
+ * power of two. Removed entries leave tombstones so probe chains stay intact.
+ *
+ * A shard that passes MAX_LOAD_PERCENT allocates a table twice the size of its live
+ * entries and then migrates MIGRATE_STEP old buckets on every later operation, so no
+ * single malloc pays for rehashing millions of entries. Until migration finishes, lookups
+ * fall back to the old table.
+ *
+ * Slot arrays come from mmap rather than malloc, because this code runs inside malloc.
+ *
+ * A cut gives a consistent view of the whole table without freezing it for a whole walk
+ * (see alloc_table_begin_cut()): entries carry the epoch they were inserted in, and an entry
+ * of an older epoch removed from a shard the walk has not reached yet is handed to the
+ * cut's departed visitor instead of being missed.
+ */
+
+typedef struct {
+    AllocationEntry* slots;
+    unsigned int bits;
+    size_t used;  // live entries plus tombstones
+} SlotArray;
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    SlotArray current;
+    SlotArray previous;  // table being migrated, slots == NULL when idle
+    size_t migrate_pos;
+    size_t live;
+    int cut_pending;  // the walk of the current cut has not visited this shard yet
+} TableShard;
+
+static TableShard shards[SHARD_COUNT] = {
+    [0 ... SHARD_COUNT - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static atomic_size_t live_total = 0;
+static uint32_t table_epoch = 0;  // only changes with every shard lock held
+static AllocationVisitor departed_visitor = NULL;
+static void* departed_arg = NULL;
+
+/**
+ * @brief Computes a well-distributed hash value from a pointer using Fibonacci hashing.
+ *
+ * This function transforms a pointer into a hash index suitable for open-addressed hash tables.
+ * It uses Fibonacci hashing, a multiplicative hashing technique that spreads clustered inputs
+ * (such as memory addresses) uniformly across the table. This is especially useful to reduce
+ * collisions when tracking memory allocations where addresses are often aligned and sequential.
+ *
+ * @param ptr Memory address to be hashed (e.g., an allocation address).
+ * @param bits Number of hash bits to keep.
+ * @return Hash index in the range [0, 2^bits - 1]
+ */
+unsigned long hash_ptr(const void* ptr, const unsigned int bits) {
+    return (((uintptr_t)ptr) * HASH_MULTIPLIER) >> (64 - bits);
+}
+
+static TableShard* shard_for(const void* addr) {
+    return &shards[hash_ptr(addr, SHARD_BITS)];
+}
+
+/**
+ * @brief Probe start inside a shard, using the hash bits just below the shard selector.
+ */
+static size_t home_slot(const void* addr, const unsigned int bits) {
+    return (hash_ptr(addr, SHARD_BITS + bits)) & ((1ul << bits) - 1);
+}
+
+static size_t capacity_of(const SlotArray* array) {
+    return (size_t)1 << array->bits;
+}
+
+static int map_slots(SlotArray* array, const unsigned int bits) {
+    void* slots = mmap(NULL, sizeof(AllocationEntry) << bits, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slots == MAP_FAILED) return -1;
+    leak_scan_ignore(slots, sizeof(AllocationEntry) << bits);
+    array->slots = slots;
+    array->bits = bits;
+    array->used = 0;
+    return 0;
+}
+
+static void unmap_slots(SlotArray* array) {
+    leak_scan_unignore(array->slots);
+    munmap(array->slots, sizeof(AllocationEntry) * capacity_of(array));
+    array->slots = NULL;
+}
+
+/**
+ * @brief Finds the slot holding addr in one slot array, or NULL.
+ */
+static AllocationEntry* probe(const SlotArray* array, const void* addr) {
+    if (!array->slots) return NULL;
+
+    const size_t mask = capacity_of(array) - 1;
+    for (size_t i = home_slot(addr, array->bits), n = 0; n <= mask; i = (i + 1) & mask, n++) {
+        AllocationEntry* slot = &array->slots[i];
+        if (slot->addr == addr) return slot;
+        if (slot->addr == NULL) return NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Places an entry into the first free or tombstoned slot. The array must have room.
+ */
+static void place(SlotArray* array, const AllocationEntry* entry) {
+    const size_t mask = capacity_of(array) - 1;
+    for (size_t i = home_slot(entry->addr, array->bits);; i = (i + 1) & mask) {
+        AllocationEntry* slot = &array->slots[i];
+        if (slot->addr == NULL) {
+            array->used++;
+            *slot = *entry;
+            return;
+        }
+        if (slot->addr == TOMBSTONE) {
+            *slot = *entry;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Moves up to `budget` buckets of the previous table into the current one.
+ */
+static void migrate(TableShard* shard, size_t budget) {
+    if (!shard->previous.slots) return;
+
+    const size_t capacity = capacity_of(&shard->previous);
+    while (budget-- > 0 && shard->migrate_pos < capacity) {
+        AllocationEntry* slot = &shard->previous.slots[shard->migrate_pos++];
+        if (slot->addr != NULL && slot->addr != TOMBSTONE) {
+            place(&shard->current, slot);
+            slot->addr = TOMBSTONE;  // keeps later probes of the old table going past it
+        }
+    }
+    if (shard->migrate_pos == capacity) unmap_slots(&shard->previous);
+}
+
+/**
+ * @brief Makes sure the current table can take one more entry, starting a resize if needed.
+ */
+static int reserve(TableShard* shard) {
+    if (!shard->current.slots) return map_slots(&shard->current, INITIAL_BITS);
+
+    const size_t capacity = capacity_of(&shard->current);
+    if ((shard->current.used + 1) * 100 <= capacity * MAX_LOAD_PERCENT) return 0;
+
+    // A second resize cannot start while the first is still migrating
+    migrate(shard, SIZE_MAX);
+
+    unsigned int bits = shard->current.bits;
+    while (((size_t)1 << bits) * MAX_LOAD_PERCENT < (shard->live + 1) * 2 * 100) bits++;
+
+    SlotArray grown;
+    if (map_slots(&grown, bits) == -1) return -1;
+    shard->previous = shard->current;
+    shard->current = grown;
+    shard->migrate_pos = 0;
+    migrate(shard, MIGRATE_STEP);
+    return 0;
+}
+
+/**
+ * @brief Records a new live allocation.
+ *
+ * @return 0 on success, -1 if the table could not grow.
+ */
+int alloc_table_insert(const AllocationEntry* entry) {
+    TableShard* shard = shard_for(entry->addr);
+    AllocationEntry stamped = *entry;
+
+    latency_lock(&shard->lock, LATENCY_TABLE_LOCK);
+    migrate(shard, MIGRATE_STEP);
+    if (reserve(shard) == -1) {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+    stamped.epoch = table_epoch;
+    place(&shard->current, &stamped);
+    shard->live++;
+    pthread_mutex_unlock(&shard->lock);
+
+    atomic_fetch_add_explicit(&live_total, 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Removes the entry for addr.
+ *
+ * @param removed Receives the removed entry, may be NULL.
+ * @return 1 if addr was tracked, 0 otherwise.
+ */
+int alloc_table_remove(const void* addr, AllocationEntry* removed) {
+    TableShard* shard = shard_for(addr);
+
+    latency_lock(&shard->lock, LATENCY_TABLE_LOCK);
+    migrate(shard, MIGRATE_STEP);
+    AllocationEntry* slot = probe(&shard->current, addr);
+    if (!slot) slot = probe(&shard->previous, addr);
+    if (slot) {
+        if (removed) *removed = *slot;
+        if (shard->cut_pending && slot->epoch != table_epoch) departed_visitor(slot, departed_arg);
+        slot->addr = TOMBSTONE;
+        shard->live--;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (slot) atomic_fetch_sub_explicit(&live_total, 1, memory_order_relaxed);
+    return slot != NULL;
+}
+
+/**
+ * @brief Copies the entry for addr without removing it.
+ *
+ * @return 1 if addr is tracked, 0 otherwise.
+ */
+int alloc_table_find(const void* addr, AllocationEntry* found) {
+    TableShard* shard = shard_for(addr);
+
+    latency_lock(&shard->lock, LATENCY_TABLE_LOCK);
+    const AllocationEntry* slot = probe(&shard->current, addr);
+    if (!slot) slot = probe(&shard->previous, addr);
+    if (slot && found) *found = *slot;
+    pthread_mutex_unlock(&shard->lock);
+
+    return slot != NULL;
+}
+
+static int visit_array(const SlotArray* array, const AllocationVisitor visitor, void* arg) {
+    if (!array->slots) return 0;
+
+    const size_t capacity = capacity_of(array);
+    for (size_t i = 0; i < capacity; i++) {
+        const AllocationEntry* slot = &array->slots[i];
+        if (slot->addr == NULL || slot->addr == TOMBSTONE) continue;
+        if (visitor(slot, arg)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Calls visitor for every live entry, locking one shard at a time.
+ *
+ * The walk is not a global snapshot: other shards keep changing while one is visited.
+ *
+ * @return 1 if the visitor stopped the walk, 0 otherwise.
+ */
+int alloc_table_for_each(const AllocationVisitor visitor, void* arg) {
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        TableShard* shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        const int stopped = visit_array(&shard->current, visitor, arg) ||
+                            visit_array(&shard->previous, visitor, arg);
+        pthread_mutex_unlock(&shard->lock);
+        if (stopped) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief alloc_table_for_each() for a caller holding every shard lock (see
+ * alloc_table_lock_all()), so the walk is a global snapshot. Takes no lock.
+ */
+int alloc_table_for_each_locked(const AllocationVisitor visitor, void* arg) {
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        if (visit_array(&shards[i].current, visitor, arg) || visit_array(&shards[i].previous, visitor, arg)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Number of live tracked allocations.
+ */
+size_t alloc_table_count(void) {
+    return atomic_load_explicit(&live_total, memory_order_relaxed);
+}
+
+/**
+ * @brief Starts a cut: the entries live right now, to be walked with
+ * alloc_table_for_each_cut(). Holds every shard lock only while it starts a new epoch.
+ *
+ * Until the walk reaches its shard, an entry of the cut that is removed is passed to
+ * `departed` first, on the removing thread and under the shard lock, so it must be quick
+ * and must not touch the table. Callers run one cut at a time.
+ *
+ * @return Number of entries in the cut.
+ */
+size_t alloc_table_begin_cut(const AllocationVisitor departed, void* arg) {
+    alloc_table_lock_all();
+    table_epoch++;
+    departed_visitor = departed;
+    departed_arg = arg;
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) shards[i].cut_pending = 1;
+    const size_t count = atomic_load_explicit(&live_total, memory_order_relaxed);
+    alloc_table_unlock_all();
+    return count;
+}
+
+static void visit_cut(const SlotArray* array, const AllocationVisitor visitor, void* arg) {
+    if (!array->slots) return;
+
+    const size_t capacity = capacity_of(array);
+    for (size_t i = 0; i < capacity; i++) {
+        const AllocationEntry* slot = &array->slots[i];
+        if (slot->addr != NULL && slot->addr != TOMBSTONE && slot->epoch != table_epoch) visitor(slot, arg);
+    }
+}
+
+/**
+ * @brief Calls visitor for every entry of the cut still in the table, one shard at a time,
+ * which ends the cut. The visitor's return value is ignored.
+ */
+void alloc_table_for_each_cut(const AllocationVisitor visitor, void* arg) {
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        TableShard* shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        visit_cut(&shard->current, visitor, arg);
+        visit_cut(&shard->previous, visitor, arg);
+        shard->cut_pending = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * @brief Takes every shard lock, freezing the table until alloc_table_unlock_all().
+ */
+void alloc_table_lock_all(void) {
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) pthread_mutex_lock(&shards[i].lock);
+}
+
+void alloc_table_unlock_all(void) {
+    for (unsigned int i = SHARD_COUNT; i-- > 0;) pthread_mutex_unlock(&shards[i].lock);
+}
+
+/**
+ * @brief pthread_atfork() prepare handler: takes every shard lock, so the child gets a
+ * consistent copy of the table (see inherit.c).
+ */
+void alloc_table_fork_prepare(void) {
+    alloc_table_lock_all();
+}
+
+void alloc_table_fork_parent(void) {
+    alloc_table_unlock_all();
+}
+
+static void mute_array(const SlotArray* array) {
+    if (!array->slots) return;
+
+    const size_t capacity = capacity_of(array);
+    for (size_t i = 0; i < capacity; i++) {
+        AllocationEntry* slot = &array->slots[i];
+        if (slot->addr != NULL && slot->addr != TOMBSTONE) slot->muted = 1;
+    }
+}
+
+/**
+ * @brief pthread_atfork() child handler: mutes every inherited block, so the child only
+ * reports blocks of its own. Inherited blocks stay tracked and can still be freed. A cut
+ * the parent was walking does not continue in the child.
+ */
+void alloc_table_fork_child(void) {
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        mute_array(&shards[i].current);
+        mute_array(&shards[i].previous);
+        shards[i].cut_pending = 0;  // the walking thread stayed in the parent
+    }
+    alloc_table_fork_parent();
+}
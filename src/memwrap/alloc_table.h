@@ -0,0 +1,59 @@
+#ifndef ALLOC_TABLE_H
+#define ALLOC_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file alloc_table.h
+ * @brief Sharded, incrementally resized hash table of live tracked allocations.
+ */
+
+typedef enum {
+    BLOCK_MMAP,  // own mapping: base..base+allocated_size, guard page last
+    BLOCK_SLAB,  // slab cell: data pages base..base+allocated_size, guard page right after
+    BLOCK_CANARY // real allocator block: redzones around the data, no guard page (see canary.c)
+} BlockKind;
+
+typedef enum {
+    FAMILY_MALLOC,     // malloc, calloc, realloc and the aligned variants
+    FAMILY_NEW,        // operator new
+    FAMILY_NEW_ARRAY   // operator new[]
+} AllocFamily;
+
+typedef struct {
+    void* addr;             // pointer handed to the application
+    void* base;             // start of the backing pages
+    size_t requested_size;
+    size_t allocated_size;
+    BlockKind kind;
+    AllocFamily family;
+    uint32_t stack_id;      // allocation site in the stack depot, 0 if not captured
+    uint32_t muted;         // lifetime events left out: filtered (see filter.c) or inherited over fork()
+    uint32_t thread;        // kernel id of the allocating thread
+    uint32_t epoch;         // set by the table: cut the entry was inserted after (see alloc_table_begin_cut())
+    int64_t allocated_ns;   // CLOCK_MONOTONIC allocation time
+    uint64_t weight;        // bytes the block stands for if the sampling mode picked it, 0 otherwise
+} AllocationEntry;
+
+/**
+ * @brief Callback for alloc_table_for_each(). Return non-zero to stop the walk.
+ */
+typedef int (*AllocationVisitor)(const AllocationEntry* entry, void* arg);
+
+unsigned long hash_ptr(const void* ptr, unsigned int bits);
+int alloc_table_insert(const AllocationEntry* entry);
+int alloc_table_remove(const void* addr, AllocationEntry* removed);
+int alloc_table_find(const void* addr, AllocationEntry* found);
+int alloc_table_for_each(AllocationVisitor visitor, void* arg);
+int alloc_table_for_each_locked(AllocationVisitor visitor, void* arg);
+size_t alloc_table_count(void);
+size_t alloc_table_begin_cut(AllocationVisitor departed, void* arg);
+void alloc_table_for_each_cut(AllocationVisitor visitor, void* arg);
+void alloc_table_lock_all(void);
+void alloc_table_unlock_all(void);
+void alloc_table_fork_prepare(void);
+void alloc_table_fork_parent(void);
+void alloc_table_fork_child(void);
+
+#endif
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "canary.h"
+#include "memwrap.h"
+#include "quarantine.h"
+
+#define REDZONE 16
+#define CANARY_BYTE 0xca
+#define POISON_BYTE 0xdb
+#define DEFAULT_SCAN_MS 1000
+
+/**
+ * @file canary.c
+ * @brief Cheap corruption detection for blocks too small to deserve a guard page.
+ *
+ * With MAPD_CANARY=1, test mode serves tracked requests below GUARD_THRESHOLD from the real
+ * allocator, framed by a REDZONE-byte head and a tail of at least REDZONE bytes filled with
+ * CANARY_BYTE:
+ *
+ *     base: [ head redzone | user data | tail redzone, padding to 16 ]
+ *
+ * free() and realloc() verify both redzones and report a damaged one as a buffer overflow.
+ * The freed block is then filled with POISON_BYTE and goes through the quarantine, which
+ * defers its reuse; when it is evicted, a changed poison byte is reported as a dangling
+ * pointer write. A scanner thread re-checks every live block and every quarantined block
+ * each MAPD_CANARY_SCAN_MS milliseconds (default 1000, 0 disables it), so corruption is
+ * also found in blocks that are never freed; a last scan runs at exit. Damage is repaired
+ * once reported, so each corruption is reported once.
+ *
+ * Unlike guard pages this misses reads and only notices writes after the fact, but costs
+ * no mapping or system call per allocation.
+ */
+
+static int enabled = 0;
+static unsigned int scan_interval_ms = DEFAULT_SCAN_MS;
+
+int canary_enabled(void) {
+    return enabled;
+}
+
+static size_t tail_size(const AllocationEntry* entry) {
+    return entry->allocated_size - REDZONE - entry->requested_size;
+}
+
+/**
+ * @brief Whether all `length` bytes at p equal `value`.
+ */
+static int filled_with(const unsigned char* p, const size_t length, const unsigned char value) {
+    for (size_t i = 0; i < length; i++) {
+        if (p[i] != value) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks both redzones, reporting and repairing them if damaged.
+ *
+ * @return 1 if they were intact.
+ */
+static int check_redzones(const AllocationEntry* entry) {
+    unsigned char* head = entry->base;
+    unsigned char* tail = (unsigned char*)entry->addr + entry->requested_size;
+    if (filled_with(head, REDZONE, CANARY_BYTE) && filled_with(tail, tail_size(entry), CANARY_BYTE)) return 1;
+
+    send_stack_event(EVENT_BUFFER_OVERFLOW, entry->addr, entry->requested_size, entry->stack_id);
+    memset(head, CANARY_BYTE, REDZONE);
+    memset(tail, CANARY_BYTE, tail_size(entry));
+    return 0;
+}
+
+/**
+ * @brief Checks the poison of a freed block, reporting and restoring it if changed.
+ */
+static void check_poison(const AllocationEntry* entry) {
+    if (filled_with(entry->addr, entry->requested_size, POISON_BYTE)) return;
+
+    send_stack_event(EVENT_DANGLING_POINTER, entry->addr, entry->requested_size, entry->stack_id);
+    memset(entry->addr, POISON_BYTE, entry->requested_size);
+}
+
+/**
+ * @brief Whether ptr points into a canary block rather than into memory of the real
+ * allocator. An intact head redzone settles it, since a chunk header of the real
+ * allocator never reads as one; a block whose head was overwritten is looked up.
+ */
+int canary_owns(const void* ptr) {
+    if (!enabled || ((uintptr_t)ptr & 15) != 0) return 0;
+    if (filled_with((const unsigned char*)ptr - REDZONE, REDZONE, CANARY_BYTE)) return 1;
+
+    AllocationEntry entry;
+    return alloc_table_find(ptr, &entry) && entry.kind == BLOCK_CANARY;
+}
+
+/**
+ * @brief Allocates a redzoned block from the real allocator and fills in the entry.
+ *
+ * @param zero Whether the user data must read as zero.
+ * @return The user pointer, 16-byte aligned, or NULL.
+ */
+void* canary_alloc(const size_t size, const int zero, AllocationEntry* entry) {
+    const size_t total = REDZONE + ((size + 15) & ~(size_t)15) + REDZONE;
+    unsigned char* base = heap_alloc(total);
+    if (!base) return NULL;
+
+    entry->base = base;
+    entry->allocated_size = total;
+    entry->kind = BLOCK_CANARY;
+    memset(base, CANARY_BYTE, REDZONE);
+    memset(base + REDZONE + size, CANARY_BYTE, total - REDZONE - size);
+    if (zero) memset(base + REDZONE, 0, size);
+    return base + REDZONE;
+}
+
+/**
+ * @brief Verifies the redzones of a block being freed and poisons its data.
+ */
+void canary_retire(const AllocationEntry* entry) {
+    check_redzones(entry);
+    memset(entry->addr, POISON_BYTE, entry->requested_size);
+}
+
+/**
+ * @brief Gives a block evicted from the quarantine back to the real allocator, after
+ * checking that nothing wrote to it while it was freed.
+ */
+void canary_release(const AllocationEntry* entry) {
+    check_poison(entry);
+    heap_free(entry->base);
+}
+
+/**
+ * @brief Frees a block that was never handed to the application.
+ */
+void canary_discard(const AllocationEntry* entry) {
+    heap_free(entry->base);
+}
+
+static int scan_live(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (entry->kind == BLOCK_CANARY) check_redzones(entry);
+    return 0;
+}
+
+static int scan_freed(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (entry->kind == BLOCK_CANARY) check_poison(entry);
+    return 0;
+}
+
+/**
+ * @brief Checks every live and every quarantined canary block.
+ */
+void canary_scan(void) {
+    if (!enabled) return;
+    alloc_table_for_each(scan_live, NULL);
+    quarantine_for_each(scan_freed, NULL);
+}
+
+static void* scanner_main(void* arg __attribute__((unused))) {
+    while (1) {
+        usleep(scan_interval_ms * 1000);
+        canary_scan();
+    }
+    return NULL;
+}
+
+static void start_scanner(void) {
+    if (scan_interval_ms == 0) return;
+
+    pthread_t scanner;
+    if (pthread_create(&scanner, NULL, scanner_main, NULL) == 0) {
+        pthread_setname_np(scanner, "mapd-canary");
+        pthread_detach(scanner);
+    }
+}
+
+/**
+ * @brief Reads MAPD_CANARY and MAPD_CANARY_SCAN_MS and starts the scanner thread.
+ */
+void canary_init(void) {
+    const char* env = getenv("MAPD_CANARY");
+    if (!env || strcmp(env, "1") != 0) return;
+    enabled = 1;
+
+    const char* scan_env = getenv("MAPD_CANARY_SCAN_MS");
+    if (scan_env) scan_interval_ms = (unsigned int)strtoul(scan_env, NULL, 10);
+    start_scanner();
+}
+
+/**
+ * @brief pthread_atfork() child handler: the scanner thread did not survive the fork.
+ */
+void canary_fork_child(void) {
+    if (enabled) start_scanner();
+}
@@ -0,0 +1,22 @@
+#ifndef CANARY_H
+#define CANARY_H
+
+#include <stddef.h>
+#include "alloc_table.h"
+
+/**
+ * @file canary.h
+ * @brief Heap blocks with canary redzones and poison-on-free for small tracked allocations.
+ */
+
+void canary_init(void);
+int canary_enabled(void);
+int canary_owns(const void* ptr);
+void* canary_alloc(size_t size, int zero, AllocationEntry* entry);
+void canary_retire(const AllocationEntry* entry);
+void canary_release(const AllocationEntry* entry);
+void canary_discard(const AllocationEntry* entry);
+void canary_scan(void);
+void canary_fork_child(void);
+
+#endif
@@ -0,0 +1,69 @@
+#include "control.h"
+#include "memwrap.h"
+#include "transport.h"
+#include "sample.h"
+#include "stack.h"
+#include "guard_pool.h"
+#include "canary.h"
+#include "filter.h"
+#include "tracking.h"
+#include "leak_scan.h"
+#include "snapshot.h"
+#include "latency.h"
+
+/**
+ * @file control.c
+ * @brief Retunes a running wrapper on request of the analyzer.
+ *
+ * Commands arrive as FRAME_CONTROL frames on the analyzer socket and are applied by the
+ * transport's reader thread, so they take effect while the application keeps running.
+ * Settings only affect allocations made from then on; blocks already handed out keep the
+ * layout they were allocated with.
+ */
+
+/**
+ * @brief Applies one control command. Unknown commands are ignored.
+ */
+void control_apply(const ControlFrame* frame) {
+    switch (frame->command) {
+        case CONTROL_SET_MODE:
+            switch_mode((ControlMode)frame->value);
+            break;
+        case CONTROL_SET_SAMPLE_BYTES:
+            sample_set_mean(frame->value);
+            break;
+        case CONTROL_SET_STACK_DEPTH:
+            stack_set_depth(frame->value > PROTOCOL_MAX_STACK_DEPTH ? PROTOCOL_MAX_STACK_DEPTH : (int)frame->value);
+            break;
+        case CONTROL_SET_GUARD_RATE:
+            guard_pool_set_rate(frame->value);
+            break;
+        case CONTROL_SET_EVENT_MASK:
+            filter_set_event_mask(frame->value);
+            break;
+        case CONTROL_SET_TRACKING:
+            tracking_switch(frame->value != 0);
+            break;
+        case CONTROL_SNAPSHOT:
+            if (frame->value == CONTROL_SNAPSHOT_FILE) {
+                snapshot_write();
+                break;
+            }
+            report_live_blocks();
+            transport_flush();
+            break;
+        case CONTROL_SCAN:
+            canary_scan();
+            transport_flush();
+            break;
+        case CONTROL_LEAK_SCAN:
+            leak_scan_run();
+            transport_flush();
+            break;
+        case CONTROL_SET_LATENCY:
+            latency_set_interval(frame->value);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "protocol.h"
+
+/**
+ * @file control.h
+ * @brief Applies commands the analyzer sends over the control channel.
+ */
+
+void control_apply(const ControlFrame* frame);
+
+#endif
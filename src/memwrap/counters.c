@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "counters.h"
+#include "counters_page.h"
+#include "leak_scan.h"
+
+#define MAX_COUNTER_THREADS 256
+
+/**
+ * @file counters.c
+ * @brief Counts allocations, frees and bytes per size class in a page shared with the analyzer.
+ *
+ * At start-up the wrapper maps a CountersPage (see counters_page.h) from a memfd, which the
+ * transport passes to binary analyzers after the handshake (see transport.c). Every tracked
+ * and untracked allocation and free of the program is counted there in every mode but perf,
+ * so dashboards can follow the heap without a single event; MAPD_MODE=count does nothing
+ * else and sends every allocation to the real allocator. Blocks of the real allocator are
+ * counted with their usable size, tracked blocks with their requested size. Blocks allocated
+ * while counting was paused are still counted when freed, so switching into or out of perf
+ * mode at runtime skews the live bytes. MAPD_COUNTERS=0 turns the page off.
+ *
+ * A thread claims one of MAX_COUNTER_THREADS slots on its first allocation and then writes
+ * it alone, with plain loads and stores. Once all are taken, a new thread takes over the slot
+ * of a thread that has exited, after folding its counts into slot 0; threads that find none
+ * count into slot 0 directly with atomic additions. Exits are noticed by probing the thread
+ * id, as in latency.c.
+ */
+
+int counters_active = 0;
+static int counters_paused = 0;
+static CountersPage* page = NULL;
+static size_t page_size = 0;
+static int page_fd = -1;
+static pthread_mutex_t claim_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread CounterSlot* thread_slot __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread int thread_shared __attribute__((tls_model("initial-exec"))) = 0;
+
+/**
+ * @brief Creates and maps a memfd-backed page; sets page, page_size and page_fd.
+ *
+ * @return 0 on success, -1 if the page could not be created.
+ */
+static int create_page(void) {
+    const uint32_t slot_count = MAX_COUNTER_THREADS + 1;
+    const size_t size = counters_page_size(slot_count);
+
+    const int fd = memfd_create("mapd_counters", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) return -1;
+    // The analyzer refuses a page whose size can still change
+    if (ftruncate(fd, (off_t)size) == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    page = mapping;
+    page_size = size;
+    page_fd = fd;
+    counters_page_init(page, slot_count, (uint32_t)getpid());
+    leak_scan_ignore(mapping, size);
+    return 0;
+}
+
+static void update_active(void) {
+    __atomic_store_n(&counters_active, page != NULL && !counters_paused, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Whether the owner of a claimed slot has exited.
+ */
+static int owner_exited(const CounterSlot* slot) {
+    const pid_t owner = (pid_t)atomic_load_explicit(&slot->owner, memory_order_relaxed);
+    return syscall(SYS_tgkill, getpid(), owner, 0) == -1 && errno == ESRCH;
+}
+
+/**
+ * @brief Moves `bytes` of a thread's live bytes into the page total and raises the peak.
+ */
+static void flush_live(const int64_t bytes) {
+    const int64_t live = atomic_fetch_add_explicit(&page->live_bytes, bytes, memory_order_relaxed) + bytes;
+    int64_t peak = atomic_load_explicit(&page->peak_live_bytes, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&page->peak_live_bytes, &peak, live,
+                                                  memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+/**
+ * @brief Folds the slot of an exited thread into slot 0 and hands it to the caller.
+ * Caller holds claim_lock.
+ */
+static void recycle_slot(CounterSlot* slot, const uint32_t owner) {
+    CounterSlot* retired = &page->slots[0];
+
+    // Readers retry while the generation is odd
+    atomic_fetch_add_explicit(&page->generation, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int c = 0; c < COUNTERS_SIZE_CLASSES; c++) {
+        atomic_fetch_add_explicit(&retired->allocs[c], atomic_exchange(&slot->allocs[c], 0), memory_order_relaxed);
+        atomic_fetch_add_explicit(&retired->frees[c], atomic_exchange(&slot->frees[c], 0), memory_order_relaxed);
+        atomic_fetch_add_explicit(&retired->alloc_bytes[c], atomic_exchange(&slot->alloc_bytes[c], 0),
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&retired->free_bytes[c], atomic_exchange(&slot->free_bytes[c], 0),
+                                  memory_order_relaxed);
+    }
+    flush_live(atomic_exchange(&slot->unflushed, 0));
+    atomic_store_explicit(&slot->owner, owner, memory_order_relaxed);
+    atomic_fetch_add_explicit(&page->generation, 1, memory_order_release);
+}
+
+/**
+ * @brief Returns the calling thread's slot, claiming one on first use; slot 0 when all
+ * are taken by live threads.
+ */
+static CounterSlot* slot_for_thread(void) {
+    if (__builtin_expect(thread_slot != NULL, 1)) return thread_slot;
+
+    const uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    atomic_fetch_add_explicit(&page->threads_seen, 1, memory_order_relaxed);
+    for (uint32_t i = 1; i < page->slot_count; i++) {
+        uint32_t expected = 0;
+        if (atomic_compare_exchange_strong(&page->slots[i].owner, &expected, tid)) {
+            thread_slot = &page->slots[i];
+            return thread_slot;
+        }
+    }
+
+    pthread_mutex_lock(&claim_lock);
+    for (uint32_t i = 1; i < page->slot_count && !thread_slot; i++) {
+        if (owner_exited(&page->slots[i])) {
+            recycle_slot(&page->slots[i], tid);
+            thread_slot = &page->slots[i];
+        }
+    }
+    pthread_mutex_unlock(&claim_lock);
+
+    if (!thread_slot) {
+        thread_slot = &page->slots[0];
+        thread_shared = 1;
+    }
+    return thread_slot;
+}
+
+static void bump(_Atomic uint64_t* counter, const uint64_t by) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts an allocation, or a free if `freed` is set, of a block of `size` bytes.
+ * Called through counters_alloc() and counters_free().
+ */
+void counters_add(const size_t size, const int freed) {
+    CounterSlot* slot = slot_for_thread();
+    const unsigned size_class = counters_size_class(size);
+    const int64_t delta = freed ? -(int64_t)size : (int64_t)size;
+
+    if (__builtin_expect(thread_shared, 0)) {
+        atomic_fetch_add_explicit(freed ? &slot->frees[size_class] : &slot->allocs[size_class], 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(freed ? &slot->free_bytes[size_class] : &slot->alloc_bytes[size_class], size,
+                                  memory_order_relaxed);
+        flush_live(delta);
+        return;
+    }
+
+    bump(freed ? &slot->frees[size_class] : &slot->allocs[size_class], 1);
+    bump(freed ? &slot->free_bytes[size_class] : &slot->alloc_bytes[size_class], size);
+    const int64_t unflushed = atomic_load_explicit(&slot->unflushed, memory_order_relaxed) + delta;
+    if (unflushed >= COUNTERS_FLUSH_BYTES || unflushed <= -COUNTERS_FLUSH_BYTES) {
+        flush_live(unflushed);
+        atomic_store_explicit(&slot->unflushed, 0, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(&slot->unflushed, unflushed, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Stops counting while the wrapper runs in perf mode.
+ */
+void counters_set_paused(const int paused) {
+    counters_paused = paused;
+    update_active();
+}
+
+/**
+ * @brief memfd of the page, for the transport to pass on; -1 if there is none.
+ */
+int counters_fd(void) {
+    return page_fd;
+}
+
+size_t counters_size(void) {
+    return page_size;
+}
+
+/**
+ * @brief Maps the page unless MAPD_COUNTERS=0.
+ */
+void counters_init(void) {
+    const char* env = getenv("MAPD_COUNTERS");
+    if (env && strcmp(env, "0") == 0) return;
+    if (create_page() == 0) update_active();
+}
+
+/**
+ * @brief pthread_atfork() child handler: the parent's page is shared with it, so the child
+ * moves to a page of its own that starts from the parent's counts, as it inherited the
+ * parent's heap. Runs before anything else in the child allocates.
+ */
+void counters_fork_child(void) {
+    pthread_mutex_init(&claim_lock, NULL);
+    thread_slot = NULL;
+    thread_shared = 0;
+    if (!page) return;
+
+    CountersPage* const inherited = page;
+    const size_t inherited_size = page_size;
+    close(page_fd);
+    leak_scan_unignore(inherited);
+    page = NULL;
+    page_size = 0;
+    page_fd = -1;
+
+    CountersTotals totals;
+    const int readable = counters_page_read(inherited, inherited->slot_count, &totals) == 0;
+    if (create_page() == 0 && readable) {
+        CounterSlot* retired = &page->slots[0];
+        for (int c = 0; c < COUNTERS_SIZE_CLASSES; c++) {
+            atomic_store(&retired->allocs[c], totals.allocs[c]);
+            atomic_store(&retired->frees[c], totals.frees[c]);
+            atomic_store(&retired->alloc_bytes[c], totals.alloc_bytes[c]);
+            atomic_store(&retired->free_bytes[c], totals.free_bytes[c]);
+        }
+        atomic_store(&page->live_bytes, totals.live_bytes);
+        atomic_store(&page->peak_live_bytes, totals.peak_live_bytes);
+    }
+    munmap(inherited, inherited_size);
+    update_active();  // off if the new page could not be created
+}
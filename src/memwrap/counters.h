@@ -0,0 +1,35 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stddef.h>
+
+/**
+ * @file counters.h
+ * @brief Live allocation counters in a shared-memory page the analyzer reads directly.
+ */
+
+extern int counters_active;
+
+void counters_init(void);
+void counters_set_paused(int paused);
+int counters_fd(void);
+size_t counters_size(void);
+void counters_add(size_t size, int freed);
+void counters_fork_child(void);
+
+/**
+ * @brief Counts a block of `size` bytes handed to the program. Costs a load and a branch
+ * while counting is off.
+ */
+static inline void counters_alloc(const size_t size) {
+    if (__builtin_expect(counters_active, 1)) counters_add(size, 0);
+}
+
+/**
+ * @brief Counts a block of `size` bytes given back by the program.
+ */
+static inline void counters_free(const size_t size) {
+    if (__builtin_expect(counters_active, 1)) counters_add(size, 1);
+}
+
+#endif
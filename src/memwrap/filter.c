@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <link.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "filter.h"
+#include "stack.h"
+
+#define MAX_SITE_RANGES 64
+
+/**
+ * @file filter.c
+ * @brief Event filters the analyzer pushes down to the wrapper (see FilterFrame).
+ *
+ * Filtering here rather than in the analyzer saves formatting, the socket write and the
+ * analyzer's parse of every event nobody looks at. Two filters apply:
+ *  - the event mask (CONTROL_SET_EVENT_MASK) drops whole event types in send_stack_event();
+ *  - the block filter (FRAME_FILTER, or MAPD_FILTER_MIN_SIZE, MAPD_FILTER_MAX_SIZE and a
+ *    comma-separated MAPD_FILTER_ALLOW or MAPD_FILTER_DENY at start-up) mutes the lifetime
+ *    events of blocks by size and allocation site.
+ *
+ * The block filter is decided once per block, when it is allocated, and remembered in its
+ * AllocationEntry, so a malloc and its free, leak or snapshot report are always kept or
+ * dropped together. The site is only looked up while a site list is set.
+ *
+ * Site names are resolved to address ranges when the filter is set, so checking a block
+ * is a walk to the first caller outside the wrapper and a few compares. Each filter lives
+ * in a mapping of its own and is published with one pointer store; a replaced filter is
+ * never unmapped, since an allocating thread may still read it, and filters change rarely.
+ */
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} SiteRange;
+
+typedef struct {
+    uint64_t min_size;
+    uint64_t max_size;
+    FilterSitePolicy policy;
+    int range_count;
+    SiteRange ranges[MAX_SITE_RANGES];
+} BlockFilter;
+
+typedef struct {
+    const char* name;     // module name, matched as a substring
+    size_t name_length;
+    int whole_module;
+    uint64_t low;         // file offsets, if !whole_module
+    uint64_t high;
+    BlockFilter* filter;
+} SiteQuery;
+
+static atomic_ullong event_mask = ~0ull;
+static _Atomic(BlockFilter*) active = NULL;
+
+/**
+ * @brief Sets the event types to send, one bit (1 << EventType) per type.
+ */
+void filter_set_event_mask(const uint64_t mask) {
+    atomic_store_explicit(&event_mask, mask, memory_order_relaxed);
+}
+
+int filter_accepts_type(const EventType type) {
+    return (atomic_load_explicit(&event_mask, memory_order_relaxed) >> type) & 1;
+}
+
+static const char* module_name(const struct dl_phdr_info* info) {
+    const char* path = info->dlpi_name[0] ? info->dlpi_name : program_invocation_name;
+    const char* base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+/**
+ * @brief dl_iterate_phdr() callback adding the executable segments a site entry names.
+ */
+static int add_site_ranges(struct dl_phdr_info* info, size_t size __attribute__((unused)), void* arg) {
+    SiteQuery* query = arg;
+    const char* name = module_name(info);
+    if (!memmem(name, strlen(name), query->name, query->name_length)) return 0;
+
+    BlockFilter* filter = query->filter;
+    for (int i = 0; i < info->dlpi_phnum && filter->range_count < MAX_SITE_RANGES; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) continue;
+
+        const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        // File offsets p_offset.. of the segment are mapped from start on
+        uint64_t low = phdr->p_offset;
+        uint64_t high = phdr->p_offset + phdr->p_memsz;
+        if (!query->whole_module) {
+            if (query->low > low) low = query->low;
+            if (query->high < high) high = query->high;
+            if (low >= high) continue;
+        }
+        filter->ranges[filter->range_count++] =
+            (SiteRange){ start + (low - phdr->p_offset), start + (high - phdr->p_offset) };
+    }
+    return 0;
+}
+
+/**
+ * @brief Resolves one site entry, "module" or "module+0xlow-0xhigh", into address ranges.
+ */
+static void resolve_site(BlockFilter* filter, const char* site) {
+    SiteQuery query = { .name = site, .whole_module = 1, .filter = filter };
+    const char* plus = strchr(site, '+');
+    query.name_length = plus ? (size_t)(plus - site) : strlen(site);
+    if (plus) {
+        char* dash;
+        query.low = strtoull(plus + 1, &dash, 16);
+        query.high = *dash == '-' ? strtoull(dash + 1, NULL, 16) : query.low + 1;
+        query.whole_module = 0;
+        if (query.high <= query.low) return;
+    }
+    if (query.name_length > 0) dl_iterate_phdr(add_site_ranges, &query);
+}
+
+/**
+ * @brief Replaces the block filter. A frame that lets every block through removes it.
+ *
+ * Called at start-up and from the control thread.
+ */
+void filter_apply(const FilterFrame* frame) {
+    const int by_site = frame->site_policy == FILTER_SITES_ALLOW || frame->site_policy == FILTER_SITES_DENY;
+    if (frame->min_size == 0 && frame->max_size == 0 && !by_site) {
+        atomic_store_explicit(&active, NULL, memory_order_release);
+        return;
+    }
+
+    BlockFilter* filter = mmap(NULL, sizeof(BlockFilter), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (filter == MAP_FAILED) return;
+    filter->min_size = frame->min_size;
+    filter->max_size = frame->max_size;
+    filter->policy = by_site ? (FilterSitePolicy)frame->site_policy : FILTER_SITES_ANY;
+
+    const int count = frame->site_count < PROTOCOL_MAX_FILTER_SITES ? frame->site_count : PROTOCOL_MAX_FILTER_SITES;
+    for (int i = 0; i < count && by_site; i++) {
+        char site[PROTOCOL_FILTER_SITE_LENGTH];
+        memcpy(site, frame->sites[i], sizeof(site));
+        site[sizeof(site) - 1] = '\0';
+        resolve_site(filter, site);
+    }
+    atomic_store_explicit(&active, filter, memory_order_release);
+}
+
+/**
+ * @brief Reads the start-up block filter from the environment.
+ */
+void filter_init(void) {
+    FilterFrame frame = {0};
+    const char* min_env = getenv("MAPD_FILTER_MIN_SIZE");
+    const char* max_env = getenv("MAPD_FILTER_MAX_SIZE");
+    const char* allow_env = getenv("MAPD_FILTER_ALLOW");
+    const char* deny_env = getenv("MAPD_FILTER_DENY");
+    if (min_env) frame.min_size = strtoull(min_env, NULL, 10);
+    if (max_env) frame.max_size = strtoull(max_env, NULL, 10);
+    if (allow_env) {
+        frame.site_policy = FILTER_SITES_ALLOW;
+        protocol_filter_add_sites(&frame, allow_env);
+    } else if (deny_env) {
+        frame.site_policy = FILTER_SITES_DENY;
+        protocol_filter_add_sites(&frame, deny_env);
+    }
+    filter_apply(&frame);
+}
+
+static int site_listed(const BlockFilter* filter, uintptr_t site) {
+    // Return addresses point after the call; step back into it, as stacks are printed
+    if (site > 0) site--;
+    for (int i = 0; i < filter->range_count; i++) {
+        if (site >= filter->ranges[i].start && site < filter->ranges[i].end) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether the lifetime events of a block being allocated are to be left out.
+ * Called from the allocating thread, so the site is its caller.
+ */
+int filter_mutes_block(const size_t size) {
+    const BlockFilter* filter = atomic_load_explicit(&active, memory_order_acquire);
+    if (!filter) return 0;
+    if (size < filter->min_size || (filter->max_size && size > filter->max_size)) return 1;
+    if (filter->policy == FILTER_SITES_ANY) return 0;
+
+    const int listed = site_listed(filter, stack_call_site());
+    return filter->policy == FILTER_SITES_ALLOW ? !listed : listed;
+}
@@ -0,0 +1,19 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/**
+ * @file filter.h
+ * @brief Decides in the wrapper which events are sent, before any record is built.
+ */
+
+void filter_init(void);
+void filter_set_event_mask(uint64_t mask);
+int filter_accepts_type(EventType type);
+void filter_apply(const FilterFrame* frame);
+int filter_mutes_block(size_t size);
+
+#endif
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "guard_pool.h"
+#include "memwrap.h"
+#include "shadow.h"
+#include "stack.h"
+#include "filter.h"
+#include "counters.h"
+
+#define DEFAULT_GUARD_SLOTS 256
+#define MAX_GUARD_SLOTS 65536
+
+/**
+ * @file guard_pool.c
+ * @brief Always-on, probabilistic overflow and use-after-free detection, GWP-ASan style.
+ *
+ * With MAPD_GUARD_SAMPLE_RATE=N, about one in N allocations that would otherwise go to the
+ * real allocator is placed in this pool instead. The pool is mapped once at start-up as
+ * MAPD_GUARD_SLOTS one-page slots, each followed by a guard page, all PROT_NONE; a slot is
+ * unlocked while it holds a live object, which sits end-aligned against the guard page like
+ * a slab cell. Freed slots are locked again and queued FIFO behind every other free slot, so
+ * a dangling pointer keeps faulting for as long as possible before its slot is reused.
+ *
+ * Slots are entered in the shadow map, so handle_segv() reports faults on them like any
+ * other tracked block. Requests larger than a page, or aligned beyond it, are not sampled,
+ * and allocations simply go to the real allocator while every slot is in use.
+ *
+ * Pool blocks are picked from the allocations the sampling mode left out, so their events
+ * carry no sampling weight and do not count towards the sampled heap estimate.
+ */
+
+typedef enum { SLOT_FREE, SLOT_LIVE, SLOT_FREED } SlotState;
+
+typedef struct {
+    AllocationEntry entry;
+    SlotState state;
+} GuardSlot;
+
+uint32_t guard_pool_rate = 0;
+__thread uint32_t guard_pool_countdown __attribute__((tls_model("initial-exec"))) = 0;
+uintptr_t guard_pool_start = 0;
+uintptr_t guard_pool_end = 0;
+
+static __thread uint64_t rng_state __attribute__((tls_model("initial-exec"))) = 0;
+static size_t pagesize = 0;
+static GuardSlot* slots = NULL;
+static uint32_t* free_ring = NULL;  // slot indices, oldest free first
+static size_t slot_count = 0;
+static size_t ring_head = 0;
+static size_t ring_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Maps MAPD_GUARD_SLOTS slots, once.
+ *
+ * @return 1 if the pool is ready.
+ */
+static int map_pool(void) {
+    if (slots) return 1;
+
+    size_t count = DEFAULT_GUARD_SLOTS;
+    const char* slots_env = getenv("MAPD_GUARD_SLOTS");
+    if (slots_env) count = strtoul(slots_env, NULL, 10);
+    if (count == 0) return 0;
+    if (count > MAX_GUARD_SLOTS) count = MAX_GUARD_SLOTS;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    void* pool = mmap(NULL, 2 * count * pagesize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* meta = mmap(NULL, count * (sizeof(GuardSlot) + sizeof(uint32_t)), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED || meta == MAP_FAILED) {
+        if (pool != MAP_FAILED) munmap(pool, 2 * count * pagesize);
+        if (meta != MAP_FAILED) munmap(meta, count * (sizeof(GuardSlot) + sizeof(uint32_t)));
+        return 0;
+    }
+
+    GuardSlot* fresh = meta;
+    free_ring = (uint32_t*)(fresh + count);
+    for (size_t i = 0; i < count; i++) {
+        fresh[i].entry.base = (char*)pool + 2 * i * pagesize;
+        fresh[i].entry.allocated_size = pagesize;
+        fresh[i].entry.kind = BLOCK_SLAB;  // guard page right after the data, as for slab cells
+        free_ring[i] = (uint32_t)i;
+    }
+    slot_count = ring_count = count;
+    slots = fresh;
+    guard_pool_start = (uintptr_t)pool;
+    guard_pool_end = (uintptr_t)pool + 2 * count * pagesize;
+    return 1;
+}
+
+/**
+ * @brief Reads MAPD_GUARD_SAMPLE_RATE and maps the pool if it is set.
+ */
+void guard_pool_init(void) {
+    const char* rate_env = getenv("MAPD_GUARD_SAMPLE_RATE");
+    if (!rate_env) return;
+    const long rate = atol(rate_env);
+    if (rate > 0) guard_pool_set_rate((uint64_t)rate);
+}
+
+/**
+ * @brief Samples one in `rate` untracked allocations from now on, mapping the pool on
+ * first use; 0 stops sampling. Slots in use stay guarded until they are freed.
+ */
+void guard_pool_set_rate(const uint64_t rate) {
+    if (rate == 0) {
+        guard_pool_rate = 0;
+        return;
+    }
+    if (!map_pool()) return;
+    guard_pool_rate = (uint32_t)(rate > UINT32_MAX / 2 ? UINT32_MAX / 2 : rate);
+}
+
+static uint64_t next_random(void) {
+    if (rng_state == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rng_state = ((uint64_t)syscall(SYS_gettid) << 32) ^ (uint64_t)now.tv_nsec ^ 0x9e3779b97f4a7c15ull;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * @brief Slow path of guard_pool_hit(): draws the next gap, uniform in [1, 2N - 1].
+ *
+ * A thread's first call only arms its countdown.
+ *
+ * @return 1 if this allocation is sampled.
+ */
+int guard_pool_refill(void) {
+    const uint64_t rate = guard_pool_rate;  // may be changed by the control thread meanwhile
+    if (rate == 0) return 0;
+    const int armed = guard_pool_countdown != 0;
+    guard_pool_countdown = 1 + (uint32_t)(next_random() % (2 * rate - 1));
+    return armed;
+}
+
+static GuardSlot* slot_of(const void* ptr) {
+    const size_t index = ((uintptr_t)ptr - guard_pool_start) / (2 * pagesize);
+    return &slots[index];
+}
+
+/**
+ * @brief Places a sampled allocation in a free slot.
+ *
+ * @return The user pointer, or NULL if the request does not fit a slot or none is free.
+ */
+void* guard_pool_alloc(const size_t size, const size_t alignment, const AllocFamily family) {
+    if (size > pagesize || alignment > pagesize) return NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    if (ring_count == 0) {
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    GuardSlot* slot = &slots[free_ring[ring_head]];
+    ring_head = (ring_head + 1) % slot_count;
+    ring_count--;
+    slot->state = SLOT_LIVE;
+    pthread_mutex_unlock(&pool_lock);
+
+    // End-aligned to 16 bytes or the requested alignment, so overflows hit the guard page soon
+    const size_t align = alignment > 16 ? alignment : 16;
+    const uintptr_t end = (uintptr_t)slot->entry.base + pagesize;
+    AllocationEntry* entry = &slot->entry;
+    entry->addr = (void*)((end - size) & ~(uintptr_t)(align - 1));
+    entry->requested_size = size;
+    entry->family = family;
+    entry->stack_id = stack_capture();
+    entry->muted = filter_mutes_block(size);
+
+    mprotect(entry->base, pagesize, PROT_READ | PROT_WRITE);
+    shadow_mark_live(entry);
+    if (!entry->muted) send_weighted_event(EVENT_MALLOC, entry->addr, size, entry->stack_id, 0);
+    return entry->addr;
+}
+
+/**
+ * @brief Releases a pool pointer, reporting double frees and family or size mismatches.
+ *
+ * @param family Allocation API the caller belongs to.
+ * @param size Size passed to a sized delete, UNKNOWN_SIZE otherwise.
+ */
+void guard_pool_free(void* ptr, const AllocFamily family, const size_t size) {
+    GuardSlot* slot = slot_of(ptr);
+
+    pthread_mutex_lock(&pool_lock);
+    // Freed slot, or a pointer the pool never returned (such as a guard page address)
+    if (slot->state != SLOT_LIVE || slot->entry.addr != ptr) {
+        pthread_mutex_unlock(&pool_lock);
+        send_stack_event(EVENT_DOUBLE_FREE, ptr, 0, stack_capture());
+        return;
+    }
+    slot->state = SLOT_FREED;
+    const AllocationEntry entry = slot->entry;
+    pthread_mutex_unlock(&pool_lock);
+    counters_free(entry.requested_size);
+
+    if (entry.family != family || (size != UNKNOWN_SIZE && size != entry.requested_size)) {
+        send_stack_event(EVENT_ALLOC_MISMATCH, ptr, entry.requested_size, stack_capture());
+    }
+    if (!entry.muted) send_weighted_event(EVENT_FREE, ptr, entry.requested_size, 0, 0);
+
+    mprotect(entry.base, pagesize, PROT_NONE);
+    shadow_mark_freed(&entry);
+
+    pthread_mutex_lock(&pool_lock);
+    free_ring[(ring_head + ring_count) % slot_count] = (uint32_t)(slot - slots);
+    ring_count++;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Requested size of a live pool allocation, 0 otherwise.
+ */
+size_t guard_pool_usable_size(const void* ptr) {
+    const GuardSlot* slot = slot_of(ptr);
+    return slot->state == SLOT_LIVE && slot->entry.addr == ptr ? slot->entry.requested_size : 0;
+}
+
+/**
+ * @brief pthread_atfork() prepare handler: holds the slot states still across fork().
+ */
+void guard_pool_fork_prepare(void) {
+    pthread_mutex_lock(&pool_lock);
+}
+
+void guard_pool_fork_parent(void) {
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief pthread_atfork() child handler: mutes the inherited live slots, like
+ * alloc_table_fork_child(), and gives the child its own random sequence.
+ */
+void guard_pool_fork_child(void) {
+    for (size_t i = 0; i < slot_count; i++) {
+        if (slots[i].state == SLOT_LIVE) slots[i].entry.muted = 1;
+    }
+    rng_state = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,48 @@
+#ifndef GUARD_POOL_H
+#define GUARD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "alloc_table.h"
+
+/**
+ * @file guard_pool.h
+ * @brief Preallocated pool of guarded slots for randomly sampled untracked allocations.
+ */
+
+extern uint32_t guard_pool_rate;
+extern __thread uint32_t guard_pool_countdown __attribute__((tls_model("initial-exec")));
+extern uintptr_t guard_pool_start;
+extern uintptr_t guard_pool_end;
+
+void guard_pool_init(void);
+void guard_pool_set_rate(uint64_t rate);
+int guard_pool_refill(void);
+void* guard_pool_alloc(size_t size, size_t alignment, AllocFamily family);
+void guard_pool_free(void* ptr, AllocFamily family, size_t size);
+size_t guard_pool_usable_size(const void* ptr);
+void guard_pool_fork_prepare(void);
+void guard_pool_fork_parent(void);
+void guard_pool_fork_child(void);
+
+/**
+ * @brief Whether the next untracked allocation goes to the pool: roughly one in
+ * MAPD_GUARD_SAMPLE_RATE. Costs a load, a thread-local decrement and a branch.
+ */
+static inline int guard_pool_hit(void) {
+    if (__builtin_expect(guard_pool_rate == 0, 1)) return 0;
+    if (__builtin_expect(guard_pool_countdown > 1, 1)) {
+        guard_pool_countdown--;
+        return 0;
+    }
+    return guard_pool_refill();
+}
+
+/**
+ * @brief Whether ptr lies in the pool, in which case only guard_pool_free() may release it.
+ */
+static inline int guard_pool_owns(const void* ptr) {
+    return (uintptr_t)ptr >= guard_pool_start && (uintptr_t)ptr < guard_pool_end;
+}
+
+#endif
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "memwrap.h"
+#include "inherit.h"
+#include "transport.h"
+#include "alloc_table.h"
+#include "quarantine.h"
+#include "slab.h"
+#include "guard_pool.h"
+#include "canary.h"
+#include "stack.h"
+#include "tracking.h"
+#include "snapshot.h"
+#include "latency.h"
+#include "counters.h"
+
+#define PARENT_ENV "MAPD_PARENT_CLIENT"
+#define PRELOAD_ENV "LD_PRELOAD"
+#define STACK_ENV_BYTES (64 * 1024)
+
+/**
+ * @file inherit.c
+ * @brief Keeps child processes traced, each as a client of its own.
+ *
+ * fork(): the child inherits the parent's connection, ring and tables. A pthread_atfork()
+ * prepare handler takes the table locks so the child gets a consistent copy. The child
+ * handler then leaves the parent's connection and connects again (see
+ * transport_reconnect()), announcing the parent's client id and pid in its hello. Blocks
+ * inherited from the parent stay tracked but are muted, so the child only reports its own.
+ * The helper threads are restarted, and the child counts into a counters page of its own that
+ * starts from the parent's counts. MAPD_FOLLOW_FORK=0 leaves children disconnected.
+ *
+ * exec(): the exec functions make sure the new program preloads this library, even when the
+ * caller passes an environment of its own. That environment also gets the MAPD_* settings
+ * it lacks, and MAPD_PARENT_CLIENT="<client>:<pid>" naming the calling client. Pending
+ * events are flushed first. posix_spawn() and posix_spawnp() are handled the same way.
+ * MAPD_FOLLOW_EXEC=0 passes environments through unchanged. Children started by glibc
+ * itself (system(), popen()) inherit `environ` as it is.
+ *
+ * exec() is often called in the child of a vfork(), which shares the parent's memory and
+ * must not take a lock another thread of the parent may hold. The exec functions therefore
+ * build the environment on the stack, or in a mapping when it is too large for that, and
+ * only flush pending events when the caller is not such a child.
+ */
+
+static int follow_fork = 1;
+static int follow_exec = 1;
+static const char* library_path = NULL;
+static const char* library_name = NULL;
+static pid_t own_pid = 0;  // differs from getpid() in the child of a vfork()
+
+static int (*real_execve)(const char*, char* const[], char* const[]) = NULL;
+static int (*real_execvpe)(const char*, char* const[], char* const[]) = NULL;
+static int (*real_posix_spawn)(pid_t*, const char*, const posix_spawn_file_actions_t*, const posix_spawnattr_t*,
+                               char* const[], char* const[]) = NULL;
+static int (*real_posix_spawnp)(pid_t*, const char*, const posix_spawn_file_actions_t*, const posix_spawnattr_t*,
+                                char* const[], char* const[]) = NULL;
+
+static void fork_prepare(void) {
+    slab_fork_prepare();
+    guard_pool_fork_prepare();
+    quarantine_fork_prepare();
+    alloc_table_fork_prepare();
+}
+
+static void fork_parent(void) {
+    alloc_table_fork_parent();
+    quarantine_fork_parent();
+    guard_pool_fork_parent();
+    slab_fork_parent();
+}
+
+static void fork_child(void) {
+    own_pid = getpid();
+    counters_fork_child();  // first: the parent's page is still shared
+    alloc_table_fork_child();
+    quarantine_fork_parent();
+    guard_pool_fork_child();
+    slab_fork_child();
+
+    transport_reconnect(follow_fork);
+    stack_fork_child();
+    canary_fork_child();
+    tracking_fork_child();
+    snapshot_fork_child();
+    latency_fork_child();
+}
+
+static int has_prefix(const char* string, const char* prefix) {
+    return strncmp(string, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * @brief Whether `env` sets the variable that `entry` ("NAME=value") sets.
+ */
+static int sets_variable(char* const env[], const size_t count, const char* entry) {
+    const size_t name_length = strcspn(entry, "=");
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(env[i], entry, name_length) == 0 && env[i][name_length] == '=') return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Bytes traced_environment() needs for `envp`, 0 to pass it through unchanged.
+ */
+static size_t traced_environment_size(char* const envp[]) {
+    if (!follow_exec || !library_path) return 0;
+
+    size_t count = 0;
+    size_t preload_length = 0;
+    while (envp && envp[count]) {
+        if (has_prefix(envp[count], PRELOAD_ENV "=")) preload_length = strlen(envp[count]);
+        count++;
+    }
+    size_t own = 0;
+    for (char** e = environ; e && *e; e++) own++;
+
+    // LD_PRELOAD=<this library>:<the caller's preloads>, MAPD_PARENT_CLIENT=<client>:<pid>
+    const size_t preload_size = strlen(PRELOAD_ENV "=") + strlen(library_path) + 1 + preload_length + 1;
+    const size_t parent_size = sizeof(PARENT_ENV "=") + 24;
+    return (count + own + 3) * sizeof(char*) + preload_size + parent_size;
+}
+
+/**
+ * @brief Builds the environment for a traced child from the one the caller passed.
+ *
+ * Takes no locks and allocates nothing, so it is safe in the child of a vfork().
+ *
+ * @param pid Process that will be the child's parent client, which is the caller's own
+ * pid for exec().
+ * @param buffer Memory for the array and its new strings, traced_environment_size() bytes.
+ * @return The environment, or NULL to pass `envp` through unchanged.
+ */
+static char** traced_environment(char* const envp[], const pid_t pid, void* buffer, const size_t size) {
+    if (!buffer || size == 0) return NULL;
+
+    size_t count = 0;
+    const char* preload = NULL;
+    while (envp && envp[count]) {
+        if (has_prefix(envp[count], PRELOAD_ENV "=")) preload = envp[count] + strlen(PRELOAD_ENV "=");
+        count++;
+    }
+    size_t own = 0;
+    for (char** e = environ; e && *e; e++) own++;
+
+    const size_t preload_size = strlen(PRELOAD_ENV "=") + strlen(library_path) + 1 + (preload ? strlen(preload) : 0) + 1;
+    const size_t slots = count + own + 3;
+    char** env = buffer;
+    char* preload_entry = (char*)(env + slots);
+    char* parent_entry = preload_entry + preload_size;
+    const size_t parent_size = (char*)buffer + size - parent_entry;
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (has_prefix(envp[i], PRELOAD_ENV "=") || has_prefix(envp[i], PARENT_ENV "=")) continue;
+        env[n++] = envp[i];
+    }
+    // Settings of this process the caller left out
+    for (char** e = environ; e && *e; e++) {
+        if (!has_prefix(*e, "MAPD_") || has_prefix(*e, PARENT_ENV "=")) continue;
+        if (!sets_variable(envp, count, *e)) env[n++] = *e;
+    }
+
+    if (preload && strstr(preload, library_name)) {
+        snprintf(preload_entry, preload_size, PRELOAD_ENV "=%s", preload);
+    } else {
+        snprintf(preload_entry, preload_size, PRELOAD_ENV "=%s%s%s", library_path,
+                 preload && *preload ? ":" : "", preload ? preload : "");
+    }
+    env[n++] = preload_entry;
+
+    if (transport_client_id() > 0) {
+        snprintf(parent_entry, parent_size, PARENT_ENV "=%d:%d", (int)transport_client_id(), (int)pid);
+        env[n++] = parent_entry;
+    }
+    env[n] = NULL;
+    return env;
+}
+
+static void resolve_exec_functions(void) {
+    if (real_execve) return;
+    real_execvpe = dlsym(RTLD_NEXT, "execvpe");
+    real_posix_spawn = dlsym(RTLD_NEXT, "posix_spawn");
+    real_posix_spawnp = dlsym(RTLD_NEXT, "posix_spawnp");
+    real_execve = dlsym(RTLD_NEXT, "execve");
+}
+
+typedef int (*ExecFunction)(const char*, char* const[], char* const[]);
+
+/**
+ * @brief Runs an exec function with the traced environment; see the file comment for the
+ * child of a vfork(). A mapping made in such a child stays in the parent once the exec
+ * succeeds, so it is only used for environments too large for the stack.
+ */
+static int traced_exec(const ExecFunction exec, const char* file, char* const argv[], char* const envp[]) {
+    const size_t size = traced_environment_size(envp);
+    const int on_stack = size <= STACK_ENV_BYTES;
+    void* stack_buffer[on_stack ? size / sizeof(void*) + 1 : 1];
+    void* buffer = stack_buffer;
+    if (!on_stack) {
+        buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) buffer = NULL;
+    }
+
+    char** env = traced_environment(envp, getpid(), buffer, size);
+    if (getpid() == own_pid) transport_flush();
+    const int result = exec(file, argv, env ? env : envp);
+    if (!on_stack && buffer) munmap(buffer, size);
+    return result;
+}
+
+MEMWRAP_API int execve(const char* path, char* const argv[], char* const envp[]) {
+    resolve_exec_functions();
+    return traced_exec(real_execve, path, argv, envp);
+}
+
+MEMWRAP_API int execvpe(const char* file, char* const argv[], char* const envp[]) {
+    resolve_exec_functions();
+    return traced_exec(real_execvpe, file, argv, envp);
+}
+
+MEMWRAP_API int execv(const char* path, char* const argv[]) {
+    return execve(path, argv, environ);
+}
+
+MEMWRAP_API int execvp(const char* file, char* const argv[]) {
+    return execvpe(file, argv, environ);
+}
+
+/**
+ * @brief Collects the arguments of execl() and friends, up to and including the NULL.
+ *
+ * @return The number of arguments before the NULL.
+ */
+static size_t count_arguments(const char* arg, va_list args) {
+    size_t count = 0;
+    for (const char* a = arg; a; a = va_arg(args, const char*)) count++;
+    return count;
+}
+
+MEMWRAP_API int execl(const char* path, const char* arg, ...) {
+    va_list args;
+    va_start(args, arg);
+    const size_t count = count_arguments(arg, args);
+    va_end(args);
+
+    char* argv[count + 1];
+    va_start(args, arg);
+    argv[0] = (char*)arg;
+    for (size_t i = 1; i <= count; i++) argv[i] = va_arg(args, char*);
+    va_end(args);
+    return execve(path, argv, environ);
+}
+
+MEMWRAP_API int execlp(const char* file, const char* arg, ...) {
+    va_list args;
+    va_start(args, arg);
+    const size_t count = count_arguments(arg, args);
+    va_end(args);
+
+    char* argv[count + 1];
+    va_start(args, arg);
+    argv[0] = (char*)arg;
+    for (size_t i = 1; i <= count; i++) argv[i] = va_arg(args, char*);
+    va_end(args);
+    return execvpe(file, argv, environ);
+}
+
+MEMWRAP_API int execle(const char* path, const char* arg, ...) {
+    va_list args;
+    va_start(args, arg);
+    const size_t count = count_arguments(arg, args);
+    va_end(args);
+
+    // The environment follows the terminating NULL
+    char* argv[count + 1];
+    va_start(args, arg);
+    argv[0] = (char*)arg;
+    for (size_t i = 1; i <= count; i++) argv[i] = va_arg(args, char*);
+    char* const* envp = va_arg(args, char* const*);
+    va_end(args);
+    return execve(path, argv, envp);
+}
+
+MEMWRAP_API int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions,
+                const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+    resolve_exec_functions();
+    const size_t size = traced_environment_size(envp);
+    void* buffer = size ? malloc(size) : NULL;
+    char** env = traced_environment(envp, getpid(), buffer, size);
+    const int result = real_posix_spawn(pid, path, file_actions, attrp, argv, env ? env : envp);
+    free(buffer);
+    return result;
+}
+
+MEMWRAP_API int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions,
+                 const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]) {
+    resolve_exec_functions();
+    const size_t size = traced_environment_size(envp);
+    void* buffer = size ? malloc(size) : NULL;
+    char** env = traced_environment(envp, getpid(), buffer, size);
+    const int result = real_posix_spawnp(pid, file, file_actions, attrp, argv, env ? env : envp);
+    free(buffer);
+    return result;
+}
+
+/**
+ * @brief Reads MAPD_FOLLOW_FORK, MAPD_FOLLOW_EXEC and the parent left by an exec(), and
+ * registers the fork handlers. Runs before the first connection.
+ */
+void inherit_init(void) {
+    const char* fork_env = getenv("MAPD_FOLLOW_FORK");
+    const char* exec_env = getenv("MAPD_FOLLOW_EXEC");
+    if (fork_env && strcmp(fork_env, "0") == 0) follow_fork = 0;
+    if (exec_env && strcmp(exec_env, "0") == 0) follow_exec = 0;
+
+    Dl_info self;
+    if (dladdr((void*)inherit_init, &self) && self.dli_fname && self.dli_fname[0]) {
+        library_path = self.dli_fname;
+        const char* slash = strrchr(library_path, '/');
+        library_name = slash ? slash + 1 : library_path;
+    }
+
+    // Set for us alone; our own children get a fresh one
+    const char* parent_env = getenv(PARENT_ENV);
+    if (parent_env) {
+        int client = 0, pid = 0;
+        if (sscanf(parent_env, "%d:%d", &client, &pid) == 2) transport_set_parent((uint32_t)pid, client);
+        unsetenv(PARENT_ENV);
+    }
+
+    own_pid = getpid();
+    resolve_exec_functions();  // dlsym() may allocate, which the child of a vfork() must not
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
@@ -0,0 +1,11 @@
+#ifndef INHERIT_H
+#define INHERIT_H
+
+/**
+ * @file inherit.h
+ * @brief Tracing of child processes: reconnecting after fork() and staying loaded across exec().
+ */
+
+void inherit_init(void);
+
+#endif
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include "interpose.h"
+
+#if defined(__x86_64__)
+#define R_JUMP_SLOT R_X86_64_JUMP_SLOT
+#define R_GLOB_DAT R_X86_64_GLOB_DAT
+#elif defined(__aarch64__)
+#define R_JUMP_SLOT R_AARCH64_JUMP_SLOT
+#define R_GLOB_DAT R_AARCH64_GLOB_DAT
+#endif
+
+/**
+ * @file interpose.c
+ * @brief Takes over the malloc family of a process the wrapper was injected into.
+ *
+ * Under LD_PRELOAD the dynamic linker binds every malloc() call to this library. When it
+ * is dlopen()ed into a running process instead (see mapd-attach), every module is already
+ * bound to the real allocator, so each module's GOT slots for the malloc family and the
+ * C++ operators are rewritten to point here. RELRO pages are made writable for the write
+ * and read-only again afterwards.
+ *
+ * The release functions are redirected first: from then on a block of either allocator
+ * can be released through this library (see pointer_untracked()), so no module patched
+ * so far hands one of our blocks to the real free(). Only then are the allocation
+ * functions redirected.
+ *
+ * dlopen() is redirected as well, and every module it loads is patched before it returns.
+ * The constructors of such a module still run against the real allocator, as do modules
+ * libc loads on its own (NSS, iconv) until the next dlopen(). The dynamic linker itself
+ * keeps the real allocator.
+ */
+
+typedef struct {
+    const char* name;
+    int releases;  // frees or resizes an existing block
+} InterposedSymbol;
+
+static const InterposedSymbol symbols[] = {
+    { "free", 1 }, { "realloc", 1 }, { "reallocarray", 1 }, { "malloc_usable_size", 1 },
+    { "_ZdlPv", 1 }, { "_ZdaPv", 1 }, { "_ZdlPvm", 1 }, { "_ZdaPvm", 1 },
+    { "_ZdlPvSt11align_val_t", 1 }, { "_ZdaPvSt11align_val_t", 1 },
+    { "_ZdlPvmSt11align_val_t", 1 }, { "_ZdaPvmSt11align_val_t", 1 },
+    { "_ZdlPvRKSt9nothrow_t", 1 }, { "_ZdaPvRKSt9nothrow_t", 1 },
+    { "_ZdlPvSt11align_val_tRKSt9nothrow_t", 1 }, { "_ZdaPvSt11align_val_tRKSt9nothrow_t", 1 },
+    { "malloc", 0 }, { "calloc", 0 }, { "memalign", 0 }, { "posix_memalign", 0 },
+    { "aligned_alloc", 0 }, { "valloc", 0 },
+    { "_Znwm", 0 }, { "_Znam", 0 }, { "_ZnwmRKSt9nothrow_t", 0 }, { "_ZnamRKSt9nothrow_t", 0 },
+    { "_ZnwmSt11align_val_t", 0 }, { "_ZnamSt11align_val_t", 0 },
+    { "_ZnwmSt11align_val_tRKSt9nothrow_t", 0 }, { "_ZnamSt11align_val_tRKSt9nothrow_t", 0 },
+    // Not allocation functions, but they keep children traced (see inherit.c)
+    { "execve", 0 }, { "execvpe", 0 }, { "execv", 0 }, { "execvp", 0 },
+    { "execl", 0 }, { "execlp", 0 }, { "execle", 0 }, { "posix_spawn", 0 }, { "posix_spawnp", 0 },
+    { "dlopen", 0 },  // patches the modules it loads, see interposed_dlopen()
+};
+
+#define SYMBOL_COUNT (sizeof(symbols) / sizeof(symbols[0]))
+
+typedef struct {
+    void* replacements[SYMBOL_COUNT];
+    uintptr_t self_base;
+    int releases;  // pass: 1 for the release functions, 0 for the rest
+    int patched;
+} PatchPass;
+
+/**
+ * @brief Whether this library was loaded after start-up, so nothing calls into it yet.
+ */
+int interpose_needed(void) {
+    Dl_info self;
+    if (!dladdr((void*)interpose_needed, &self)) return 0;
+    void* bound = dlsym(RTLD_DEFAULT, "malloc");
+    Dl_info owner;
+    return bound && dladdr(bound, &owner) && owner.dli_fbase != self.dli_fbase;
+}
+
+#if defined(R_JUMP_SLOT)
+
+/**
+ * @brief Address inside a module from a dynamic entry; the dynamic linker relocates most
+ * of them in place, but not those of the vDSO.
+ */
+static uintptr_t dynamic_address(const struct dl_phdr_info* info, const uintptr_t value) {
+    return value < info->dlpi_addr ? info->dlpi_addr + value : value;
+}
+
+static int in_relro(const struct dl_phdr_info* info, const uintptr_t addr) {
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_GNU_RELRO) continue;
+        const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (addr >= start && addr < start + phdr->p_memsz) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Points one GOT slot at its replacement.
+ */
+static int write_slot(const struct dl_phdr_info* info, void** slot, void* replacement) {
+    if (*slot == replacement) return 0;
+
+    const uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    void* page = (void*)((uintptr_t)slot & ~(pagesize - 1));
+    const int relro = in_relro(info, (uintptr_t)slot);
+    if (relro && mprotect(page, pagesize, PROT_READ | PROT_WRITE) != 0) return 0;
+    __atomic_store_n(slot, replacement, __ATOMIC_RELEASE);
+    if (relro) mprotect(page, pagesize, PROT_READ);
+    return 1;
+}
+
+static void patch_relocations(const struct dl_phdr_info* info, const ElfW(Rela)* relocations, const size_t size,
+                              const ElfW(Sym)* symtab, const char* strtab, PatchPass* pass) {
+    for (size_t i = 0; i < size / sizeof(ElfW(Rela)); i++) {
+        const ElfW(Rela)* rela = &relocations[i];
+        const unsigned long type = ELF64_R_TYPE(rela->r_info);
+        if (type != R_JUMP_SLOT && type != R_GLOB_DAT) continue;
+
+        const char* name = strtab + symtab[ELF64_R_SYM(rela->r_info)].st_name;
+        for (size_t s = 0; s < SYMBOL_COUNT; s++) {
+            if (symbols[s].releases != pass->releases || !pass->replacements[s]) continue;
+            if (strcmp(name, symbols[s].name) != 0) continue;
+            pass->patched += write_slot(info, (void**)(info->dlpi_addr + rela->r_offset), pass->replacements[s]);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief dl_iterate_phdr() callback patching one module.
+ */
+static int patch_module(struct dl_phdr_info* info, size_t size __attribute__((unused)), void* arg) {
+    PatchPass* pass = arg;
+    if (info->dlpi_addr == pass->self_base && info->dlpi_addr != 0) return 0;
+    if (strstr(info->dlpi_name, "ld-linux") || strstr(info->dlpi_name, "linux-vdso")) return 0;
+
+    const ElfW(Dyn)* dynamic = NULL;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_DYNAMIC)
+            dynamic = (const ElfW(Dyn)*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+    }
+    if (!dynamic) return 0;
+
+    const ElfW(Sym)* symtab = NULL;
+    const char* strtab = NULL;
+    const ElfW(Rela)* jmprel = NULL;
+    const ElfW(Rela)* rela = NULL;
+    size_t jmprel_size = 0, rela_size = 0;
+    for (const ElfW(Dyn)* d = dynamic; d->d_tag != DT_NULL; d++) {
+        switch (d->d_tag) {
+            case DT_SYMTAB: symtab = (const ElfW(Sym)*)dynamic_address(info, d->d_un.d_ptr); break;
+            case DT_STRTAB: strtab = (const char*)dynamic_address(info, d->d_un.d_ptr); break;
+            case DT_JMPREL: jmprel = (const ElfW(Rela)*)dynamic_address(info, d->d_un.d_ptr); break;
+            case DT_PLTRELSZ: jmprel_size = d->d_un.d_val; break;
+            case DT_RELA: rela = (const ElfW(Rela)*)dynamic_address(info, d->d_un.d_ptr); break;
+            case DT_RELASZ: rela_size = d->d_un.d_val; break;
+            default: break;
+        }
+    }
+    if (!symtab || !strtab) return 0;
+
+    if (jmprel) patch_relocations(info, jmprel, jmprel_size, symtab, strtab, pass);
+    if (rela) patch_relocations(info, rela, rela_size, symtab, strtab, pass);
+    return 0;
+}
+
+static PatchPass patch_template;  // replacements and self_base, set by interpose_patch()
+
+/**
+ * @brief Rewrites the slots of every loaded module; those already patched are skipped.
+ */
+static int patch_all(void) {
+    PatchPass pass = patch_template;
+    pass.releases = 1;
+    dl_iterate_phdr(patch_module, &pass);
+    pass.releases = 0;
+    dl_iterate_phdr(patch_module, &pass);
+    return pass.patched;
+}
+
+/**
+ * @brief Stands in for dlopen() in the patched modules. Not exported: under LD_PRELOAD the
+ * dynamic linker binds new modules to this library by itself. The caller dlopen() sees is
+ * this library, which only matters for a $ORIGIN in `file`.
+ */
+static void* interposed_dlopen(const char* file, const int mode) {
+    void* handle = dlopen(file, mode);  // our own slot is never patched
+    if (handle) patch_all();
+    return handle;
+}
+
+/**
+ * @brief Redirects the malloc family of every loaded module to this library, and dlopen()
+ * so that later modules are redirected too.
+ *
+ * @return Number of GOT slots rewritten, -1 if this library cannot be found.
+ */
+int interpose_patch(void) {
+    Dl_info self;
+    if (!dladdr((void*)interpose_patch, &self)) return -1;
+    void* handle = dlopen(self.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+    if (!handle) return -1;
+
+    patch_template.self_base = (uintptr_t)self.dli_fbase;
+    // Our own definitions, not the ones the process is bound to
+    for (size_t s = 0; s < SYMBOL_COUNT; s++) {
+        patch_template.replacements[s] = strcmp(symbols[s].name, "dlopen") == 0
+            ? (void*)interposed_dlopen : dlsym(handle, symbols[s].name);
+    }
+    dlclose(handle);
+    return patch_all();
+}
+
+#else
+
+int interpose_patch(void) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef INTERPOSE_H
+#define INTERPOSE_H
+
+/**
+ * @file interpose.h
+ * @brief Redirects the malloc family of a running process when the wrapper is loaded late.
+ */
+
+int interpose_needed(void);
+int interpose_patch(void);
+
+#endif
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "latency.h"
+#include "memwrap.h"
+#include "transport.h"
+
+#define MAX_LATENCY_THREADS 256
+#define DEFAULT_INTERVAL_MS 1000
+
+/**
+ * @file latency.c
+ * @brief Tells whether the real allocator or the wrapper causes slow allocations.
+ *
+ * With MAPD_LATENCY=1, or once the analyzer sends CONTROL_SET_LATENCY, every thread records
+ * how long its calls into the real allocator, the mappings of tracked blocks, its waits for
+ * the allocation table and quarantine locks and its event sends took (see LatencyMetric).
+ * Values go into log-linear histograms (see PROTOCOL_LATENCY_BUCKETS) in a slot of the
+ * thread's own, so recording takes no lock and no atomic read-modify-write: two clock reads
+ * and a few increments. A lock acquired without waiting is recorded as 0 without reading
+ * the clock.
+ *
+ * A "mapd-latency" thread sums the slots every MAPD_LATENCY_MS milliseconds (default 1000)
+ * and sends the totals as one FRAME_LATENCY to binary analyzers; a last report goes out at
+ * exit. Slots of threads that have exited are folded into a process-wide total and reused.
+ * Exits are noticed by probing the thread id, not with a thread-specific destructor, since
+ * pthread_setspecific() may allocate while the caller holds a table lock. Threads beyond
+ * MAX_LATENCY_THREADS at a time are not measured.
+ */
+
+enum { SLOT_FREE, SLOT_ACTIVE };
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[PROTOCOL_LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * Written by its thread only; the exporter reads it with relaxed loads, which may see an
+ * increment a report late but never a torn value.
+ */
+typedef struct {
+    _Alignas(64) atomic_int state;
+    pid_t thread;  // kernel id of the owner
+    LatencyHistogram metrics[LATENCY_METRIC_COUNT];
+} ThreadLatency;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[PROTOCOL_LATENCY_BUCKETS];
+} LatencyTotals;
+
+int latency_enabled = 0;
+static uint64_t interval_ms = DEFAULT_INTERVAL_MS;
+static int exporter_running = 0;
+static ThreadLatency* slots = NULL;
+static atomic_uint threads_seen = 0;
+static uint32_t report_count = 0;
+static LatencyTotals retired[LATENCY_METRIC_COUNT];
+static LatencyTotals totals[LATENCY_METRIC_COUNT];
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread ThreadLatency* thread_slot __attribute__((tls_model("initial-exec"))) = NULL;
+static uint8_t frame[sizeof(FrameHeader) + PROTOCOL_MAX_LATENCY_BYTES] __attribute__((aligned(8)));
+
+/**
+ * @brief Returns the calling thread's slot, claiming a free one on first use.
+ *
+ * @return NULL when all slots are taken.
+ */
+static ThreadLatency* slot_for_thread(void) {
+    if (__builtin_expect(thread_slot != NULL, 1)) return thread_slot;
+    if (!slots) return NULL;
+
+    for (int i = 0; i < MAX_LATENCY_THREADS; i++) {
+        int expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&slots[i].state, &expected, SLOT_ACTIVE)) {
+            slots[i].thread = (pid_t)syscall(SYS_gettid);
+            thread_slot = &slots[i];
+            atomic_fetch_add_explicit(&threads_seen, 1, memory_order_relaxed);
+            break;
+        }
+    }
+    return thread_slot;
+}
+
+/**
+ * @brief Whether the owner of an active slot has exited.
+ */
+static int owner_exited(const ThreadLatency* slot) {
+    return syscall(SYS_tgkill, getpid(), slot->thread, 0) == -1 && errno == ESRCH;
+}
+
+static void bump(atomic_uint_fast64_t* counter, const uint64_t by) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+static void record_ns(const LatencyMetric metric, const uint64_t ns) {
+    ThreadLatency* slot = slot_for_thread();
+    if (!slot) return;
+
+    LatencyHistogram* histogram = &slot->metrics[metric];
+    bump(&histogram->buckets[protocol_latency_bucket(ns)], 1);
+    bump(&histogram->count, 1);
+    bump(&histogram->sum_ns, ns);
+    if (ns > atomic_load_explicit(&histogram->max_ns, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max_ns, ns, memory_order_relaxed);
+}
+
+/**
+ * @brief Records the time since `start`, as returned by latency_start(). Does nothing if
+ * latencies were not measured when the call started.
+ */
+void latency_record(const LatencyMetric metric, const int64_t start) {
+    if (start == 0) return;
+    const int64_t elapsed = protocol_clock_ns(CLOCK_MONOTONIC) - start;
+    record_ns(metric, elapsed > 0 ? (uint64_t)elapsed : 0);
+}
+
+/**
+ * @brief pthread_mutex_lock() that records the wait under `metric`.
+ */
+void latency_lock(pthread_mutex_t* lock, const LatencyMetric metric) {
+    if (__builtin_expect(!latency_enabled, 1)) {
+        pthread_mutex_lock(lock);
+        return;
+    }
+    if (pthread_mutex_trylock(lock) == 0) {
+        record_ns(metric, 0);
+        return;
+    }
+    const int64_t start = protocol_clock_ns(CLOCK_MONOTONIC);
+    pthread_mutex_lock(lock);
+    latency_record(metric, start);
+}
+
+static void add_totals(LatencyTotals* into, const LatencyTotals* from) {
+    into->count += from->count;
+    into->sum_ns += from->sum_ns;
+    if (from->max_ns > into->max_ns) into->max_ns = from->max_ns;
+    for (int i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++) into->buckets[i] += from->buckets[i];
+}
+
+static void load_histogram(LatencyTotals* into, const LatencyHistogram* histogram) {
+    into->count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    into->sum_ns = atomic_load_explicit(&histogram->sum_ns, memory_order_relaxed);
+    into->max_ns = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    for (int i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++)
+        into->buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+}
+
+/**
+ * @brief Sums every slot into `totals`, folding and freeing the slots of exited threads.
+ * Caller holds export_lock.
+ */
+static void collect_totals(void) {
+    memcpy(totals, retired, sizeof(totals));
+    for (int i = 0; i < MAX_LATENCY_THREADS; i++) {
+        ThreadLatency* slot = &slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == SLOT_FREE) continue;
+
+        // Checked first: an owner seen exited has written its last value
+        const int exited = owner_exited(slot);
+        for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++) {
+            LatencyTotals values;
+            load_histogram(&values, &slot->metrics[metric]);
+            add_totals(&totals[metric], &values);
+            if (exited) add_totals(&retired[metric], &values);
+        }
+        if (exited) {
+            memset(slot->metrics, 0, sizeof(slot->metrics));
+            atomic_store_explicit(&slot->state, SLOT_FREE, memory_order_release);
+        }
+    }
+}
+
+/**
+ * @brief Packs one metric as described at LatencyFrame.
+ *
+ * @return Number of bytes written, at most PROTOCOL_MAX_LATENCY_METRIC_BYTES.
+ */
+static size_t put_metric(uint8_t* out, const int metric, const LatencyTotals* values) {
+    uint64_t filled = 0;
+    for (int i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++) filled += values->buckets[i] != 0;
+
+    size_t length = protocol_put_varint(out, PROTOCOL_LATENCY_FIELDS);
+    length += protocol_put_varint(out + length, (uint64_t)metric);
+    length += protocol_put_varint(out + length, values->count);
+    length += protocol_put_varint(out + length, values->sum_ns);
+    length += protocol_put_varint(out + length, values->max_ns);
+    length += protocol_put_varint(out + length, filled);
+    int previous = -1;
+    for (int i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++) {
+        if (values->buckets[i] == 0) continue;
+        length += protocol_put_varint(out + length, (uint64_t)(i - previous));
+        length += protocol_put_varint(out + length, values->buckets[i]);
+        previous = i;
+    }
+    return length;
+}
+
+/**
+ * @brief Sends the histograms of every thread so far to a binary analyzer.
+ */
+void latency_export(void) {
+    if (!slots || atomic_load(&threads_seen) == 0) return;
+    if (!transport_connected() || transport_format() != PROTOCOL_FORMAT_BINARY) return;
+
+    pthread_mutex_lock(&export_lock);
+    collect_totals();
+
+    LatencyFrame latency = {
+        .report = ++report_count,
+        .metric_count = LATENCY_METRIC_COUNT,
+        .entries_offset = sizeof(LatencyFrame),
+        .threads = atomic_load(&threads_seen),
+        .timestamp = protocol_clock_ns(CLOCK_MONOTONIC)
+    };
+    uint8_t* const payload = frame + sizeof(FrameHeader);
+    size_t length = sizeof(latency);
+    for (int metric = 0; metric < LATENCY_METRIC_COUNT; metric++)
+        length += put_metric(payload + length, metric, &totals[metric]);
+
+    const FrameHeader header = { .kind = FRAME_LATENCY, .length = (uint32_t)length };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(payload, &latency, sizeof(latency));
+    transport_send_bulk(frame, sizeof(header) + length);
+    pthread_mutex_unlock(&export_lock);
+}
+
+static void* exporter_main(void* arg __attribute__((unused))) {
+    set_thread_untracked(1);
+    while (1) {
+        usleep((useconds_t)(interval_ms * 1000));
+        if (latency_enabled) latency_export();
+    }
+    return NULL;
+}
+
+static void start_exporter(void) {
+    pthread_t exporter;
+    if (pthread_create(&exporter, NULL, exporter_main, NULL) == 0) {
+        pthread_setname_np(exporter, "mapd-latency");
+        pthread_detach(exporter);
+        exporter_running = 1;
+    }
+}
+
+/**
+ * @brief Starts measuring with a report every `ms` milliseconds, or stops measuring if 0.
+ * Histograms are kept while measuring is off.
+ */
+void latency_set_interval(const uint64_t ms) {
+    if (ms == 0 || !slots) {
+        latency_enabled = 0;
+        return;
+    }
+    interval_ms = ms;
+    latency_enabled = 1;
+    if (!exporter_running) start_exporter();
+}
+
+/**
+ * @brief Maps the thread slots and reads MAPD_LATENCY and MAPD_LATENCY_MS.
+ */
+void latency_init(void) {
+    void* memory = mmap(NULL, sizeof(ThreadLatency) * MAX_LATENCY_THREADS, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) return;
+    slots = memory;
+
+    const char* env = getenv("MAPD_LATENCY");
+    if (!env || strcmp(env, "1") != 0) return;
+    const char* interval_env = getenv("MAPD_LATENCY_MS");
+    latency_set_interval(interval_env ? strtoull(interval_env, NULL, 10) : DEFAULT_INTERVAL_MS);
+}
+
+/**
+ * @brief pthread_atfork() child handler: the child starts its histograms over, keeping only
+ * the slot of the thread that forked, and the exporter thread stayed in the parent.
+ */
+void latency_fork_child(void) {
+    pthread_mutex_init(&export_lock, NULL);
+    report_count = 0;
+    memset(retired, 0, sizeof(retired));
+    if (!slots) return;
+
+    for (int i = 0; i < MAX_LATENCY_THREADS; i++) {
+        memset(slots[i].metrics, 0, sizeof(slots[i].metrics));
+        atomic_store(&slots[i].state, &slots[i] == thread_slot ? SLOT_ACTIVE : SLOT_FREE);
+    }
+    if (thread_slot) thread_slot->thread = (pid_t)syscall(SYS_gettid);
+    atomic_store(&threads_seen, thread_slot ? 1 : 0);
+    if (!exporter_running) return;
+    exporter_running = 0;
+    start_exporter();
+}
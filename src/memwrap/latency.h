@@ -0,0 +1,31 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "protocol.h"
+
+/**
+ * @file latency.h
+ * @brief Per-thread latency histograms of the real allocator and of the wrapper's bookkeeping.
+ */
+
+extern int latency_enabled;
+
+void latency_init(void);
+void latency_set_interval(uint64_t interval_ms);
+void latency_record(LatencyMetric metric, int64_t start);
+void latency_lock(pthread_mutex_t* lock, LatencyMetric metric);
+void latency_export(void);
+void latency_fork_child(void);
+
+/**
+ * @brief Start time of a measured call for latency_record(), 0 while latencies are not
+ * measured. Costs a load and a branch when off, a vDSO clock read when on.
+ */
+static inline int64_t latency_start(void) {
+    if (__builtin_expect(!latency_enabled, 1)) return 0;
+    return protocol_clock_ns(CLOCK_MONOTONIC);
+}
+
+#endif
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "leak_report.h"
+#include "memwrap.h"
+#include "transport.h"
+
+#define MIN_GROUP_SLOTS 64
+#define MAX_GROUP_SLOTS (1ul << 21)
+#define HASH_MULTIPLIER 11400714819323198485llu  // 2⁶⁴ / golden ratio
+
+/**
+ * @file leak_report.c
+ * @brief Sends the blocks of a leak report as a few summary frames instead of one event each.
+ *
+ * Between leak_report_begin() and leak_report_end() reported blocks are only counted, in an
+ * open-addressing table keyed by event type and allocation site, or by size for blocks
+ * without a stack. Callers can add blocks while they hold table locks: nothing is sent and
+ * nothing allocated. leak_report_end() then packs the aggregates into FRAME_LEAK_SUMMARY
+ * frames of at most PROTOCOL_MAX_SUMMARY_BYTES (see LeakSummaryFrame), which
+ * transport_send_bulk() writes straight to the socket, so a report of thousands of blocks
+ * costs a handful of writes and never overflows a queue on either end.
+ *
+ * Only binary clients can send summaries; for JSON clients leak_report_begin() fails and
+ * callers send one event per block as before. Should the table fill up, which takes more
+ * than MAX_GROUP_SLOTS / 2 distinct sites, blocks of further sites are queued in a list of
+ * their own mapping and sent as single events by leak_report_end(), after the summary.
+ * Blocks that do not fit into that list either, because it cannot grow, are left out.
+ */
+
+typedef struct {
+    void* addr;
+    size_t size;
+    uint64_t weight;
+    uint32_t stack_id;
+    EventType type;
+} OverflowBlock;
+
+static LeakSummaryEntry* groups = NULL;
+static size_t slot_count = 0;
+static size_t group_count = 0;
+static uint32_t report_count = 0;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t frame[sizeof(FrameHeader) + PROTOCOL_MAX_SUMMARY_BYTES] __attribute__((aligned(8)));
+static OverflowBlock* overflow = NULL;
+static size_t overflow_count = 0;
+static size_t overflow_capacity = 0;
+
+/**
+ * @brief Starts a report of up to `blocks` blocks.
+ *
+ * @return 0 if the blocks are to be added, -1 if the caller has to send them as events.
+ */
+int leak_report_begin(const size_t blocks) {
+    if (!transport_connected() || transport_format() != PROTOCOL_FORMAT_BINARY) return -1;
+
+    size_t slots = MIN_GROUP_SLOTS;
+    while (slots < 2 * blocks && slots < MAX_GROUP_SLOTS) slots <<= 1;
+
+    pthread_mutex_lock(&report_lock);
+    void* table = mmap(NULL, slots * sizeof(LeakSummaryEntry), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table == MAP_FAILED) {
+        pthread_mutex_unlock(&report_lock);
+        return -1;
+    }
+    groups = table;
+    slot_count = slots;
+    group_count = 0;
+    overflow_count = 0;
+    return 0;
+}
+
+/**
+ * @brief Queues a block whose site found no room in the group table, mapping or growing the
+ * list as needed. Nothing is sent, so callers may still hold table locks.
+ */
+static void queue_overflow(const EventType type, const AllocationEntry* entry) {
+    if (overflow_count == overflow_capacity) {
+        const size_t capacity = overflow_capacity ? 2 * overflow_capacity : MIN_GROUP_SLOTS;
+        const size_t bytes = capacity * sizeof(OverflowBlock);
+        void* grown = overflow
+            ? mremap(overflow, overflow_capacity * sizeof(OverflowBlock), bytes, MREMAP_MAYMOVE)
+            : mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (grown == MAP_FAILED) return;
+        overflow = grown;
+        overflow_capacity = capacity;
+    }
+    overflow[overflow_count++] = (OverflowBlock){
+        .addr = entry->addr, .size = entry->requested_size, .weight = entry->weight,
+        .stack_id = entry->stack_id, .type = type
+    };
+}
+
+static size_t group_slot(const EventType type, const uint32_t stack_id, const size_t size) {
+    const uint64_t key = ((uint64_t)type << 32 | stack_id) ^ (stack_id ? 0 : size * HASH_MULTIPLIER);
+    return (size_t)((key * HASH_MULTIPLIER) >> 32) & (slot_count - 1);
+}
+
+/**
+ * @brief Counts a block into its group. Blocks of event types the analyzer filtered out are skipped.
+ */
+void leak_report_add(const EventType type, const AllocationEntry* entry) {
+    if (!event_reportable(type)) return;
+
+    const size_t size = entry->requested_size;
+    size_t slot = group_slot(type, entry->stack_id, size);
+    while (groups[slot].count > 0) {
+        const LeakSummaryEntry* group = &groups[slot];
+        if (group->type == type && group->stack_id == entry->stack_id && (entry->stack_id || group->min_size == size))
+            break;
+        slot = (slot + 1) & (slot_count - 1);
+    }
+
+    LeakSummaryEntry* group = &groups[slot];
+    if (group->count == 0) {
+        // Kept at most half full, so probing stays short
+        if (2 * (group_count + 1) > slot_count) {
+            queue_overflow(type, entry);
+            return;
+        }
+        *group = (LeakSummaryEntry){ .type = (uint16_t)type, .stack_id = entry->stack_id, .min_size = size };
+        group_count++;
+    }
+    group->count++;
+    group->bytes += size;
+    group->weight += entry->weight;
+    if (size < group->min_size) group->min_size = size;
+    if (size > group->max_size) group->max_size = size;
+}
+
+/**
+ * @brief Writes the summary frame filled so far; its entries are already in place.
+ */
+static void send_part(LeakSummaryFrame* summary, const size_t length, const int last) {
+    summary->last = (uint16_t)last;
+    const FrameHeader header = { .kind = FRAME_LEAK_SUMMARY, .length = (uint32_t)length };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), summary, sizeof(*summary));
+    transport_send_bulk(frame, sizeof(header) + length);
+    summary->part++;
+    summary->entry_count = 0;
+}
+
+/**
+ * @brief Sends the report, at least one frame even if it is empty, then the queued overflow
+ * blocks as single events, and ends it. Callers must not hold table locks.
+ */
+void leak_report_end(void) {
+    LeakSummaryFrame summary = {
+        .report = ++report_count,
+        .entries_offset = sizeof(LeakSummaryFrame),
+        .timestamp = protocol_clock_ns(CLOCK_MONOTONIC)
+    };
+    for (size_t i = 0; i < slot_count; i++) {
+        summary.blocks += groups[i].count;
+        summary.bytes += groups[i].bytes;
+    }
+
+    uint8_t* const payload = frame + sizeof(FrameHeader);
+    size_t length = sizeof(summary);
+    for (size_t i = 0; i < slot_count; i++) {
+        if (groups[i].count == 0) continue;
+        if (length + PROTOCOL_MAX_ENTRY_BYTES > PROTOCOL_MAX_SUMMARY_BYTES) {
+            send_part(&summary, length, 0);
+            length = sizeof(summary);
+        }
+        length += protocol_put_summary_entry(payload + length, &groups[i]);
+        summary.entry_count++;
+    }
+    send_part(&summary, length, 1);
+
+    for (size_t i = 0; i < overflow_count; i++) {
+        const OverflowBlock* block = &overflow[i];
+        send_weighted_event(block->type, block->addr, block->size, block->stack_id, block->weight);
+    }
+    if (overflow) munmap(overflow, overflow_capacity * sizeof(OverflowBlock));
+    overflow = NULL;
+    overflow_count = 0;
+    overflow_capacity = 0;
+
+    munmap(groups, slot_count * sizeof(LeakSummaryEntry));
+    groups = NULL;
+    slot_count = 0;
+    pthread_mutex_unlock(&report_lock);
+}
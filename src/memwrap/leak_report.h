@@ -0,0 +1,17 @@
+#ifndef LEAK_REPORT_H
+#define LEAK_REPORT_H
+
+#include <stddef.h>
+#include "protocol.h"
+#include "alloc_table.h"
+
+/**
+ * @file leak_report.h
+ * @brief Aggregates the blocks of a leak report by site and sends them as bulk summary frames.
+ */
+
+int leak_report_begin(size_t blocks);
+void leak_report_add(EventType type, const AllocationEntry* entry);
+void leak_report_end(void);
+
+#endif
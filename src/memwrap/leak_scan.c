@@ -0,0 +1,818 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "leak_scan.h"
+#include "memwrap.h"
+#include "alloc_table.h"
+#include "leak_report.h"
+#include "tracking.h"
+
+#define DEFAULT_SUSPEND_SIGNAL SIGPWR
+#define MAX_IGNORED_RANGES 1024
+#define MAX_STOPPED_THREADS 4096
+#define MAX_SCAN_WORKERS 16
+#define DEFAULT_SCAN_WORKERS 4
+#define WORKER_STACK_BYTES (256 * 1024)
+#define CHUNK_BYTES (1ul << 20)
+#define MAPS_BYTES (64 * 1024)
+#define STOP_TIMEOUT_MS 2000
+#define CLAIMED 1  // start of an ignored range being filled in
+
+/**
+ * @file leak_scan.c
+ * @brief Finds leaks by reachability, LeakSanitizer style, instead of calling every block
+ * still allocated a leak.
+ *
+ * A scan stops every other thread with the suspend signal. Each thread records where
+ * its signal frame starts, so the used part of its stack and the registers saved in the
+ * frame become roots. So does every other private writable mapping: data and bss segments,
+ * the heap, anonymous mappings. Excluded are the tracked blocks themselves and the
+ * wrapper's bookkeeping, which modules register with leak_scan_ignore(). Roots are split
+ * into chunks, scanned in parallel by the calling thread and MAPD_LEAK_SCAN_THREADS
+ * workers (default 4). Every tracked block a word points into, interior pointers included,
+ * is marked reachable, and its contents are scanned in turn. The blocks left over are then
+ * scanned by address: whatever they reach is indirectly lost, the rest definitely lost, so
+ * a cycle of lost blocks has one definitely lost member.
+ *
+ * Once the threads run again, definitely lost blocks are reported as EVENT_MEMORY_LEAK and
+ * indirectly lost ones as EVENT_INDIRECT_LEAK. With MAPD_LEAK_SHOW_REACHABLE=1, the others
+ * are reported as EVENT_STILL_REACHABLE. Muted blocks are left out. A scan runs at exit
+ * and on CONTROL_LEAK_SCAN. The scan is conservative: a word that merely looks like a
+ * pointer keeps a block alive, so a leak can be missed but a referenced block is never
+ * reported. With MAPD_LEAK_SCAN=0, or when a thread cannot be stopped (the signal blocked),
+ * every block still allocated at exit is reported as a leak, as before.
+ *
+ * The suspend signal is SIGPWR unless MAPD_LEAK_SCAN_SIGNAL names another. Some runtimes
+ * stop their own threads with SIGPWR (Boehm GC, Mono): when the signal already has a
+ * handler at start-up the scan is disabled, with a message, rather than taking it over,
+ * and a scan is skipped the same way if a handler replaced the wrapper's since. Choose a
+ * signal the program leaves alone to scan such programs.
+ *
+ * The snapshot of the table is taken with every shard lock held, and the locks are kept
+ * until the other threads are stopped, so no block in it can be freed before the scan is
+ * over. While the world is stopped only system calls are made: a stopped thread may hold
+ * any other lock, the allocator's included. Scratch memory is mapped beforehand and
+ * ignored, and the snapshot is sorted without qsort(). Should reading a block fault all the
+ * same, leak_scan_fault() resumes the scan behind it. Like any signal, the suspend signal cuts
+ * short sleeps and other calls that are not restarted in the stopped threads.
+ */
+
+typedef enum { BLOCK_UNREACHED, BLOCK_REACHABLE, BLOCK_INDIRECT } Reachability;
+
+typedef struct {
+    uintptr_t start;      // user data, scanned once the block is reached
+    uintptr_t end;
+    uintptr_t map_start;  // backing memory, never scanned as a root
+    uintptr_t map_end;
+    uint32_t stack_id;
+    uint32_t muted;
+    uint32_t state;       // a Reachability, changed atomically
+} ScanBlock;
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} ScanRange;
+
+typedef struct {
+    _Atomic uintptr_t start;  // 0 for a free slot
+    _Atomic uintptr_t end;
+} IgnoredRange;
+
+typedef struct {
+    pid_t tid;
+    uintptr_t sp;
+    _Atomic unsigned int generation;  // of the scan the thread stopped for
+} StoppedThread;
+
+typedef struct {
+    uint32_t* items;  // block indices whose contents are still to be scanned
+    size_t count;
+} MarkStack;
+
+typedef struct {
+    uint64_t inode;
+    int64_t offset;
+    unsigned short length;
+    unsigned char type;
+    char name[];
+} DirEntry;
+
+typedef struct {
+    ScanBlock* blocks;  // sorted by address
+    size_t block_count;
+    size_t blocks_size;
+    uintptr_t low;
+    uintptr_t high;
+    ScanRange* ranges;  // roots, at most CHUNK_BYTES each
+    size_t range_count;
+    size_t range_capacity;
+    atomic_size_t next_range;
+    uint32_t* mark_memory;
+    size_t mark_size;
+    MarkStack stacks[MAX_SCAN_WORKERS + 1];  // [0] for the calling thread
+    char* worker_stacks;
+    pthread_t workers[MAX_SCAN_WORKERS];
+    _Atomic pid_t worker_tids[MAX_SCAN_WORKERS];
+    int worker_count;
+    atomic_int go;        // 1 once roots are collected
+    atomic_int finished;  // workers done with the roots
+    int aborted;
+} ScanRun;
+
+static int enabled = 1;
+static int suspend_signal = DEFAULT_SUSPEND_SIGNAL;
+static int show_reachable = 0;
+static int scan_workers = DEFAULT_SCAN_WORKERS;
+static IgnoredRange ignored[MAX_IGNORED_RANGES];
+static ScanRange ignored_sorted[MAX_IGNORED_RANGES];
+static StoppedThread stopped[MAX_STOPPED_THREADS];
+static pid_t targets[MAX_STOPPED_THREADS];
+static size_t target_count = 0;
+static atomic_uint arrivals = 0;
+static atomic_uint scan_generation = 0;
+static atomic_uint released_generation = 0;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static ScanRun run;
+static __thread sigjmp_buf* fault_target __attribute__((tls_model("initial-exec"))) = NULL;
+
+/**
+ * @brief Excludes [start, start + length) from the roots, for memory of the wrapper that
+ * holds block addresses, such as the allocation table. Lock-free and malloc-free.
+ */
+void leak_scan_ignore(const void* start, const size_t length) {
+    if (!start || length == 0) return;
+    for (size_t i = 0; i < MAX_IGNORED_RANGES; i++) {
+        uintptr_t expected = 0;
+        if (!atomic_compare_exchange_strong(&ignored[i].start, &expected, CLAIMED)) continue;
+        atomic_store(&ignored[i].end, (uintptr_t)start + length);
+        atomic_store(&ignored[i].start, (uintptr_t)start);
+        return;
+    }
+}
+
+/**
+ * @brief Forgets the range leak_scan_ignore() registered at start.
+ */
+void leak_scan_unignore(const void* start) {
+    if (!start) return;
+    for (size_t i = 0; i < MAX_IGNORED_RANGES; i++) {
+        if (atomic_load(&ignored[i].start) != (uintptr_t)start) continue;
+        atomic_store(&ignored[i].end, 0);
+        atomic_store(&ignored[i].start, 0);
+        return;
+    }
+}
+
+static void* map_scratch(const size_t size) {
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    leak_scan_ignore(memory, size);
+    return memory;
+}
+
+static void unmap_scratch(void* memory, const size_t size) {
+    if (!memory) return;
+    leak_scan_unignore(memory);
+    munmap(memory, size);
+}
+
+/**
+ * @brief dl_iterate_phdr() callback ignoring the writable segments of this library.
+ */
+static int ignore_own_segments(struct dl_phdr_info* info, size_t size __attribute__((unused)),
+                               void* arg __attribute__((unused))) {
+    const uintptr_t self = (uintptr_t)&enabled;
+    int own = 0;
+    for (int i = 0; i < info->dlpi_phnum && !own; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        own = phdr->p_type == PT_LOAD && self >= start && self < start + phdr->p_memsz;
+    }
+    if (!own) return 0;
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_W)) continue;
+        const uintptr_t start = (info->dlpi_addr + phdr->p_vaddr) & ~(page - 1);
+        const uintptr_t end = (info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz + page - 1) & ~(page - 1);
+        leak_scan_ignore((void*)start, end - start);
+    }
+    return 1;
+}
+
+/**
+ * @brief Suspend signal handler: records where the thread's stack is in use and waits until
+ * the scan that stopped it is over.
+ */
+static void suspend_handler(int sig __attribute__((unused)), siginfo_t* info __attribute__((unused)), void* context) {
+    const int saved_errno = errno;
+    const unsigned int generation = atomic_load(&scan_generation);
+
+    if (generation != atomic_load(&released_generation)) {
+        const unsigned int slot = atomic_fetch_add(&arrivals, 1);
+        if (slot < MAX_STOPPED_THREADS) {
+            stopped[slot].tid = syscall(SYS_gettid);
+            stopped[slot].sp = (uintptr_t)context;  // the saved registers lie above
+            atomic_store_explicit(&stopped[slot].generation, generation, memory_order_release);
+        }
+        unsigned int released;
+        while ((int)((released = atomic_load(&released_generation)) - generation) < 0) {
+            syscall(SYS_futex, &released_generation, FUTEX_WAIT_PRIVATE, released, NULL, NULL, 0);
+        }
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief Called first thing by the SIGSEGV handler: a fault while this thread reads a block
+ * resumes the scan behind the block. Returns if the thread is not scanning.
+ */
+void leak_scan_fault(void) {
+    sigjmp_buf* target = fault_target;
+    if (!target) return;
+    fault_target = NULL;
+
+    sigset_t segv;
+    sigemptyset(&segv);
+    sigaddset(&segv, SIGSEGV);
+    pthread_sigmask(SIG_UNBLOCK, &segv, NULL);
+    siglongjmp(*target, 1);
+}
+
+/**
+ * @brief Disables scanning, saying why.
+ */
+static void disable_scan(const char* reason) {
+    enabled = 0;
+    fprintf(stderr, "[Wrapper] Leak scan disabled: %s; every block left at exit is reported as a leak.\n", reason);
+}
+
+/**
+ * @brief Reads MAPD_LEAK_SCAN, MAPD_LEAK_SCAN_THREADS, MAPD_LEAK_SHOW_REACHABLE and
+ * MAPD_LEAK_SCAN_SIGNAL and installs the suspend signal handler, unless the program
+ * handles that signal itself.
+ */
+void leak_scan_init(void) {
+    const char* scan_env = getenv("MAPD_LEAK_SCAN");
+    const char* threads_env = getenv("MAPD_LEAK_SCAN_THREADS");
+    const char* reachable_env = getenv("MAPD_LEAK_SHOW_REACHABLE");
+    const char* signal_env = getenv("MAPD_LEAK_SCAN_SIGNAL");
+    if (scan_env && strcmp(scan_env, "0") == 0) {
+        enabled = 0;
+        return;
+    }
+    if (threads_env) scan_workers = atoi(threads_env);
+    if (scan_workers < 0) scan_workers = 0;
+    if (scan_workers > MAX_SCAN_WORKERS) scan_workers = MAX_SCAN_WORKERS;
+    show_reachable = reachable_env && strcmp(reachable_env, "1") == 0;
+    if (signal_env) suspend_signal = parse_signal(signal_env);
+    if (!suspend_signal) {
+        disable_scan("MAPD_LEAK_SCAN_SIGNAL is not a signal");
+        return;
+    }
+
+    struct sigaction previous;
+    if (sigaction(suspend_signal, NULL, &previous) != 0) {
+        disable_scan("the suspend signal cannot be handled");
+        return;
+    }
+    if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+        disable_scan("the program handles the suspend signal, see MAPD_LEAK_SCAN_SIGNAL");
+        return;
+    }
+
+    dl_iterate_phdr(ignore_own_segments, NULL);
+
+    struct sigaction sa = {0};
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = suspend_handler;
+    sigfillset(&sa.sa_mask);
+    sigdelset(&sa.sa_mask, SIGSEGV);
+    if (sigaction(suspend_signal, &sa, NULL) != 0) disable_scan("the suspend signal cannot be handled");
+}
+
+static int collect_block(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (run.block_count * sizeof(ScanBlock) == run.blocks_size) return 1;
+    ScanBlock* block = &run.blocks[run.block_count++];
+    block->start = (uintptr_t)entry->addr;
+    block->end = block->start + (entry->requested_size ? entry->requested_size : 1);
+    block->map_start = (uintptr_t)entry->base;
+    block->map_end = block->map_start + entry->allocated_size;
+    block->stack_id = entry->stack_id;
+    block->muted = entry->muted;
+    block->state = BLOCK_UNREACHED;
+    return 0;
+}
+
+static void sift_down(size_t root, const size_t count) {
+    ScanBlock* blocks = run.blocks;
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && blocks[child + 1].start > blocks[child].start) child++;
+        if (blocks[root].start >= blocks[child].start) return;
+        const ScanBlock swap = blocks[root];
+        blocks[root] = blocks[child];
+        blocks[child] = swap;
+    }
+}
+
+/**
+ * @brief Heapsorts the snapshot by address; qsort() may allocate.
+ */
+static void sort_blocks(void) {
+    for (size_t i = run.block_count / 2; i-- > 0;) sift_down(i, run.block_count);
+    for (size_t end = run.block_count; end-- > 1;) {
+        const ScanBlock swap = run.blocks[0];
+        run.blocks[0] = run.blocks[end];
+        run.blocks[end] = swap;
+        sift_down(0, end);
+    }
+    if (run.block_count > 0) {
+        run.low = run.blocks[0].start;
+        run.high = run.blocks[run.block_count - 1].end;
+    }
+}
+
+/**
+ * @brief Index of the block containing value, or -1.
+ */
+static long find_block(const uintptr_t value) {
+    if (value < run.low || value >= run.high) return -1;
+    size_t low = 0;
+    size_t high = run.block_count;
+    while (low < high) {  // first block starting above value
+        const size_t middle = low + (high - low) / 2;
+        if (run.blocks[middle].start <= value) low = middle + 1;
+        else high = middle;
+    }
+    return low > 0 && value < run.blocks[low - 1].end ? (long)low - 1 : -1;
+}
+
+/**
+ * @brief Moves every block a word of [start, end) points into from state `from` to `to`,
+ * pushing it for its contents to be scanned. The block `source` is skipped.
+ */
+static void scan_words(const uintptr_t start, const uintptr_t end, MarkStack* stack,
+                       const uint32_t from, const uint32_t to, const long source) {
+    for (uintptr_t p = (start + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+         p + sizeof(uintptr_t) <= end; p += sizeof(uintptr_t)) {
+        const long index = find_block(*(const uintptr_t*)p);
+        if (index < 0 || index == source) continue;
+        uint32_t expected = from;
+        if (__atomic_compare_exchange_n(&run.blocks[index].state, &expected, to, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            stack->items[stack->count++] = (uint32_t)index;
+        }
+    }
+}
+
+/**
+ * @brief scan_words(), resuming after a fault in [start, end) instead of crashing.
+ */
+static void scan_guarded(const uintptr_t start, const uintptr_t end, MarkStack* stack,
+                         const uint32_t from, const uint32_t to, const long source) {
+    sigjmp_buf recover;
+    if (sigsetjmp(recover, 0) == 0) {
+        fault_target = &recover;
+        scan_words(start, end, stack, from, to, source);
+    }
+    fault_target = NULL;
+}
+
+static void drain(MarkStack* stack, const uint32_t from, const uint32_t to, const long source) {
+    while (stack->count > 0) {
+        const ScanBlock* block = &run.blocks[stack->items[--stack->count]];
+        scan_guarded(block->start, block->end, stack, from, to, source);
+    }
+}
+
+/**
+ * @brief Takes root chunks until none are left, marking what they reach.
+ */
+static void scan_roots(MarkStack* stack) {
+    for (;;) {
+        const size_t index = atomic_fetch_add(&run.next_range, 1);
+        if (index >= run.range_count) return;
+        scan_guarded(run.ranges[index].start, run.ranges[index].end, stack, BLOCK_UNREACHED, BLOCK_REACHABLE, -1);
+        drain(stack, BLOCK_UNREACHED, BLOCK_REACHABLE, -1);
+    }
+}
+
+/**
+ * @brief Marks what the unreached blocks reach as indirectly lost.
+ */
+static void find_indirect(void) {
+    MarkStack* stack = &run.stacks[0];
+    for (size_t i = 0; i < run.block_count; i++) {
+        if (run.blocks[i].state != BLOCK_UNREACHED) continue;
+        scan_guarded(run.blocks[i].start, run.blocks[i].end, stack, BLOCK_UNREACHED, BLOCK_INDIRECT, (long)i);
+        drain(stack, BLOCK_UNREACHED, BLOCK_INDIRECT, (long)i);
+    }
+}
+
+static void pause_briefly(void) {
+    const struct timespec pause = {0, 100000};
+    nanosleep(&pause, NULL);
+}
+
+static void* worker_main(void* arg) {
+    const int index = (int)(intptr_t)arg;
+    atomic_store(&run.worker_tids[index], (pid_t)syscall(SYS_gettid));
+    while (!atomic_load(&run.go)) pause_briefly();
+    if (!run.aborted) scan_roots(&run.stacks[index + 1]);
+    atomic_fetch_add(&run.finished, 1);
+    return NULL;
+}
+
+/**
+ * @brief Maps the snapshot and the mark stacks, with room for the table to grow a little,
+ * and starts the workers, each on a stack of ignored scratch memory. All of this allocates,
+ * so it happens before the table is locked.
+ */
+static int prepare_run(void) {
+    const size_t count = alloc_table_count();
+    const size_t capacity = count + count / 4 + 1024;
+    run.blocks_size = capacity * sizeof(ScanBlock);
+    run.blocks = map_scratch(run.blocks_size);
+    if (!run.blocks) return -1;
+
+    const int stacks = scan_workers + 1;
+    run.mark_size = (size_t)stacks * capacity * sizeof(uint32_t);
+    run.mark_memory = map_scratch(run.mark_size);
+    if (!run.mark_memory) return -1;
+    for (int i = 0; i < stacks; i++) {
+        run.stacks[i].items = run.mark_memory + (size_t)i * capacity;
+        run.stacks[i].count = 0;
+    }
+
+    if (scan_workers > 0) run.worker_stacks = map_scratch((size_t)scan_workers * WORKER_STACK_BYTES);
+    set_thread_untracked(1);  // keeps the threads' TLS out of the table
+    for (int i = 0; run.worker_stacks && i < scan_workers; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstack(&attr, run.worker_stacks + (size_t)i * WORKER_STACK_BYTES, WORKER_STACK_BYTES);
+        const int created = pthread_create(&run.workers[i], &attr, worker_main, (void*)(intptr_t)i) == 0;
+        pthread_attr_destroy(&attr);
+        if (!created) break;
+        pthread_setname_np(run.workers[i], "mapd-scan");
+        run.worker_count++;
+    }
+    set_thread_untracked(0);
+    for (int i = 0; i < run.worker_count; i++) {
+        while (!atomic_load(&run.worker_tids[i])) pause_briefly();
+    }
+    return 0;
+}
+
+static int is_scanner(const pid_t tid) {
+    if (tid == (pid_t)syscall(SYS_gettid)) return 1;
+    for (int i = 0; i < run.worker_count; i++) {
+        if (atomic_load(&run.worker_tids[i]) == tid) return 1;
+    }
+    return 0;
+}
+
+static int is_target(const pid_t tid) {
+    for (size_t i = 0; i < target_count; i++) {
+        if (targets[i] == tid) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lists the threads of the process without allocating.
+ */
+static size_t list_threads(pid_t* tids, const size_t capacity) {
+    const int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    char buffer[4096] __attribute__((aligned(8)));
+    size_t count = 0;
+    long length;
+    while ((length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < length;) {
+            const DirEntry* entry = (const DirEntry*)(buffer + offset);
+            offset += entry->length;
+            if (entry->name[0] < '0' || entry->name[0] > '9' || count == capacity) continue;
+            tids[count++] = (pid_t)strtol(entry->name, NULL, 10);
+        }
+    }
+    close(fd);
+    return count;
+}
+
+static int has_stopped(const pid_t tid, const unsigned int generation) {
+    unsigned int count = atomic_load(&arrivals);
+    if (count > MAX_STOPPED_THREADS) count = MAX_STOPPED_THREADS;
+    for (unsigned int i = 0; i < count; i++) {
+        if (atomic_load_explicit(&stopped[i].generation, memory_order_acquire) == generation
+            && stopped[i].tid == tid) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits until every target stopped or exited.
+ *
+ * @return 0 on success, -1 after STOP_TIMEOUT_MS.
+ */
+static int wait_for_targets(const unsigned int generation) {
+    for (int waited = 0; waited < STOP_TIMEOUT_MS * 10; waited++) {
+        size_t pending = 0;
+        for (size_t i = 0; i < target_count; i++) {
+            if (has_stopped(targets[i], generation)) continue;
+            if (syscall(SYS_tgkill, getpid(), targets[i], 0) != 0) continue;  // exited
+            pending++;
+        }
+        if (pending == 0) return 0;
+        pause_briefly();
+    }
+    return -1;
+}
+
+/**
+ * @brief Signals every thread but the scanners, again until no new thread shows up.
+ *
+ * @return 0 once all are stopped.
+ */
+static int stop_the_world(const unsigned int generation) {
+    static pid_t listed[MAX_STOPPED_THREADS];
+    target_count = 0;
+    for (;;) {
+        const size_t count = list_threads(listed, MAX_STOPPED_THREADS);
+        int signalled = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (is_scanner(listed[i]) || is_target(listed[i])) continue;
+            if (target_count == MAX_STOPPED_THREADS) return -1;
+            if (syscall(SYS_tgkill, getpid(), listed[i], suspend_signal) != 0) continue;
+            targets[target_count++] = listed[i];
+            signalled = 1;
+        }
+        if (!signalled) return 0;
+        if (wait_for_targets(generation) != 0) return -1;
+    }
+}
+
+static void resume_the_world(const unsigned int generation) {
+    atomic_store(&released_generation, generation);
+    syscall(SYS_futex, &released_generation, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static int push_range(const uintptr_t start, const uintptr_t end) {
+    if (run.range_count == run.range_capacity) {
+        const size_t capacity = run.range_capacity ? run.range_capacity * 2 : 4096;
+        ScanRange* grown = map_scratch(capacity * sizeof(ScanRange));
+        if (!grown) return -1;
+        if (run.ranges) memcpy(grown, run.ranges, run.range_count * sizeof(ScanRange));
+        unmap_scratch(run.ranges, run.range_capacity * sizeof(ScanRange));
+        run.ranges = grown;
+        run.range_capacity = capacity;
+    }
+    run.ranges[run.range_count++] = (ScanRange){start, end};
+    return 0;
+}
+
+/**
+ * @brief Adds [start, end) minus the tracked blocks, in chunks.
+ */
+static int add_unblocked(uintptr_t start, const uintptr_t end) {
+    size_t low = 0;
+    size_t high = run.block_count;
+    while (low < high) {  // first block ending above start
+        const size_t middle = low + (high - low) / 2;
+        if (run.blocks[middle].map_end <= start) low = middle + 1;
+        else high = middle;
+    }
+    for (size_t i = low; start < end; i++) {
+        const int blocked = i < run.block_count && run.blocks[i].map_start < end;
+        const uintptr_t stop = !blocked ? end : run.blocks[i].map_start > start ? run.blocks[i].map_start : start;
+        for (uintptr_t chunk = start; chunk < stop; chunk += CHUNK_BYTES) {
+            if (push_range(chunk, stop - chunk > CHUNK_BYTES ? chunk + CHUNK_BYTES : stop) != 0) return -1;
+        }
+        if (!blocked) break;
+        start = run.blocks[i].map_end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds [start, end) minus the ignored ranges, of which there are `ignored_count`.
+ */
+static int add_root(uintptr_t start, const uintptr_t end, const size_t ignored_count) {
+    for (size_t i = 0; i < ignored_count && start < end; i++) {
+        if (ignored_sorted[i].end <= start || ignored_sorted[i].start >= end) continue;
+        if (ignored_sorted[i].start > start && add_unblocked(start, ignored_sorted[i].start) != 0) return -1;
+        start = ignored_sorted[i].end;
+    }
+    return start < end ? add_unblocked(start, end) : 0;
+}
+
+/**
+ * @brief Copies the ignored ranges, sorted by address. No qsort(): it may allocate.
+ */
+static size_t sort_ignored(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_IGNORED_RANGES; i++) {
+        const uintptr_t start = atomic_load(&ignored[i].start);
+        const uintptr_t end = atomic_load(&ignored[i].end);
+        if (start <= CLAIMED || end <= start) continue;
+        size_t at = count++;
+        for (; at > 0 && ignored_sorted[at - 1].start > start; at--) ignored_sorted[at] = ignored_sorted[at - 1];
+        ignored_sorted[at] = (ScanRange){start, end};
+    }
+    return count;
+}
+
+static const char* parse_hex(const char* p, uintptr_t* value) {
+    *value = 0;
+    for (;; p++) {
+        if (*p >= '0' && *p <= '9') *value = *value * 16 + (uintptr_t)(*p - '0');
+        else if (*p >= 'a' && *p <= 'f') *value = *value * 16 + (uintptr_t)(*p - 'a' + 10);
+        else return p;
+    }
+}
+
+static const char* skip_field(const char* p, const char* end) {
+    while (p < end && *p != ' ') p++;
+    while (p < end && *p == ' ') p++;
+    return p;
+}
+
+static int starts_with(const char* p, const char* end, const char* prefix) {
+    const size_t length = strlen(prefix);
+    return (size_t)(end - p) >= length && memcmp(p, prefix, length) == 0;
+}
+
+/**
+ * @brief Reads /proc/self/maps into scratch memory.
+ */
+static char* read_maps(size_t* length, size_t* size) {
+    const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    *size = MAPS_BYTES;
+    *length = 0;
+    char* buffer = map_scratch(*size);
+    for (ssize_t got = 1; buffer && got > 0;) {
+        if (*length == *size) {
+            char* grown = map_scratch(*size * 2);
+            if (grown) memcpy(grown, buffer, *length);
+            unmap_scratch(buffer, *size);
+            buffer = grown;
+            *size *= 2;
+            if (!buffer) break;
+        }
+        got = read(fd, buffer + *length, *size - *length);
+        if (got > 0) *length += (size_t)got;
+    }
+    close(fd);
+    return buffer;
+}
+
+/**
+ * @brief Turns the private writable mappings into root chunks. A stack is scanned from the
+ * lowest recorded stack pointer in it up, so the free part below is skipped.
+ *
+ * @return 0 on success.
+ */
+static int collect_roots(const uintptr_t own_sp, const unsigned int generation) {
+    size_t length = 0;
+    size_t size = 0;
+    char* maps = read_maps(&length, &size);
+    if (!maps) return -1;
+
+    const size_t ignored_count = sort_ignored();
+    unsigned int stopped_count = atomic_load(&arrivals);
+    if (stopped_count > MAX_STOPPED_THREADS) stopped_count = MAX_STOPPED_THREADS;
+
+    int result = 0;
+    for (const char* line = maps; line < maps + length && result == 0;) {
+        const char* eol = memchr(line, '\n', maps + length - line);
+        if (!eol) eol = maps + length;
+
+        uintptr_t start;
+        uintptr_t end;
+        const char* p = parse_hex(line, &start);
+        p = parse_hex(p + 1, &end);
+        const char* perms = p + 1;
+        const char* path = skip_field(skip_field(skip_field(skip_field(perms, eol), eol), eol), eol);
+        const int scanned = perms + 4 <= eol && perms[0] == 'r' && perms[1] == 'w' && perms[3] == 'p'
+            && !starts_with(path, eol, "[v") && !starts_with(path, eol, "/dev/");
+
+        if (scanned) {
+            uintptr_t from = own_sp >= start && own_sp < end ? own_sp : end;
+            for (unsigned int i = 0; i < stopped_count; i++) {
+                const uintptr_t sp = stopped[i].sp;
+                if (atomic_load(&stopped[i].generation) == generation && sp >= start && sp < from) from = sp;
+            }
+            result = add_root(from == end ? start : from, end, ignored_count);
+        }
+        line = eol + 1;
+    }
+    unmap_scratch(maps, size);
+    return result;
+}
+
+/**
+ * @brief Stops the world, marks from the roots in parallel and classifies the rest.
+ *
+ * @return 0 on success, -1 if some thread could not be stopped.
+ */
+static int mark_blocks(void) {
+    jmp_buf registers;  // the callers' callee-saved registers, scanned with the stack
+    setjmp(registers);
+
+    const unsigned int generation = atomic_load(&scan_generation) + 1;
+    atomic_store(&arrivals, 0);
+    atomic_store(&scan_generation, generation);
+    alloc_table_lock_all();
+    alloc_table_for_each_locked(collect_block, NULL);  // a full table leaves blocks out: they count as roots
+    int stopped_all = stop_the_world(generation) == 0;
+    alloc_table_unlock_all();
+    sort_blocks();
+    if (stopped_all) stopped_all = collect_roots((uintptr_t)&registers, generation) == 0;
+
+    run.aborted = !stopped_all;
+    atomic_store(&run.go, 1);
+    if (stopped_all) scan_roots(&run.stacks[0]);
+    while (atomic_load(&run.finished) < run.worker_count) sched_yield();
+    if (stopped_all) find_indirect();
+    resume_the_world(generation);
+
+    for (int i = 0; i < run.worker_count; i++) pthread_join(run.workers[i], NULL);
+    return stopped_all ? 0 : -1;
+}
+
+/**
+ * @brief Sends the verdicts for the blocks that are still allocated, as a leak summary
+ * where the analyzer takes one (see leak_report.c).
+ */
+static void report_blocks(void) {
+    const int summarized = leak_report_begin(run.block_count) == 0;
+    for (size_t i = 0; i < run.block_count; i++) {
+        const ScanBlock* block = &run.blocks[i];
+        if (block->muted) continue;
+
+        EventType type;
+        switch (block->state) {
+            case BLOCK_UNREACHED: type = EVENT_MEMORY_LEAK; break;
+            case BLOCK_INDIRECT: type = EVENT_INDIRECT_LEAK; break;
+            default:
+                if (!show_reachable) continue;
+                type = EVENT_STILL_REACHABLE;
+                break;
+        }
+        AllocationEntry entry;
+        if (!alloc_table_find((void*)block->start, &entry) || (uintptr_t)entry.base != block->map_start) continue;
+        if (summarized) leak_report_add(type, &entry);
+        else send_weighted_event(type, entry.addr, entry.requested_size, entry.stack_id, entry.weight);
+    }
+    if (summarized) leak_report_end();
+}
+
+static void release_run(void) {
+    unmap_scratch(run.blocks, run.blocks_size);
+    unmap_scratch(run.mark_memory, run.mark_size);
+    unmap_scratch(run.worker_stacks, (size_t)scan_workers * WORKER_STACK_BYTES);
+    unmap_scratch(run.ranges, run.range_capacity * sizeof(ScanRange));
+    memset(&run, 0, sizeof(run));
+}
+
+/**
+ * @brief Runs a scan and reports its verdicts.
+ *
+ * @return 0 on success, -1 if scanning is disabled or failed, in which case nothing was reported.
+ */
+int leak_scan_run(void) {
+    if (!enabled) return -1;
+    // A runtime loaded after the wrapper may have taken the signal over since
+    struct sigaction current;
+    if (sigaction(suspend_signal, NULL, &current) != 0 || current.sa_sigaction != suspend_handler) {
+        disable_scan("the program took over the suspend signal, see MAPD_LEAK_SCAN_SIGNAL");
+        return -1;
+    }
+    pthread_mutex_lock(&scan_lock);
+    int result = 0;
+    if (alloc_table_count() > 0) {
+        result = prepare_run();
+        if (result == 0) result = mark_blocks();
+        if (result == 0) report_blocks();
+    }
+    release_run();
+    pthread_mutex_unlock(&scan_lock);
+    return result;
+}
@@ -0,0 +1,17 @@
+#ifndef LEAK_SCAN_H
+#define LEAK_SCAN_H
+
+#include <stddef.h>
+
+/**
+ * @file leak_scan.h
+ * @brief Reachability-based leak detection: tells lost blocks from ones still referenced.
+ */
+
+void leak_scan_init(void);
+void leak_scan_ignore(const void* start, size_t length);
+void leak_scan_unignore(const void* start);
+int leak_scan_run(void);
+void leak_scan_fault(void);
+
+#endif
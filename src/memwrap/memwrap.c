@@ -4,174 +4,392 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 #include <pthread.h>
 #include <time.h>
 #include <signal.h>
 #include <stdint.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include "memwrap.h"
+#include "transport.h"
+#include "alloc_table.h"
+#include "slab.h"
+#include "quarantine.h"
+#include "shadow.h"
+#include "stack.h"
+#include "sample.h"
+#include "guard_pool.h"
+#include "canary.h"
+#include "filter.h"
+#include "tracking.h"
+#include "interpose.h"
+#include "inherit.h"
+#include "leak_scan.h"
+#include "leak_report.h"
+#include "snapshot.h"
+#include "latency.h"
+#include "counters.h"
 #include "../analyzer/analyzer.h"
 
-#define SOCKET_PATH "/tmp/mapd_socket"
-#define MAX_TRACKED_ALLOCS 16384// 2¹⁴
-#define MAX_FREED_REGIONS 16384
 #define GUARD_THRESHOLD 1024
-#define HASH_MULTIPLIER 11400714819323198485llu  // 2⁶⁴ / golden ratio
+#define BOOTSTRAP_BYTES 4096
 
 /**
  * @file memwrap.c
  * @brief LD_PRELOAD-based memory wrapper to detect leaks, overflows, and dangling pointers.
  *
- * Tracks malloc/free activity via mmap/mprotect, logs events over a UNIX socket,
- * and installs a signal handler for runtime crash detection.
- * Supports runtime modes via MAPD_MODE (debug, test, perf).
+ * Tracks the malloc family (malloc, calloc, realloc, the aligned variants, free) via
+ * mmap/mprotect, logs events to the analyzer (see transport.c), and installs a signal
+ * handler for runtime crash detection.
+ * Supports runtime modes via MAPD_MODE (debug, test, perf, sample, count). The sampling mode
+ * tracks only the allocations picked by sample.c and hands the rest to the real allocator.
+ * Every mode but perf counts allocations in a page shared with the analyzer; the counting
+ * mode does nothing else (see counters.c).
+ * With MAPD_CANARY=1, test mode frames small blocks with canary redzones instead of giving
+ * them a mapping of their own (see canary.c).
+ * With MAPD_GUARD_SAMPLE_RATE, a few of the allocations handed to the real allocator are
+ * placed in guarded slots instead (see guard_pool.c).
+ * With MAPD_SLAB=1, small requests come from guarded slab cells instead (see slab.c).
+ * The analyzer can change the mode and most settings at runtime (see control.c), and
+ * narrow down the events sent (see filter.c). Tracking itself can be switched on and off
+ * while the program runs (see tracking.c). Forked and exec()ed children are traced as
+ * clients of their own (see inherit.c). Injected into a running process instead of
+ * preloaded, it redirects the process's calls to itself (see interpose.c). Leaks are told
+ * from blocks still in use by scanning memory for references to them (see leak_scan.c), and
+ * reported to binary analyzers aggregated by site (see leak_report.c). The live heap can be
+ * written to a snapshot file at any time (see snapshot.c). The time spent in the real
+ * allocator and in the wrapper's bookkeeping can be measured (see latency.c).
  */
 
 // Runtime modes
-enum MAPDMode { MODE_DEBUG, MODE_TEST, MODE_PERF };
+enum MAPDMode { MODE_DEBUG, MODE_TEST, MODE_PERF, MODE_SAMPLE, MODE_COUNT };
 static enum MAPDMode current_mode = MODE_TEST;
 
-static int sock_fd = -1;
 static void* (*real_malloc)(size_t) = NULL;
-static void* (*real_free)(void*) = NULL;
+static void (*real_free)(void*) = NULL;
+static void* (*real_calloc)(size_t, size_t) = NULL;
+static void* (*real_realloc)(void*, size_t) = NULL;
+static void* (*real_memalign)(size_t, size_t) = NULL;
+static int (*real_posix_memalign)(void**, size_t, size_t) = NULL;
+static size_t (*real_malloc_usable_size)(void*) = NULL;
+static int resolving = 0;
+static char bootstrap_heap[BOOTSTRAP_BYTES] __attribute__((aligned(16)));
+static atomic_size_t bootstrap_used = 0;
 static int tracking_enabled = 0;
-static volatile sig_atomic_t crashed = 0;
+static int tracking_started = 0;  // set when tracking is first switched on
+static __thread uint32_t cached_tid __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint32_t thread_seq __attribute__((tls_model("initial-exec"))) = 0;
+static __thread int thread_untracked __attribute__((tls_model("initial-exec"))) = 0;
+static atomic_uint_fast64_t event_seq = 0;
 
-typedef struct {
-    void* addr;
-    size_t requested_size;
-    size_t allocated_size;
-} AllocationEntry;
+const char* event_type_to_string(EventType type) {
+    return protocol_event_name(type);
+}
 
-static AllocationEntry allocations[MAX_TRACKED_ALLOCS];
-static int allocation_count = 0;
-static pthread_mutex_t allocation_lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief Whether the current mode hands every allocation to the real allocator and reports
+ * nothing: perf and counting mode.
+ */
+static int passthrough_mode(void) {
+    const enum MAPDMode mode = __atomic_load_n(&current_mode, __ATOMIC_RELAXED);
+    return mode == MODE_PERF || mode == MODE_COUNT;
+}
 
-static AllocationEntry freed_regions[MAX_FREED_REGIONS];
-static int freed_region_count = 0;
-static pthread_mutex_t freed_lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief Kernel id of the calling thread, fetched once per thread.
+ */
+static uint32_t current_tid(void) {
+    if (!cached_tid) cached_tid = (uint32_t)syscall(SYS_gettid);
+    return cached_tid;
+}
 
-const char* event_type_to_string(EventType type) {
-    switch (type) {
-        case EVENT_MALLOC: return "malloc";
-        case EVENT_FREE: return "free";
-        case EVENT_MEMORY_LEAK: return "memory_leak";
-        case EVENT_DANGLING_POINTER: return "dangling_pointer";
-        case EVENT_BUFFER_OVERFLOW: return "buffer_overflow";
-        case EVENT_DOUBLE_FREE: return "double_free";
-        case EVENT_FORCED_CRASH: return "forced_crash";
-        default: return "unknown";
-    }
+/**
+ * @brief pthread_atfork() child handler: the child's only thread has a new id and starts
+ * its own event numbering.
+ */
+static void forget_tid(void) {
+    cached_tid = 0;
+    thread_seq = 0;
+    atomic_store_explicit(&event_seq, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Bytes a block allocated now stands for: its sampling weight in the sampling mode, 0
+ * otherwise. Kept in the block's entry, so every later event of the block carries the same
+ * weight even if the mode changes meanwhile.
+ */
+static uint64_t allocation_weight(const size_t size) {
+    return current_mode == MODE_SAMPLE ? sample_weight(size) : 0;
 }
 
 /**
- * @brief Computes a well-distributed hash value from a pointer using Fibonacci hashing.
+ * @brief Whether events of this type currently reach the analyzer at all.
+ */
+int event_reportable(const EventType type) {
+    return filter_accepts_type(type) && transport_connected() && !passthrough_mode();
+}
+
+/**
+ * @brief Send a memory event in the format negotiated with the analyzer.
  *
- * This function transforms a pointer into a hash index suitable for open-addressed hash tables.
- * It uses Fibonacci hashing, a multiplicative hashing technique that spreads clustered inputs
- * (such as memory addresses) uniformly across the table. This is especially useful to reduce
- * collisions when tracking memory allocations where addresses are often aligned and sequential.
+ * @param type Event type (e.g., malloc, free, overflow).
+ * @param addr Pointer associated with the event.
+ * @param size Size of the memory involved (if relevant).
+ */
+void send_event(const EventType type, void* addr, const size_t size)
+{
+    send_stack_event(type, addr, size, 0);
+}
+
+/**
+ * @brief Send a memory event together with the id of its call stack (see stack.c).
  *
- * The result is scaled down by shifting to fit into the target hash table size defined
- * MAX_TRACKED_ALLOCS.
+ * @param stack_id Depot id of the relevant stack, 0 if none.
+ */
+void send_stack_event(const EventType type, void* addr, const size_t size, const uint32_t stack_id)
+{
+    send_weighted_event(type, addr, size, stack_id, 0);
+}
+
+/**
+ * @brief Send a memory event with its call stack and the bytes it stands for in the sampling mode.
  *
- * @param ptr Memory address to be hashed (e.g., an allocation address).
- * @return Hash index in the range [0, 2^14 - 1]
+ * The binary path builds a fixed-size record with no formatting. JSON lines carry no
+ * stack. Not async-signal-safe: events are staged under locks, see send_fatal_event().
+ *
+ * Callers send an allocation's event before returning its pointer and a free's before
+ * releasing the block, so numbering here orders the events of each address causally.
+ * Event types the analyzer filtered out are dropped first; lifetime events of blocks
+ * muted by the block filter are not sent by the callers at all.
+ *
+ * @param stack_id Depot id of the relevant stack, 0 if none.
+ * @param weight Sampling weight of the block the event describes (AllocationEntry.weight), 0 if none.
+ */
+void send_weighted_event(const EventType type, void* addr, const size_t size, const uint32_t stack_id,
+                         const uint64_t weight)
+{
+    if (!event_reportable(type)) return;
+    if (!transport_accepts_event(type, addr)) return;
+    const int64_t start = latency_start();
+    if (transport_format() != PROTOCOL_FORMAT_BINARY) {
+        send_json_event(type, addr, size, weight);
+        latency_record(LATENCY_EVENT_SEND, start);
+        return;
+    }
+
+    const EventRecord record = {
+        .type = type,
+        .stack_id = stack_id,
+        .addr = (uintptr_t)addr,
+        .size = size,
+        .thread = current_tid(),
+        .timestamp = protocol_clock_ns(CLOCK_MONOTONIC),
+        .weight = weight,
+        .seq = atomic_fetch_add_explicit(&event_seq, 1, memory_order_relaxed) + 1,
+        .thread_seq = ++thread_seq
+    };
+    transport_send_record(&record);
+    latency_record(LATENCY_EVENT_SEND, start);
+}
+
+/**
+ * @brief Formats an event as one line of JSON.
+ *
+ * Without the handshake's clock anchor, timestamps are wall-clock: seconds, and nanoseconds
+ * since the epoch.
+ *
+ * @return Length of the line, without the terminating NUL.
  */
-unsigned long hash_ptr(void* ptr) {
-    return (((uintptr_t)ptr) * HASH_MULTIPLIER) >> (64 - 14);
+static size_t format_json_event(char* msg, const size_t capacity, const EventType type, void* addr,
+                                const size_t size, const uint64_t weight)
+{
+    const int64_t now_ns = protocol_clock_ns(CLOCK_REALTIME);
+    const int length = snprintf(msg, capacity,
+        "{ \"type\": \"%s\", \"addr\": \"%p\", \"size\": %zu, \"thread\": %u, \"timestamp\": %lld, "
+        "\"timestamp_ns\": %lld, \"weight\": %lu }\n",
+        event_type_to_string(type), addr, size, current_tid(), (long long)(now_ns / 1000000000),
+        (long long)now_ns, (unsigned long)weight);
+    return length < 0 ? 0 : length < (int)capacity ? (size_t)length : capacity - 1;
 }
 
 /**
  * @brief Send a memory event as newline-delimited JSON over the UNIX socket.
  *
+ * Fallback encoding for analyzers that do not answer the binary handshake.
+ *
  * @param type Event type (e.g., malloc, free, overflow).
  * @param addr Pointer associated with the event.
  * @param size Size of the memory involved (if relevant).
+ * @param weight Sampling weight, see send_weighted_event().
  */
-void send_json_event(const EventType type, void* addr, const size_t size)
+void send_json_event(const EventType type, void* addr, const size_t size, const uint64_t weight)
 {
-    if (sock_fd == -1 || current_mode == MODE_PERF) return;
+    if (!transport_connected() || passthrough_mode()) return;
     char msg[512];
-    snprintf(msg, sizeof(msg),
-        "{ \"type\": \"%s\", \"addr\": \"%p\", \"size\": %zu, \"thread\": %lu, \"timestamp\": %ld }\n",
-        event_type_to_string(type), addr, size,
-    (unsigned long)pthread_self(), time(NULL));
-    write(sock_fd, msg, strlen(msg));
+    const size_t length = format_json_event(msg, sizeof(msg), type, addr, size, weight);
+    transport_send_raw(msg, length, type != EVENT_MALLOC && type != EVENT_FREE);
+}
+
+/**
+ * @brief Send an event describing the memory violation that is about to end the process.
+ *
+ * Async-signal-safe counterpart of send_stack_event() for handle_segv(): the event skips
+ * the staging buffers and the locks of the transport (see transport_send_fatal()), so it
+ * is delivered even if the faulting thread held one of them. The JSON line is formatted
+ * with snprintf(), which is not on the POSIX list of async-signal-safe functions, but
+ * neither allocates nor locks for these conversions.
+ */
+static void send_fatal_event(const EventType type, void* addr, const size_t size, const uint32_t stack_id)
+{
+    if (!event_reportable(type)) return;
+    if (transport_format() != PROTOCOL_FORMAT_BINARY) {
+        char msg[512];
+        transport_write_fatal(msg, format_json_event(msg, sizeof(msg), type, addr, size, 0));
+        return;
+    }
+
+    const EventRecord record = {
+        .type = type,
+        .stack_id = stack_id,
+        .addr = (uintptr_t)addr,
+        .size = size,
+        .thread = current_tid(),
+        .timestamp = protocol_clock_ns(CLOCK_MONOTONIC),
+        .seq = atomic_fetch_add_explicit(&event_seq, 1, memory_order_relaxed) + 1,
+        .thread_seq = ++thread_seq
+    };
+    transport_send_fatal(&record);
+}
+
+static int report_leak(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (!entry->muted)
+        send_weighted_event(EVENT_MEMORY_LEAK, entry->addr, entry->requested_size, entry->stack_id, entry->weight);
+    return 0;
+}
+
+static int summarize_leak(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (!entry->muted) leak_report_add(EVENT_MEMORY_LEAK, entry);
+    return 0;
+}
+
+static int report_live(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (!entry->muted)
+        send_weighted_event(EVENT_LIVE_BLOCK, entry->addr, entry->requested_size, entry->stack_id, entry->weight);
+    return 0;
+}
+
+/**
+ * @brief Reports every tracked block that is still allocated, for a snapshot requested by
+ * the analyzer. Guard pool slots are not included.
+ */
+void report_live_blocks(void) {
+    alloc_table_for_each(report_live, NULL);
 }
 
 /**
  * @brief Scan the allocation table and report unfreed memory blocks.
  *
  * This function iterates through all entries in the allocation hash table
- * and sends a `memory_leak` event for each entry that was allocated but
- * not freed. It is typically called during program shutdown (via destructor)
- * to detect memory leaks.
+ * and reports each entry that was allocated but not freed as a `memory_leak`:
+ * aggregated into a leak summary for binary analyzers, one event per block
+ * for JSON ones. It is called during program shutdown (via destructor) when
+ * leaks cannot be told from reachable blocks (see leak_scan.c).
  *
- * Thread-safe: acquires the allocation lock to ensure consistent view of the table.
+ * Thread-safe: the table locks one shard at a time while it is walked; only
+ * JSON events are sent with a shard lock held.
  */
 void detect_memory_leaks() {
-    pthread_mutex_lock(&allocation_lock);
-    for (int i = 0; i < MAX_TRACKED_ALLOCS; ++i) {
-        if (allocations[i].addr != NULL)
-        {
-            send_json_event(EVENT_MEMORY_LEAK, allocations[i].addr, allocations[i].requested_size);
-        }
+    if (leak_report_begin(alloc_table_count()) != 0) {
+        alloc_table_for_each(report_leak, NULL);
+        return;
     }
-    pthread_mutex_unlock(&allocation_lock);
+    alloc_table_for_each(summarize_leak, NULL);
+    leak_report_end();
 }
 
 /**
  * @brief SIGSEGV handler to detect and report dangling pointer or buffer overflow errors.
  *
- * Checks faulting address against known freed and allocated regions,
- * sends appropriate events, and terminates the process cleanly.
+ * Classifies the faulting address through the shadow map (see shadow.c), which takes
+ * no locks and costs the same however many blocks are tracked, sends the appropriate
+ * events, and terminates the process. Only async-signal-safe calls are made: the fault
+ * may hit while this thread holds a lock of the allocator or of the transport, so the
+ * events bypass staging (see send_fatal_event()) and the process ends with _exit(),
+ * without running destructors. Events other threads had staged but not yet written in
+ * socket mode are lost; the ring has no staging.
  */
 void handle_segv(int sig __attribute__((unused)), siginfo_t* info, void* context __attribute__((unused))) {
-    const void* fault_addr = info->si_addr;
-
-    // Check for dangling pointer
-    pthread_mutex_lock(&freed_lock);
-    for (int i = 0; i < freed_region_count; ++i) {
-        void* start = freed_regions[i].addr;
-        void* end = (void*)((uintptr_t)start + freed_regions[i].allocated_size);
-        if (fault_addr >= start && fault_addr < end) {
-            send_json_event(EVENT_DANGLING_POINTER, start, freed_regions[i].requested_size);
-            send_json_event(EVENT_FORCED_CRASH, start, freed_regions[i].requested_size);
-            munmap(start, freed_regions[i].allocated_size);
-            freed_regions[i] = freed_regions[--freed_region_count];
-            goto exit_crash;
-        }
-    }
-    pthread_mutex_unlock(&freed_lock);
-
-    // Check for buffer overflow
-    pthread_mutex_lock(&allocation_lock);
-    size_t pagesize = sysconf(_SC_PAGESIZE);
-    for (int i = 0; i < MAX_TRACKED_ALLOCS; i++) {
-        void* guard = (void*)((uintptr_t)allocations[i].addr + allocations[i].allocated_size - pagesize);
-        void* end = (void*)((uintptr_t)guard + pagesize);
-        if (fault_addr >= guard && fault_addr < end) {
-            send_json_event(EVENT_BUFFER_OVERFLOW, allocations[i].addr, allocations[i].requested_size);
-            send_json_event(EVENT_FORCED_CRASH, allocations[i].addr, allocations[i].requested_size);
+    void* block = NULL;
+    size_t size = 0;
+    uint32_t stack_id = 0;
+
+    leak_scan_fault();  // returns unless a leak scan read a block freed meanwhile
+    switch (shadow_lookup(info->si_addr, &block, &size, &stack_id)) {
+        case SHADOW_FREED:
+            send_fatal_event(EVENT_DANGLING_POINTER, block, size, stack_id);
+            send_fatal_event(EVENT_FORCED_CRASH, block, size, stack_id);
+            break;
+        case SHADOW_GUARD:
+            send_fatal_event(EVENT_BUFFER_OVERFLOW, block, size, stack_id);
+            send_fatal_event(EVENT_FORCED_CRASH, block, size, stack_id);
+            break;
+        default:
             break;
-        }
     }
-    pthread_mutex_unlock(&allocation_lock);
 
-exit_crash:
-    fprintf(stderr, "[Wrapper] Error: Crashing due to memory violation.\n");
-    fsync(sock_fd);
-    usleep(10000);
-    if (sock_fd != -1) close(sock_fd);
-    crashed = 1;
-    exit(EXIT_FAILURE);
+    static const char message[] = "[Wrapper] Error: Crashing due to memory violation.\n";
+    const ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)written;
+    _exit(EXIT_FAILURE);
 }
 
-void enable_tracking() {
-    tracking_enabled = 1;
+/**
+ * @brief Switches tracking on or off; safe in a signal handler.
+ *
+ * @return 1 if this changed the setting.
+ */
+int set_tracking(const int on) {
+    // Published before the switch, see pointer_untracked()
+    if (on) __atomic_store_n(&tracking_started, 1, __ATOMIC_RELEASE);
+    return __atomic_exchange_n(&tracking_enabled, on, __ATOMIC_ACQ_REL) != on;
+}
+
+int tracking_active(void) {
+    return __atomic_load_n(&tracking_enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Opens a tracking window from the program itself.
+ */
+MEMWRAP_API void enable_tracking() {
+    tracking_switch(1);
+}
+
+MEMWRAP_API void disable_tracking() {
+    tracking_switch(0);
+}
+
+/**
+ * @brief Switches the runtime mode on request of the analyzer.
+ *
+ * New allocations follow the new mode while blocks from the old one are still live; free()
+ * and friends tell them apart by ownership, not by the mode (see pointer_untracked()).
+ */
+void switch_mode(const ControlMode mode) {
+    enum MAPDMode next;
+    switch (mode) {
+        case CONTROL_MODE_DEBUG: next = MODE_DEBUG; break;
+        case CONTROL_MODE_TEST: next = MODE_TEST; break;
+        case CONTROL_MODE_PERF: next = MODE_PERF; break;
+        case CONTROL_MODE_SAMPLE: next = MODE_SAMPLE; break;
+        case CONTROL_MODE_COUNT: next = MODE_COUNT; break;
+        default: return;
+    }
+    __atomic_store_n(&current_mode, next, __ATOMIC_RELAXED);
+    counters_set_paused(next == MODE_PERF);
 }
 
 /**
@@ -187,128 +405,589 @@ void setup_connection() {
     if (mode_env) {
         if (strcmp(mode_env, "test") == 0) current_mode = MODE_TEST;
         else if (strcmp(mode_env, "perf") == 0) current_mode = MODE_PERF;
+        else if (strcmp(mode_env, "sample") == 0) current_mode = MODE_SAMPLE;
+        else if (strcmp(mode_env, "count") == 0) current_mode = MODE_COUNT;
         else current_mode = MODE_DEBUG;
     }
-    sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sock_fd == -1) return;
-
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
-
-    if (connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        close(sock_fd);
-        sock_fd = -1;
-    } else {
-        fprintf(stderr, "[Wrapper] Connected to analyzer.\n");
+    counters_init();
+    counters_set_paused(current_mode == MODE_PERF);
+    slab_init();
+    quarantine_init();
+    stack_init();
+    filter_init();
+    sample_init();
+    if (current_mode == MODE_TEST) canary_init();
+    pthread_atfork(NULL, NULL, forget_tid);
+    inherit_init();
+    leak_scan_init();
+    if (!passthrough_mode()) guard_pool_init();
+    if (transport_connect() == 0) {
+        fprintf(stderr, "[Wrapper] Connected to analyzer (%s).\n", transport_name());
     }
+    tracking_init();
+    snapshot_init();
+    latency_init();
 
     struct sigaction sa = {0};
     sa.sa_flags = SA_SIGINFO;
     sa.sa_sigaction = handle_segv;
     sigaction(SIGSEGV, &sa, NULL);
+
+    // Loaded by mapd-attach: nothing is bound to us yet
+    if (interpose_needed()) {
+        const int patched = interpose_patch();
+        if (patched < 0) fprintf(stderr, "[Wrapper] Could not redirect the allocator.\n");
+        else fprintf(stderr, "[Wrapper] Redirected %d allocator references.\n", patched);
+    }
 }
 
 /**
- * @brief Replacement for malloc(), using mmap and optional guard pages.
+ * @brief Whether allocations currently go straight to the real allocator.
+ */
+int tracking_bypassed(void) {
+    return thread_untracked || !__atomic_load_n(&tracking_enabled, __ATOMIC_ACQUIRE) || passthrough_mode();
+}
+
+/**
+ * @brief Sends the calling thread's allocations to the real allocator while `on` is set,
+ * for what libc allocates on the wrapper's behalf (see leak_scan.c).
+ */
+void set_thread_untracked(const int on) {
+    thread_untracked = on;
+}
+
+/**
+ * @brief Whether a new allocation of `size` bytes goes to the real allocator: tracking is
+ * bypassed, or the sampling mode did not pick it.
+ */
+int allocation_untracked(const size_t size) {
+    if (tracking_bypassed()) return 1;
+    return current_mode == MODE_SAMPLE && !sample_hit(size);
+}
+
+/**
+ * @brief Whether ptr belongs to the real allocator rather than to us.
+ *
+ * Blocks allocated outside a tracking window, by the sampling mode's unsampled requests or
+ * in another mode are all the real allocator's, so ownership is decided by the block
+ * itself: the lock-free shadow map knows every tracked block, and keeps the pages of
+ * blocks that left the quarantine as retired until the real allocator hands them out
+ * (see adopt_real_block()), so a late double free never reaches the real free(). Canary
+ * blocks, which are not in the shadow map, are recognised by their redzone.
+ */
+int pointer_untracked(const void* ptr) {
+    // A thread that sees a tracked block also sees tracking_started
+    if (!__atomic_load_n(&tracking_started, __ATOMIC_ACQUIRE)) return 1;
+    return shadow_lookup(ptr, NULL, NULL, NULL) == SHADOW_NONE && !canary_owns(ptr);
+}
+
+/**
+ * @brief Hands out static memory while dlsym() is resolving the real allocator.
  *
- * Applies runtime mode logic: falls back to real malloc in perf mode.
- * Otherwise, uses mmap (with guard page depending on alloc size) for overflow detection.
+ * dlsym() may itself allocate; those requests cannot be forwarded yet, and are never freed.
+ */
+static void* bootstrap_alloc(const size_t size) {
+    const size_t rounded = (size + 15) & ~(size_t)15;
+    const size_t offset = atomic_fetch_add(&bootstrap_used, rounded);
+    if (offset + rounded > BOOTSTRAP_BYTES) return NULL;
+    return bootstrap_heap + offset;
+}
+
+static int from_bootstrap(const void* ptr) {
+    return (const char*)ptr >= bootstrap_heap && (const char*)ptr < bootstrap_heap + BOOTSTRAP_BYTES;
+}
+
+/**
+ * @brief Looks up the next definition of every interposed allocation function.
+ */
+static void resolve_real_functions(void) {
+    if (real_malloc || resolving) return;
+    resolving = 1;
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    resolving = 0;
+}
+
+/**
+ * @brief Makes the last page of a mapped block a guard page, depending on mode and size.
  */
-void* malloc(size_t size) {
-    if (!tracking_enabled || current_mode == MODE_PERF) {
-        if (!real_malloc) real_malloc = dlsym(RTLD_NEXT, "malloc");
-        return real_malloc(size);
+static void protect_guard(const AllocationEntry* entry, const size_t pagesize) {
+    if (entry->requested_size >= GUARD_THRESHOLD || current_mode == MODE_DEBUG) {
+        void* guard = (void*)((uintptr_t)entry->base + entry->allocated_size - pagesize);
+        mprotect(guard, pagesize, PROT_NONE);
     }
+}
 
+/**
+ * @brief Maps a block of its own for a request, followed by a guard page.
+ *
+ * Alignments above the page size are met by mapping `alignment - pagesize` extra bytes
+ * and placing the user pointer at the first aligned address.
+ */
+static void* map_block(const size_t size, const size_t alignment, AllocationEntry* entry) {
     const size_t pagesize = sysconf(_SC_PAGESIZE);
+    const size_t slack = alignment > pagesize ? alignment - pagesize : 0;
+    if (size > SIZE_MAX - slack - 2 * pagesize) return NULL;
+
     const size_t usable = ((size + pagesize - 1) / pagesize) * pagesize;
-    const size_t total = usable + pagesize;
+    const size_t total = usable + slack + pagesize;
 
+    const int64_t start = latency_start();
     void* base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    latency_record(LATENCY_BLOCK_MAP, start);
     if (base == MAP_FAILED) return NULL;
 
-    if (size >= GUARD_THRESHOLD)
-    {
-        void* guard = (void*)((uintptr_t)base + usable);
-        mprotect(guard, pagesize, PROT_NONE);
-    } else if (current_mode == MODE_DEBUG)
-    {
-        void* guard = (void*)((uintptr_t)base + usable);
-        mprotect(guard, pagesize, PROT_NONE);
+    entry->base = base;
+    entry->allocated_size = total;
+    entry->kind = BLOCK_MMAP;
+    protect_guard(entry, pagesize);
+
+    if (!slack) return base;
+    return (void*)(((uintptr_t)base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+/**
+ * @brief Allocates a tracked block: a slab cell when slabs are enabled and it fits, else a mapping.
+ *
+ * @param alignment Required alignment of the user pointer, 0 for the malloc() default.
+ * @param zero Whether the memory must read as zero; fresh mappings already do.
+ * @param family Allocation API used, checked again when the block is released.
+ */
+void* tracked_alloc(const size_t size, const size_t alignment, const int zero, const AllocFamily family) {
+    AllocationEntry entry = {
+        .requested_size = size, .family = family, .stack_id = stack_capture(), .muted = filter_mutes_block(size),
+        .thread = current_tid(), .allocated_ns = protocol_clock_ns(CLOCK_MONOTONIC),
+        .weight = allocation_weight(size)
+    };
+    if (size <= slab_max_size()) entry.addr = slab_alloc(size, alignment, &entry);
+    if (entry.addr && zero) memset(entry.addr, 0, size);
+    if (!entry.addr && current_mode == MODE_TEST && canary_enabled() && size < GUARD_THRESHOLD && alignment <= 16) {
+        entry.addr = canary_alloc(size, zero, &entry);
+    }
+    if (!entry.addr) entry.addr = map_block(size, alignment, &entry);
+    if (!entry.addr) {
+        errno = ENOMEM;
+        return NULL;
     }
 
-    pthread_mutex_lock(&allocation_lock);
-    const unsigned long h = hash_ptr(base);
-    unsigned long idx;
-    for (int i = 0; i < MAX_TRACKED_ALLOCS; i++) {
-        idx = (h + i) % MAX_TRACKED_ALLOCS;
-        if (allocations[idx].addr == NULL) {
-            allocations[idx] = (AllocationEntry){base, size, total};
-            allocation_count++;
-            break;
-        }
+    if (alloc_table_insert(&entry) == -1) {
+        if (entry.kind == BLOCK_CANARY) canary_discard(&entry);
+        else quarantine_release(&entry);
+        errno = ENOMEM;
+        return NULL;
     }
-    pthread_mutex_unlock(&allocation_lock);
+    // Canary blocks share pages with the real allocator and stay out of the page-level shadow map
+    if (entry.kind != BLOCK_CANARY) shadow_mark_live(&entry);
+    counters_alloc(size);
 
-    send_json_event(EVENT_MALLOC, base, size);
-    return base;
+    if (!entry.muted) send_weighted_event(EVENT_MALLOC, entry.addr, size, entry.stack_id, entry.weight);
+    return entry.addr;
 }
 
 /**
- * @brief Replacement for free(), applies PROT_NONE to detect use-after-free.
+ * @brief Applies PROT_NONE to a block that is no longer tracked and moves it into the
+ * quarantine (see quarantine.c). If mprotect fails, the block is released right away.
+ * Canary blocks are checked and poisoned instead.
+ */
+static void retire_block(const AllocationEntry* entry) {
+    if (entry->kind == BLOCK_CANARY) {
+        canary_retire(entry);
+        quarantine_push(entry);
+        return;
+    }
+    if (mprotect(entry->base, entry->allocated_size, PROT_NONE) == 0) {
+        shadow_mark_freed(entry);
+        quarantine_push(entry);
+    } else {
+        quarantine_release(entry);
+    }
+}
+
+/**
+ * @brief Releases a tracked block, reporting double frees and family or size mismatches.
  *
- * Adds the freed region to a tracking list. If mprotect fails, region is unmapped.
+ * @param family Allocation API the caller belongs to (free() or one of the deletes).
+ * @param size Size passed to a sized delete, UNKNOWN_SIZE otherwise.
  */
-void free(void* ptr) {
-    if (!tracking_enabled || ptr == NULL || current_mode == MODE_PERF) {
-        if (!real_free) real_free = dlsym(RTLD_NEXT, "free");
-        real_free(ptr);
+void tracked_free(void* ptr, const AllocFamily family, const size_t size) {
+    AllocationEntry entry;
+    if (!alloc_table_remove(ptr, &entry)) {
+        send_stack_event(EVENT_DOUBLE_FREE, ptr, 0, stack_capture());
         return;
     }
 
-    int found = 0;
-    size_t requested = 0, alloc_size = 0;
-
-    pthread_mutex_lock(&allocation_lock);
-    const unsigned long h = hash_ptr(ptr);
-    unsigned long idx;
-    for (int i = 0; i < MAX_TRACKED_ALLOCS; i++)
-    {
-        idx = (h + i) % MAX_TRACKED_ALLOCS;
-        if (allocations[idx].addr == ptr)
-        {
-            requested = allocations[idx].requested_size;
-            alloc_size = allocations[idx].allocated_size;
-            allocations[idx].addr = NULL;
-            found = 1;
-            allocation_count--;
-            break;
+    if (entry.family != family || (size != UNKNOWN_SIZE && size != entry.requested_size)) {
+        send_stack_event(EVENT_ALLOC_MISMATCH, ptr, entry.requested_size, stack_capture());
+    }
+    counters_free(entry.requested_size);
+    if (!entry.muted) send_weighted_event(EVENT_FREE, ptr, entry.requested_size, 0, entry.weight);
+    retire_block(&entry);
+}
+
+/**
+ * @brief Resizes a block without copying through a new allocation, if its layout allows.
+ *
+ * A slab object that still fits its cell moves to its new end-aligned position inside
+ * the cell. A mapped block is resized with mremap(), which moves page table entries
+ * rather than bytes; its guard page is unprotected first, because mremap() only works
+ * on a range with uniform protection, and re-applied at the new end afterwards.
+ * Blocks mapped with extra alignment slack are left to the copying path.
+ *
+ * @param entry Untracked entry of the block, updated on success.
+ * @return The new user pointer, or NULL if the caller has to copy.
+ */
+static void* resize_block(AllocationEntry* entry, const size_t size) {
+    const size_t old_size = entry->requested_size;
+    if (entry->kind == BLOCK_CANARY) return NULL;
+
+    if (entry->kind == BLOCK_SLAB) {
+        char* moved = slab_place(entry, size);
+        if (!moved) return NULL;
+        memmove(moved, entry->addr, old_size < size ? old_size : size);
+        entry->addr = moved;
+        entry->requested_size = size;
+        shadow_mark_live(entry);
+        return moved;
+    }
+
+    if (entry->addr != entry->base) return NULL;
+
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - 2 * pagesize) return NULL;
+    const size_t total = ((size + pagesize - 1) / pagesize) * pagesize + pagesize;
+
+    if (total == entry->allocated_size) {
+        entry->requested_size = size;
+        protect_guard(entry, pagesize);
+        shadow_mark_live(entry);
+        return entry->addr;
+    }
+
+    void* guard = (void*)((uintptr_t)entry->base + entry->allocated_size - pagesize);
+    if (mprotect(guard, pagesize, PROT_READ | PROT_WRITE) != 0) return NULL;
+    shadow_mark_retired(entry);
+
+    void* moved = mremap(entry->base, entry->allocated_size, total, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        protect_guard(entry, pagesize);
+        shadow_mark_live(entry);
+        return NULL;
+    }
+
+    entry->addr = entry->base = moved;
+    entry->allocated_size = total;
+    entry->requested_size = size;
+    protect_guard(entry, pagesize);
+    shadow_mark_live(entry);
+    return moved;
+}
+
+/**
+ * @brief Takes in a block the real allocator just handed out: counts it (see counters.c),
+ * with its usable size so its free adds up the same, and clears the retired shadow mark
+ * a block we released there may have left on its page.
+ */
+static void adopt_real_block(void* ptr) {
+    if (!ptr) return;
+    if (tracking_started) shadow_forget(ptr);
+    if (counters_active) counters_alloc(real_malloc_usable_size(ptr));
+}
+
+static void count_real_free(void* ptr) {
+    if (counters_active && ptr) counters_free(real_malloc_usable_size(ptr));
+}
+
+/**
+ * @brief Allocates from the real allocator after allocation_untracked() said so, without
+ * drawing another sample. Now and then the block goes to the guard pool instead.
+ *
+ * @param family Allocation API used, checked again if the block lands in the guard pool.
+ */
+void* untracked_alloc(const size_t size, const size_t alignment, const AllocFamily family) {
+    if (guard_pool_hit()) {
+        void* pooled = guard_pool_alloc(size, alignment, family);
+        if (pooled) {
+            counters_alloc(size);
+            return pooled;
         }
     }
-    pthread_mutex_unlock(&allocation_lock);
+    resolve_real_functions();
+    if (!real_malloc) return bootstrap_alloc(size);
+    const int64_t start = latency_start();
+    void* ptr = alignment ? real_memalign(alignment, size) : real_malloc(size);
+    latency_record(LATENCY_REAL_ALLOC, start);
+    adopt_real_block(ptr);
+    return ptr;
+}
 
-    if (!found) {
-        send_json_event(EVENT_DOUBLE_FREE, ptr, 0);
-        return;
+/**
+ * @brief Allocates straight from the real allocator, for memory the wrapper manages itself.
+ */
+void* heap_alloc(const size_t size) {
+    resolve_real_functions();
+    if (!real_malloc) return bootstrap_alloc(size);
+    const int64_t start = latency_start();
+    void* ptr = real_malloc(size);
+    latency_record(LATENCY_REAL_ALLOC, start);
+    return ptr;
+}
+
+void heap_free(void* ptr) {
+    if (from_bootstrap(ptr)) return;
+    resolve_real_functions();
+    const int64_t start = latency_start();
+    real_free(ptr);
+    latency_record(LATENCY_REAL_FREE, start);
+}
+
+/**
+ * @brief Replacement for malloc(), using mmap and optional guard pages.
+ *
+ * Applies runtime mode logic: falls back to real malloc in perf mode, and for allocations
+ * the sampling mode does not pick.
+ * Otherwise, uses mmap (with guard page depending on alloc size) for overflow detection,
+ * or a slab cell that always has a guard page when slabs are enabled.
+ */
+MEMWRAP_API void* malloc(size_t size) {
+    if (allocation_untracked(size)) return untracked_alloc(size, 0, FAMILY_MALLOC);
+    return tracked_alloc(size, 0, 0, FAMILY_MALLOC);
+}
+
+/**
+ * @brief Replacement for calloc(); only slab cells need clearing, mappings start zeroed.
+ */
+MEMWRAP_API void* calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (allocation_untracked(total)) {
+        void* pooled = guard_pool_hit() ? guard_pool_alloc(total, 0, FAMILY_MALLOC) : NULL;
+        if (pooled) {
+            counters_alloc(total);
+            return memset(pooled, 0, total);
+        }
+        resolve_real_functions();
+        if (!real_calloc) return bootstrap_alloc(total);
+        const int64_t start = latency_start();
+        void* ptr = real_calloc(nmemb, size);
+        latency_record(LATENCY_REAL_ALLOC, start);
+        adopt_real_block(ptr);
+        return ptr;
     }
+    return tracked_alloc(total, 0, 1, FAMILY_MALLOC);
+}
 
-    send_json_event(EVENT_FREE, ptr, requested);
+/**
+ * @brief realloc() of a block the real allocator owns. Like glibc's, a size of 0 frees it.
+ */
+static void* untracked_realloc(void* ptr, const size_t size) {
+    resolve_real_functions();
+    const size_t old_size = counters_active ? real_malloc_usable_size(ptr) : 0;
+    const int64_t start = latency_start();
+    void* resized = real_realloc(ptr, size);
+    latency_record(LATENCY_REAL_ALLOC, start);
+    if (resized || size == 0) counters_free(old_size);
+    adopt_real_block(resized);
+    return resized;
+}
+
+/**
+ * @brief realloc() of a guard pool block: the slot cannot grow, so the data always moves.
+ */
+static void* realloc_from_pool(void* ptr, const size_t size) {
+    if (size == 0) {
+        guard_pool_free(ptr, FAMILY_MALLOC, UNKNOWN_SIZE);
+        return NULL;
+    }
 
-    if (mprotect(ptr, alloc_size, PROT_NONE) == 0) {
-        pthread_mutex_lock(&freed_lock);
-        if (freed_region_count < MAX_FREED_REGIONS) {
-            freed_regions[freed_region_count++] = (AllocationEntry){
-                .addr = ptr,
-                .requested_size = requested,
-                .allocated_size = alloc_size
-            };
+    // A freed slot reports 0 bytes: nothing is copied and guard_pool_free() reports the double free
+    const size_t old_size = guard_pool_usable_size(ptr);
+    void* fresh = malloc(size);
+    if (!fresh) return NULL;
+    memcpy(fresh, ptr, old_size < size ? old_size : size);
+    guard_pool_free(ptr, FAMILY_MALLOC, UNKNOWN_SIZE);
+    return fresh;
+}
+
+/**
+ * @brief Hands a resized block the allocation table could not take over to the real allocator.
+ *
+ * resize_block() has already changed the block, so failing the realloc() would leave the
+ * caller without valid memory. The contents move to a block of the real allocator instead,
+ * untracked from then on, and ours is released. Only if that fails too is ENOMEM returned.
+ */
+static void* untrack_resized(const AllocationEntry* entry) {
+    resolve_real_functions();
+    void* moved = real_malloc ? real_malloc(entry->requested_size) : NULL;
+    if (moved) {
+        memcpy(moved, entry->addr, entry->requested_size);
+        adopt_real_block(moved);
+    } else {
+        errno = ENOMEM;
+    }
+    quarantine_release(entry);
+    return moved;
+}
+
+/**
+ * @brief Replacement for realloc(), resizing in place where the block layout allows.
+ *
+ * Reported to the analyzer as a free of the old block followed by a malloc of the new one.
+ * The old block of a copying realloc goes through the quarantine like any freed block.
+ * Pointers allocated before tracking started are handed to the real realloc().
+ */
+MEMWRAP_API void* realloc(void* ptr, size_t size) {
+    if (from_bootstrap(ptr)) {
+        void* fresh = malloc(size);
+        const size_t available = bootstrap_heap + BOOTSTRAP_BYTES - (char*)ptr;
+        if (fresh) memcpy(fresh, ptr, size < available ? size : available);
+        return fresh;
+    }
+    if (ptr == NULL) return malloc(size);
+    if (guard_pool_owns(ptr)) return realloc_from_pool(ptr, size);
+    if (pointer_untracked(ptr)) {
+        return untracked_realloc(ptr, size);
+    }
+    if (size == 0) {
+        tracked_free(ptr, FAMILY_MALLOC, UNKNOWN_SIZE);
+        return NULL;
+    }
+
+    AllocationEntry entry;
+    if (!alloc_table_remove(ptr, &entry)) {
+        if (shadow_lookup(ptr, NULL, NULL, NULL) != SHADOW_NONE) {
+            send_stack_event(EVENT_DOUBLE_FREE, ptr, 0, stack_capture());
+            return NULL;
         }
-        pthread_mutex_unlock(&freed_lock);
-        return;
+        return untracked_realloc(ptr, size);
+    }
+    if (entry.family != FAMILY_MALLOC) {
+        send_stack_event(EVENT_ALLOC_MISMATCH, ptr, entry.requested_size, stack_capture());
+        entry.family = FAMILY_MALLOC;
+    }
+
+    const AllocationEntry old = entry;
+    entry.stack_id = stack_capture();
+    entry.muted = filter_mutes_block(size);
+    entry.thread = current_tid();
+    entry.allocated_ns = protocol_clock_ns(CLOCK_MONOTONIC);
+    entry.weight = allocation_weight(size);
+    void* resized = resize_block(&entry, size);
+    if (resized) {
+        counters_free(old.requested_size);
+        if (!old.muted) send_weighted_event(EVENT_FREE, ptr, old.requested_size, 0, old.weight);
+        if (alloc_table_insert(&entry) == -1) return untrack_resized(&entry);
+        counters_alloc(size);
+        if (!entry.muted) send_weighted_event(EVENT_MALLOC, resized, size, entry.stack_id, entry.weight);
+        return resized;
     }
 
-    munmap(ptr, alloc_size);  // fallback
+    void* fresh = tracked_alloc(size, 0, 0, FAMILY_MALLOC);
+    if (!fresh) {
+        alloc_table_insert(&old);
+        return NULL;
+    }
+    memcpy(fresh, ptr, old.requested_size < size ? old.requested_size : size);
+    counters_free(old.requested_size);
+    if (!old.muted) send_weighted_event(EVENT_FREE, ptr, old.requested_size, 0, old.weight);
+    retire_block(&old);
+    return fresh;
+}
+
+MEMWRAP_API void* reallocarray(void* ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+/**
+ * @brief Replacement for posix_memalign(); slab cells serve alignments up to the page size.
+ */
+MEMWRAP_API int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void* ptr = allocation_untracked(size) ? untracked_alloc(size, alignment, FAMILY_MALLOC)
+                                           : tracked_alloc(size, alignment, 0, FAMILY_MALLOC);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+/**
+ * @brief Replacement for memalign(); like glibc, rounds alignments up to a power of two.
+ */
+MEMWRAP_API void* memalign(size_t alignment, size_t size) {
+    if (alignment & (alignment - 1)) {
+        if (alignment > SIZE_MAX / 2 + 1) {
+            errno = EINVAL;
+            return NULL;
+        }
+        alignment = (size_t)1 << (64 - __builtin_clzl(alignment));
+    }
+    if (allocation_untracked(size)) return untracked_alloc(size, alignment, FAMILY_MALLOC);
+    return tracked_alloc(size, alignment, 0, FAMILY_MALLOC);
+}
+
+MEMWRAP_API void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return memalign(alignment, size);
+}
+
+MEMWRAP_API void* valloc(size_t size) {
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+/**
+ * @brief Replacement for malloc_usable_size(); reports the requested size of tracked blocks,
+ * so callers that trust it never write into the padding before a guard page.
+ */
+MEMWRAP_API size_t malloc_usable_size(void* ptr) {
+    if (ptr == NULL) return 0;
+    if (from_bootstrap(ptr)) return bootstrap_heap + BOOTSTRAP_BYTES - (char*)ptr;
+    if (guard_pool_owns(ptr)) return guard_pool_usable_size(ptr);
+
+    if (!pointer_untracked(ptr)) {
+        AllocationEntry entry;
+        return alloc_table_find(ptr, &entry) ? entry.requested_size : 0;
+    }
+
+    resolve_real_functions();
+    return real_malloc_usable_size(ptr);
+}
+
+/**
+ * @brief Replacement for free(), applies PROT_NONE to detect use-after-free.
+ *
+ * Moves the freed region into the quarantine (see quarantine.c). If mprotect fails,
+ * the region is released right away.
+ */
+MEMWRAP_API void free(void* ptr) {
+    if (ptr == NULL || from_bootstrap(ptr)) return;
+    if (guard_pool_owns(ptr)) {
+        guard_pool_free(ptr, FAMILY_MALLOC, UNKNOWN_SIZE);
+        return;
+    }
+    if (pointer_untracked(ptr)) {
+        resolve_real_functions();
+        count_real_free(ptr);
+        const int64_t start = latency_start();
+        real_free(ptr);
+        latency_record(LATENCY_REAL_FREE, start);
+        return;
+    }
+    tracked_free(ptr, FAMILY_MALLOC, UNKNOWN_SIZE);
 }
 
 /**
@@ -319,11 +998,13 @@ void free(void* ptr) {
  */
 __attribute__((destructor))
 void shutdown_connection() {
-    if (tracking_enabled && !crashed) {
-        detect_memory_leaks();
+    if (tracking_started) {
+        canary_scan();
+        if (leak_scan_run() != 0) detect_memory_leaks();
     }
-    if (sock_fd != -1) {
-        close(sock_fd);
+    if (transport_connected()) {
+        latency_export();
+        transport_close();
         fprintf(stderr, "[Wrapper] Disconnected from analyzer.\n");
     }
 }
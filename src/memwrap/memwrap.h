@@ -2,18 +2,37 @@
 #define MEMWRAP_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "alloc_table.h"
 
-typedef enum {
-    EVENT_MALLOC,
-    EVENT_FREE,
-    EVENT_MEMORY_LEAK,
-    EVENT_DANGLING_POINTER,
-    EVENT_BUFFER_OVERFLOW,
-    EVENT_DOUBLE_FREE,
-    EVENT_FORCED_CRASH
-} EventType;
+#define UNKNOWN_SIZE ((size_t)-1)
+
+// The library is built with -fvisibility=hidden: only what a program links against or interposes is exported
+#define MEMWRAP_API __attribute__((visibility("default")))
 
 const char* event_type_to_string(EventType type);
-void send_json_event(EventType type, void* addr, size_t size);
+void send_event(EventType type, void* addr, size_t size);
+void send_stack_event(EventType type, void* addr, size_t size, uint32_t stack_id);
+void send_weighted_event(EventType type, void* addr, size_t size, uint32_t stack_id, uint64_t weight);
+void send_json_event(EventType type, void* addr, size_t size, uint64_t weight);
+int event_reportable(EventType type);
+
+void switch_mode(ControlMode mode);
+int set_tracking(int on);
+int tracking_active(void);
+void enable_tracking(void);
+void disable_tracking(void);
+void report_live_blocks(void);
+
+int tracking_bypassed(void);
+void set_thread_untracked(int on);
+int allocation_untracked(size_t size);
+int pointer_untracked(const void* ptr);
+void* untracked_alloc(size_t size, size_t alignment, AllocFamily family);
+void* heap_alloc(size_t size);
+void heap_free(void* ptr);
+void* tracked_alloc(size_t size, size_t alignment, int zero, AllocFamily family);
+void tracked_free(void* ptr, AllocFamily family, size_t size);
 
 #endif
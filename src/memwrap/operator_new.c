@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include "memwrap.h"
+#include "guard_pool.h"
+
+/**
+ * @file operator_new.c
+ * @brief Replacements for the C++ global operator new and delete overloads.
+ *
+ * The library is plain C, so every overload is defined under its Itanium-mangled name
+ * (size_t is `m` on LP64). new and new[] record their family in the tracking entry, and
+ * each delete checks it, reporting new/free/delete[] mixups as alloc_mismatch events;
+ * sized deletes also check the size against the recorded one.
+ *
+ * C cannot throw std::bad_alloc. When a throwing new runs out of memory, it runs the
+ * installed new_handler and retries itself, so the block it gets is still recorded with
+ * the new family. Once no handler is left, it asks the real operator new from libstdc++ for
+ * a size no allocator can satisfy, which throws.
+ */
+
+#define MANGLED(name) __asm__(name) MEMWRAP_API
+
+typedef void (*NewHandler)(void);
+
+/**
+ * @brief Allocates through the tracker, or from the real allocator when the block is not
+ * tracked (tracking bypassed, or not sampled).
+ */
+static void* allocate(const size_t size, const size_t alignment, const AllocFamily family) {
+    if (allocation_untracked(size)) return untracked_alloc(size, alignment, family);
+    return tracked_alloc(size, alignment, 0, family);
+}
+
+/**
+ * @brief Allocates like a throwing operator new: calls the new_handler and retries while one is
+ * installed, then throws std::bad_alloc.
+ */
+static void* allocate_or_throw(const size_t size, const size_t alignment, const AllocFamily family) {
+    for (;;) {
+        void* ptr = allocate(size, alignment, family);
+        if (ptr) return ptr;
+
+        NewHandler (*get_new_handler)(void) = dlsym(RTLD_DEFAULT, "_ZSt15get_new_handlerv");
+        const NewHandler handler = get_new_handler ? get_new_handler() : NULL;
+        if (!handler) break;
+        handler();
+    }
+
+    // Fails again without allocating, with no handler to call, so it throws
+    if (alignment) {
+        void* (*real_new)(size_t, size_t) = dlsym(RTLD_NEXT, "_ZnwmSt11align_val_t");
+        return real_new(SIZE_MAX, alignment);
+    }
+    void* (*real_new)(size_t) = dlsym(RTLD_NEXT, "_Znwm");
+    return real_new(SIZE_MAX);
+}
+
+static void deallocate(void* ptr, const AllocFamily family, const size_t size) {
+    if (ptr == NULL) return;
+    if (guard_pool_owns(ptr)) {
+        guard_pool_free(ptr, family, size);
+        return;
+    }
+    if (pointer_untracked(ptr)) {
+        free(ptr);
+        return;
+    }
+    tracked_free(ptr, family, size);
+}
+
+// operator new, new[]
+void* op_new(size_t size) MANGLED("_Znwm");
+void* op_new(size_t size) { return allocate_or_throw(size, 0, FAMILY_NEW); }
+void* op_new_array(size_t size) MANGLED("_Znam");
+void* op_new_array(size_t size) { return allocate_or_throw(size, 0, FAMILY_NEW_ARRAY); }
+
+// nothrow
+void* op_new_nothrow(size_t size, const void* tag) MANGLED("_ZnwmRKSt9nothrow_t");
+void* op_new_nothrow(size_t size, const void* tag __attribute__((unused))) {
+    return allocate(size, 0, FAMILY_NEW);
+}
+void* op_new_array_nothrow(size_t size, const void* tag) MANGLED("_ZnamRKSt9nothrow_t");
+void* op_new_array_nothrow(size_t size, const void* tag __attribute__((unused))) {
+    return allocate(size, 0, FAMILY_NEW_ARRAY);
+}
+
+// std::align_val_t
+void* op_new_aligned(size_t size, size_t alignment) MANGLED("_ZnwmSt11align_val_t");
+void* op_new_aligned(size_t size, size_t alignment) { return allocate_or_throw(size, alignment, FAMILY_NEW); }
+void* op_new_array_aligned(size_t size, size_t alignment) MANGLED("_ZnamSt11align_val_t");
+void* op_new_array_aligned(size_t size, size_t alignment) {
+    return allocate_or_throw(size, alignment, FAMILY_NEW_ARRAY);
+}
+
+// std::align_val_t, nothrow
+void* op_new_aligned_nothrow(size_t size, size_t alignment, const void* tag) MANGLED("_ZnwmSt11align_val_tRKSt9nothrow_t");
+void* op_new_aligned_nothrow(size_t size, size_t alignment, const void* tag __attribute__((unused))) {
+    return allocate(size, alignment, FAMILY_NEW);
+}
+void* op_new_array_aligned_nothrow(size_t size, size_t alignment, const void* tag) MANGLED("_ZnamSt11align_val_tRKSt9nothrow_t");
+void* op_new_array_aligned_nothrow(size_t size, size_t alignment, const void* tag __attribute__((unused))) {
+    return allocate(size, alignment, FAMILY_NEW_ARRAY);
+}
+
+// operator delete, delete[]
+void op_delete(void* ptr) MANGLED("_ZdlPv");
+void op_delete(void* ptr) { deallocate(ptr, FAMILY_NEW, UNKNOWN_SIZE); }
+void op_delete_array(void* ptr) MANGLED("_ZdaPv");
+void op_delete_array(void* ptr) { deallocate(ptr, FAMILY_NEW_ARRAY, UNKNOWN_SIZE); }
+
+// sized
+void op_delete_sized(void* ptr, size_t size) MANGLED("_ZdlPvm");
+void op_delete_sized(void* ptr, size_t size) { deallocate(ptr, FAMILY_NEW, size); }
+void op_delete_array_sized(void* ptr, size_t size) MANGLED("_ZdaPvm");
+void op_delete_array_sized(void* ptr, size_t size) { deallocate(ptr, FAMILY_NEW_ARRAY, size); }
+
+// std::align_val_t
+void op_delete_aligned(void* ptr, size_t alignment) MANGLED("_ZdlPvSt11align_val_t");
+void op_delete_aligned(void* ptr, size_t alignment __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW, UNKNOWN_SIZE);
+}
+void op_delete_array_aligned(void* ptr, size_t alignment) MANGLED("_ZdaPvSt11align_val_t");
+void op_delete_array_aligned(void* ptr, size_t alignment __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW_ARRAY, UNKNOWN_SIZE);
+}
+
+// sized, std::align_val_t
+void op_delete_sized_aligned(void* ptr, size_t size, size_t alignment) MANGLED("_ZdlPvmSt11align_val_t");
+void op_delete_sized_aligned(void* ptr, size_t size, size_t alignment __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW, size);
+}
+void op_delete_array_sized_aligned(void* ptr, size_t size, size_t alignment) MANGLED("_ZdaPvmSt11align_val_t");
+void op_delete_array_sized_aligned(void* ptr, size_t size, size_t alignment __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW_ARRAY, size);
+}
+
+// nothrow
+void op_delete_nothrow(void* ptr, const void* tag) MANGLED("_ZdlPvRKSt9nothrow_t");
+void op_delete_nothrow(void* ptr, const void* tag __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW, UNKNOWN_SIZE);
+}
+void op_delete_array_nothrow(void* ptr, const void* tag) MANGLED("_ZdaPvRKSt9nothrow_t");
+void op_delete_array_nothrow(void* ptr, const void* tag __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW_ARRAY, UNKNOWN_SIZE);
+}
+
+// std::align_val_t, nothrow
+void op_delete_aligned_nothrow(void* ptr, size_t alignment, const void* tag) MANGLED("_ZdlPvSt11align_val_tRKSt9nothrow_t");
+void op_delete_aligned_nothrow(void* ptr, size_t alignment __attribute__((unused)), const void* tag __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW, UNKNOWN_SIZE);
+}
+void op_delete_array_aligned_nothrow(void* ptr, size_t alignment, const void* tag) MANGLED("_ZdaPvSt11align_val_tRKSt9nothrow_t");
+void op_delete_array_aligned_nothrow(void* ptr, size_t alignment __attribute__((unused)), const void* tag __attribute__((unused))) {
+    deallocate(ptr, FAMILY_NEW_ARRAY, UNKNOWN_SIZE);
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "quarantine.h"
+#include "slab.h"
+#include "shadow.h"
+#include "canary.h"
+#include "leak_scan.h"
+#include "latency.h"
+
+#define DEFAULT_QUARANTINE_BYTES (256ul * 1024 * 1024)
+#define DEFAULT_QUARANTINE_REGIONS 16384
+#define MAX_QUARANTINE_REGIONS (1ul << 24)
+#define RELEASE_MIN_BYTES (64 * 1024)  // smaller blocks keep their pages until eviction
+#define EVICT_BATCH 32
+
+/**
+ * @file quarantine.c
+ * @brief Holds freed blocks under PROT_NONE so use-after-free faults, within fixed budgets.
+ *
+ * Freed blocks enter a FIFO ring and stay inaccessible until the ring exceeds either
+ * MAPD_QUARANTINE_BYTES of address space or MAPD_QUARANTINE_REGIONS blocks; then the
+ * oldest are evicted: mapped blocks are unmapped, slab cells go back to their slab, and
+ * canary blocks, which stay accessible but poisoned, go back to the real allocator.
+ * Blocks of at least RELEASE_MIN_BYTES drop their physical pages on entry (MADV_DONTNEED),
+ * so large quarantined blocks keep only their virtual range reserved. A block larger than
+ * the whole byte budget is released immediately.
+ *
+ * Evicted blocks are collected under the lock and released after it, so munmap does not
+ * run while other threads wait to free.
+ */
+
+static AllocationEntry* ring = NULL;
+static size_t capacity = 0;
+static size_t head = 0;   // oldest entry
+static size_t count = 0;
+static size_t bytes = 0;
+static size_t byte_budget = DEFAULT_QUARANTINE_BYTES;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Reads the budgets from the environment and maps the ring.
+ */
+void quarantine_init(void) {
+    const char* bytes_env = getenv("MAPD_QUARANTINE_BYTES");
+    if (bytes_env) byte_budget = strtoul(bytes_env, NULL, 10);
+
+    size_t regions = DEFAULT_QUARANTINE_REGIONS;
+    const char* regions_env = getenv("MAPD_QUARANTINE_REGIONS");
+    if (regions_env) regions = strtoul(regions_env, NULL, 10);
+    if (regions > MAX_QUARANTINE_REGIONS) regions = MAX_QUARANTINE_REGIONS;
+    if (regions == 0 || byte_budget == 0) return;
+
+    void* slots = mmap(NULL, sizeof(AllocationEntry) * regions, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slots == MAP_FAILED) return;
+    leak_scan_ignore(slots, sizeof(AllocationEntry) * regions);
+    ring = slots;
+    capacity = regions;
+}
+
+/**
+ * @brief Gives a freed block back for good: unmaps it, or returns a slab cell for reuse.
+ */
+void quarantine_release(const AllocationEntry* entry) {
+    if (entry->kind == BLOCK_CANARY) {
+        canary_release(entry);
+        return;
+    }
+    shadow_mark_retired(entry);
+    if (entry->kind == BLOCK_SLAB) slab_release(entry->base, entry->allocated_size);
+    else munmap(entry->base, entry->allocated_size);
+}
+
+static AllocationEntry pop_oldest_locked(void) {
+    const AllocationEntry oldest = ring[head];
+    head = (head + 1) % capacity;
+    count--;
+    bytes -= oldest.allocated_size;
+    return oldest;
+}
+
+static int fits_locked(const size_t size) {
+    return count < capacity && bytes + size <= byte_budget;
+}
+
+/**
+ * @brief Quarantines a freed block that is already PROT_NONE (or poisoned, for canary
+ * blocks), evicting the oldest as needed.
+ */
+void quarantine_push(const AllocationEntry* entry) {
+    if (capacity == 0 || entry->allocated_size > byte_budget) {
+        quarantine_release(entry);
+        return;
+    }
+
+    if (entry->allocated_size >= RELEASE_MIN_BYTES) madvise(entry->base, entry->allocated_size, MADV_DONTNEED);
+
+    AllocationEntry evicted[EVICT_BATCH];
+    int queued = 0;
+    while (!queued) {
+        int n = 0;
+
+        latency_lock(&quarantine_lock, LATENCY_QUARANTINE_LOCK);
+        while (n < EVICT_BATCH && count > 0 && !fits_locked(entry->allocated_size)) {
+            evicted[n++] = pop_oldest_locked();
+        }
+        if (fits_locked(entry->allocated_size)) {
+            ring[(head + count) % capacity] = *entry;
+            count++;
+            bytes += entry->allocated_size;
+            queued = 1;
+        }
+        pthread_mutex_unlock(&quarantine_lock);
+
+        for (int i = 0; i < n; i++) quarantine_release(&evicted[i]);
+    }
+}
+
+/**
+ * @brief Visits every quarantined block, oldest first, under the quarantine lock.
+ */
+void quarantine_for_each(const AllocationVisitor visitor, void* arg) {
+    pthread_mutex_lock(&quarantine_lock);
+    for (size_t i = 0; i < count; i++) {
+        if (visitor(&ring[(head + i) % capacity], arg)) break;
+    }
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/**
+ * @brief pthread_atfork() prepare handler: holds the quarantine still across fork().
+ */
+void quarantine_fork_prepare(void) {
+    pthread_mutex_lock(&quarantine_lock);
+}
+
+/**
+ * @brief pthread_atfork() parent and child handler.
+ */
+void quarantine_fork_parent(void) {
+    pthread_mutex_unlock(&quarantine_lock);
+}
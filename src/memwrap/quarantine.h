@@ -0,0 +1,19 @@
+#ifndef QUARANTINE_H
+#define QUARANTINE_H
+
+#include <stddef.h>
+#include "alloc_table.h"
+
+/**
+ * @file quarantine.h
+ * @brief FIFO quarantine of freed, inaccessible blocks with byte and region budgets.
+ */
+
+void quarantine_init(void);
+void quarantine_push(const AllocationEntry* entry);
+void quarantine_release(const AllocationEntry* entry);
+void quarantine_for_each(AllocationVisitor visitor, void* arg);
+void quarantine_fork_prepare(void);
+void quarantine_fork_parent(void);
+
+#endif
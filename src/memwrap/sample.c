@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "sample.h"
+
+#define DEFAULT_SAMPLE_BYTES (512ul * 1024)
+
+/**
+ * @file sample.c
+ * @brief Chooses which allocations the sampling mode records, heap-profiler style.
+ *
+ * Allocated bytes are treated as a Poisson process: every thread keeps a countdown of bytes
+ * to the next sample point, drawn from an exponential distribution with mean
+ * MAPD_SAMPLE_BYTES (default 512 KiB). An allocation is sampled when it crosses the point,
+ * so a block of `s` bytes is picked with probability 1 - exp(-s / mean), independently of
+ * how the program slices its allocations. Dividing the size by that probability gives the
+ * sample's weight: the number of bytes it stands for, whose sum estimates the true heap.
+ */
+
+__thread int64_t sample_countdown __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t rng_state __attribute__((tls_model("initial-exec"))) = 0;
+static double mean_interval = DEFAULT_SAMPLE_BYTES;
+
+/**
+ * @brief Reads MAPD_SAMPLE_BYTES.
+ */
+void sample_init(void) {
+    const char* env = getenv("MAPD_SAMPLE_BYTES");
+    if (env) {
+        const long long bytes = atoll(env);
+        if (bytes > 0) mean_interval = (double)bytes;
+    }
+}
+
+/**
+ * @brief Changes the mean distance between samples. Countdowns already drawn run out first.
+ */
+void sample_set_mean(const uint64_t bytes) {
+    if (bytes > 0) mean_interval = (double)bytes;
+}
+
+static uint64_t next_random(void) {
+    // xorshift64*, seeded per thread so threads do not sample in lockstep
+    if (rng_state == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rng_state = ((uint64_t)syscall(SYS_gettid) << 32) ^ (uint64_t)now.tv_nsec ^ 0x9e3779b97f4a7c15ull;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static int64_t next_interval(void) {
+    // Uniform in (0, 1]; 53 bits are all a double holds
+    const double uniform = ((double)(next_random() >> 11) + 1.0) / 9007199254740992.0;
+    const double interval = -log(uniform) * mean_interval;
+    return interval < 1.0 ? 1 : (int64_t)interval;
+}
+
+/**
+ * @brief Slow path of sample_hit(): the countdown ran out.
+ *
+ * A thread's first call only arms the countdown, so start-up allocations are not all
+ * sampled. Otherwise the allocation is sampled and the next point is drawn.
+ *
+ * @return 1 if the allocation is sampled.
+ */
+int sample_refill(const size_t size __attribute__((unused))) {
+    if (rng_state == 0) {
+        sample_countdown += next_interval();
+        if (sample_countdown > 0) return 0;
+    }
+    sample_countdown = next_interval();
+    return 1;
+}
+
+/**
+ * @brief Bytes a sampled block of `size` bytes stands for: size / P(sampled).
+ */
+uint64_t sample_weight(const size_t size) {
+    if (size == 0) return (uint64_t)mean_interval;
+    const double probability = -expm1(-(double)size / mean_interval);
+    return (uint64_t)((double)size / probability + 0.5);
+}
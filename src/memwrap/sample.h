@@ -0,0 +1,31 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file sample.h
+ * @brief Poisson byte sampling of allocations for the sampling mode (MAPD_MODE=sample).
+ */
+
+extern __thread int64_t sample_countdown __attribute__((tls_model("initial-exec")));
+
+void sample_init(void);
+void sample_set_mean(uint64_t bytes);
+int sample_refill(size_t size);
+uint64_t sample_weight(size_t size);
+
+/**
+ * @brief Whether an allocation of `size` bytes is sampled.
+ *
+ * The common case costs one thread-local decrement and a branch; the slow path draws the
+ * distance to the next sample.
+ */
+static inline int sample_hit(const size_t size) {
+    sample_countdown -= (int64_t)size;
+    if (__builtin_expect(sample_countdown > 0, 1)) return 0;
+    return sample_refill(size);
+}
+
+#endif
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "shadow.h"
+#include "leak_scan.h"
+
+#define ADDRESS_BITS 47  // user-space virtual addresses on x86-64 and arm64 with 4-level tables
+#define LEAF_BITS 18
+#define STATE_MASK ((uintptr_t)3)
+#define RETIRED_TAG ((uintptr_t)4)  // no block pointer, so no state bits either
+
+/**
+ * @file shadow.c
+ * @brief Two-level radix table with one cell per page of every tracked block.
+ *
+ * A cell holds the application pointer of the block the page belongs to, tagged with a
+ * ShadowState in its low bits (pointers are at least 16-byte aligned), the requested
+ * size and the allocation stack id. The page number splits into a root index and a leaf
+ * index; leaves cover 2^LEAF_BITS pages each and are mapped on first use, then never freed. The root lives in .bss, so the
+ * table needs no setup and untouched parts cost no memory.
+ *
+ * Pages of a block that left the quarantine stay marked as retired, so a late double free
+ * of the block is still recognised as ours. Once the address space is reused by the real
+ * allocator, the wrapper clears the mark of each page it hands out (shadow_forget()).
+ *
+ * Writers own the pages they mark: a block's pages are only changed by the thread
+ * allocating, freeing or evicting that block. Readers take no lock, which makes
+ * shadow_lookup() safe in a signal handler that interrupted any other code; a lookup racing
+ * with an update may pair the new pointer with the old size, which is fine for a report.
+ */
+
+typedef struct {
+    _Atomic uintptr_t tagged;  // block pointer | ShadowState
+    _Atomic size_t size;
+    _Atomic uint32_t stack_id;
+} ShadowCell;
+
+static _Atomic(ShadowCell*) root[1ul << (ADDRESS_BITS - LEAF_BITS - 12)];
+static unsigned int page_shift = 0;
+
+static unsigned int shift(void) {
+    if (!page_shift) page_shift = __builtin_ctzl(sysconf(_SC_PAGESIZE));
+    return page_shift;
+}
+
+/**
+ * @brief Cell of the page containing addr, mapping its leaf if `create` is set.
+ */
+static ShadowCell* cell_for(const uintptr_t addr, const int create) {
+    const uintptr_t page = addr >> page_shift;
+    const uintptr_t index = page >> LEAF_BITS;
+    if (index >= sizeof(root) / sizeof(root[0])) return NULL;
+
+    ShadowCell* leaf = atomic_load_explicit(&root[index], memory_order_acquire);
+    if (!leaf && create) {
+        ShadowCell* fresh = mmap(NULL, sizeof(ShadowCell) << LEAF_BITS, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (fresh == MAP_FAILED) return NULL;
+        if (atomic_compare_exchange_strong_explicit(&root[index], &leaf, fresh,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            leaf = fresh;
+            leak_scan_ignore(fresh, sizeof(ShadowCell) << LEAF_BITS);
+        } else {
+            munmap(fresh, sizeof(ShadowCell) << LEAF_BITS);  // another thread mapped it first
+        }
+    }
+    return leaf ? &leaf[page & ((1ul << LEAF_BITS) - 1)] : NULL;
+}
+
+static void mark(const uintptr_t start, const uintptr_t end, const ShadowState state, const AllocationEntry* entry) {
+    const uintptr_t tagged = state == SHADOW_NONE ? 0
+                           : state == SHADOW_RETIRED ? RETIRED_TAG
+                           : ((uintptr_t)entry->addr | state);
+    const uintptr_t page = (uintptr_t)1 << shift();
+
+    for (uintptr_t addr = start; addr < end; addr += page) {
+        ShadowCell* cell = cell_for(addr, state != SHADOW_NONE);
+        if (!cell) continue;
+        atomic_store_explicit(&cell->size, entry->requested_size, memory_order_relaxed);
+        atomic_store_explicit(&cell->stack_id, entry->stack_id, memory_order_relaxed);
+        atomic_store_explicit(&cell->tagged, tagged, memory_order_release);
+    }
+}
+
+/**
+ * @brief Guard page of a block: the last page of its mapping, or the page after a slab cell.
+ */
+static uintptr_t guard_of(const AllocationEntry* entry) {
+    const uintptr_t end = (uintptr_t)entry->base + entry->allocated_size;
+    return entry->kind == BLOCK_SLAB ? end : end - ((uintptr_t)1 << shift());
+}
+
+/**
+ * @brief Marks the data pages of a new allocation live and its guard page as guard.
+ */
+void shadow_mark_live(const AllocationEntry* entry) {
+    const uintptr_t guard = guard_of(entry);
+    mark((uintptr_t)entry->base, guard, SHADOW_LIVE, entry);
+    mark(guard, guard + ((uintptr_t)1 << shift()), SHADOW_GUARD, entry);
+}
+
+/**
+ * @brief Marks every page of a freed block, guard included, as freed.
+ */
+void shadow_mark_freed(const AllocationEntry* entry) {
+    const uintptr_t guard = guard_of(entry);
+    mark((uintptr_t)entry->base, guard + ((uintptr_t)1 << shift()), SHADOW_FREED, entry);
+}
+
+/**
+ * @brief Marks every page of a block that is being unmapped or reused as retired.
+ */
+void shadow_mark_retired(const AllocationEntry* entry) {
+    const uintptr_t guard = guard_of(entry);
+    mark((uintptr_t)entry->base, guard + ((uintptr_t)1 << shift()), SHADOW_RETIRED, entry);
+}
+
+/**
+ * @brief Clears a retired mark from the page of addr, which the real allocator just handed out.
+ *
+ * The caller owns the block at addr, so no tracked block can be marked there meanwhile.
+ */
+void shadow_forget(const void* addr) {
+    if (!page_shift) return;
+
+    ShadowCell* cell = cell_for((uintptr_t)addr, 0);
+    if (cell && atomic_load_explicit(&cell->tagged, memory_order_relaxed) == RETIRED_TAG)
+        atomic_store_explicit(&cell->tagged, 0, memory_order_release);
+}
+
+/**
+ * @brief Classifies an address in constant time without taking locks.
+ *
+ * @param block Receives the application pointer of the owning block, may be NULL.
+ * @param size Receives its requested size, may be NULL.
+ * @param stack_id Receives its allocation stack id, may be NULL.
+ * @return The state of the page containing addr.
+ */
+ShadowState shadow_lookup(const void* addr, void** block, size_t* size, uint32_t* stack_id) {
+    if (!page_shift) return SHADOW_NONE;
+
+    const ShadowCell* cell = cell_for((uintptr_t)addr, 0);
+    if (!cell) return SHADOW_NONE;
+
+    const uintptr_t tagged = atomic_load_explicit(&cell->tagged, memory_order_acquire);
+    if (tagged == RETIRED_TAG) {
+        if (block) *block = NULL;
+        if (size) *size = 0;
+        if (stack_id) *stack_id = 0;
+        return SHADOW_RETIRED;
+    }
+    if (block) *block = (void*)(tagged & ~STATE_MASK);
+    if (size) *size = atomic_load_explicit(&cell->size, memory_order_relaxed);
+    if (stack_id) *stack_id = atomic_load_explicit(&cell->stack_id, memory_order_relaxed);
+    return (ShadowState)(tagged & STATE_MASK);
+}
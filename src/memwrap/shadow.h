@@ -0,0 +1,27 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "alloc_table.h"
+
+/**
+ * @file shadow.h
+ * @brief Page-indexed shadow map classifying addresses for the SIGSEGV handler.
+ */
+
+typedef enum {
+    SHADOW_NONE,   // not a tracked page
+    SHADOW_LIVE,   // data page of a live allocation
+    SHADOW_GUARD,  // guard page behind a live allocation
+    SHADOW_FREED,  // page of a quarantined block
+    SHADOW_RETIRED // page of a block released for good, until someone else allocates there
+} ShadowState;
+
+void shadow_mark_live(const AllocationEntry* entry);
+void shadow_mark_freed(const AllocationEntry* entry);
+void shadow_mark_retired(const AllocationEntry* entry);
+void shadow_forget(const void* addr);
+ShadowState shadow_lookup(const void* addr, void** block, size_t* size, uint32_t* stack_id);
+
+#endif
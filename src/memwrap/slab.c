@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "slab.h"
+#include "leak_scan.h"
+
+#define SLAB_CLASSES 3          // cells of 1, 2 and 4 data pages
+#define SLAB_BYTES (512 * 1024) // address space per slab, guards included
+#define SLAB_CACHE_CELLS 32     // per-thread cache depth per class
+#define SLAB_REFILL 16          // cells moved between global lists and a thread cache at once
+#define SLAB_ALIGN 16
+#define MAX_THREAD_CACHES 1024
+
+/**
+ * @file slab.c
+ * @brief Guarded small-object allocator used when MAPD_SLAB=1.
+ *
+ * Without slabs every tracked malloc() maps its own block, costing an mmap and an
+ * mprotect per call, and every freed block stays mapped. Here each size class owns slabs
+ * of SLAB_BYTES carved into cells of [data pages][guard page]. A slab is mapped PROT_NONE
+ * in one call and only the data pages of allocated cells are made accessible, so guards
+ * cost no syscall, a malloc costs one mprotect, and freed cells fold back into the
+ * surrounding inaccessible mapping instead of leaving mappings behind.
+ *
+ * Objects are placed end-aligned (to SLAB_ALIGN) inside their data pages so that a linear
+ * overflow runs straight into the guard page; overflows smaller than the alignment
+ * padding are not caught. A live cell still splits its slab into two mappings, so the
+ * number of simultaneously live slab objects remains bounded by vm.max_map_count / 2.
+ *
+ * Freed cells go through the normal free path (PROT_NONE, then the quarantine) and come back
+ * via slab_release(). Cells are handed out from per-thread caches, refilled in batches
+ * from a per-class stack, so the common malloc takes no lock.
+ *
+ * Free cells are inaccessible, so the class stacks live in their own mappings, as do the
+ * thread caches, because this code runs inside malloc.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    void** free_cells;    // released cells, mapped separately
+    size_t free_count;
+    size_t free_capacity;
+    char* cursor;         // next never-used cell of the newest slab
+    size_t cells_left;    // never-used cells remaining after cursor
+} SlabClass;
+
+typedef struct {
+    void* cells[SLAB_CLASSES][SLAB_CACHE_CELLS];
+    int count[SLAB_CLASSES];
+    int in_use;
+} SlabCache;
+
+static int enabled = 0;
+static size_t pagesize = 0;
+static SlabClass classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static SlabCache* caches = NULL;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static __thread SlabCache* thread_cache __attribute__((tls_model("initial-exec"))) = NULL;
+
+static size_t class_pages(const int cls) {
+    return (size_t)1 << cls;
+}
+
+static size_t cell_bytes(const int cls) {
+    return (class_pages(cls) + 1) * pagesize;
+}
+
+static int class_for_size(const size_t size) {
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        if (size <= class_pages(cls) * pagesize) return cls;
+    }
+    return -1;
+}
+
+static int class_for_data_bytes(const size_t allocated_size) {
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        if (allocated_size == class_pages(cls) * pagesize) return cls;
+    }
+    return -1;
+}
+
+/**
+ * @brief Maps a new, entirely inaccessible slab for a class.
+ */
+static int grow_class(SlabClass* sc, const int cls) {
+    const size_t cell = cell_bytes(cls);
+    const size_t cells = SLAB_BYTES / cell;
+
+    char* slab = mmap(NULL, cells * cell, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slab == MAP_FAILED) return -1;
+
+    sc->cursor = slab;
+    sc->cells_left = cells;
+    return 0;
+}
+
+/**
+ * @brief Moves up to SLAB_REFILL cells from the global class into a thread cache.
+ */
+static void refill(SlabCache* cache, const int cls) {
+    SlabClass* sc = &classes[cls];
+
+    pthread_mutex_lock(&sc->lock);
+    while (cache->count[cls] < SLAB_REFILL) {
+        void* cell;
+        if (sc->free_count > 0) {
+            cell = sc->free_cells[--sc->free_count];
+        } else {
+            if (sc->cells_left == 0 && grow_class(sc, cls) == -1) break;
+            cell = sc->cursor;
+            sc->cursor += cell_bytes(cls);
+            sc->cells_left--;
+        }
+        cache->cells[cls][cache->count[cls]++] = cell;
+    }
+    pthread_mutex_unlock(&sc->lock);
+}
+
+/**
+ * @brief Pushes a cell onto its class stack, growing the stack mapping when full. Caller holds sc->lock.
+ */
+static void push_free_locked(SlabClass* sc, void* cell) {
+    if (sc->free_count == sc->free_capacity) {
+        const size_t capacity = sc->free_capacity ? sc->free_capacity * 2 : pagesize / sizeof(void*);
+        void** grown = sc->free_cells
+            ? mremap(sc->free_cells, sc->free_capacity * sizeof(void*), capacity * sizeof(void*), MREMAP_MAYMOVE)
+            : mmap(NULL, capacity * sizeof(void*), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (grown == MAP_FAILED) return;  // the cell is lost to reuse, never handed out twice
+        leak_scan_unignore(sc->free_cells);
+        leak_scan_ignore(grown, capacity * sizeof(void*));
+        sc->free_cells = grown;
+        sc->free_capacity = capacity;
+    }
+    sc->free_cells[sc->free_count++] = cell;
+}
+
+/**
+ * @brief Gives the cells of a cache back to the class stacks, keeping `keep` of them.
+ */
+static void drain_cache(SlabCache* cache, const int cls, const int keep) {
+    SlabClass* sc = &classes[cls];
+
+    pthread_mutex_lock(&sc->lock);
+    while (cache->count[cls] > keep) push_free_locked(sc, cache->cells[cls][--cache->count[cls]]);
+    pthread_mutex_unlock(&sc->lock);
+}
+
+/**
+ * @brief Thread-exit destructor: returns cached cells and frees the cache slot.
+ */
+static void release_cache(void* arg) {
+    SlabCache* cache = arg;
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) drain_cache(cache, cls, 0);
+
+    pthread_mutex_lock(&caches_lock);
+    cache->in_use = 0;
+    pthread_mutex_unlock(&caches_lock);
+    thread_cache = NULL;
+}
+
+/**
+ * @brief Returns the calling thread's cache, or NULL when all MAX_THREAD_CACHES are taken.
+ */
+static SlabCache* cache_for_thread(void) {
+    if (thread_cache) return thread_cache;
+
+    pthread_mutex_lock(&caches_lock);
+    for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+        if (!caches[i].in_use) {
+            caches[i].in_use = 1;
+            thread_cache = &caches[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&caches_lock);
+
+    if (thread_cache) pthread_setspecific(cache_key, thread_cache);
+    return thread_cache;
+}
+
+/**
+ * @brief Reads MAPD_SLAB and sets up the thread cache pool.
+ */
+void slab_init(void) {
+    const char* env = getenv("MAPD_SLAB");
+    if (!env || strcmp(env, "1") != 0) return;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    caches = mmap(NULL, sizeof(SlabCache) * MAX_THREAD_CACHES, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (caches == MAP_FAILED) return;
+    leak_scan_ignore(caches, sizeof(SlabCache) * MAX_THREAD_CACHES);
+    if (pthread_key_create(&cache_key, release_cache) != 0) return;
+
+    enabled = 1;
+}
+
+int slab_enabled(void) {
+    return enabled;
+}
+
+/**
+ * @brief Largest request served from slabs.
+ */
+size_t slab_max_size(void) {
+    return enabled ? class_pages(SLAB_CLASSES - 1) * pagesize : 0;
+}
+
+/**
+ * @brief Offset of an object inside a cell's data pages, or SIZE_MAX if it does not fit.
+ */
+static size_t placement(const size_t data, const size_t size, const size_t alignment) {
+    const size_t align = alignment > SLAB_ALIGN ? alignment : SLAB_ALIGN;
+    const size_t placed = ((size ? size : 1) + align - 1) & ~(align - 1);
+    return placed <= data ? data - placed : SIZE_MAX;
+}
+
+/**
+ * @brief Hands out a guarded cell for a small request.
+ *
+ * @param size Requested size, at most slab_max_size().
+ * @param alignment Power of two the user pointer must be aligned to, at most the page size.
+ * @param entry Receives base, allocated_size and kind of the cell.
+ * @return User pointer, end-aligned against the guard page, or NULL.
+ */
+void* slab_alloc(const size_t size, const size_t alignment, AllocationEntry* entry) {
+    if (alignment > pagesize) return NULL;
+    const int cls = class_for_size(size + (alignment > SLAB_ALIGN ? alignment - 1 : 0));
+    if (cls < 0) return NULL;
+
+    SlabCache* cache = cache_for_thread();
+    char* cell = NULL;
+    if (cache) {
+        if (cache->count[cls] == 0) refill(cache, cls);
+        if (cache->count[cls] > 0) cell = cache->cells[cls][--cache->count[cls]];
+    } else {
+        SlabCache local = {0};
+        refill(&local, cls);
+        if (local.count[cls] > 0) cell = local.cells[cls][--local.count[cls]];
+        drain_cache(&local, cls, 0);
+    }
+    if (!cell) return NULL;
+
+    const size_t data = class_pages(cls) * pagesize;
+    if (mprotect(cell, data, PROT_READ | PROT_WRITE) != 0) {
+        slab_release(cell, data);
+        return NULL;
+    }
+
+    entry->base = cell;
+    entry->allocated_size = data;
+    entry->kind = BLOCK_SLAB;
+    return cell + placement(data, size, alignment);
+}
+
+/**
+ * @brief Where an object of a new size would sit inside an existing cell, for realloc().
+ *
+ * @return The end-aligned user pointer inside the same cell, or NULL if the size does not fit.
+ */
+void* slab_place(const AllocationEntry* entry, const size_t size) {
+    const size_t offset = placement(entry->allocated_size, size, SLAB_ALIGN);
+    return offset == SIZE_MAX ? NULL : (char*)entry->base + offset;
+}
+
+/**
+ * @brief Returns a freed cell to the calling thread's cache for reuse.
+ *
+ * The cell's data pages may be in any protection state; slab_alloc() unlocks them again.
+ *
+ * @param base Start of the cell's data pages.
+ * @param allocated_size Data bytes of the cell, as recorded in its AllocationEntry.
+ */
+void slab_release(void* base, const size_t allocated_size) {
+    const int cls = class_for_data_bytes(allocated_size);
+    if (cls < 0) return;
+
+    SlabCache* cache = cache_for_thread();
+    if (cache) {
+        if (cache->count[cls] == SLAB_CACHE_CELLS) drain_cache(cache, cls, SLAB_CACHE_CELLS - SLAB_REFILL);
+        cache->cells[cls][cache->count[cls]++] = base;
+        return;
+    }
+
+    SlabClass* sc = &classes[cls];
+    pthread_mutex_lock(&sc->lock);
+    push_free_locked(sc, base);
+    pthread_mutex_unlock(&sc->lock);
+}
+
+/**
+ * @brief pthread_atfork() prepare handler: takes the cache and class locks.
+ */
+void slab_fork_prepare(void) {
+    if (!enabled) return;
+    pthread_mutex_lock(&caches_lock);
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) pthread_mutex_lock(&classes[cls].lock);
+}
+
+void slab_fork_parent(void) {
+    if (!enabled) return;
+    for (int cls = SLAB_CLASSES; cls-- > 0;) pthread_mutex_unlock(&classes[cls].lock);
+    pthread_mutex_unlock(&caches_lock);
+}
+
+/**
+ * @brief pthread_atfork() child handler: the caches of the threads that did not survive
+ * the fork go back to the class stacks.
+ */
+void slab_fork_child(void) {
+    if (!enabled) return;
+    slab_fork_parent();
+    for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+        SlabCache* cache = &caches[i];
+        if (!cache->in_use || cache == thread_cache) continue;
+        for (int cls = 0; cls < SLAB_CLASSES; cls++) drain_cache(cache, cls, 0);
+        cache->in_use = 0;
+    }
+}
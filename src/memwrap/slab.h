@@ -0,0 +1,22 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include "alloc_table.h"
+
+/**
+ * @file slab.h
+ * @brief Size-class slabs of guarded cells for small tracked allocations.
+ */
+
+void slab_init(void);
+int slab_enabled(void);
+size_t slab_max_size(void);
+void* slab_alloc(size_t size, size_t alignment, AllocationEntry* entry);
+void* slab_place(const AllocationEntry* entry, size_t size);
+void slab_release(void* base, size_t allocated_size);
+void slab_fork_prepare(void);
+void slab_fork_parent(void);
+void slab_fork_child(void);
+
+#endif
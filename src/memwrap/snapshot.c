@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "snapshot.h"
+#include "memwrap.h"
+#include "alloc_table.h"
+#include "stack.h"
+#include "tracking.h"
+#include "leak_scan.h"
+#include "heap_snapshot.h"
+
+#define BLOCK_OFFSET 128
+#define DEFAULT_KEEP 4
+#define SPARE_BLOCKS 1024
+#define STACK_USED 0x80000000u  // flag in the per-id depth array: a block refers to the id
+
+_Static_assert(sizeof(HeapSnapshotHeader) <= BLOCK_OFFSET, "header must fit before the blocks");
+
+/**
+ * @file snapshot.c
+ * @brief Writes every live tracked block to a heap snapshot file (see heap_snapshot.h).
+ *
+ * A snapshot is written on CONTROL_SNAPSHOT with CONTROL_SNAPSHOT_FILE, on the signal
+ * named by MAPD_SNAPSHOT_SIGNAL (USR1, USR2 or a number) and every MAPD_SNAPSHOT_MS
+ * milliseconds; the last two are served by a "mapd-snapshot" thread, since a signal
+ * handler can only post a semaphore. Files are named mapd-heap-<pid>-<n>.snap in
+ * MAPD_SNAPSHOT_DIR (default /tmp), and only the last MAPD_SNAPSHOT_KEEP (default 4) are
+ * kept. Nothing goes over the analyzer socket.
+ *
+ * The snapshot shows the table at one instant without stopping the program: the table
+ * starts a cut (see alloc_table_begin_cut()), and the walk then locks one shard at a time.
+ * A block of the cut freed before the walk reaches its shard is recorded by the freeing
+ * thread itself. Both write straight into the file, mapped beforehand with room for the
+ * blocks live then plus a margin; walked blocks fill it from the front, freed ones from the
+ * back. Blocks allocated while the file is being prepared may not fit and are counted in
+ * `missed`. Sorting, the stacks and a copy of /proc/self/maps follow once the table is free
+ * again. Muted blocks are left out.
+ */
+
+typedef struct {
+    HeapSnapshotBlock* blocks;
+    size_t capacity;
+    size_t front;                // walked blocks, only written by the walking thread
+    atomic_size_t back;          // blocks recorded by freeing threads
+    atomic_size_t claimed;
+    atomic_size_t missed;
+} CutBuffer;
+
+static char directory[256] = "/tmp";
+static unsigned int keep = DEFAULT_KEEP;
+static long long interval_ms = 0;
+static int signal_number = 0;
+static int thread_running = 0;
+static uint32_t snapshot_count = 0;
+static CutBuffer cut;
+static sem_t requests;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fill_block(HeapSnapshotBlock* block, const AllocationEntry* entry) {
+    *block = (HeapSnapshotBlock){
+        .addr = (uintptr_t)entry->addr,
+        .size = entry->requested_size,
+        .allocated_ns = entry->allocated_ns,
+        .stack_id = entry->stack_id,
+        .thread = entry->thread
+    };
+}
+
+static int claim_block(void) {
+    if (atomic_fetch_add_explicit(&cut.claimed, 1, memory_order_relaxed) < cut.capacity) return 1;
+    atomic_fetch_add_explicit(&cut.missed, 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Departed visitor of the cut: runs on a freeing thread under its shard lock.
+ */
+static int record_departed(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (entry->muted || !claim_block()) return 0;
+    const size_t index = cut.capacity - 1 - atomic_fetch_add_explicit(&cut.back, 1, memory_order_relaxed);
+    fill_block(&cut.blocks[index], entry);
+    return 0;
+}
+
+static int record_live(const AllocationEntry* entry, void* arg __attribute__((unused))) {
+    if (entry->muted || !claim_block()) return 0;
+    fill_block(&cut.blocks[cut.front++], entry);
+    return 0;
+}
+
+static void sift_down(HeapSnapshotBlock* blocks, size_t root, const size_t count) {
+    while (2 * root + 1 < count) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < count && blocks[child + 1].addr > blocks[child].addr) child++;
+        if (blocks[root].addr >= blocks[child].addr) return;
+        const HeapSnapshotBlock swap = blocks[root];
+        blocks[root] = blocks[child];
+        blocks[child] = swap;
+        root = child;
+    }
+}
+
+/**
+ * @brief Heapsort by address: in place, and without calling the allocator we are part of.
+ */
+static void sort_blocks(HeapSnapshotBlock* blocks, const size_t count) {
+    for (size_t i = count / 2; i-- > 0;) sift_down(blocks, i, count);
+    for (size_t end = count; end-- > 1;) {
+        const HeapSnapshotBlock swap = blocks[0];
+        blocks[0] = blocks[end];
+        blocks[end] = swap;
+        sift_down(blocks, 0, end);
+    }
+}
+
+/**
+ * @brief Stack section under construction: `depths` is indexed by stack id.
+ */
+typedef struct {
+    uint32_t* depths;
+    uint32_t id_limit;
+    HeapSnapshotStack* index;
+    uint64_t* frames;
+    uint64_t* first_frame;  // per id, filled while the index is laid out
+    size_t stack_count;
+    size_t frame_count;
+} StackSection;
+
+static void measure_stack(const uint32_t stack_id, const uintptr_t* frames __attribute__((unused)),
+                          const uint32_t depth, void* arg) {
+    StackSection* section = arg;
+    if (stack_id >= section->id_limit || !(section->depths[stack_id] & STACK_USED) || depth == 0) return;
+    section->depths[stack_id] = STACK_USED | depth;
+    section->stack_count++;
+    section->frame_count += depth;
+}
+
+static void copy_stack(const uint32_t stack_id, const uintptr_t* frames, const uint32_t depth, void* arg) {
+    const StackSection* section = arg;
+    if (stack_id >= section->id_limit || !(section->depths[stack_id] & STACK_USED)) return;
+    for (uint32_t i = 0; i < depth; i++) section->frames[section->first_frame[stack_id] + i] = frames[i];
+}
+
+/**
+ * @brief Marks the stacks the blocks refer to and measures them.
+ *
+ * @return 0 on success, -1 if scratch memory could not be mapped.
+ */
+static int measure_stacks(StackSection* section, const HeapSnapshotBlock* blocks, const size_t count) {
+    memset(section, 0, sizeof(*section));
+    section->id_limit = stack_max_id() + 1;
+    const size_t size = (size_t)section->id_limit * (sizeof(uint32_t) + sizeof(uint64_t));
+    void* scratch = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (scratch == MAP_FAILED) return -1;
+    section->first_frame = scratch;
+    section->depths = (uint32_t*)(section->first_frame + section->id_limit);
+
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i].stack_id && blocks[i].stack_id < section->id_limit) section->depths[blocks[i].stack_id] = STACK_USED;
+    }
+    stack_for_each(measure_stack, section);
+    return 0;
+}
+
+/**
+ * @brief Lays out the index in id order and copies the frames behind it.
+ */
+static void write_stacks(StackSection* section, void* destination) {
+    section->index = destination;
+    section->frames = (uint64_t*)(section->index + section->stack_count);
+
+    size_t next = 0;
+    uint64_t frame = 0;
+    for (uint32_t id = 1; id < section->id_limit && next < section->stack_count; id++) {
+        const uint32_t depth = section->depths[id] & ~STACK_USED;
+        if (!(section->depths[id] & STACK_USED) || depth == 0) continue;
+        section->index[next++] = (HeapSnapshotStack){ .stack_id = id, .depth = depth, .first_frame = frame };
+        section->first_frame[id] = frame;
+        frame += depth;
+    }
+    stack_for_each(copy_stack, section);
+}
+
+static void release_stacks(const StackSection* section) {
+    if (section->first_frame)
+        munmap(section->first_frame, (size_t)section->id_limit * (sizeof(uint32_t) + sizeof(uint64_t)));
+}
+
+/**
+ * @brief Appends /proc/self/maps at `offset`.
+ *
+ * @return Bytes written.
+ */
+static uint64_t append_maps(const int fd, const off_t offset) {
+    const int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps == -1) return 0;
+
+    char buffer[4096];
+    uint64_t written = 0;
+    ssize_t length;
+    while ((length = read(maps, buffer, sizeof(buffer))) > 0) {
+        if (pwrite(fd, buffer, (size_t)length, offset + (off_t)written) != length) break;
+        written += (uint64_t)length;
+    }
+    close(maps);
+    return written;
+}
+
+static void snapshot_path(char* path, const size_t size, const uint32_t number, const char* suffix) {
+    snprintf(path, size, "%s/mapd-heap-%d-%u.snap%s", directory, (int)getpid(), number, suffix);
+}
+
+/**
+ * @brief Maps a fresh file with room for the blocks live now and the margin.
+ *
+ * @return The mapping, or NULL with `*fd` closed.
+ */
+static void* map_file(const char* path, int* fd, const size_t capacity, size_t* mapped) {
+    *fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (*fd == -1) return NULL;
+
+    *mapped = BLOCK_OFFSET + capacity * sizeof(HeapSnapshotBlock);
+    void* file = MAP_FAILED;
+    if (ftruncate(*fd, (off_t)*mapped) == 0)
+        file = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (file != MAP_FAILED) {
+        leak_scan_ignore(file, *mapped);  // it holds block addresses
+        return file;
+    }
+
+    close(*fd);
+    unlink(path);
+    return NULL;
+}
+
+/**
+ * @brief Writes one snapshot. Safe to call from any thread but signal handlers.
+ *
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int snapshot_write(void) {
+    pthread_mutex_lock(&snapshot_lock);
+    const uint32_t number = ++snapshot_count;
+    char temporary[320], path[320];
+    snapshot_path(temporary, sizeof(temporary), number, ".tmp");
+    snapshot_path(path, sizeof(path), number, "");
+
+    int fd;
+    size_t mapped;
+    const size_t live = alloc_table_count();
+    const size_t capacity = live + live / 4 + SPARE_BLOCKS;
+    char* file = map_file(temporary, &fd, capacity, &mapped);
+    if (!file) {
+        pthread_mutex_unlock(&snapshot_lock);
+        return -1;
+    }
+
+    cut.blocks = (HeapSnapshotBlock*)(file + BLOCK_OFFSET);
+    cut.capacity = capacity;
+    cut.front = 0;
+    atomic_store(&cut.back, 0);
+    atomic_store(&cut.claimed, 0);
+    atomic_store(&cut.missed, 0);
+
+    HeapSnapshotHeader header = {
+        .magic = HEAP_SNAPSHOT_MAGIC,
+        .version = HEAP_SNAPSHOT_VERSION,
+        .header_size = sizeof(HeapSnapshotHeader),
+        .pid = (uint32_t)getpid(),
+        .snapshot = number,
+        .block_offset = BLOCK_OFFSET,
+        .block_size = sizeof(HeapSnapshotBlock),
+        .stack_size = sizeof(HeapSnapshotStack)
+    };
+    alloc_table_begin_cut(record_departed, NULL);
+    header.monotonic_ns = protocol_clock_ns(CLOCK_MONOTONIC);
+    header.realtime_ns = protocol_clock_ns(CLOCK_REALTIME);
+    alloc_table_for_each_cut(record_live, NULL);
+
+    // Close the gap between walked and departed blocks
+    const size_t departed = atomic_load(&cut.back);
+    memmove(cut.blocks + cut.front, cut.blocks + cut.capacity - departed, departed * sizeof(HeapSnapshotBlock));
+    header.block_count = cut.front + departed;
+    header.missed = atomic_load(&cut.missed);
+    sort_blocks(cut.blocks, header.block_count);
+    for (size_t i = 0; i < header.block_count; i++) header.total_bytes += cut.blocks[i].size;
+
+    StackSection stacks;
+    const int have_stacks = measure_stacks(&stacks, cut.blocks, header.block_count) == 0;
+    header.stack_offset = BLOCK_OFFSET + header.block_count * sizeof(HeapSnapshotBlock);
+    header.stack_count = have_stacks ? stacks.stack_count : 0;
+    header.frame_count = have_stacks ? stacks.frame_count : 0;
+    header.maps_offset = header.stack_offset + header.stack_count * sizeof(HeapSnapshotStack)
+                         + header.frame_count * sizeof(uint64_t);
+
+    int result = -1;
+    if (ftruncate(fd, (off_t)header.maps_offset) == 0) {
+        void* resized = mremap(file, mapped, header.maps_offset, MREMAP_MAYMOVE);
+        if (resized != MAP_FAILED) {
+            leak_scan_unignore(file);
+            leak_scan_ignore(resized, header.maps_offset);
+            file = resized;
+            mapped = header.maps_offset;
+            if (have_stacks) write_stacks(&stacks, file + header.stack_offset);
+            result = 0;
+        }
+    }
+    if (have_stacks) release_stacks(&stacks);
+    leak_scan_unignore(file);
+    munmap(file, mapped);
+
+    if (result == 0) {
+        header.maps_bytes = append_maps(fd, (off_t)header.maps_offset);
+        if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) result = -1;
+    }
+    close(fd);
+    if (result == 0 && rename(temporary, path) == 0) {
+        if (keep > 0 && number > keep) {
+            char old[320];
+            snapshot_path(old, sizeof(old), number - keep, "");
+            unlink(old);
+        }
+        fprintf(stderr, "[Wrapper] Heap snapshot: %llu blocks written to %s.\n",
+                (unsigned long long)header.block_count, path);
+    } else {
+        unlink(temporary);
+        result = -1;
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    return result;
+}
+
+static void request_on_signal(int sig __attribute__((unused))) {
+    sem_post(&requests);
+}
+
+/**
+ * @brief Snapshot thread: writes a snapshot per signal and every MAPD_SNAPSHOT_MS.
+ */
+static void* snapshot_main(void* arg __attribute__((unused))) {
+    set_thread_untracked(1);
+    int64_t next = interval_ms > 0 ? protocol_clock_ns(CLOCK_MONOTONIC) + interval_ms * 1000000 : 0;
+
+    while (1) {
+        if (next == 0) {
+            sem_wait(&requests);
+        } else {
+            const struct timespec deadline = { .tv_sec = next / 1000000000, .tv_nsec = next % 1000000000 };
+            if (sem_clockwait(&requests, CLOCK_MONOTONIC, &deadline) != 0) next += interval_ms * 1000000;
+        }
+        snapshot_write();
+    }
+    return NULL;
+}
+
+static void start_thread(void) {
+    sem_init(&requests, 0, 0);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, snapshot_main, NULL) == 0) {
+        pthread_setname_np(thread, "mapd-snapshot");
+        pthread_detach(thread);
+        thread_running = 1;
+    }
+}
+
+/**
+ * @brief Reads the MAPD_SNAPSHOT_* variables, starts the snapshot thread and installs the
+ * signal handler if asked to.
+ */
+void snapshot_init(void) {
+    const char* directory_env = getenv("MAPD_SNAPSHOT_DIR");
+    const char* keep_env = getenv("MAPD_SNAPSHOT_KEEP");
+    const char* interval_env = getenv("MAPD_SNAPSHOT_MS");
+    const char* signal_env = getenv("MAPD_SNAPSHOT_SIGNAL");
+    if (directory_env && *directory_env) snprintf(directory, sizeof(directory), "%s", directory_env);
+    if (keep_env) keep = (unsigned int)strtoul(keep_env, NULL, 10);
+    if (interval_env) interval_ms = atoll(interval_env);
+    signal_number = signal_env ? parse_signal(signal_env) : 0;
+
+    if (interval_ms > 0 || signal_number) start_thread();
+    if (signal_number && thread_running) {
+        struct sigaction sa = {0};
+        sa.sa_handler = request_on_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(signal_number, &sa, NULL);
+    }
+}
+
+/**
+ * @brief pthread_atfork() child handler: the child numbers its own snapshots, and the
+ * thread, and a snapshot the parent was writing, stayed in the parent.
+ */
+void snapshot_fork_child(void) {
+    pthread_mutex_init(&snapshot_lock, NULL);
+    snapshot_count = 0;
+    if (!thread_running) return;
+    thread_running = 0;
+    start_thread();
+}
@@ -0,0 +1,13 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/**
+ * @file snapshot.h
+ * @brief Heap snapshots: every live tracked block written to a memory-mapped file.
+ */
+
+void snapshot_init(void);
+int snapshot_write(void);
+void snapshot_fork_child(void);
+
+#endif
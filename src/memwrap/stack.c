@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <link.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "stack.h"
+#include "transport.h"
+
+#define DEPOT_BITS 18
+#define DEPOT_ARENA_BYTES (64ul << 20)
+#define MAX_PROBES 64
+
+/**
+ * @file stack.c
+ * @brief Captures allocation call stacks and interns them in a lock-free depot.
+ *
+ * Capture is off unless MAPD_STACK_DEPTH is set (1..PROTOCOL_MAX_STACK_DEPTH frames) and
+ * the binary protocol is in use. By default the stack is read by following the frame
+ * pointer chain, which costs a few loads per frame; every step is checked against the
+ * bounds of the thread's stack, so code built without frame pointers ends the walk early
+ * instead of faulting. MAPD_STACK_UNWIND=backtrace switches to glibc's backtrace(), which
+ * uses unwind tables and works without frame pointers at a much higher cost. Frames inside
+ * this library are skipped, so a stack starts at the allocation call site.
+ *
+ * The depot is an open-addressed table of pointers to immutable records carved from an
+ * mmap'd arena. A new stack is announced to the analyzer with a FRAME_STACK, written to the
+ * socket right away, and only then published with a single compare-and-swap on an empty
+ * bucket. Another thread can therefore only use the id once the analyzer has the stack,
+ * even though events go through per-thread staging buffers. Events only carry the 32-bit
+ * id. Should two threads race to intern the same stack, the loser's record and id are
+ * announced but never used. Records are never removed. When the arena or a probe sequence
+ * is exhausted, capture returns 0 ("no stack").
+ */
+
+typedef struct {
+    uint32_t id;
+    uint32_t hash;
+    uint32_t depth;
+    uint32_t reserved;
+    uintptr_t frames[];
+} StackRecord;
+
+static int max_depth = 0;
+static int use_backtrace = 0;
+static uintptr_t self_start = 0;  // executable segment of this library
+static uintptr_t self_end = 0;
+
+static _Atomic(StackRecord*)* buckets = NULL;
+static char* arena = NULL;
+static atomic_size_t arena_used = 0;
+static atomic_uint next_id = 1;
+
+static __thread int capturing __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uintptr_t stack_low __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uintptr_t stack_high __attribute__((tls_model("initial-exec"))) = 0;
+
+/**
+ * @brief dl_iterate_phdr() callback finding the executable segment that holds this code.
+ */
+static int find_self(struct dl_phdr_info* info, size_t size __attribute__((unused)), void* arg) {
+    const uintptr_t probe = (uintptr_t)arg;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) continue;
+
+        const uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (probe >= start && probe < start + phdr->p_memsz) {
+            self_start = start;
+            self_end = start + phdr->p_memsz;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Maps the depot, once.
+ *
+ * @return 1 if the depot is ready.
+ */
+static int map_depot(void) {
+    if (buckets) return 1;
+
+    const size_t buckets_size = sizeof(*buckets) << DEPOT_BITS;
+    void* fresh_buckets = mmap(NULL, buckets_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* fresh_arena = mmap(NULL, DEPOT_ARENA_BYTES, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (fresh_buckets == MAP_FAILED || fresh_arena == MAP_FAILED) {
+        if (fresh_buckets != MAP_FAILED) munmap(fresh_buckets, buckets_size);
+        if (fresh_arena != MAP_FAILED) munmap(fresh_arena, DEPOT_ARENA_BYTES);
+        return 0;
+    }
+
+    if (use_backtrace) {
+        void* warmup[1];
+        backtrace(warmup, 1);  // loads libgcc_s now rather than inside the first malloc
+    }
+    arena = fresh_arena;
+    buckets = fresh_buckets;
+    return 1;
+}
+
+/**
+ * @brief Reads MAPD_STACK_DEPTH and MAPD_STACK_UNWIND, locates this library and maps the depot.
+ */
+void stack_init(void) {
+    const char* unwind_env = getenv("MAPD_STACK_UNWIND");
+    use_backtrace = unwind_env && strcmp(unwind_env, "backtrace") == 0;
+    dl_iterate_phdr(find_self, (void*)(uintptr_t)stack_init);
+
+    const char* depth_env = getenv("MAPD_STACK_DEPTH");
+    if (depth_env) stack_set_depth(atoi(depth_env));
+}
+
+/**
+ * @brief Sets the number of frames captured per stack, mapping the depot on first use.
+ *
+ * Only called at start-up and from the control thread. 0 turns capture off; ids already
+ * handed out stay valid.
+ */
+void stack_set_depth(int depth) {
+    if (depth <= 0) {
+        max_depth = 0;
+        return;
+    }
+    if (depth > PROTOCOL_MAX_STACK_DEPTH) depth = PROTOCOL_MAX_STACK_DEPTH;
+    if (map_depot()) max_depth = depth;
+}
+
+int stack_enabled(void) {
+    return max_depth > 0 && transport_connected() && transport_format() == PROTOCOL_FORMAT_BINARY;
+}
+
+/**
+ * @brief Caches the calling thread's stack bounds. May allocate, so callers guard recursion.
+ */
+static int thread_stack_bounds(void) {
+    if (stack_high) return 1;
+
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+    void* low;
+    size_t size;
+    const int found = pthread_attr_getstack(&attr, &low, &size) == 0;
+    pthread_attr_destroy(&attr);
+    if (!found) return 0;
+
+    stack_low = (uintptr_t)low;
+    stack_high = (uintptr_t)low + size;
+    return 1;
+}
+
+static int in_self(const uintptr_t pc) {
+    return pc >= self_start && pc < self_end;
+}
+
+static int walk_frame_pointers(uintptr_t* frames, const int limit) {
+    if (!thread_stack_bounds()) return 0;
+
+    const uintptr_t* fp = __builtin_frame_address(0);
+    int depth = 0;
+    while (depth < limit) {
+        if ((uintptr_t)fp < stack_low || (uintptr_t)(fp + 2) > stack_high || ((uintptr_t)fp & 7)) break;
+
+        const uintptr_t pc = fp[1];
+        const uintptr_t* next = (const uintptr_t*)fp[0];
+        if (pc == 0) break;
+        if (depth > 0 || !in_self(pc)) frames[depth++] = pc;
+        if (next <= fp) break;
+        fp = next;
+    }
+    return depth;
+}
+
+static int walk_unwind_tables(uintptr_t* frames, const int limit) {
+    void* raw[PROTOCOL_MAX_STACK_DEPTH + 8];
+    const int captured = backtrace(raw, limit + 8);
+
+    int depth = 0;
+    for (int i = 0; i < captured && depth < limit; i++) {
+        if (depth > 0 || !in_self((uintptr_t)raw[i])) frames[depth++] = (uintptr_t)raw[i];
+    }
+    return depth;
+}
+
+static uint32_t hash_frames(const uintptr_t* frames, const int depth) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t)depth;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i]) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    return (uint32_t)hash;
+}
+
+static StackRecord* new_record(const uintptr_t* frames, const int depth, const uint32_t hash) {
+    const size_t size = sizeof(StackRecord) + sizeof(uintptr_t) * (size_t)depth;
+    const size_t offset = atomic_fetch_add_explicit(&arena_used, size, memory_order_relaxed);
+    if (offset + size > DEPOT_ARENA_BYTES) return NULL;
+
+    StackRecord* record = (StackRecord*)(arena + offset);
+    record->id = atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+    record->hash = hash;
+    record->depth = (uint32_t)depth;
+    memcpy(record->frames, frames, sizeof(uintptr_t) * (size_t)depth);
+    return record;
+}
+
+/**
+ * @brief Sends a newly interned stack to the analyzer.
+ */
+static void announce(const StackRecord* record) {
+    StackTrace trace = { .stack_id = record->id, .depth = (uint16_t)record->depth };
+    for (uint32_t i = 0; i < record->depth; i++) trace.frames[i] = record->frames[i];
+    transport_send_frame(FRAME_STACK, &trace,
+                         (uint32_t)(offsetof(StackTrace, frames) + sizeof(uint64_t) * record->depth));
+}
+
+/**
+ * @brief Returns the depot id of a stack, announcing and adding it if it is new.
+ */
+static uint32_t intern(const uintptr_t* frames, const int depth) {
+    const uint32_t hash = hash_frames(frames, depth);
+    const size_t mask = ((size_t)1 << DEPOT_BITS) - 1;
+    StackRecord* fresh = NULL;
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        _Atomic(StackRecord*)* bucket = &buckets[(hash + probe) & mask];
+        StackRecord* record = atomic_load_explicit(bucket, memory_order_acquire);
+
+        if (!record) {
+            if (!fresh) {
+                fresh = new_record(frames, depth, hash);
+                if (!fresh) return 0;
+                announce(fresh);
+            }
+            if (atomic_compare_exchange_strong_explicit(bucket, &record, fresh,
+                                                        memory_order_acq_rel, memory_order_acquire)) {
+                return fresh->id;
+            }
+            // Lost the bucket; `record` now holds the winner, which may be this very stack
+        }
+        if (record->hash == hash && record->depth == (uint32_t)depth &&
+            memcmp(record->frames, frames, sizeof(uintptr_t) * (size_t)depth) == 0) {
+            return record->id;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Captures the caller's stack and returns its depot id.
+ *
+ * @return Stack id, or 0 when capture is disabled, re-entered or fails.
+ */
+uint32_t stack_capture(void) {
+    if (!stack_enabled() || capturing) return 0;
+    capturing = 1;
+
+    uintptr_t frames[PROTOCOL_MAX_STACK_DEPTH];
+    const int depth = use_backtrace ? walk_unwind_tables(frames, max_depth) : walk_frame_pointers(frames, max_depth);
+    const uint32_t id = depth > 0 ? intern(frames, depth) : 0;
+
+    capturing = 0;
+    return id;
+}
+
+/**
+ * @brief Return address of the innermost caller outside this library, without touching
+ * the depot. Works whether or not stacks are captured.
+ *
+ * @return The address, or 0 when re-entered or the walk fails.
+ */
+uintptr_t stack_call_site(void) {
+    if (capturing) return 0;
+    capturing = 1;
+
+    uintptr_t site = 0;
+    if (use_backtrace) walk_unwind_tables(&site, 1);
+    else walk_frame_pointers(&site, 1);
+
+    capturing = 0;
+    return site;
+}
+
+/**
+ * @brief Upper bound of the ids handed out so far.
+ */
+uint32_t stack_max_id(void) {
+    return atomic_load_explicit(&next_id, memory_order_relaxed);
+}
+
+/**
+ * @brief Calls visitor for every stack in the depot, in no particular order. Stacks
+ * interned meanwhile may or may not be visited.
+ */
+void stack_for_each(const StackVisitor visitor, void* arg) {
+    if (!buckets) return;
+    const size_t count = (size_t)1 << DEPOT_BITS;
+    for (size_t i = 0; i < count; i++) {
+        const StackRecord* record = atomic_load_explicit(&buckets[i], memory_order_acquire);
+        if (record) visitor(record->id, record->frames, record->depth, arg);
+    }
+}
+
+/**
+ * @brief pthread_atfork() child handler, run once the child has its own connection: the
+ * analyzer knows the inherited stacks only under the parent's client, so they are
+ * announced again.
+ */
+void stack_fork_child(void) {
+    if (!buckets) return;
+    const size_t count = (size_t)1 << DEPOT_BITS;
+    for (size_t i = 0; i < count; i++) {
+        const StackRecord* record = atomic_load_explicit(&buckets[i], memory_order_acquire);
+        if (record) announce(record);
+    }
+}
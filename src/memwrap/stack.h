@@ -0,0 +1,25 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+/**
+ * @file stack.h
+ * @brief Allocation-site capture and the deduplicating stack depot.
+ */
+
+/**
+ * @brief Callback for stack_for_each().
+ */
+typedef void (*StackVisitor)(uint32_t stack_id, const uintptr_t* frames, uint32_t depth, void* arg);
+
+void stack_init(void);
+void stack_set_depth(int depth);
+int stack_enabled(void);
+uint32_t stack_capture(void);
+uintptr_t stack_call_site(void);
+uint32_t stack_max_id(void);
+void stack_for_each(StackVisitor visitor, void* arg);
+void stack_fork_child(void);
+
+#endif
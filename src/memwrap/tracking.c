@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "tracking.h"
+#include "memwrap.h"
+
+/**
+ * @file tracking.c
+ * @brief Opens and closes tracking windows, so a long-running program only pays for
+ * tracking while someone looks.
+ *
+ * Tracking is off until it is switched on by one of:
+ *  - MAPD_TRACK=1, from start-up on;
+ *  - MAPD_TRACK_AFTER_MS=N, N milliseconds after start-up;
+ *  - MAPD_TRACK_SIGNAL=USR1 (or USR2, or a signal number), each signal toggles it;
+ *  - CONTROL_SET_TRACKING from the analyzer, or enable_tracking() from the program.
+ * With MAPD_TRACK_FOR_MS=M, every window closes by itself M milliseconds after it opened.
+ *
+ * While tracking is off, new allocations go to the real allocator. Blocks from earlier
+ * windows stay tracked until they are freed, and pointers from outside any window are
+ * told apart by ownership (see pointer_untracked()), so either kind may be freed at any
+ * time. Every change is announced to the analyzer as an EVENT_TRACKING.
+ *
+ * The signal handler only flips the switch and posts a semaphore: the announcement and
+ * the timing are left to a "mapd-window" thread, started when a schedule or a signal is
+ * configured.
+ */
+
+static long long after_ms = 0;
+static long long for_ms = 0;
+static int64_t start_at = 0;  // CLOCK_MONOTONIC time of the scheduled window, 0 once opened
+static int timer_running = 0;
+static sem_t wakeup;
+static atomic_int reported = 0;
+
+/**
+ * @brief Sends an EVENT_TRACKING if the switch changed since the last one.
+ */
+static void announce_change(void) {
+    const int on = tracking_active();
+    if (atomic_exchange(&reported, on) != on) send_event(EVENT_TRACKING, NULL, (size_t)on);
+}
+
+/**
+ * @brief Switches tracking on or off at once. Not for signal handlers.
+ */
+void tracking_switch(const int on) {
+    set_tracking(on);
+    announce_change();
+    if (timer_running) sem_post(&wakeup);
+}
+
+static void toggle_on_signal(int sig __attribute__((unused))) {
+    set_tracking(!tracking_active());
+    sem_post(&wakeup);
+}
+
+static void wait_until(const int64_t deadline_ns) {
+    if (deadline_ns == 0) {
+        sem_wait(&wakeup);
+        return;
+    }
+    const struct timespec deadline = { .tv_sec = deadline_ns / 1000000000, .tv_nsec = deadline_ns % 1000000000 };
+    sem_clockwait(&wakeup, CLOCK_MONOTONIC, &deadline);
+}
+
+/**
+ * @brief Timer thread: opens the scheduled window, closes windows after MAPD_TRACK_FOR_MS
+ * and announces changes made by the signal handler.
+ */
+static void* timer_main(void* arg __attribute__((unused))) {
+    int64_t close_at = 0;
+
+    while (1) {
+        announce_change();
+        const int64_t now = protocol_clock_ns(CLOCK_MONOTONIC);
+        if (start_at && now >= start_at) {
+            start_at = 0;
+            set_tracking(1);
+            continue;
+        }
+
+        if (!tracking_active() || for_ms <= 0) {
+            close_at = 0;
+        } else if (!close_at) {
+            close_at = now + for_ms * 1000000;
+        } else if (now >= close_at) {
+            close_at = 0;
+            set_tracking(0);
+            continue;
+        }
+
+        int64_t deadline = start_at;
+        if (close_at && (!deadline || close_at < deadline)) deadline = close_at;
+        wait_until(deadline);
+    }
+    return NULL;
+}
+
+static void start_timer(void) {
+    sem_init(&wakeup, 0, 0);
+    pthread_t timer;
+    if (pthread_create(&timer, NULL, timer_main, NULL) == 0) {
+        pthread_setname_np(timer, "mapd-window");
+        pthread_detach(timer);
+        timer_running = 1;
+    }
+}
+
+/**
+ * @brief Reads a signal name ("USR1", "SIGUSR2") or number, as given in MAPD_*_SIGNAL.
+ *
+ * @return The signal, 0 if not recognized.
+ */
+int parse_signal(const char* name) {
+    if (strncmp(name, "SIG", 3) == 0) name += 3;
+    if (strcmp(name, "USR1") == 0) return SIGUSR1;
+    if (strcmp(name, "USR2") == 0) return SIGUSR2;
+    const int number = atoi(name);
+    return number > 0 && number < NSIG ? number : 0;
+}
+
+/**
+ * @brief Reads the MAPD_TRACK* variables, installs the signal handler and starts the timer.
+ */
+void tracking_init(void) {
+    const char* track_env = getenv("MAPD_TRACK");
+    const char* after_env = getenv("MAPD_TRACK_AFTER_MS");
+    const char* for_env = getenv("MAPD_TRACK_FOR_MS");
+    const char* signal_env = getenv("MAPD_TRACK_SIGNAL");
+    if (after_env) after_ms = atoll(after_env);
+    if (for_env) for_ms = atoll(for_env);
+    const int sig = signal_env ? parse_signal(signal_env) : 0;
+
+    if (after_ms > 0) start_at = protocol_clock_ns(CLOCK_MONOTONIC) + after_ms * 1000000;
+    if (after_ms > 0 || for_ms > 0 || sig) start_timer();
+    if (sig && timer_running) {
+        struct sigaction sa = {0};
+        sa.sa_handler = toggle_on_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(sig, &sa, NULL);
+    }
+    if (track_env && strcmp(track_env, "1") == 0) tracking_switch(1);
+}
+
+/**
+ * @brief pthread_atfork() child handler, run once the child has its own connection: tells
+ * the new client about an open window and restarts the timer thread, which did not survive
+ * the fork. The child keeps the parent's schedule and its current window.
+ */
+void tracking_fork_child(void) {
+    atomic_store(&reported, 0);
+    announce_change();
+    if (!timer_running) return;
+    timer_running = 0;
+    start_timer();
+}
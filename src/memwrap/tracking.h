@@ -0,0 +1,14 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+
+/**
+ * @file tracking.h
+ * @brief Tracking windows: switching tracking on and off while the program runs.
+ */
+
+void tracking_init(void);
+void tracking_switch(int on);
+void tracking_fork_child(void);
+int parse_signal(const char* name);
+
+#endif
@@ -0,0 +1,981 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "transport.h"
+#include "memwrap.h"
+#include "event_ring.h"
+#include "control.h"
+#include "filter.h"
+#include "leak_scan.h"
+#include "counters.h"
+
+#define SOCKET_PATH "/tmp/mapd_socket"
+#define HANDSHAKE_TIMEOUT_MS 250
+#define HASH_MULTIPLIER 11400714819323198485llu  // 2⁶⁴ / golden ratio
+
+#define STAGING_BYTES 4096
+#define MAX_STAGING_THREADS 256
+#define DEFAULT_BATCH_BYTES (1 << 20)
+#define DEFAULT_FLUSH_MS 20
+#define MAX_SAMPLE_SHIFT 10
+#define RING_FULL_SPINS 1024
+#define RING_FULL_WAIT_MS 1
+#define FATAL_WAIT_MS 100
+
+/**
+ * @file transport.c
+ * @brief Delivers wrapper events to the analyzer over the UNIX socket or a shared-memory ring.
+ *
+ * The transport is chosen once during the handshake:
+ *  - JSON lines on the socket, for analyzers that do not answer the hello;
+ *  - binary frames on the socket (MAPD_TRANSPORT=socket);
+ *  - binary records in a memfd-backed EventRing shared with the analyzer (default), where
+ *    the socket only carries wakeups.
+ *
+ * Socket transports never write on the application thread. Events are appended to a
+ * per-thread staging buffer; full staging buffers move into a bounded batch queue that a
+ * background flusher thread writes out in large chunks, and the flusher also collects
+ * partially filled staging buffers every MAPD_FLUSH_MS.
+ *
+ * When the batch queue (or the shared ring) is full, MAPD_BACKPRESSURE selects what the
+ * application thread does:
+ *  - block:  wait for the analyzer to catch up (default, nothing is lost);
+ *  - drop:   discard the events and report the count as an events_dropped event;
+ *  - sample: like drop, and additionally halve the share of malloc/free events that are
+ *            sent, by address hash so a malloc and its free are kept or dropped together.
+ *            The rate recovers once the backlog drains.
+ * Error events (leaks, overflows, ...) are never dropped or sampled; they always block.
+ *
+ * With the binary protocol a reader thread listens on the socket for FRAME_CONTROL frames
+ * and hands them to control_apply(), and for FRAME_FILTER frames, which go to
+ * filter_apply().
+ *
+ * Leak summaries (see leak_report.c) skip the staging buffers: transport_send_bulk() writes
+ * them out in one go. The live counters page (see counters.c) is passed to binary analyzers
+ * once, right after the handshake.
+ *
+ * A forked child must not write into its parent's connection: transport_reconnect() drops
+ * everything inherited and connects again as a new client (see inherit.c).
+ */
+
+typedef enum { BACKPRESSURE_BLOCK, BACKPRESSURE_DROP, BACKPRESSURE_SAMPLE } BackpressurePolicy;
+
+/**
+ * Per-thread staging buffer. `lock` is only contended by the flusher collecting
+ * partially filled buffers.
+ */
+typedef struct {
+    atomic_flag lock;
+    atomic_int in_use;
+    uint32_t records;
+    uint32_t critical;
+    size_t used;
+    char data[STAGING_BYTES];
+} StagingBuffer;
+
+/**
+ * Bounded byte queue between staging buffers and the flusher.
+ */
+typedef struct {
+    char* data;
+    size_t capacity;
+    size_t head;
+    size_t used;
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+} BatchQueue;
+
+static int sock_fd = -1;
+static ProtocolFormat wire_format = PROTOCOL_FORMAT_JSON;
+static EventRing* ring = NULL;
+
+static BackpressurePolicy backpressure = BACKPRESSURE_BLOCK;
+static atomic_int sample_shift = 0;
+static atomic_ullong dropped_events = 0;
+static atomic_int broken = 0;
+static atomic_int socket_writes = 0;  // write_all() calls in progress, see transport_send_fatal()
+static int flush_interval_ms = DEFAULT_FLUSH_MS;
+
+static StagingBuffer* staging_buffers = NULL;
+static __thread StagingBuffer* thread_staging = NULL;
+static pthread_key_t staging_key;
+static BatchQueue batches = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER
+};
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t flusher_thread;
+static int flusher_running = 0;
+static pthread_t control_thread;
+static int control_running = 0;
+static int32_t client_id = 0;
+static uint32_t parent_pid = 0;
+static int32_t parent_client_id = 0;
+
+/**
+ * @brief Reads MAPD_RING_SLOTS, rounded up to a power of two.
+ */
+static uint32_t ring_slots_from_env(void) {
+    const char* env = getenv("MAPD_RING_SLOTS");
+    if (!env) return EVENT_RING_DEFAULT_SLOTS;
+
+    unsigned long requested = strtoul(env, NULL, 10);
+    if (requested < 64) requested = 64;
+    if (requested > (1ul << 24)) requested = 1ul << 24;
+
+    uint32_t slots = 64;
+    while (slots < requested) slots <<= 1;
+    return slots;
+}
+
+/**
+ * @brief Creates and maps a memfd-backed event ring.
+ *
+ * @return The memfd to pass to the analyzer, or -1 if the ring could not be created.
+ */
+static int create_ring(void) {
+    const uint32_t slots = ring_slots_from_env();
+    const size_t size = event_ring_size(slots);
+
+    const int fd = memfd_create("mapd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) return -1;
+
+    // The analyzer refuses a ring whose size can still change
+    if (ftruncate(fd, (off_t)size) == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    ring = mapping;
+    event_ring_init(ring, slots);
+    return fd;
+}
+
+static void destroy_ring(void) {
+    if (!ring) return;
+    munmap(ring, event_ring_size(ring->slot_count));
+    ring = NULL;
+}
+
+/**
+ * @brief Writes `length` bytes to the socket in one message, attaching `fd` with SCM_RIGHTS
+ * unless it is -1.
+ */
+static int send_with_fd(const void* data, const size_t length, const int fd) {
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = length };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd != -1) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return sendmsg(sock_fd, &msg, MSG_NOSIGNAL) == (ssize_t)length ? 0 : -1;
+}
+
+/**
+ * @brief Sends the hello frame, attaching the ring memfd with SCM_RIGHTS when there is one.
+ */
+static int send_hello(const int ring_fd) {
+    struct {
+        FrameHeader header;
+        HelloFrame hello;
+    } frame = {
+        .header = { .kind = FRAME_HELLO, .length = sizeof(HelloFrame) },
+        .hello = {
+            .magic = PROTOCOL_MAGIC,
+            .version = PROTOCOL_VERSION,
+            .formats = PROTOCOL_FORMAT_JSON | PROTOCOL_FORMAT_BINARY,
+            .pid = (uint32_t)getpid(),
+            .transports = PROTOCOL_TRANSPORT_SOCKET | (ring_fd != -1 ? PROTOCOL_TRANSPORT_RING : 0),
+            .realtime_ns = protocol_clock_ns(CLOCK_REALTIME),
+            .monotonic_ns = protocol_clock_ns(CLOCK_MONOTONIC),
+            .parent_pid = parent_pid,
+            .parent_client_id = parent_client_id
+        }
+    };
+    return send_with_fd(&frame, sizeof(frame), ring_fd);
+}
+
+/**
+ * @brief Hands a binary analyzer the live counters page (see counters.c).
+ *
+ * Sent after the hello answer, so the analyzer has taken the ring memfd off the socket by
+ * the time this one arrives.
+ */
+static void send_counters(void) {
+    if (wire_format != PROTOCOL_FORMAT_BINARY || counters_fd() == -1) return;
+
+    const struct {
+        FrameHeader header;
+        CountersFrame counters;
+    } frame = {
+        .header = { .kind = FRAME_COUNTERS, .length = sizeof(CountersFrame) },
+        .counters = { .size = counters_size() }
+    };
+    pthread_mutex_lock(&write_lock);
+    send_with_fd(&frame, sizeof(frame), counters_fd());
+    pthread_mutex_unlock(&write_lock);
+}
+
+/**
+ * @brief Reads a `length`-byte frame payload into a `size`-byte struct.
+ *
+ * Newer analyzers may send a longer struct; the bytes we do not know are read and
+ * discarded. Fields missing from a shorter one stay zero.
+ *
+ * @return 0 on success, -1 if the socket closed before the payload was complete.
+ */
+static int read_payload(void* out, const size_t size, uint32_t length) {
+    const size_t copied = length < size ? length : size;
+    if (copied > 0 && recv(sock_fd, out, copied, MSG_WAITALL) != (ssize_t)copied) return -1;
+    length -= (uint32_t)copied;
+
+    char discard[64];
+    while (length > 0) {
+        const size_t chunk = length < sizeof(discard) ? length : sizeof(discard);
+        if (recv(sock_fd, discard, chunk, MSG_WAITALL) != (ssize_t)chunk) return -1;
+        length -= (uint32_t)chunk;
+    }
+    return 0;
+}
+
+/**
+ * @brief Offer the binary protocol (and the ring) to the analyzer and wait briefly for its answer.
+ *
+ * Analyzers that predate the handshake never reply; after HANDSHAKE_TIMEOUT_MS the
+ * wrapper keeps using JSON. MAPD_PROTOCOL=json skips the handshake entirely and
+ * MAPD_TRANSPORT=socket keeps binary frames on the socket instead of the ring.
+ */
+static void negotiate_protocol(void) {
+    const char* protocol_env = getenv("MAPD_PROTOCOL");
+    if (protocol_env && strcmp(protocol_env, "json") == 0) return;
+
+    const char* transport_env = getenv("MAPD_TRANSPORT");
+    const int want_ring = !(transport_env && strcmp(transport_env, "socket") == 0);
+
+    const int ring_fd = want_ring ? create_ring() : -1;
+    const int sent = send_hello(ring_fd);
+    if (ring_fd != -1) close(ring_fd);  // the analyzer holds its own reference now
+    if (sent == -1) {
+        destroy_ring();
+        return;
+    }
+
+    HelloAckFrame ack = {0};
+    FrameHeader header;
+    struct pollfd pfd = { .fd = sock_fd, .events = POLLIN };
+    if (poll(&pfd, 1, HANDSHAKE_TIMEOUT_MS) <= 0 ||
+        recv(sock_fd, &header, sizeof(header), MSG_WAITALL) != (ssize_t)sizeof(header) ||
+        header.kind != FRAME_HELLO_ACK || read_payload(&ack, sizeof(ack), header.length) != 0 ||
+        ack.magic != PROTOCOL_MAGIC) {
+        destroy_ring();
+        return;
+    }
+
+    client_id = ack.client_id;
+    if (ack.format == PROTOCOL_FORMAT_BINARY) wire_format = PROTOCOL_FORMAT_BINARY;
+    if (wire_format != PROTOCOL_FORMAT_BINARY || ack.transport != PROTOCOL_TRANSPORT_RING) destroy_ring();
+}
+
+/**
+ * @brief Reads MAPD_BACKPRESSURE, MAPD_FLUSH_MS and MAPD_BATCH_BYTES.
+ */
+static void read_writer_config(void) {
+    const char* policy_env = getenv("MAPD_BACKPRESSURE");
+    if (policy_env) {
+        if (strcmp(policy_env, "drop") == 0) backpressure = BACKPRESSURE_DROP;
+        else if (strcmp(policy_env, "sample") == 0) backpressure = BACKPRESSURE_SAMPLE;
+        else backpressure = BACKPRESSURE_BLOCK;
+    }
+
+    const char* flush_env = getenv("MAPD_FLUSH_MS");
+    if (flush_env && atoi(flush_env) > 0) flush_interval_ms = atoi(flush_env);
+
+    batches.capacity = DEFAULT_BATCH_BYTES;
+    const char* batch_env = getenv("MAPD_BATCH_BYTES");
+    if (batch_env && strtoul(batch_env, NULL, 10) >= 4 * STAGING_BYTES)
+        batches.capacity = strtoul(batch_env, NULL, 10);
+}
+
+/**
+ * @brief Gives up on the analyzer and wakes every thread waiting for room in the batch queue.
+ */
+static void mark_broken(void) {
+    atomic_store(&broken, 1);
+    pthread_mutex_lock(&batches.lock);
+    pthread_cond_broadcast(&batches.not_full);
+    pthread_cond_broadcast(&batches.not_empty);
+    pthread_mutex_unlock(&batches.lock);
+}
+
+/**
+ * @brief Sends a whole buffer, retrying short writes. Marks the transport broken on error.
+ */
+static void write_all(const char* data, size_t length) {
+    atomic_fetch_add(&socket_writes, 1);
+    while (length > 0 && !atomic_load(&broken)) {
+        const ssize_t written = send(sock_fd, data, length, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            atomic_store(&broken, 1);
+            break;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    atomic_fetch_sub(&socket_writes, 1);
+}
+
+/**
+ * @brief Accounts for events discarded under backpressure and tightens sampling if asked to.
+ */
+static void note_dropped(const uint32_t records) {
+    atomic_fetch_add(&dropped_events, records);
+    if (backpressure == BACKPRESSURE_SAMPLE && atomic_load(&sample_shift) < MAX_SAMPLE_SHIFT)
+        atomic_fetch_add(&sample_shift, 1);
+}
+
+/**
+ * @brief Copies a chunk into the batch queue if it fits. Caller holds batches.lock.
+ */
+static int append_batch_locked(const char* data, const size_t length) {
+    if (batches.used + length > batches.capacity) return 0;
+
+    const size_t tail = (batches.head + batches.used) % batches.capacity;
+    const size_t first = length < batches.capacity - tail ? length : batches.capacity - tail;
+    memcpy(batches.data + tail, data, first);
+    memcpy(batches.data, data + first, length - first);
+    batches.used += length;
+
+    if (batches.used >= batches.capacity / 2) pthread_cond_signal(&batches.not_empty);
+    return 1;
+}
+
+/**
+ * @brief Writes out everything currently in the batch queue. Caller holds write_lock.
+ */
+static void drain_batches(void) {
+    pthread_mutex_lock(&batches.lock);
+    const size_t head = batches.head;
+    const size_t used = batches.used;
+    pthread_mutex_unlock(&batches.lock);
+    if (used == 0) return;
+
+    // Only this function consumes, so [head, head + used) stays stable while we write it
+    const size_t first = used < batches.capacity - head ? used : batches.capacity - head;
+    write_all(batches.data + head, first);
+    write_all(batches.data, used - first);
+
+    pthread_mutex_lock(&batches.lock);
+    batches.head = (head + used) % batches.capacity;
+    batches.used -= used;
+    pthread_cond_broadcast(&batches.not_full);
+    pthread_mutex_unlock(&batches.lock);
+}
+
+/**
+ * @brief Moves a chunk of staged bytes into the batch queue, applying the backpressure policy.
+ *
+ * Only called from application threads; the flusher uses collect_staging(), which drains
+ * instead of waiting on itself. A chunk larger than the whole queue is written out
+ * directly, after what is already queued, unless the policy allows dropping it.
+ */
+static void enqueue_batch(const char* data, const size_t length, const uint32_t records, const uint32_t critical) {
+    if (length == 0) return;
+    if (length > batches.capacity) {
+        if (backpressure != BACKPRESSURE_BLOCK && critical == 0) {
+            note_dropped(records);
+            return;
+        }
+        pthread_mutex_lock(&write_lock);
+        drain_batches();
+        write_all(data, length);
+        pthread_mutex_unlock(&write_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&batches.lock);
+    while (!atomic_load(&broken) && !append_batch_locked(data, length)) {
+        if (backpressure != BACKPRESSURE_BLOCK && critical == 0) {
+            pthread_mutex_unlock(&batches.lock);
+            note_dropped(records);
+            return;
+        }
+        pthread_cond_signal(&batches.not_empty);
+        pthread_cond_wait(&batches.not_full, &batches.lock);
+    }
+    pthread_mutex_unlock(&batches.lock);
+}
+
+static void lock_staging(StagingBuffer* staging) {
+    while (atomic_flag_test_and_set_explicit(&staging->lock, memory_order_acquire)) sched_yield();
+}
+
+static void unlock_staging(StagingBuffer* staging) {
+    atomic_flag_clear_explicit(&staging->lock, memory_order_release);
+}
+
+/**
+ * @brief Hands the staged bytes of one buffer to the batch queue. Caller holds the staging lock.
+ */
+static void flush_staging_locked(StagingBuffer* staging) {
+    enqueue_batch(staging->data, staging->used, staging->records, staging->critical);
+    staging->used = 0;
+    staging->records = 0;
+    staging->critical = 0;
+}
+
+/**
+ * @brief Returns the calling thread's staging buffer, claiming a free slot on first use.
+ *
+ * @return NULL when all MAX_STAGING_THREADS slots are taken.
+ */
+static StagingBuffer* staging_for_thread(void) {
+    if (thread_staging) return thread_staging;
+    if (!staging_buffers) return NULL;
+
+    for (int i = 0; i < MAX_STAGING_THREADS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&staging_buffers[i].in_use, &expected, 1)) {
+            thread_staging = &staging_buffers[i];
+            pthread_setspecific(staging_key, thread_staging);
+            return thread_staging;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Thread-exit destructor: flushes and releases the thread's staging slot.
+ */
+static void release_staging(void* arg) {
+    StagingBuffer* staging = arg;
+    lock_staging(staging);
+    flush_staging_locked(staging);
+    unlock_staging(staging);
+    atomic_store(&staging->in_use, 0);
+    thread_staging = NULL;
+}
+
+/**
+ * @brief Appends one encoded event to the calling thread's staging buffer.
+ */
+static void stage(const void* data, const size_t length, const int critical) {
+    StagingBuffer* staging = staging_for_thread();
+    if (!staging || length > STAGING_BYTES) {
+        enqueue_batch(data, length, 1, critical);
+        return;
+    }
+
+    lock_staging(staging);
+    if (staging->used + length > STAGING_BYTES) flush_staging_locked(staging);
+    memcpy(staging->data + staging->used, data, length);
+    staging->used += length;
+    staging->records++;
+    if (critical) staging->critical++;
+    unlock_staging(staging);
+}
+
+/**
+ * @brief Collects partially filled staging buffers and writes everything out. Caller holds write_lock.
+ *
+ * Buffers busy on their own thread are left for the next round. When the batch queue is
+ * full the collector writes it out itself rather than waiting, since it is the consumer.
+ */
+static void collect_staging(void) {
+    for (int i = 0; i < MAX_STAGING_THREADS; i++) {
+        StagingBuffer* staging = &staging_buffers[i];
+        if (!atomic_load(&staging->in_use) || staging->used == 0) continue;
+        if (atomic_flag_test_and_set_explicit(&staging->lock, memory_order_acquire)) continue;
+
+        while (!atomic_load(&broken)) {
+            pthread_mutex_lock(&batches.lock);
+            const int appended = append_batch_locked(staging->data, staging->used);
+            pthread_mutex_unlock(&batches.lock);
+            if (appended) break;
+            drain_batches();
+        }
+        staging->used = 0;
+        staging->records = 0;
+        staging->critical = 0;
+        unlock_staging(staging);
+    }
+    drain_batches();
+}
+
+/**
+ * @brief Backlog of the active transport as a fraction of its capacity, in percent.
+ */
+static int backlog_percent(void) {
+    if (ring) {
+        const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        return (int)((head - tail) * 100 / ring->slot_count);
+    }
+    pthread_mutex_lock(&batches.lock);
+    const int percent = (int)(batches.used * 100 / batches.capacity);
+    pthread_mutex_unlock(&batches.lock);
+    return percent;
+}
+
+/**
+ * @brief Background flusher: writes batches, collects staging buffers, reports drops and relaxes sampling.
+ */
+static void* flusher_main(void* arg) {
+    (void)arg;
+
+    while (!atomic_load(&broken)) {
+        if (!ring) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)flush_interval_ms * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+
+            pthread_mutex_lock(&batches.lock);
+            if (batches.used < batches.capacity / 2)
+                pthread_cond_timedwait(&batches.not_empty, &batches.lock, &deadline);
+            pthread_mutex_unlock(&batches.lock);
+
+            pthread_mutex_lock(&write_lock);
+            drain_batches();
+            collect_staging();
+            pthread_mutex_unlock(&write_lock);
+        } else {
+            usleep((useconds_t)flush_interval_ms * 1000);
+        }
+
+        if (atomic_load(&sample_shift) > 0 && backlog_percent() < 25)
+            atomic_fetch_sub(&sample_shift, 1);
+
+        const unsigned long long dropped = atomic_exchange(&dropped_events, 0);
+        if (dropped > 0) send_event(EVENT_EVENTS_DROPPED, NULL, (size_t)dropped);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sets up staging buffers, the batch queue and the flusher thread.
+ */
+static void start_writer(void) {
+    read_writer_config();
+
+    // A forked child reuses the buffers it inherited, see transport_reconnect()
+    if (!ring && !batches.data) {
+        batches.data = mmap(NULL, batches.capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        staging_buffers = mmap(NULL, sizeof(StagingBuffer) * MAX_STAGING_THREADS, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (batches.data == MAP_FAILED || staging_buffers == MAP_FAILED) {
+            // Without buffers the socket is written synchronously
+            batches.data = NULL;
+            staging_buffers = NULL;
+            return;
+        }
+        leak_scan_ignore(batches.data, batches.capacity);
+        leak_scan_ignore(staging_buffers, sizeof(StagingBuffer) * MAX_STAGING_THREADS);
+        pthread_key_create(&staging_key, release_staging);
+    }
+
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) == 0) {
+        pthread_setname_np(flusher_thread, "mapd-flush");
+        flusher_running = 1;
+    }
+}
+
+/**
+ * @brief Reader thread: applies the control and filter frames the analyzer sends until the
+ * socket closes.
+ *
+ * End of file means the analyzer is gone, so the transport is marked broken on the way
+ * out; otherwise threads blocked on a full ring or batch queue would wait forever.
+ */
+static void* control_main(void* arg) {
+    (void)arg;
+
+    FrameHeader header;
+    char payload[sizeof(FilterFrame)];
+    while (recv(sock_fd, &header, sizeof(header), MSG_WAITALL) == (ssize_t)sizeof(header)) {
+        // Skip what does not fit; only control frames are expected here
+        uint32_t remaining = header.length;
+        while (remaining > 0) {
+            const size_t chunk = remaining < sizeof(payload) ? remaining : sizeof(payload);
+            if (recv(sock_fd, payload, chunk, MSG_WAITALL) != (ssize_t)chunk) break;
+            remaining -= (uint32_t)chunk;
+        }
+        if (remaining > 0) break;
+        if (header.length > sizeof(payload)) continue;
+
+        if (header.kind == FRAME_CONTROL) {
+            ControlFrame frame = {0};
+            memcpy(&frame, payload, header.length < sizeof(frame) ? header.length : sizeof(frame));
+            control_apply(&frame);
+        } else if (header.kind == FRAME_FILTER) {
+            FilterFrame frame = {0};
+            memcpy(&frame, payload, header.length);
+            filter_apply(&frame);
+        }
+    }
+    mark_broken();
+    return NULL;
+}
+
+/**
+ * @brief Starts the control reader; only analyzers speaking the binary protocol send commands.
+ */
+static void start_control_reader(void) {
+    if (wire_format != PROTOCOL_FORMAT_BINARY) return;
+    if (pthread_create(&control_thread, NULL, control_main, NULL) == 0) {
+        pthread_setname_np(control_thread, "mapd-control");
+        control_running = 1;
+    }
+}
+
+/**
+ * @brief Connects to the analyzer socket and negotiates format and transport.
+ *
+ * @return 0 on success, -1 if no analyzer is listening.
+ */
+int transport_connect(void) {
+    sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) return -1;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    if (connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(sock_fd);
+        sock_fd = -1;
+        return -1;
+    }
+
+    negotiate_protocol();
+    send_counters();
+    start_writer();
+    start_control_reader();
+    return 0;
+}
+
+/**
+ * @brief Records the client this process descends from, announced in the next hello.
+ */
+void transport_set_parent(const uint32_t pid, const int32_t client) {
+    parent_pid = pid;
+    parent_client_id = client;
+}
+
+/**
+ * @brief Id the analyzer gave this process in its hello answer, 0 if none.
+ */
+int32_t transport_client_id(void) {
+    return client_id;
+}
+
+/**
+ * @brief pthread_atfork() child handler: leaves the parent's connection and connects as a
+ * client of our own, unless `follow` is 0.
+ *
+ * The child's only thread runs this, so the inherited state is simply reset: the socket
+ * and the ring belong to the parent, threads other than the caller are gone, and any lock
+ * may have been held by one of them. Staged events are the parent's and are discarded.
+ */
+void transport_reconnect(const int follow) {
+    const int32_t parent = client_id;
+    if (sock_fd != -1) close(sock_fd);  // shutdown() would end the parent's connection too
+    sock_fd = -1;
+    if (ring) munmap(ring, event_ring_size(ring->slot_count));  // the analyzer's copy stays
+    ring = NULL;
+    wire_format = PROTOCOL_FORMAT_JSON;
+    client_id = 0;
+    atomic_store(&broken, 0);
+    atomic_store(&dropped_events, 0);
+    atomic_store(&sample_shift, 0);
+    flusher_running = 0;
+    control_running = 0;
+
+    pthread_mutex_init(&write_lock, NULL);
+    pthread_mutex_init(&batches.lock, NULL);
+    pthread_cond_init(&batches.not_full, NULL);
+    pthread_cond_init(&batches.not_empty, NULL);
+    batches.head = 0;
+    batches.used = 0;
+    if (staging_buffers) {
+        memset(staging_buffers, 0, sizeof(StagingBuffer) * MAX_STAGING_THREADS);
+        pthread_setspecific(staging_key, NULL);
+    }
+    thread_staging = NULL;
+
+    if (!follow) return;
+    transport_set_parent((uint32_t)getppid(), parent);
+    transport_connect();
+}
+
+int transport_connected(void) {
+    return sock_fd != -1 && !atomic_load_explicit(&broken, memory_order_relaxed);
+}
+
+ProtocolFormat transport_format(void) {
+    return wire_format;
+}
+
+const char* transport_name(void) {
+    if (wire_format != PROTOCOL_FORMAT_BINARY) return "json";
+    return ring ? "binary, shared ring" : "binary";
+}
+
+static int is_routine_event(const int type) {
+    return type == EVENT_MALLOC || type == EVENT_FREE;
+}
+
+/**
+ * @brief Decides whether an event survives the current backpressure sampling rate.
+ *
+ * Hashing the address keeps a malloc and its free together. Error events always pass
+ * the sampling.
+ */
+int transport_accepts_event(const EventType type, const void* addr) {
+    const int shift = atomic_load_explicit(&sample_shift, memory_order_relaxed);
+    if (shift == 0 || !is_routine_event(type)) return 1;
+    return ((uintptr_t)addr * HASH_MULTIPLIER) >> (64 - shift) == 0;
+}
+
+/**
+ * @brief Wakes the analyzer if it went to sleep on an empty ring.
+ */
+static void wake_consumer(void) {
+    if (!atomic_load_explicit(&ring->consumer_waiting, memory_order_relaxed)) return;
+    if (!atomic_exchange(&ring->consumer_waiting, 0)) return;
+
+    const FrameHeader wakeup = { .kind = FRAME_WAKEUP, .length = 0 };
+    if (send(sock_fd, &wakeup, sizeof(wakeup), MSG_NOSIGNAL | MSG_DONTWAIT) == -1 &&
+        (errno == EPIPE || errno == ECONNRESET)) {
+        atomic_store(&broken, 1);
+    }
+}
+
+/**
+ * @brief Waits briefly on the socket and marks the transport broken if the analyzer hung up.
+ *
+ * The control reader notices the hangup too, but it does not run when it could not be
+ * started, and a consumer that died while busy never asks for a wakeup that would fail.
+ */
+static void wait_for_consumer(void) {
+    struct pollfd pfd = { .fd = sock_fd, .events = POLLRDHUP };
+    if (poll(&pfd, 1, RING_FULL_WAIT_MS) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)))
+        mark_broken();
+}
+
+/**
+ * @brief Publishes a record into the shared ring, applying the backpressure policy when it is full.
+ *
+ * Blocking spins for at most RING_FULL_SPINS yields at a time, then checks that the
+ * analyzer is still there before spinning again.
+ */
+static void push_to_ring(const EventRecord* record) {
+    for (unsigned spins = 1; !event_ring_push(ring, record); spins++) {
+        if (atomic_load_explicit(&broken, memory_order_relaxed)) return;
+        if (backpressure != BACKPRESSURE_BLOCK && is_routine_event(record->type)) {
+            note_dropped(1);
+            return;
+        }
+        wake_consumer();
+        if (spins % RING_FULL_SPINS == 0) wait_for_consumer();
+        else sched_yield();
+    }
+    wake_consumer();
+}
+
+/**
+ * @brief Delivers one binary event record.
+ */
+void transport_send_record(const EventRecord* record) {
+    if (!transport_connected()) return;
+
+    if (ring) {
+        push_to_ring(record);
+        return;
+    }
+
+    struct {
+        FrameHeader header;
+        EventRecord record;
+    } frame = {
+        .header = { .kind = FRAME_EVENT, .length = sizeof(EventRecord) },
+        .record = *record
+    };
+    transport_send_raw(&frame, sizeof(frame), !is_routine_event(record->type));
+}
+
+/**
+ * @brief Writes preformatted bytes straight to the socket; async-signal-safe, for handle_segv().
+ *
+ * Takes no locks and stages nothing. The data goes out in a single send(), once no other
+ * write is in progress so that it cannot land in the middle of another frame. Each wait,
+ * for that or for room, gives up after FATAL_WAIT_MS, since the faulting thread may have
+ * been writing itself; the data is then lost. Events still staged are not written.
+ */
+void transport_write_fatal(const void* data, const size_t length) {
+    if (!transport_connected()) return;
+
+    const struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+    for (int waited = 0; atomic_load(&socket_writes) != 0 && waited < FATAL_WAIT_MS; waited++) {
+        nanosleep(&pause, NULL);
+    }
+    struct pollfd pfd = { .fd = sock_fd, .events = POLLOUT };
+    if (poll(&pfd, 1, FATAL_WAIT_MS) <= 0) return;
+    send(sock_fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/**
+ * @brief Delivers the binary record of a fatal error; async-signal-safe, for handle_segv().
+ *
+ * In ring mode the record is published like any other, waiting at most FATAL_WAIT_MS for
+ * room; otherwise it is framed and written by transport_write_fatal().
+ */
+void transport_send_fatal(const EventRecord* record) {
+    if (!transport_connected() || wire_format != PROTOCOL_FORMAT_BINARY) return;
+
+    if (ring) {
+        const struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+        for (int waited = 0; !event_ring_push(ring, record); waited++) {
+            if (waited == FATAL_WAIT_MS) return;
+            wake_consumer();
+            nanosleep(&pause, NULL);
+        }
+        wake_consumer();
+        return;
+    }
+
+    const struct {
+        FrameHeader header;
+        EventRecord record;
+    } frame = {
+        .header = { .kind = FRAME_EVENT, .length = sizeof(EventRecord) },
+        .record = *record
+    };
+    transport_write_fatal(&frame, sizeof(frame));
+}
+
+/**
+ * @brief Delivers a non-event binary frame. These always travel on the socket and are never dropped.
+ *
+ * The frame is written before this returns, skipping the staging buffers, so it reaches the
+ * analyzer ahead of any event staged afterwards on any thread. Stacks rely on that: an id is
+ * only published once its FRAME_STACK is on the socket (see stack.c).
+ */
+void transport_send_frame(const FrameKind kind, const void* payload, const uint32_t length) {
+    if (!transport_connected() || wire_format != PROTOCOL_FORMAT_BINARY) return;
+
+    char frame[sizeof(FrameHeader) + sizeof(StackTrace)];
+    if (length > sizeof(frame) - sizeof(FrameHeader)) return;
+
+    const FrameHeader header = { .kind = kind, .length = length };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), payload, length);
+    pthread_mutex_lock(&write_lock);
+    write_all(frame, sizeof(header) + length);
+    pthread_mutex_unlock(&write_lock);
+}
+
+/**
+ * @brief Queues preformatted bytes (a frame or a JSON line) for the flusher.
+ *
+ * Falls back to a direct write when the writer could not be set up.
+ */
+void transport_send_raw(const void* data, const size_t length, const int critical) {
+    if (!transport_connected()) return;
+
+    if (!batches.data) {
+        pthread_mutex_lock(&write_lock);
+        write_all(data, length);
+        pthread_mutex_unlock(&write_lock);
+        return;
+    }
+    stage(data, length, critical);
+}
+
+/**
+ * @brief Writes a large binary frame straight to the socket, bypassing staging buffers and
+ * the batch queue.
+ *
+ * Everything staged before is written out first, so stacks the frame refers to reach the
+ * analyzer ahead of it. The frame is never dropped.
+ */
+void transport_send_bulk(const void* frame, const size_t length) {
+    if (!transport_connected() || wire_format != PROTOCOL_FORMAT_BINARY) return;
+
+    pthread_mutex_lock(&write_lock);
+    if (batches.data) collect_staging();
+    write_all(frame, length);
+    pthread_mutex_unlock(&write_lock);
+}
+
+/**
+ * @brief Writes out everything staged so far from the calling thread.
+ */
+void transport_flush(void) {
+    if (sock_fd == -1 || !batches.data) return;
+
+    pthread_mutex_lock(&write_lock);
+    collect_staging();
+    pthread_mutex_unlock(&write_lock);
+}
+
+/**
+ * @brief Flushes pending events and closes the socket.
+ *
+ * The ring stays mapped because other threads may still be publishing.
+ */
+void transport_close(void) {
+    if (sock_fd == -1) return;
+    transport_flush();
+
+    mark_broken();
+    if (flusher_running) {
+        pthread_join(flusher_thread, NULL);
+        flusher_running = 0;
+    }
+
+    // Wakes the control reader, unless it is the caller
+    shutdown(sock_fd, SHUT_RDWR);
+    if (control_running && !pthread_equal(control_thread, pthread_self())) {
+        pthread_join(control_thread, NULL);
+        control_running = 0;
+    }
+
+    close(sock_fd);
+    sock_fd = -1;
+}
@@ -0,0 +1,29 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include "protocol.h"
+
+/**
+ * @file transport.h
+ * @brief Connection from memwrap to the analyzer: socket setup, handshake and event delivery.
+ */
+
+int transport_connect(void);
+void transport_set_parent(uint32_t pid, int32_t client);
+int32_t transport_client_id(void);
+void transport_reconnect(int follow);
+int transport_connected(void);
+ProtocolFormat transport_format(void);
+const char* transport_name(void);
+int transport_accepts_event(EventType type, const void* addr);
+void transport_send_record(const EventRecord* record);
+void transport_send_fatal(const EventRecord* record);
+void transport_write_fatal(const void* data, size_t length);
+void transport_send_frame(FrameKind kind, const void* payload, uint32_t length);
+void transport_send_raw(const void* data, size_t length, int critical);
+void transport_send_bulk(const void* frame, size_t length);
+void transport_flush(void);
+void transport_close(void);
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef COUNTERS_PAGE_H
+#define COUNTERS_PAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/**
+ * Live counters page: allocation statistics a wrapper process keeps in shared memory, for the analyzer to read at any
+ * time without a message.
+ *
+ * The page lives in a memfd created by the wrapper at start-up and passed to the analyzer with SCM_RIGHTS in a
+ * FRAME_COUNTERS after the handshake. Like the event ring's, the memfd is sealed against resizing before it is sent. Every thread counts into a slot of its own, so counting is a few plain stores
+ * into cache lines no other thread writes. Slot 0 holds the counts of threads that have exited and of threads that
+ * found no free slot; it is updated with atomic additions.
+ *
+ * Allocations, frees and their bytes are counted per power-of-two size class (see counters_size_class()). The bytes
+ * live right now are the allocated minus the freed bytes of all slots. Each thread also moves its share of the live
+ * bytes into `live_bytes` every COUNTERS_FLUSH_BYTES, and `peak_live_bytes` is the highest value `live_bytes` reached,
+ * so the peak lags the true one by at most COUNTERS_FLUSH_BYTES per thread.
+ *
+ * When all slots are taken, a new thread folds the slot of an exited one into slot 0 and takes it over. `generation`
+ * is odd while that happens; readers retry until they saw the same even value before and after summing.
+ */
+
+#define COUNTERS_PAGE_MAGIC 0x52544e43u  // "CNTR"
+#define COUNTERS_PAGE_VERSION 1
+#define COUNTERS_SIZE_CLASSES 32
+#define COUNTERS_FLUSH_BYTES (64 * 1024)
+#define COUNTERS_CACHE_LINE 64
+#define COUNTERS_READ_ATTEMPTS 1000
+
+/**
+ * CounterSlot:
+ *
+ * Counts of one thread. Class k counts blocks of 2^(k-1) + 1 to 2^k bytes, class 0 blocks of 0 and 1 byte, and the
+ * last class every larger block too. `owner` is the kernel thread id, 0 for a free slot. `unflushed` is the share of
+ * the live bytes not moved into the page's `live_bytes` yet.
+ */
+typedef struct {
+    _Alignas(COUNTERS_CACHE_LINE) _Atomic uint32_t owner;
+    uint32_t reserved;
+    _Atomic int64_t unflushed;
+    _Atomic uint64_t allocs[COUNTERS_SIZE_CLASSES];
+    _Atomic uint64_t frees[COUNTERS_SIZE_CLASSES];
+    _Atomic uint64_t alloc_bytes[COUNTERS_SIZE_CLASSES];
+    _Atomic uint64_t free_bytes[COUNTERS_SIZE_CLASSES];
+} CounterSlot;
+
+/**
+ * CountersPage:
+ *
+ * Header of the shared mapping, followed by `slot_count` slots of `slot_size` bytes.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t class_count;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t pid;
+    uint32_t reserved;
+    _Alignas(COUNTERS_CACHE_LINE) _Atomic uint64_t generation;
+    _Atomic int64_t live_bytes;
+    _Atomic int64_t peak_live_bytes;
+    _Atomic uint32_t threads_seen;
+    _Alignas(COUNTERS_CACHE_LINE) CounterSlot slots[];
+} CountersPage;
+
+/**
+ * CountersTotals:
+ *
+ * The slots of a page summed up, as read by counters_page_read().
+ */
+typedef struct {
+    uint64_t allocs[COUNTERS_SIZE_CLASSES];
+    uint64_t frees[COUNTERS_SIZE_CLASSES];
+    uint64_t alloc_bytes[COUNTERS_SIZE_CLASSES];
+    uint64_t free_bytes[COUNTERS_SIZE_CLASSES];
+    uint64_t total_allocs;
+    uint64_t total_frees;
+    int64_t live_bytes;
+    int64_t peak_live_bytes;
+    uint32_t threads_seen;
+} CountersTotals;
+
+/**
+ * counters_page_size:
+ *
+ * @param slot_count Number of thread slots, slot 0 included
+ * @return Bytes needed for the shared mapping
+ */
+static inline size_t counters_page_size(uint32_t slot_count)
+{
+    return sizeof(CountersPage) + (size_t)slot_count * sizeof(CounterSlot);
+}
+
+/**
+ * counters_size_class:
+ *
+ * Size class a block of `size` bytes is counted in.
+ */
+static inline unsigned counters_size_class(size_t size)
+{
+    if (size <= 1) return 0;
+    const unsigned size_class = 64 - (unsigned)__builtin_clzll((unsigned long long)(size - 1));
+    return size_class < COUNTERS_SIZE_CLASSES ? size_class : COUNTERS_SIZE_CLASSES - 1;
+}
+
+/**
+ * counters_page_init:
+ *
+ * Initializes a freshly mapped (zeroed) page.
+ */
+static inline void counters_page_init(CountersPage* page, uint32_t slot_count, uint32_t pid)
+{
+    page->magic = COUNTERS_PAGE_MAGIC;
+    page->version = COUNTERS_PAGE_VERSION;
+    page->class_count = COUNTERS_SIZE_CLASSES;
+    page->slot_count = slot_count;
+    page->slot_size = sizeof(CounterSlot);
+    page->pid = pid;
+}
+
+/**
+ * counters_page_valid:
+ *
+ * Checks that a mapping of `size` bytes holds a page this build can read. The wrapper can still write the header
+ * afterwards, so the reader keeps the slot count returned here and never reads `slot_count` again.
+ *
+ * @param slot_count Set to the validated number of slots
+ */
+static inline int counters_page_valid(const CountersPage* page, size_t size, uint32_t* slot_count)
+{
+    if (size < sizeof(CountersPage) ||
+        page->magic != COUNTERS_PAGE_MAGIC ||
+        page->class_count != COUNTERS_SIZE_CLASSES ||
+        page->slot_size != sizeof(CounterSlot))
+        return 0;
+    const uint32_t slots = *(const volatile uint32_t*)&page->slot_count;
+    if (slots == 0 || counters_page_size(slots) > size) return 0;
+    *slot_count = slots;
+    return 1;
+}
+
+/**
+ * counters_page_read:
+ *
+ * Sums the first `slot_count` slots of a page into `totals`: the count counters_page_valid() returned for a page
+ * received from a wrapper. Values written at the same time may or may not be included yet, but a slot being recycled
+ * is never counted twice or left out.
+ *
+ * @return 0 on success, -1 if slots were being recycled on every attempt (a wrapper killed while recycling one)
+ */
+static inline int counters_page_read(const CountersPage* page, uint32_t slot_count, CountersTotals* totals)
+{
+    uint64_t before, after;
+    int attempts = 0;
+    do {
+        if (++attempts > COUNTERS_READ_ATTEMPTS) return -1;
+        before = atomic_load_explicit(&page->generation, memory_order_acquire);
+        if (before & 1)
+        {
+            after = before + 1;
+            continue;
+        }
+
+        memset(totals, 0, sizeof(*totals));
+        for (uint32_t i = 0; i < slot_count; i++)
+        {
+            const CounterSlot* slot = &page->slots[i];
+            for (unsigned c = 0; c < COUNTERS_SIZE_CLASSES; c++)
+            {
+                totals->allocs[c] += atomic_load_explicit(&slot->allocs[c], memory_order_relaxed);
+                totals->frees[c] += atomic_load_explicit(&slot->frees[c], memory_order_relaxed);
+                totals->alloc_bytes[c] += atomic_load_explicit(&slot->alloc_bytes[c], memory_order_relaxed);
+                totals->free_bytes[c] += atomic_load_explicit(&slot->free_bytes[c], memory_order_relaxed);
+            }
+        }
+        totals->peak_live_bytes = atomic_load_explicit(&page->peak_live_bytes, memory_order_relaxed);
+        totals->threads_seen = atomic_load_explicit(&page->threads_seen, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&page->generation, memory_order_relaxed);
+    } while (before != after);
+
+    uint64_t allocated = 0, freed = 0;
+    for (unsigned c = 0; c < COUNTERS_SIZE_CLASSES; c++)
+    {
+        totals->total_allocs += totals->allocs[c];
+        totals->total_frees += totals->frees[c];
+        allocated += totals->alloc_bytes[c];
+        freed += totals->free_bytes[c];
+    }
+    totals->live_bytes = (int64_t)(allocated - freed);
+    if (totals->peak_live_bytes < totals->live_bytes) totals->peak_live_bytes = totals->live_bytes;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "protocol.h"
+
+/**
+ * Shared-memory event ring between one wrapper process (many producer threads) and its analyzer client thread
+ * (single consumer).
+ *
+ * The ring lives in a memfd created by the wrapper and passed to the analyzer with SCM_RIGHTS alongside the hello.
+ * The wrapper seals its size (F_SEAL_SHRINK, F_SEAL_GROW, F_SEAL_SEAL) before sending it, and the analyzer refuses an
+ * unsealed one: a ring truncated under its mapping would fault the analyzer.
+ * Producers claim a slot with a CAS on `head` and publish it by storing the slot sequence; no syscall is needed per
+ * event. When the consumer runs dry it sets `consumer_waiting` and blocks on the socket; the next producer to see the
+ * flag clears it and sends a single FRAME_WAKEUP.
+ *
+ * Slot protocol (bounded MPMC queue after D. Vyukov): slot i starts with sequence i. A slot at position p is free for
+ * producers when sequence == p, readable by the consumer when sequence == p + 1, and handed back for the next lap by
+ * setting sequence = p + slot_count.
+ */
+
+#define EVENT_RING_MAGIC 0x474e4952u  // "RING"
+#define EVENT_RING_DEFAULT_SLOTS 65536
+#define EVENT_RING_CACHE_LINE 64
+
+/**
+ * EventRingSlot:
+ *
+ * One record plus its publication sequence. Slots are cache-line aligned so concurrent producers do not share lines.
+ */
+typedef struct {
+    _Alignas(EVENT_RING_CACHE_LINE) _Atomic uint64_t sequence;
+    EventRecord record;
+} EventRingSlot;
+
+/**
+ * EventRing:
+ *
+ * Header of the shared mapping, followed by `slot_count` slots. `slot_count` is a power of two.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t reserved;
+    _Alignas(EVENT_RING_CACHE_LINE) _Atomic uint64_t head;
+    _Alignas(EVENT_RING_CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(EVENT_RING_CACHE_LINE) _Atomic uint32_t consumer_waiting;
+    _Alignas(EVENT_RING_CACHE_LINE) EventRingSlot slots[];
+} EventRing;
+
+/**
+ * event_ring_size:
+ *
+ * @param slot_count Number of slots (power of two)
+ * @return Bytes needed for the shared mapping
+ */
+static inline size_t event_ring_size(uint32_t slot_count)
+{
+    return sizeof(EventRing) + (size_t)slot_count * sizeof(EventRingSlot);
+}
+
+/**
+ * event_ring_init:
+ *
+ * Initializes a freshly mapped (zeroed) ring.
+ */
+static inline void event_ring_init(EventRing* ring, uint32_t slot_count)
+{
+    ring->magic = EVENT_RING_MAGIC;
+    ring->slot_count = slot_count;
+    ring->slot_size = sizeof(EventRingSlot);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->consumer_waiting, 0);
+    for (uint32_t i = 0; i < slot_count; i++)
+        atomic_init(&ring->slots[i].sequence, i);
+}
+
+/**
+ * event_ring_valid:
+ *
+ * Checks a mapping received from an untrusted peer before it is used. The peer can still write the header
+ * afterwards, so the consumer keeps the slot count returned here and never reads `slot_count` again.
+ *
+ * @param ring Mapped ring
+ * @param mapped_size Size of the mapping in bytes
+ * @param slot_count Set to the validated number of slots
+ * @return 1 if the header is consistent with the mapping, 0 otherwise
+ */
+static inline int event_ring_valid(const EventRing* ring, size_t mapped_size, uint32_t* slot_count)
+{
+    if (mapped_size < sizeof(EventRing)) return 0;
+    if (ring->magic != EVENT_RING_MAGIC || ring->slot_size != sizeof(EventRingSlot)) return 0;
+    const uint32_t slots = *(const volatile uint32_t*)&ring->slot_count;
+    if (slots == 0 || (slots & (slots - 1)) != 0 || event_ring_size(slots) > mapped_size) return 0;
+    *slot_count = slots;
+    return 1;
+}
+
+/**
+ * event_ring_push:
+ *
+ * Publishes one record. Lock-free and async-signal-safe.
+ *
+ * @return 1 on success, 0 if the ring is full
+ */
+static inline int event_ring_push(EventRing* ring, const EventRecord* record)
+{
+    const uint64_t mask = ring->slot_count - 1;
+    uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    for (;;) {
+        EventRingSlot* slot = &ring->slots[pos & mask];
+        const uint64_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        const int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->record = *record;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * event_ring_pop:
+ *
+ * Takes the oldest published record. Must only be called by the single consumer, with the slot count
+ * event_ring_valid() returned.
+ *
+ * @return 1 if a record was copied to `record`, 0 if the ring is empty
+ */
+static inline int event_ring_pop(EventRing* ring, uint32_t slot_count, EventRecord* record)
+{
+    const uint64_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    EventRingSlot* slot = &ring->slots[pos & (slot_count - 1)];
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1) return 0;
+
+    *record = slot->record;
+    atomic_store_explicit(&slot->sequence, pos + slot_count, memory_order_release);
+    atomic_store_explicit(&ring->tail, pos + 1, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * event_ring_empty:
+ *
+ * Consumer-side check used after arming `consumer_waiting` to avoid a lost wakeup.
+ */
+static inline int event_ring_empty(EventRing* ring, uint32_t slot_count)
+{
+    const uint64_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const EventRingSlot* slot = &ring->slots[pos & (slot_count - 1)];
+    return atomic_load_explicit(&slot->sequence, memory_order_seq_cst) != pos + 1;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef HEAP_SNAPSHOT_H
+#define HEAP_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+
+/**
+ * Heap snapshot file written by memwrap (see snapshot.c): every live tracked block of one process at one instant.
+ *
+ * The file starts with a HeapSnapshotHeader. The offsets in it lead to three sections:
+ *  - `block_count` HeapSnapshotBlock records sorted by address, so a reader can binary-search the block holding a
+ *    pointer;
+ *  - `stack_count` HeapSnapshotStack records sorted by stack id, indexing `frame_count` frames stored right after them
+ *    (64-bit return addresses, innermost first), for the allocation sites the blocks refer to;
+ *  - the text of the process's /proc/self/maps, `maps_bytes` long, to symbolize frames after the process is gone.
+ * All fields are in native byte order. Records only grow at the end; readers use the sizes given in the header.
+ *
+ * Snapshots are written to a temporary name and renamed when complete, so a file under the final name is never
+ * partial.
+ */
+
+#define HEAP_SNAPSHOT_MAGIC 0x50414e53u  // "SNAP"
+#define HEAP_SNAPSHOT_VERSION 1
+
+/**
+ * HeapSnapshotHeader:
+ *
+ * `realtime_ns` and `monotonic_ns` are the instant the snapshot shows; a block's age is `monotonic_ns` minus its
+ * `allocated_ns`. `missed` counts blocks live at that instant that did not fit into the file (blocks allocated while it
+ * was being prepared); it is 0 for a complete snapshot.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t pid;
+    uint32_t snapshot;
+    int64_t realtime_ns;
+    int64_t monotonic_ns;
+    uint64_t block_offset;
+    uint64_t block_count;
+    uint32_t block_size;
+    uint32_t stack_size;
+    uint64_t stack_offset;
+    uint64_t stack_count;
+    uint64_t frame_count;
+    uint64_t maps_offset;
+    uint64_t maps_bytes;
+    uint64_t total_bytes;
+    uint64_t missed;
+} HeapSnapshotHeader;
+
+/**
+ * HeapSnapshotBlock:
+ *
+ * One live block: requested size, allocation site (0 if no stack was captured), allocating thread's kernel id and
+ * CLOCK_MONOTONIC allocation time.
+ */
+typedef struct {
+    uint64_t addr;
+    uint64_t size;
+    int64_t allocated_ns;
+    uint32_t stack_id;
+    uint32_t thread;
+} HeapSnapshotBlock;
+
+/**
+ * HeapSnapshotStack:
+ *
+ * Allocation site `stack_id`: `depth` frames starting at index `first_frame` of the frame array.
+ */
+typedef struct {
+    uint32_t stack_id;
+    uint32_t depth;
+    uint64_t first_frame;
+} HeapSnapshotStack;
+
+_Static_assert(sizeof(HeapSnapshotHeader) % 8 == 0, "HeapSnapshotHeader must stay 8-byte aligned");
+
+/**
+ * heap_snapshot_frames:
+ *
+ * Frame array of a snapshot, right after its stack index.
+ */
+static inline const uint64_t* heap_snapshot_frames(const void* file)
+{
+    const HeapSnapshotHeader* header = file;
+    return (const uint64_t*)((const char*)file + header->stack_offset + header->stack_count * header->stack_size);
+}
+
+/**
+ * heap_snapshot_valid:
+ *
+ * Checks the header of a mapped snapshot file, that its sections lie inside the file and that the stack index and its
+ * frames end before the maps text, and that every stack's frames lie inside the frame array.
+ */
+static inline int heap_snapshot_valid(const void* file, size_t size)
+{
+    if (size < sizeof(HeapSnapshotHeader)) return 0;
+    const HeapSnapshotHeader* header = file;
+    if (header->magic != HEAP_SNAPSHOT_MAGIC || header->header_size < sizeof(HeapSnapshotHeader)) return 0;
+    if (header->block_size < sizeof(HeapSnapshotBlock) || header->stack_size < sizeof(HeapSnapshotStack)) return 0;
+    if (header->block_offset > size || header->stack_offset > size || header->maps_offset > size) return 0;
+    if (header->block_count > (size - header->block_offset) / header->block_size) return 0;
+    if (header->maps_bytes > size - header->maps_offset) return 0;
+
+    if (header->stack_offset > header->maps_offset) return 0;
+    if (header->stack_count > (header->maps_offset - header->stack_offset) / header->stack_size) return 0;
+    const uint64_t frames_offset = header->stack_offset + header->stack_count * header->stack_size;
+    if (header->frame_count > (header->maps_offset - frames_offset) / sizeof(uint64_t)) return 0;
+
+    const char* index = (const char*)file + header->stack_offset;
+    for (uint64_t i = 0; i < header->stack_count; i++)
+    {
+        const HeapSnapshotStack* stack = (const HeapSnapshotStack*)(index + i * header->stack_size);
+        if (stack->first_frame > header->frame_count || stack->depth > header->frame_count - stack->first_frame)
+            return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -57,21 +57,68 @@ Message parse_json_to_message(const char* json_str, int client_id) {
     cJSON* size = cJSON_GetObjectItem(root, "size");
     cJSON* thread = cJSON_GetObjectItem(root, "thread");
     cJSON* timestamp = cJSON_GetObjectItem(root, "timestamp");
+    cJSON* timestamp_ns = cJSON_GetObjectItem(root, "timestamp_ns");
     cJSON* severity = cJSON_GetObjectItem(root, "severity");
     cJSON* desc = cJSON_GetObjectItem(root, "description");
+    cJSON* weight = cJSON_GetObjectItem(root, "weight");
 
     if (type && cJSON_IsString(type)) strncpy(msg.type, type->valuestring, sizeof(msg.type));
     if (addr && cJSON_IsString(addr)) strncpy(msg.addr, addr->valuestring, sizeof(msg.addr));
     if (size && cJSON_IsNumber(size)) msg.size = size->valuedouble;
     if (thread && cJSON_IsNumber(thread)) msg.thread = thread->valuedouble;
     if (timestamp && cJSON_IsNumber(timestamp)) msg.timestamp = timestamp->valuedouble;
+    // Older wrappers only send whole seconds
+    if (timestamp_ns && cJSON_IsNumber(timestamp_ns)) msg.timestamp_ns = (int64_t)timestamp_ns->valuedouble;
+    else msg.timestamp_ns = (int64_t)msg.timestamp * 1000000000;
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
     if (severity && cJSON_IsString(severity)) strncpy(msg.severity, severity->valuestring, sizeof(msg.severity));
     if (desc && cJSON_IsString(desc)) strncpy(msg.description, desc->valuestring, sizeof(msg.description));
+    if (weight && cJSON_IsNumber(weight)) msg.weight = weight->valuedouble;
 
     cJSON_Delete(root);
     return msg;
 }
 
+/**
+ * parse_event_record:
+ *
+ * @param clock_offset_ns: CLOCK_REALTIME minus CLOCK_MONOTONIC of the client, from its hello
+ */
+Message parse_event_record(const EventRecord* record, int client_id, int64_t clock_offset_ns) {
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client_id = client_id;
+
+    strncpy(msg.type, protocol_event_name(record->type), sizeof(msg.type) - 1);
+    snprintf(msg.addr, sizeof(msg.addr), "%p", (void*)(uintptr_t)record->addr);
+    msg.size = record->size;
+    msg.thread = record->thread;
+    msg.timestamp_ns = record->timestamp + clock_offset_ns;
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
+    msg.stack_id = record->stack_id;
+    msg.weight = record->weight;
+    msg.seq = record->seq;
+    msg.thread_seq = record->thread_seq;
+    if (record->type == EVENT_TRACKING)
+        snprintf(msg.description, sizeof(msg.description), "Tracking %s.", record->size ? "started" : "stopped");
+
+    return msg;
+}
+
+/**
+ * message_format_time:
+ *
+ * Formats the message timestamp as local time with microseconds, e.g. "2024-05-01 12:00:00.123456".
+ */
+void message_format_time(const Message* msg, char* buffer, size_t size) {
+    const time_t seconds = (time_t)(msg->timestamp_ns / 1000000000);
+    struct tm tm_info;
+    localtime_r(&seconds, &tm_info);
+
+    const size_t used = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm_info);
+    snprintf(buffer + used, size - used, ".%06ld", (long)(msg->timestamp_ns % 1000000000 / 1000));
+}
+
 void create_connection_message(int client_id, const char* event) {
     if (analyzer_options && analyzer_options->info_logs_enabled == 0)
         return;
@@ -82,7 +129,8 @@ void create_connection_message(int client_id, const char* event) {
     strncpy(msg.addr, "-", sizeof(msg.addr));
     msg.size = 0;
     msg.thread = (unsigned long)pthread_self();
-    msg.timestamp = time(NULL);
+    msg.timestamp_ns = protocol_clock_ns(CLOCK_REALTIME);
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
     strncpy(msg.severity, "info", sizeof(msg.severity));
 
     if (strcmp(event, "connection") == 0) {
@@ -96,6 +144,83 @@ void create_connection_message(int client_id, const char* event) {
     enqueue_message(&msg);
 }
 
+/**
+ * create_lineage_message:
+ *
+ * Tells which client a new one descends from: the process that forked it (`parent_pid` differs from `pid`) or the
+ * program image that exec()ed it.
+ */
+void create_lineage_message(int client_id, int parent_client_id, uint32_t pid, uint32_t parent_pid) {
+    if (analyzer_options && analyzer_options->info_logs_enabled == 0)
+        return;
+
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client_id = client_id;
+    strncpy(msg.type, "connection", sizeof(msg.type));
+    strncpy(msg.addr, "-", sizeof(msg.addr));
+    msg.thread = (unsigned long)pthread_self();
+    msg.timestamp_ns = protocol_clock_ns(CLOCK_REALTIME);
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
+    strncpy(msg.severity, "info", sizeof(msg.severity));
+    if (parent_pid == pid)
+        snprintf(msg.description, sizeof(msg.description), "Client %d (pid %u) continues client %d after exec.",
+            client_id, pid, parent_client_id);
+    else
+        snprintf(msg.description, sizeof(msg.description), "Client %d (pid %u) is a child of client %d (pid %u).",
+            client_id, pid, parent_client_id, parent_pid);
+
+    enqueue_message(&msg);
+}
+
+/**
+ * create_leak_summary_message:
+ *
+ * Announces a leak summary of a client. Its sites stay in the analyzer's summary store and are fetched with
+ * leak_summary_take(), using `seq` as the report number.
+ */
+void create_leak_summary_message(int client_id, uint32_t report, uint64_t blocks, uint64_t bytes, size_t sites,
+                                 int64_t timestamp_ns) {
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client_id = client_id;
+    strncpy(msg.type, "leak_summary", sizeof(msg.type));
+    strncpy(msg.addr, "-", sizeof(msg.addr));
+    msg.size = bytes;
+    msg.thread = (unsigned long)pthread_self();
+    msg.timestamp_ns = timestamp_ns;
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
+    msg.seq = report;
+    strncpy(msg.severity, blocks ? "error" : "info", sizeof(msg.severity));
+    snprintf(msg.description, sizeof(msg.description), "Leak report %u: %llu blocks, %llu bytes at %zu sites.",
+        report, (unsigned long long)blocks, (unsigned long long)bytes, sites);
+
+    enqueue_message(&msg);
+}
+
+/**
+ * create_latency_message:
+ *
+ * Reports the latencies of one LatencyMetric of a client since its previous latency report. `addr` names the metric,
+ * `size` is the number of values and `seq` the report number.
+ */
+void create_latency_message(int client_id, uint32_t report, const char* metric, uint64_t count, const char* summary,
+                            int64_t timestamp_ns) {
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client_id = client_id;
+    strncpy(msg.type, "latency", sizeof(msg.type));
+    strncpy(msg.addr, metric, sizeof(msg.addr) - 1);
+    msg.size = count;
+    msg.thread = (unsigned long)pthread_self();
+    msg.timestamp_ns = timestamp_ns;
+    msg.timestamp = (time_t)(msg.timestamp_ns / 1000000000);
+    msg.seq = report;
+    strncpy(msg.severity, "info", sizeof(msg.severity));
+    snprintf(msg.description, sizeof(msg.description), "%s", summary);
+
+    enqueue_message(&msg);
+}
 
 void message_free(Message *msg)
 {
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <pthread.h>
 #include <time.h>
+#include "protocol.h"
 
 typedef struct {
     int client_id;
@@ -12,8 +13,14 @@ typedef struct {
     size_t size;
     unsigned long thread;
     time_t timestamp;
+    int64_t timestamp_ns;   // wall clock, nanoseconds since the epoch
     char severity[16];
     char description[128];
+    uint32_t stack_id;
+    char stack[512];
+    size_t weight;
+    uint64_t seq;           // event number within the client process, 0 if unknown
+    uint32_t thread_seq;    // event number within the sending thread, 0 if unknown
 } Message;
 
 #define MAX_QUEUE_SIZE 1024
@@ -32,8 +39,15 @@ extern MessageQueue message_queue;
 void enqueue_message(const Message* msg);
 Message dequeue_message();
 Message parse_json_to_message(const char* json_str, int client_id);
+Message parse_event_record(const EventRecord* record, int client_id, int64_t clock_offset_ns);
+void message_format_time(const Message* msg, char* buffer, size_t size);
 void message_free(Message* msg);
 Message* message_copy(const Message* src);
 void create_connection_message(int client_id, const char* event);
+void create_lineage_message(int client_id, int parent_client_id, uint32_t pid, uint32_t parent_pid);
+void create_leak_summary_message(int client_id, uint32_t report, uint64_t blocks, uint64_t bytes, size_t sites,
+                                 int64_t timestamp_ns);
+void create_latency_message(int client_id, uint32_t report, const char* metric, uint64_t count, const char* summary,
+                            int64_t timestamp_ns);
 
 #endif
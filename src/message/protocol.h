@@ -0,0 +1,582 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Wire protocol shared by memwrap and the analyzer.
+ *
+ * A wrapper opens the connection with a FRAME_HELLO. An analyzer that understands the binary protocol answers with a
+ * FRAME_HELLO_ACK naming the format to use; clients that get no answer (old analyzers) fall back to newline-delimited
+ * JSON, and analyzers still accept JSON from old wrappers that never send a hello.
+ *
+ * Every binary message is a FrameHeader followed by `length` payload bytes. Both ends run on the same host, so all
+ * fields are in native byte order. Payload structs only ever grow at the end: a reader copies min(length, sizeof)
+ * bytes and zero-fills the rest, so older peers keep working when fields are appended.
+ *
+ * After the handshake a binary wrapper also reads the socket: the analyzer may send FRAME_CONTROL frames at any time
+ * to retune it (see ControlFrame) and FRAME_FILTER frames to narrow down the events it sends (see FilterFrame). Frames of
+ * unknown kinds are skipped by both ends.
+ *
+ * Leaks found by a binary wrapper are not sent one event per block but aggregated into FRAME_LEAK_SUMMARY frames (see
+ * LeakSummaryFrame), written straight to the socket. Wrappers measuring latencies send their histograms the same way in
+ * FRAME_LATENCY frames (see LatencyFrame). A FRAME_COUNTERS hands the analyzer the wrapper's live counters page (see
+ * CountersFrame).
+ */
+
+#define PROTOCOL_MAGIC 0x4450414du  // "MAPD"
+#define PROTOCOL_VERSION 1
+
+typedef enum {
+    EVENT_MALLOC,
+    EVENT_FREE,
+    EVENT_MEMORY_LEAK,
+    EVENT_DANGLING_POINTER,
+    EVENT_BUFFER_OVERFLOW,
+    EVENT_DOUBLE_FREE,
+    EVENT_FORCED_CRASH,
+    EVENT_EVENTS_DROPPED,
+    EVENT_ALLOC_MISMATCH,  // released through a different family than allocated, or sized delete with the wrong size
+    EVENT_LIVE_BLOCK,      // block still allocated, reported for a snapshot requested with CONTROL_SNAPSHOT
+    EVENT_TRACKING,        // tracking was switched on (size 1) or off (size 0)
+    EVENT_INDIRECT_LEAK,   // lost block only referenced from other lost blocks (see leak_scan.c)
+    EVENT_STILL_REACHABLE  // block still referenced when leaks were scanned for
+} EventType;
+
+/**
+ * ProtocolFormat:
+ *
+ * Event encodings a wrapper can offer in its hello. Used as a bitmask in HelloFrame.formats.
+ */
+typedef enum {
+    PROTOCOL_FORMAT_JSON = 1 << 0,
+    PROTOCOL_FORMAT_BINARY = 1 << 1
+} ProtocolFormat;
+
+/**
+ * ProtocolTransport:
+ *
+ * Ways binary events can travel, used as a bitmask in HelloFrame.transports. With PROTOCOL_TRANSPORT_RING the
+ * wrapper attaches a memfd holding an EventRing (see event_ring.h) to the hello and only uses the socket for
+ * FRAME_WAKEUP and non-event frames.
+ */
+typedef enum {
+    PROTOCOL_TRANSPORT_SOCKET = 1 << 0,
+    PROTOCOL_TRANSPORT_RING = 1 << 1
+} ProtocolTransport;
+
+typedef enum {
+    FRAME_HELLO = 1,
+    FRAME_HELLO_ACK = 2,
+    FRAME_EVENT = 3,
+    FRAME_WAKEUP = 4,
+    FRAME_STACK = 5,
+    FRAME_CONTROL = 6,
+    FRAME_FILTER = 7,
+    FRAME_LEAK_SUMMARY = 8,
+    FRAME_LATENCY = 9,
+    FRAME_COUNTERS = 10
+} FrameKind;
+
+#define PROTOCOL_MAX_STACK_DEPTH 64
+#define PROTOCOL_MAX_FILTER_SITES 16
+#define PROTOCOL_FILTER_SITE_LENGTH 64
+#define PROTOCOL_MAX_SUMMARY_BYTES 32768  // payload of one FRAME_LEAK_SUMMARY, well below the analyzer's read buffer
+#define PROTOCOL_MAX_VARINT_BYTES 10
+
+// Event mask (see CONTROL_SET_EVENT_MASK) without the routine malloc/free traffic
+#define PROTOCOL_ERROR_EVENTS (~((1ull << EVENT_MALLOC) | (1ull << EVENT_FREE)))
+
+/**
+ * FrameHeader:
+ *
+ * Prefix of every binary message. `length` counts the payload bytes that follow the header.
+ */
+typedef struct {
+    uint16_t kind;
+    uint16_t flags;
+    uint32_t length;
+} FrameHeader;
+
+/**
+ * HelloFrame:
+ *
+ * First frame sent by a wrapper after connecting. `realtime_ns` and `monotonic_ns` are CLOCK_REALTIME and
+ * CLOCK_MONOTONIC read back to back; they anchor the monotonic event timestamps to the wall clock.
+ * `parent_client_id` is the client this one descends from, 0 for none: the process that forked it, with its pid in
+ * `parent_pid`, or the program image that exec()ed it, in which case `parent_pid` equals `pid`.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t formats;
+    uint32_t pid;
+    uint32_t transports;
+    int64_t realtime_ns;
+    int64_t monotonic_ns;
+    uint32_t parent_pid;
+    int32_t parent_client_id;
+} HelloFrame;
+
+/**
+ * HelloAckFrame:
+ *
+ * Analyzer answer to a hello. `format` and `transport` are the single ProtocolFormat and ProtocolTransport the
+ * wrapper must use from now on.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t format;
+    int32_t client_id;
+    uint32_t transport;
+} HelloAckFrame;
+
+/**
+ * EventRecord:
+ *
+ * Fixed-size binary form of one memory event, the payload of a FRAME_EVENT. `stack_id` names a call stack
+ * announced earlier with a FRAME_STACK, 0 if none was captured. `thread` is the kernel thread id and `timestamp`
+ * CLOCK_MONOTONIC in nanoseconds. `weight` is set in the sampling mode: the number of allocated bytes the sampled
+ * block stands for.
+ *
+ * `seq` numbers the events of a process from 1 in the order they happened: a malloc is numbered before its pointer is
+ * returned and a free before the block is released, so the events of one address are numbered in causal order even
+ * when they come from different threads. `thread_seq` numbers the events of the sending thread from 1. Both are 0
+ * from wrappers that predate them.
+ */
+typedef struct {
+    uint16_t type;
+    uint16_t flags;
+    uint32_t stack_id;
+    uint64_t addr;
+    uint64_t size;
+    uint64_t thread;
+    int64_t timestamp;
+    uint64_t weight;
+    uint64_t seq;
+    uint32_t thread_seq;
+    uint32_t reserved;
+} EventRecord;
+
+/**
+ * StackTrace:
+ *
+ * Payload of a FRAME_STACK: a call stack the wrapper interned under `stack_id`, innermost frame first. Each id is
+ * announced once per connection, before or shortly after the first event that uses it. Only `depth` frames are
+ * sent, so the payload is shorter than the struct.
+ */
+typedef struct {
+    uint32_t stack_id;
+    uint16_t depth;
+    uint16_t reserved;
+    uint64_t frames[PROTOCOL_MAX_STACK_DEPTH];
+} StackTrace;
+
+/**
+ * ControlCommand:
+ *
+ * Commands an analyzer can send to a connected binary wrapper, with the meaning of ControlFrame.value:
+ *  - CONTROL_SET_MODE: a ControlMode, for allocations from now on;
+ *  - CONTROL_SET_SAMPLE_BYTES: mean bytes between samples in the sampling mode;
+ *  - CONTROL_SET_STACK_DEPTH: frames captured per allocation stack, 0 disables capture;
+ *  - CONTROL_SET_GUARD_RATE: one in `value` untracked allocations goes to the guard pool, 0 disables it;
+ *  - CONTROL_SET_EVENT_MASK: bit (1 << EventType) set for every event type the wrapper should send;
+ *  - CONTROL_SNAPSHOT: a ControlSnapshotTarget, where to put every live block;
+ *  - CONTROL_SCAN: check the heap for corruption now, no value;
+ *  - CONTROL_SET_TRACKING: 1 opens a tracking window, 0 closes it;
+ *  - CONTROL_LEAK_SCAN: look for unreachable blocks now, no value;
+ *  - CONTROL_SET_LATENCY: milliseconds between FRAME_LATENCY reports, 0 stops measuring latencies.
+ */
+typedef enum {
+    CONTROL_SET_MODE = 1,
+    CONTROL_SET_SAMPLE_BYTES = 2,
+    CONTROL_SET_STACK_DEPTH = 3,
+    CONTROL_SET_GUARD_RATE = 4,
+    CONTROL_SET_EVENT_MASK = 5,
+    CONTROL_SNAPSHOT = 6,
+    CONTROL_SCAN = 7,
+    CONTROL_SET_TRACKING = 8,
+    CONTROL_LEAK_SCAN = 9,
+    CONTROL_SET_LATENCY = 10
+} ControlCommand;
+
+/**
+ * ControlSnapshotTarget:
+ *
+ * Values of CONTROL_SNAPSHOT: every live block reported as an EVENT_LIVE_BLOCK, or written to a heap snapshot file
+ * on the wrapper's side (see heap_snapshot.h).
+ */
+typedef enum {
+    CONTROL_SNAPSHOT_EVENTS = 0,
+    CONTROL_SNAPSHOT_FILE = 1
+} ControlSnapshotTarget;
+
+/**
+ * ControlMode:
+ *
+ * Wrapper modes, as selected at start-up with MAPD_MODE.
+ */
+typedef enum {
+    CONTROL_MODE_DEBUG = 0,
+    CONTROL_MODE_TEST = 1,
+    CONTROL_MODE_PERF = 2,
+    CONTROL_MODE_SAMPLE = 3,
+    CONTROL_MODE_COUNT = 4
+} ControlMode;
+
+/**
+ * ControlFrame:
+ *
+ * Payload of a FRAME_CONTROL, sent from the analyzer to a wrapper. Wrappers ignore commands they do not know.
+ */
+typedef struct {
+    uint16_t command;
+    uint16_t reserved;
+    uint32_t reserved2;
+    uint64_t value;
+} ControlFrame;
+
+/**
+ * FilterSitePolicy:
+ *
+ * How FilterFrame.sites are used: ignored, as the only allocation sites to report, or as sites not to report.
+ */
+typedef enum {
+    FILTER_SITES_ANY = 0,
+    FILTER_SITES_ALLOW = 1,
+    FILTER_SITES_DENY = 2
+} FilterSitePolicy;
+
+/**
+ * FilterFrame:
+ *
+ * Payload of a FRAME_FILTER, sent from the analyzer to a wrapper. Replaces the wrapper's block filter, which decides
+ * at allocation time whether the malloc, free, memory_leak and live_block events of a block are sent at all; error
+ * events are never filtered by it. A block is reported if its requested size lies in [min_size, max_size] (0 for no
+ * upper bound) and its allocation site passes `site_policy`.
+ *
+ * A site is the first caller outside the wrapper. Each entry of `sites` names a module, matched as a substring of
+ * its file name ("libfoo" or "myapp"), optionally narrowed to a range of file offsets as printed in stacks
+ * ("myapp+0x1200-0x1400"). Modules are resolved when the filter arrives, so libraries loaded later are not covered.
+ * Only `site_count` entries are sent, so the payload is shorter than the struct.
+ */
+typedef struct {
+    uint64_t min_size;
+    uint64_t max_size;
+    uint16_t site_policy;
+    uint16_t site_count;
+    uint32_t reserved;
+    char sites[PROTOCOL_MAX_FILTER_SITES][PROTOCOL_FILTER_SITE_LENGTH];
+} FilterFrame;
+
+/**
+ * LeakSummaryFrame:
+ *
+ * Payload of a FRAME_LEAK_SUMMARY: the lost (and, if asked for, still reachable) blocks of one leak report, aggregated
+ * by event type and allocation site, or by size for blocks without a stack. `report` numbers the reports of a client
+ * from 1. A report too big for one frame is split into parts numbered from 0, and its last part has `last` set;
+ * `blocks` and `bytes` are totals of the whole report, repeated in every part. `timestamp` is CLOCK_MONOTONIC in
+ * nanoseconds.
+ *
+ * `entry_count` LeakSummaryEntry records start `entries_offset` bytes into the payload, so this struct can still grow.
+ * Each entry is packed as LEB128 varints: the number of fields that follow, then the fields in declaration order from
+ * `type` on, skipping `reserved`. Readers zero the fields an entry lacks and skip those they do not know.
+ */
+typedef struct {
+    uint32_t report;
+    uint16_t part;
+    uint16_t last;
+    uint32_t entry_count;
+    uint16_t entries_offset;
+    uint16_t reserved;
+    uint64_t blocks;
+    uint64_t bytes;
+    int64_t timestamp;
+} LeakSummaryFrame;
+
+/**
+ * LeakSummaryEntry:
+ *
+ * One aggregate of a leak summary: `count` blocks reported as `type`, allocated at `stack_id` (0 if no stack was
+ * captured, in which case every block has `min_size` bytes), with `bytes` bytes in total. `weight` is the sum of the
+ * sampling weights, see EventRecord.
+ */
+typedef struct {
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t stack_id;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t min_size;
+    uint64_t max_size;
+    uint64_t weight;
+} LeakSummaryEntry;
+
+#define PROTOCOL_SUMMARY_FIELDS 7
+#define PROTOCOL_MAX_ENTRY_BYTES ((PROTOCOL_SUMMARY_FIELDS + 1) * PROTOCOL_MAX_VARINT_BYTES)
+
+/**
+ * LatencyMetric:
+ *
+ * What a wrapper times, see LatencyFrame: calls into the real allocator, the mapping of a tracked block, waits for the
+ * wrapper's own locks (an allocation table shard, the quarantine) and the sending of one event.
+ */
+typedef enum {
+    LATENCY_REAL_ALLOC,
+    LATENCY_REAL_FREE,
+    LATENCY_BLOCK_MAP,
+    LATENCY_TABLE_LOCK,
+    LATENCY_QUARANTINE_LOCK,
+    LATENCY_EVENT_SEND,
+    LATENCY_METRIC_COUNT
+} LatencyMetric;
+
+/**
+ * Latency histograms are log-linear, as in HdrHistogram: values below 2^(PROTOCOL_LATENCY_SUB_BITS + 1) nanoseconds
+ * get a bucket each, and every power of two above is split into 2^PROTOCOL_LATENCY_SUB_BITS buckets, so a bucket is
+ * never wider than 1/8 of its values. The last bucket also counts everything from 2^41 ns (about 37 minutes) up.
+ */
+#define PROTOCOL_LATENCY_SUB_BITS 3
+#define PROTOCOL_LATENCY_MAX_EXPONENT 40
+#define PROTOCOL_LATENCY_BUCKETS ((PROTOCOL_LATENCY_MAX_EXPONENT - PROTOCOL_LATENCY_SUB_BITS + 2) << PROTOCOL_LATENCY_SUB_BITS)
+#define PROTOCOL_LATENCY_FIELDS 5
+#define PROTOCOL_MAX_LATENCY_METRIC_BYTES \
+    ((PROTOCOL_LATENCY_FIELDS + 1 + 2 * PROTOCOL_LATENCY_BUCKETS) * PROTOCOL_MAX_VARINT_BYTES)
+
+/**
+ * LatencyFrame:
+ *
+ * Payload of a FRAME_LATENCY: the latency histograms of a wrapper, totals since it started measuring, summed over all
+ * its threads. `report` numbers the reports of a client from 1; a reader gets the histograms of an interval by
+ * subtracting the previous report. `timestamp` is CLOCK_MONOTONIC in nanoseconds and `threads` the number of threads
+ * measured so far.
+ *
+ * `metric_count` metrics start `entries_offset` bytes into the payload. Each is packed as LEB128 varints: the number
+ * of fields that follow, then the LatencyMetric, the number of values, their sum and maximum in nanoseconds, and the
+ * number of non-empty buckets; then, per non-empty bucket in ascending order, its distance to the previous one (to -1
+ * for the first) and its count. Readers zero the fields a metric lacks and skip those they do not know.
+ */
+typedef struct {
+    uint32_t report;
+    uint16_t metric_count;
+    uint16_t entries_offset;
+    uint32_t threads;
+    uint32_t reserved;
+    int64_t timestamp;
+} LatencyFrame;
+
+#define PROTOCOL_MAX_LATENCY_BYTES (sizeof(LatencyFrame) + LATENCY_METRIC_COUNT * PROTOCOL_MAX_LATENCY_METRIC_BYTES)
+
+/**
+ * CountersFrame:
+ *
+ * Payload of a FRAME_COUNTERS, sent once after the handshake with the memfd of the wrapper's live counters page
+ * attached with SCM_RIGHTS (see counters_page.h). `size` is the size of the page in bytes.
+ */
+typedef struct {
+    uint64_t size;
+} CountersFrame;
+
+_Static_assert(sizeof(FrameHeader) == 8, "FrameHeader must stay 8 bytes");
+_Static_assert(sizeof(EventRecord) % 8 == 0, "EventRecord must stay 8-byte aligned");
+
+/**
+ * protocol_clock_ns:
+ *
+ * Reads a clock in nanoseconds. CLOCK_MONOTONIC and CLOCK_REALTIME are served by the vDSO, without a system call.
+ */
+static inline int64_t protocol_clock_ns(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * protocol_filter_add_sites:
+ *
+ * Appends the comma-separated entries of `list` to the sites of a filter, skipping empty entries and those that do
+ * not fit.
+ *
+ * @return Number of entries added
+ */
+static inline int protocol_filter_add_sites(FilterFrame* filter, const char* list)
+{
+    int added = 0;
+    while (list && *list) {
+        const char* end = strchr(list, ',');
+        const size_t length = end ? (size_t)(end - list) : strlen(list);
+        if (length > 0 && length < PROTOCOL_FILTER_SITE_LENGTH && filter->site_count < PROTOCOL_MAX_FILTER_SITES) {
+            memcpy(filter->sites[filter->site_count], list, length);
+            filter->sites[filter->site_count][length] = '\0';
+            filter->site_count++;
+            added++;
+        }
+        list = end ? end + 1 : NULL;
+    }
+    return added;
+}
+
+/**
+ * protocol_put_varint:
+ *
+ * Writes `value` as a LEB128 varint, seven bits per byte, low bits first.
+ *
+ * @return Number of bytes written, at most PROTOCOL_MAX_VARINT_BYTES
+ */
+static inline size_t protocol_put_varint(uint8_t* out, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+/**
+ * protocol_get_varint:
+ *
+ * Reads a LEB128 varint at `*cursor`, advancing it.
+ *
+ * @return 0 on success, -1 if the varint runs past `end` or is too long
+ */
+static inline int protocol_get_varint(const uint8_t** cursor, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 7 * PROTOCOL_MAX_VARINT_BYTES && *cursor < end; shift += 7) {
+        const uint8_t byte = *(*cursor)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * protocol_put_summary_entry:
+ *
+ * Packs a LeakSummaryEntry as described at LeakSummaryFrame.
+ *
+ * @param out Room for PROTOCOL_MAX_ENTRY_BYTES bytes
+ * @return Number of bytes written
+ */
+static inline size_t protocol_put_summary_entry(uint8_t* out, const LeakSummaryEntry* entry)
+{
+    const uint64_t fields[PROTOCOL_SUMMARY_FIELDS] = {
+        entry->type, entry->stack_id, entry->count, entry->bytes, entry->min_size, entry->max_size, entry->weight
+    };
+    size_t length = protocol_put_varint(out, PROTOCOL_SUMMARY_FIELDS);
+    for (int i = 0; i < PROTOCOL_SUMMARY_FIELDS; i++) length += protocol_put_varint(out + length, fields[i]);
+    return length;
+}
+
+/**
+ * protocol_get_summary_entry:
+ *
+ * Unpacks the LeakSummaryEntry at `*cursor`, advancing it past the entry.
+ *
+ * @return 0 on success, -1 if the entry is truncated
+ */
+static inline int protocol_get_summary_entry(const uint8_t** cursor, const uint8_t* end, LeakSummaryEntry* entry)
+{
+    uint64_t count;
+    uint64_t fields[PROTOCOL_SUMMARY_FIELDS] = {0};
+    if (protocol_get_varint(cursor, end, &count) != 0) return -1;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t value;
+        if (protocol_get_varint(cursor, end, &value) != 0) return -1;
+        if (i < PROTOCOL_SUMMARY_FIELDS) fields[i] = value;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->type = (uint16_t)fields[0];
+    entry->stack_id = (uint32_t)fields[1];
+    entry->count = fields[2];
+    entry->bytes = fields[3];
+    entry->min_size = fields[4];
+    entry->max_size = fields[5];
+    entry->weight = fields[6];
+    return 0;
+}
+
+/**
+ * protocol_latency_bucket:
+ *
+ * Index of the histogram bucket counting `ns`, see PROTOCOL_LATENCY_BUCKETS.
+ */
+static inline unsigned protocol_latency_bucket(uint64_t ns)
+{
+    if (ns < (2u << PROTOCOL_LATENCY_SUB_BITS)) return (unsigned)ns;
+    const unsigned exponent = 63 - (unsigned)__builtin_clzll(ns);
+    if (exponent > PROTOCOL_LATENCY_MAX_EXPONENT) return PROTOCOL_LATENCY_BUCKETS - 1;
+    const unsigned shift = exponent - PROTOCOL_LATENCY_SUB_BITS;
+    return ((shift + 1) << PROTOCOL_LATENCY_SUB_BITS) + (unsigned)((ns >> shift) & ((1u << PROTOCOL_LATENCY_SUB_BITS) - 1));
+}
+
+/**
+ * protocol_latency_bucket_low:
+ *
+ * Smallest value counted by bucket `index`.
+ */
+static inline uint64_t protocol_latency_bucket_low(unsigned index)
+{
+    if (index < (2u << PROTOCOL_LATENCY_SUB_BITS)) return index;
+    const unsigned shift = (index >> PROTOCOL_LATENCY_SUB_BITS) - 1;
+    const uint64_t mantissa = (1u << PROTOCOL_LATENCY_SUB_BITS) | (index & ((1u << PROTOCOL_LATENCY_SUB_BITS) - 1));
+    return mantissa << shift;
+}
+
+/**
+ * protocol_latency_metric_name:
+ *
+ * Maps a LatencyMetric to a short name for logs.
+ */
+static inline const char* protocol_latency_metric_name(int metric)
+{
+    switch (metric) {
+        case LATENCY_REAL_ALLOC: return "real_alloc";
+        case LATENCY_REAL_FREE: return "real_free";
+        case LATENCY_BLOCK_MAP: return "block_map";
+        case LATENCY_TABLE_LOCK: return "table_lock";
+        case LATENCY_QUARANTINE_LOCK: return "quarantine_lock";
+        case LATENCY_EVENT_SEND: return "event_send";
+        default: return "unknown";
+    }
+}
+
+/**
+ * protocol_event_name:
+ *
+ * Maps an EventType to the name used in JSON messages and Message.type.
+ *
+ * @param type Event type
+ * @return Static string, "unknown" for out-of-range values
+ */
+static inline const char* protocol_event_name(int type)
+{
+    switch (type) {
+        case EVENT_MALLOC: return "malloc";
+        case EVENT_FREE: return "free";
+        case EVENT_MEMORY_LEAK: return "memory_leak";
+        case EVENT_DANGLING_POINTER: return "dangling_pointer";
+        case EVENT_BUFFER_OVERFLOW: return "buffer_overflow";
+        case EVENT_DOUBLE_FREE: return "double_free";
+        case EVENT_FORCED_CRASH: return "forced_crash";
+        case EVENT_EVENTS_DROPPED: return "events_dropped";
+        case EVENT_ALLOC_MISMATCH: return "alloc_mismatch";
+        case EVENT_LIVE_BLOCK: return "live_block";
+        case EVENT_TRACKING: return "tracking";
+        case EVENT_INDIRECT_LEAK: return "indirect_leak";
+        case EVENT_STILL_REACHABLE: return "still_reachable";
+        default: return "unknown";
+    }
+}
+
+#endif
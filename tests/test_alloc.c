@@ -40,6 +40,20 @@ void test_buffer_overflow() {
     free(p3);
 }
 
+void test_small_overflow() {
+    printf("\n[TEST] Small buffer overflow detection\n");
+    char* p = malloc(24);
+    if (!p) {
+        fprintf(stderr, "malloc failed\n");
+        return;
+    }
+    memset(p, 'a', 24);
+    // Past the padding to 16 bytes: the guard page of a slab cell (MAPD_SLAB=1) or the tail redzone
+    // (MAPD_CANARY=1). A small block mapped on its own ends far from any guard page.
+    p[32] = 'X';
+    free(p);
+}
+
 void test_dangling_pointer() {
     printf("\n[TEST] Dangling pointer detection\n");
     char* p = malloc(126);
@@ -62,6 +76,27 @@ void test_double_free() {
     free(p);
 }
 
+void test_realloc_overflow() {
+    printf("\n[TEST] Overflow of a realloc-grown buffer\n");
+    char* p = calloc(1, 16);
+    if (!p) {
+        fprintf(stderr, "calloc failed\n");
+        return;
+    }
+
+    // Grow step by step, as string builders do
+    for (size_t size = 32; size <= 8192; size *= 2) {
+        p = realloc(p, size);
+        if (!p) {
+            fprintf(stderr, "realloc failed\n");
+            return;
+        }
+        memset(p, 'a', size);
+    }
+    p[8192] = 'X';  // Write just past the grown buffer
+    free(p);
+}
+
 void test_fragmentation() {
     printf("\n[TEST] Fragmentation detection\n");
 
@@ -95,7 +130,7 @@ void test_fragmentation() {
 }
 
 void print_usage(const char* progname) {
-    fprintf(stderr, "Usage: %s [--leak|--overflow|--dangling|--double-free|--fragmentation|--simple|--all]\n", progname);
+    fprintf(stderr, "Usage: %s [--leak|--overflow|--small-overflow|--dangling|--double-free|--realloc|--fragmentation|--simple|--all]\n", progname);
 }
 
 int main(int argc, char** argv) {
@@ -113,8 +148,10 @@ int main(int argc, char** argv) {
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--leak") == 0) test_memory_leak();
         else if (strcmp(argv[i], "--overflow") == 0) test_buffer_overflow();
+        else if (strcmp(argv[i], "--small-overflow") == 0) test_small_overflow();
         else if (strcmp(argv[i], "--dangling") == 0) test_dangling_pointer();
         else if (strcmp(argv[i], "--double-free") == 0) test_double_free();
+        else if (strcmp(argv[i], "--realloc") == 0) test_realloc_overflow();
         else if (strcmp(argv[i], "--fragmentation") == 0) test_fragmentation();
         else if (strcmp(argv[i], "--simple") == 0) test_simple_allocation();
         else if (strcmp(argv[i], "--all") == 0) {
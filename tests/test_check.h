@@ -0,0 +1,26 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+
+/*
+ * Minimal checks for the self-checking tests run by ctest: a failed check is
+ * reported with its line and counted, and main() returns test_result().
+ */
+
+static int test_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static inline int test_result(void) {
+    printf("\n[TEST] %s\n", test_failures ? "FAILED" : "All tests completed.");
+    return test_failures ? 1 : 0;
+}
+
+#endif
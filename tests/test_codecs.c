@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "protocol.h"
+#include "leak_summary.h"
+#include "latency_stats.h"
+#include "test_check.h"
+
+/*
+ * The LEB128 codecs of protocol.h and the payload parsers built on them
+ * (src/analyzer/leak_summary.c, src/analyzer/latency_stats.c): values round
+ * trip, and truncated or overlong varints are rejected rather than read past
+ * the end of a payload.
+ */
+
+void test_varint_round_trip() {
+    printf("\n[TEST] Varints round trip\n");
+    const uint64_t values[] = { 0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX, (uint64_t)1 << 63, UINT64_MAX };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t buffer[PROTOCOL_MAX_VARINT_BYTES];
+        const size_t length = protocol_put_varint(buffer, values[i]);
+        CHECK(length >= 1 && length <= PROTOCOL_MAX_VARINT_BYTES);
+
+        const uint8_t* cursor = buffer;
+        uint64_t value = 0;
+        CHECK(protocol_get_varint(&cursor, buffer + length, &value) == 0);
+        CHECK(value == values[i]);
+        CHECK(cursor == buffer + length);
+    }
+}
+
+void test_varint_truncated() {
+    printf("\n[TEST] Truncated varints are rejected\n");
+    uint8_t buffer[PROTOCOL_MAX_VARINT_BYTES];
+    const size_t length = protocol_put_varint(buffer, UINT64_MAX);
+    for (size_t cut = 0; cut < length; cut++) {
+        const uint8_t* cursor = buffer;
+        uint64_t value;
+        CHECK(protocol_get_varint(&cursor, buffer + cut, &value) == -1);
+        CHECK(cursor <= buffer + cut);
+    }
+}
+
+void test_varint_overlong() {
+    printf("\n[TEST] Overlong varints are rejected\n");
+    uint8_t buffer[PROTOCOL_MAX_VARINT_BYTES + 4];
+    memset(buffer, 0x80, sizeof(buffer));  // continuation bit on every byte
+    buffer[sizeof(buffer) - 1] = 0x01;
+
+    const uint8_t* cursor = buffer;
+    uint64_t value;
+    CHECK(protocol_get_varint(&cursor, buffer + sizeof(buffer), &value) == -1);
+    CHECK(cursor <= buffer + PROTOCOL_MAX_VARINT_BYTES);
+}
+
+void test_summary_entry() {
+    printf("\n[TEST] Leak summary entries round trip, with fields added or missing\n");
+    const LeakSummaryEntry entry = {
+        .type = EVENT_MEMORY_LEAK, .stack_id = 7, .count = 3, .bytes = 96, .min_size = 32, .max_size = 32,
+        .weight = UINT64_MAX
+    };
+    uint8_t buffer[PROTOCOL_MAX_ENTRY_BYTES + 16];
+    size_t length = protocol_put_summary_entry(buffer, &entry);
+    CHECK(length <= PROTOCOL_MAX_ENTRY_BYTES);
+
+    const uint8_t* cursor = buffer;
+    LeakSummaryEntry read;
+    CHECK(protocol_get_summary_entry(&cursor, buffer + length, &read) == 0);
+    CHECK(memcmp(&read, &entry, sizeof(entry)) == 0);
+
+    // A newer writer's entry with an extra field, which is skipped
+    length = protocol_put_varint(buffer, PROTOCOL_SUMMARY_FIELDS + 1);
+    const uint64_t fields[] = { EVENT_MEMORY_LEAK, 7, 3, 96, 32, 32, 5, 12345 };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) length += protocol_put_varint(buffer + length, fields[i]);
+    cursor = buffer;
+    CHECK(protocol_get_summary_entry(&cursor, buffer + length, &read) == 0);
+    CHECK(cursor == buffer + length && read.weight == 5);
+
+    // An older writer's entry without the weight, which reads as 0
+    length = protocol_put_varint(buffer, PROTOCOL_SUMMARY_FIELDS - 1);
+    for (size_t i = 0; i < PROTOCOL_SUMMARY_FIELDS - 1; i++) length += protocol_put_varint(buffer + length, fields[i]);
+    cursor = buffer;
+    CHECK(protocol_get_summary_entry(&cursor, buffer + length, &read) == 0);
+    CHECK(read.count == 3 && read.weight == 0);
+
+    // Cut short anywhere
+    length = protocol_put_summary_entry(buffer, &entry);
+    for (size_t cut = 0; cut < length; cut++) {
+        cursor = buffer;
+        CHECK(protocol_get_summary_entry(&cursor, buffer + cut, &read) == -1);
+    }
+}
+
+/**
+ * @brief Builds a FRAME_LEAK_SUMMARY payload with the given entries.
+ *
+ * @return Length of the payload
+ */
+static uint32_t build_summary(char* payload, const uint32_t report, const uint16_t part, const uint16_t last,
+                              const LeakSummaryEntry* entries, const uint32_t count) {
+    const LeakSummaryFrame frame = {
+        .report = report, .part = part, .last = last, .entry_count = count,
+        .entries_offset = sizeof(LeakSummaryFrame), .blocks = 10, .bytes = 1000
+    };
+    memcpy(payload, &frame, sizeof(frame));
+    size_t length = sizeof(frame);
+    for (uint32_t i = 0; i < count; i++) length += protocol_put_summary_entry((uint8_t*)payload + length, &entries[i]);
+    return (uint32_t)length;
+}
+
+void test_leak_summary_parts() {
+    printf("\n[TEST] Leak summary parts are assembled and malformed ones rejected\n");
+    const LeakSummaryEntry small = { .type = EVENT_MEMORY_LEAK, .count = 1, .bytes = 10, .min_size = 10, .max_size = 10 };
+    const LeakSummaryEntry large = { .type = EVENT_MEMORY_LEAK, .count = 2, .bytes = 990, .min_size = 490, .max_size = 500 };
+    StackTable stacks;
+    stack_table_init(&stacks, 0);
+    LeakSummary summary;
+    leak_summary_init(&summary, 1);
+    char payload[256];
+
+    uint32_t length = build_summary(payload, 1, 0, 0, &small, 1);
+    CHECK(leak_summary_add_part(&summary, payload, length, &stacks, 0) == 0);
+    length = build_summary(payload, 1, 1, 1, &large, 1);
+    CHECK(leak_summary_add_part(&summary, payload, length, &stacks, 0) == 1);
+    CHECK(summary.site_count == 2 && summary.sites[0].entry.bytes == 990);  // largest first
+    CHECK(summary.blocks == 10 && summary.bytes == 1000);
+    leak_summary_free(&summary);
+
+    // The last entry cut short, at every length
+    const uint32_t full = build_summary(payload, 2, 0, 1, &large, 1);
+    for (uint32_t cut = sizeof(LeakSummaryFrame); cut < full; cut++) {
+        CHECK(leak_summary_add_part(&summary, payload, cut, &stacks, 0) == -1);
+        CHECK(summary.site_count == 0);
+    }
+
+    // An overlong varint in place of the entry
+    length = build_summary(payload, 3, 0, 1, NULL, 0);
+    ((LeakSummaryFrame*)payload)->entry_count = 1;
+    memset(payload + length, 0x80, PROTOCOL_MAX_VARINT_BYTES + 1);
+    payload[length + PROTOCOL_MAX_VARINT_BYTES + 1] = 0x01;
+    CHECK(leak_summary_add_part(&summary, payload, length + PROTOCOL_MAX_VARINT_BYTES + 2, &stacks, 0) == -1);
+
+    // Entries that start past the payload
+    length = build_summary(payload, 4, 0, 1, &small, 1);
+    ((LeakSummaryFrame*)payload)->entries_offset = (uint16_t)(length + 1);
+    CHECK(leak_summary_add_part(&summary, payload, length, &stacks, 0) == -1);
+
+    leak_summary_free(&summary);
+    stack_table_free(&stacks);
+}
+
+/**
+ * @brief Builds a FRAME_LATENCY payload with one metric whose non-empty buckets are given.
+ *
+ * @return Length of the payload
+ */
+static uint32_t build_latency(uint8_t* payload, const unsigned* buckets, const uint64_t* counts, const unsigned used) {
+    const LatencyFrame frame = { .report = 1, .metric_count = 1, .entries_offset = sizeof(LatencyFrame), .threads = 1 };
+    memcpy(payload, &frame, sizeof(frame));
+    size_t length = sizeof(frame);
+
+    uint64_t total = 0;
+    for (unsigned i = 0; i < used; i++) total += counts[i];
+    const uint64_t fields[PROTOCOL_LATENCY_FIELDS] = { LATENCY_REAL_ALLOC, total, 1000, 500, used };
+    length += protocol_put_varint(payload + length, PROTOCOL_LATENCY_FIELDS);
+    for (int i = 0; i < PROTOCOL_LATENCY_FIELDS; i++) length += protocol_put_varint(payload + length, fields[i]);
+    unsigned previous = (unsigned)-1;
+    for (unsigned i = 0; i < used; i++) {
+        length += protocol_put_varint(payload + length, buckets[i] - previous);
+        length += protocol_put_varint(payload + length, counts[i]);
+        previous = buckets[i];
+    }
+    return (uint32_t)length;
+}
+
+void test_latency_report() {
+    printf("\n[TEST] Latency reports are unpacked and malformed ones rejected\n");
+    const unsigned buckets[] = { 0, 5, 40 };
+    const uint64_t counts[] = { 3, 1, UINT64_MAX >> 1 };
+    uint8_t payload[512];
+    LatencyReport report;
+
+    const uint32_t length = build_latency(payload, buckets, counts, 3);
+    CHECK(latency_report_parse((const char*)payload, length, 0, &report) == 0);
+    const LatencyHistogram* histogram = &report.metrics[LATENCY_REAL_ALLOC];
+    CHECK(histogram->buckets[0] == 3 && histogram->buckets[5] == 1 && histogram->buckets[40] == UINT64_MAX >> 1);
+    CHECK(histogram->max_ns == 500);
+
+    for (uint32_t cut = sizeof(LatencyFrame); cut < length; cut++)
+        CHECK(latency_report_parse((const char*)payload, cut, 0, &report) == -1);
+
+    // A bucket past the last one
+    const unsigned beyond[] = { 0, PROTOCOL_LATENCY_BUCKETS };
+    const uint32_t too_far = build_latency(payload, beyond, counts, 2);
+    CHECK(latency_report_parse((const char*)payload, too_far, 0, &report) == -1);
+
+    // The same bucket twice
+    const unsigned twice[] = { 5, 5 };
+    const uint32_t repeated = build_latency(payload, twice, counts, 2);
+    CHECK(latency_report_parse((const char*)payload, repeated, 0, &report) == -1);
+}
+
+int main() {
+    printf("=== Starting test_codecs ===\n");
+    test_varint_round_trip();
+    test_varint_truncated();
+    test_varint_overlong();
+    test_summary_entry();
+    test_leak_summary_parts();
+    test_latency_report();
+    return test_result();
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "counters_page.h"
+#include "test_check.h"
+
+/*
+ * The live counters page (src/message/counters_page.h): counters_page_read()
+ * sums the slots, and never counts a slot twice or leaves it out while another
+ * thread recycles it as the wrapper does.
+ */
+
+#define SLOTS 4
+
+static CountersPage* new_page(void) {
+    const size_t size = counters_page_size(SLOTS);  // a multiple of the cache line, as aligned_alloc() wants
+    CountersPage* page = aligned_alloc(COUNTERS_CACHE_LINE, size);
+    memset(page, 0, size);
+    counters_page_init(page, SLOTS, 1);
+    return page;
+}
+
+static void count(CounterSlot* slot, const size_t size, const int allocated) {
+    const unsigned size_class = counters_size_class(size);
+    atomic_fetch_add(allocated ? &slot->allocs[size_class] : &slot->frees[size_class], 1);
+    atomic_fetch_add(allocated ? &slot->alloc_bytes[size_class] : &slot->free_bytes[size_class], size);
+}
+
+void test_size_classes() {
+    printf("\n[TEST] Size classes\n");
+    CHECK(counters_size_class(0) == 0 && counters_size_class(1) == 0);
+    CHECK(counters_size_class(2) == 1);
+    CHECK(counters_size_class(3) == 2 && counters_size_class(4) == 2);
+    CHECK(counters_size_class(4096) == 12 && counters_size_class(4097) == 13);
+    CHECK(counters_size_class(SIZE_MAX) == COUNTERS_SIZE_CLASSES - 1);
+}
+
+void test_read_totals() {
+    printf("\n[TEST] Slots are summed up\n");
+    CountersPage* page = new_page();
+    uint32_t slot_count = 0;
+    CHECK(!counters_page_valid(page, counters_page_size(SLOTS) - 1, &slot_count));
+    CHECK(counters_page_valid(page, counters_page_size(SLOTS), &slot_count) && slot_count == SLOTS);
+
+    count(&page->slots[0], 100, 1);
+    count(&page->slots[1], 100, 1);
+    count(&page->slots[1], 100, 0);
+    count(&page->slots[3], 5000, 1);
+    atomic_store(&page->peak_live_bytes, 1000);
+    atomic_store(&page->threads_seen, 3);
+
+    CountersTotals totals;
+    CHECK(counters_page_read(page, SLOTS, &totals) == 0);
+    CHECK(totals.total_allocs == 3 && totals.total_frees == 1);
+    CHECK(totals.allocs[counters_size_class(100)] == 2);
+    CHECK(totals.alloc_bytes[counters_size_class(5000)] == 5000);
+    CHECK(totals.live_bytes == 5100);
+    CHECK(totals.peak_live_bytes == 5100);  // never below what is live now
+    CHECK(totals.threads_seen == 3);
+
+    // The header is the wrapper's to write: the validated count is the one summed
+    page->slot_count = UINT32_MAX;
+    CHECK(counters_page_read(page, slot_count, &totals) == 0 && totals.total_allocs == 3);
+    free(page);
+}
+
+void test_stuck_recycling() {
+    printf("\n[TEST] A page left mid-recycle is given up on\n");
+    CountersPage* page = new_page();
+    atomic_store(&page->generation, 1);
+    CountersTotals totals;
+    CHECK(counters_page_read(page, SLOTS, &totals) == -1);
+    free(page);
+}
+
+#define RECYCLES 20000
+#define READS 1000
+
+static atomic_int stop;
+static atomic_int recycled;
+
+/**
+ * @brief Moves slot 1 into slot 0 and back again, under an odd generation like the wrapper.
+ *
+ * Yields while the generation is even, or a reader on a single CPU would only ever find it odd.
+ */
+static void* recycle(void* arg) {
+    CountersPage* page = arg;
+    CounterSlot* from = &page->slots[1];
+    CounterSlot* into = &page->slots[0];
+    while (!atomic_load(&stop)) {
+        atomic_fetch_add(&page->generation, 1);
+        for (unsigned c = 0; c < COUNTERS_SIZE_CLASSES; c++) {
+            atomic_fetch_add(&into->allocs[c], atomic_exchange(&from->allocs[c], 0));
+            atomic_fetch_add(&into->alloc_bytes[c], atomic_exchange(&from->alloc_bytes[c], 0));
+        }
+        atomic_fetch_add(&page->generation, 1);
+        sched_yield();
+
+        atomic_fetch_add(&page->generation, 1);
+        for (unsigned c = 0; c < COUNTERS_SIZE_CLASSES; c++) {
+            atomic_fetch_add(&from->allocs[c], atomic_exchange(&into->allocs[c], 0));
+            atomic_fetch_add(&from->alloc_bytes[c], atomic_exchange(&into->alloc_bytes[c], 0));
+        }
+        atomic_fetch_add(&page->generation, 1);
+        atomic_fetch_add(&recycled, 1);
+        sched_yield();
+    }
+    return NULL;
+}
+
+void test_read_while_recycling() {
+    printf("\n[TEST] Reads during recycling see every count once\n");
+    CountersPage* page = new_page();
+    for (int i = 0; i < 1000; i++) count(&page->slots[1], 64, 1);
+
+    atomic_store(&stop, 0);
+    atomic_store(&recycled, 0);
+    pthread_t thread;
+    pthread_create(&thread, NULL, recycle, page);
+    int consistent = 1, reads = 0;
+    while (atomic_load(&recycled) < RECYCLES || reads < READS) {
+        CountersTotals totals;
+        if (counters_page_read(page, SLOTS, &totals) == 0) {
+            reads++;
+            if (totals.total_allocs != 1000 || totals.live_bytes != 64000) consistent = 0;
+        }
+        sched_yield();
+    }
+    atomic_store(&stop, 1);
+    pthread_join(thread, NULL);
+    CHECK(consistent);
+    free(page);
+}
+
+int main() {
+    printf("=== Starting test_counters_page ===\n");
+    test_size_classes();
+    test_read_totals();
+    test_stuck_recycling();
+    test_read_while_recycling();
+    return test_result();
+}
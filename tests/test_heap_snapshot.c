@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "heap_snapshot.h"
+#include "test_check.h"
+
+/*
+ * Round trip of a heap snapshot: run under the wrapper with MAPD_TRACK=1,
+ * MAPD_SNAPSHOT_SIGNAL=USR1 and MAPD_SNAPSHOT_DIR set (see CMakeLists.txt), it
+ * asks for a snapshot, validates the file and reads its blocks and stacks
+ * back, then checks that damaged copies are rejected.
+ */
+
+#define BLOCKS 64
+#define FIRST_SIZE 1000
+
+static void* map_snapshot(const char* path, size_t* size) {
+    // The snapshot thread renames the file into place once it is complete
+    for (int i = 0; i < 500; i++) {
+        const int fd = open(path, O_RDONLY);
+        if (fd != -1) {
+            struct stat st;
+            void* file = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+                file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (file == MAP_FAILED) return NULL;
+            *size = (size_t)st.st_size;
+            return file;
+        }
+        const struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000000 };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static const HeapSnapshotBlock* find_block(const void* file, const uint64_t addr) {
+    const HeapSnapshotHeader* header = file;
+    const char* blocks = (const char*)file + header->block_offset;
+    size_t low = 0, high = header->block_count;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        const HeapSnapshotBlock* block = (const HeapSnapshotBlock*)(blocks + middle * header->block_size);
+        if (block->addr == addr) return block;
+        if (block->addr < addr) low = middle + 1;
+        else high = middle;
+    }
+    return NULL;
+}
+
+static const HeapSnapshotStack* find_stack(const void* file, const uint32_t stack_id) {
+    const HeapSnapshotHeader* header = file;
+    const char* index = (const char*)file + header->stack_offset;
+    for (uint64_t i = 0; i < header->stack_count; i++) {
+        const HeapSnapshotStack* stack = (const HeapSnapshotStack*)(index + i * header->stack_size);
+        if (stack->stack_id == stack_id) return stack;
+    }
+    return NULL;
+}
+
+void test_read_back(const void* file, const size_t size, void* const* blocks) {
+    printf("\n[TEST] Snapshot read back\n");
+    CHECK(heap_snapshot_valid(file, size));
+
+    const HeapSnapshotHeader* header = file;
+    CHECK(header->version == HEAP_SNAPSHOT_VERSION);
+    CHECK(header->pid == (uint32_t)getpid());
+    CHECK(header->block_count >= BLOCKS);
+    CHECK(header->maps_bytes > 0);
+
+    const uint64_t* frames = heap_snapshot_frames(file);
+    for (int i = 0; i < BLOCKS; i++) {
+        const HeapSnapshotBlock* block = find_block(file, (uintptr_t)blocks[i]);
+        CHECK(block != NULL);
+        if (!block) continue;
+        CHECK(block->size == (uint64_t)(FIRST_SIZE + i));
+        if (block->stack_id == 0) continue;
+
+        const HeapSnapshotStack* stack = find_stack(file, block->stack_id);
+        CHECK(stack != NULL);
+        if (stack) CHECK(stack->depth > 0 && frames[stack->first_frame] != 0);
+    }
+}
+
+/*
+ * Stacks are only captured with an analyzer connected, so the stack index is
+ * checked on a snapshot built here: two blocks, two stacks of 2 and 3 frames.
+ */
+static size_t build_snapshot(char* file, const size_t capacity) {
+    const char maps[] = "00400000-00401000 r-xp 00000000 00:00 0 /test\n";
+    HeapSnapshotHeader header = {
+        .magic = HEAP_SNAPSHOT_MAGIC,
+        .version = HEAP_SNAPSHOT_VERSION,
+        .header_size = sizeof(HeapSnapshotHeader),
+        .block_offset = sizeof(HeapSnapshotHeader),
+        .block_count = 2,
+        .block_size = sizeof(HeapSnapshotBlock),
+        .stack_size = sizeof(HeapSnapshotStack),
+        .stack_count = 2,
+        .frame_count = 5,
+        .maps_bytes = sizeof(maps) - 1
+    };
+    header.stack_offset = header.block_offset + header.block_count * sizeof(HeapSnapshotBlock);
+    header.maps_offset = header.stack_offset + header.stack_count * sizeof(HeapSnapshotStack)
+                         + header.frame_count * sizeof(uint64_t);
+    const size_t size = header.maps_offset + header.maps_bytes;
+    if (size > capacity) return 0;
+
+    const HeapSnapshotBlock blocks[] = {
+        { .addr = 0x1000, .size = 16, .stack_id = 1 },
+        { .addr = 0x2000, .size = 32, .stack_id = 2 }
+    };
+    const HeapSnapshotStack stacks[] = {
+        { .stack_id = 1, .depth = 2, .first_frame = 0 },
+        { .stack_id = 2, .depth = 3, .first_frame = 2 }
+    };
+    const uint64_t frames[] = { 0x400100, 0x400200, 0x400300, 0x400400, 0x400500 };
+    memcpy(file, &header, sizeof(header));
+    memcpy(file + header.block_offset, blocks, sizeof(blocks));
+    memcpy(file + header.stack_offset, stacks, sizeof(stacks));
+    memcpy(file + header.stack_offset + sizeof(stacks), frames, sizeof(frames));
+    memcpy(file + header.maps_offset, maps, header.maps_bytes);
+    return size;
+}
+
+void test_damaged_copies(const void* file, const size_t size) {
+    printf("\n[TEST] Damaged snapshots are rejected\n");
+    char* copy = malloc(size);
+    HeapSnapshotHeader* header = (HeapSnapshotHeader*)copy;
+
+    memcpy(copy, file, size);
+    CHECK(heap_snapshot_valid(copy, size));
+    CHECK(!heap_snapshot_valid(copy, header->maps_offset - 1));
+
+    memcpy(copy, file, size);
+    header->frame_count += 1;
+    CHECK(!heap_snapshot_valid(copy, size));
+
+    memcpy(copy, file, size);
+    header->stack_count = (header->maps_offset - header->stack_offset) / header->stack_size + 1;
+    CHECK(!heap_snapshot_valid(copy, size));
+
+    memcpy(copy, file, size);
+    header->stack_offset = header->maps_offset + 8;
+    CHECK(!heap_snapshot_valid(copy, size));
+
+    memcpy(copy, file, size);
+    if (header->stack_count > 0) {
+        HeapSnapshotStack* last = (HeapSnapshotStack*)(copy + header->stack_offset) + header->stack_count - 1;
+
+        last->depth += 1;
+        CHECK(!heap_snapshot_valid(copy, size));
+
+        memcpy(copy, file, size);
+        last->first_frame = UINT64_MAX;
+        CHECK(!heap_snapshot_valid(copy, size));
+    }
+    free(copy);
+}
+
+void test_stack_index(void) {
+    printf("\n[TEST] Stack index read back\n");
+    char file[512];
+    const size_t size = build_snapshot(file, sizeof(file));
+    CHECK(size > 0 && heap_snapshot_valid(file, size));
+
+    const HeapSnapshotStack* stack = find_stack(file, 2);
+    CHECK(stack != NULL);
+    if (stack) CHECK(stack->depth == 3 && heap_snapshot_frames(file)[stack->first_frame + 2] == 0x400500);
+    test_damaged_copies(file, size);
+}
+
+int main(void) {
+    printf("=== Starting test_heap_snapshot ===\n");
+
+    const char* directory = getenv("MAPD_SNAPSHOT_DIR");
+    if (!directory || !getenv("MAPD_SNAPSHOT_SIGNAL")) {
+        fprintf(stderr, "Run with the wrapper preloaded and MAPD_SNAPSHOT_DIR, MAPD_SNAPSHOT_SIGNAL=USR1 set\n");
+        return 1;
+    }
+
+    void* blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; i++) blocks[i] = malloc(FIRST_SIZE + i);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/mapd-heap-%d-1.snap", directory, (int)getpid());
+    unlink(path);
+    raise(SIGUSR1);
+
+    size_t size = 0;
+    void* file = map_snapshot(path, &size);
+    CHECK(file != NULL);
+    if (file) {
+        test_read_back(file, size, blocks);
+        test_damaged_copies(file, size);
+        munmap(file, size);
+    }
+    unlink(path);
+    test_stack_index();
+
+    for (int i = 0; i < BLOCKS; i++) free(blocks[i]);
+    return test_result();
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "protocol.h"
+#include "latency_stats.h"
+#include "test_check.h"
+
+/*
+ * Latency histograms: the bucket bounds of protocol.h, and the percentiles
+ * and intervals computed from them in src/analyzer/latency_stats.c.
+ */
+
+static void record(LatencyHistogram* histogram, const uint64_t ns, const uint64_t times) {
+    histogram->buckets[protocol_latency_bucket(ns)] += times;
+    histogram->count += times;
+    histogram->sum_ns += ns * times;
+    if (ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+void test_bucket_bounds() {
+    printf("\n[TEST] Latency buckets tile the values without gaps\n");
+    for (unsigned i = 0; i < PROTOCOL_LATENCY_BUCKETS; i++) {
+        const uint64_t low = protocol_latency_bucket_low(i);
+        CHECK(protocol_latency_bucket(low) == i);
+        if (i + 1 == PROTOCOL_LATENCY_BUCKETS) continue;
+
+        const uint64_t next = protocol_latency_bucket_low(i + 1);
+        CHECK(next > low);
+        CHECK(protocol_latency_bucket(next - 1) == i);
+        // Never wider than 1/8 of the values it counts
+        CHECK(next - low <= (low >> PROTOCOL_LATENCY_SUB_BITS) || next - low == 1);
+    }
+    CHECK(protocol_latency_bucket(0) == 0);
+    CHECK(protocol_latency_bucket((uint64_t)1 << (PROTOCOL_LATENCY_MAX_EXPONENT + 1)) == PROTOCOL_LATENCY_BUCKETS - 1);
+    CHECK(protocol_latency_bucket(UINT64_MAX) == PROTOCOL_LATENCY_BUCKETS - 1);
+}
+
+void test_percentiles() {
+    printf("\n[TEST] Percentiles are the upper end of their bucket, capped by the maximum\n");
+    LatencyHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    CHECK(latency_histogram_percentile(&histogram, 50.0) == 0);
+
+    record(&histogram, 10, 90);
+    record(&histogram, 1000, 9);
+    record(&histogram, 100000, 1);
+
+    CHECK(latency_histogram_percentile(&histogram, 50.0) == 10);
+    CHECK(latency_histogram_percentile(&histogram, 90.0) == 10);
+    const uint64_t p99 = latency_histogram_percentile(&histogram, 99.0);
+    CHECK(p99 >= 1000 && p99 <= 1000 + (1000 >> PROTOCOL_LATENCY_SUB_BITS));
+    CHECK(latency_histogram_percentile(&histogram, 99.9) == 100000);
+    CHECK(latency_histogram_percentile(&histogram, 100.0) == 100000);
+    CHECK(latency_histogram_percentile(&histogram, 0.0) == 10);
+
+    // The bucket of 20 ends at 21, above the largest value
+    memset(&histogram, 0, sizeof(histogram));
+    record(&histogram, 20, 1);
+    CHECK(latency_histogram_percentile(&histogram, 50.0) == 20);
+
+    // The last bucket is open-ended
+    memset(&histogram, 0, sizeof(histogram));
+    record(&histogram, UINT64_MAX / 4, 1);
+    CHECK(latency_histogram_percentile(&histogram, 50.0) == UINT64_MAX / 4);
+}
+
+void test_interval() {
+    printf("\n[TEST] The interval between two reports\n");
+    LatencyHistogram before, now, interval;
+    memset(&before, 0, sizeof(before));
+    record(&before, 10, 5);
+    record(&before, 5000, 1);
+    now = before;
+    record(&now, 100, 4);
+
+    latency_histogram_since(&now, &before, &interval);
+    CHECK(interval.count == 4);
+    CHECK(interval.sum_ns == 400);
+    CHECK(interval.buckets[protocol_latency_bucket(100)] == 4);
+    CHECK(interval.buckets[protocol_latency_bucket(10)] == 0);
+    // The interval's own maximum is not known, only the end of its highest bucket
+    CHECK(interval.max_ns >= 100 && interval.max_ns < 5000);
+
+    // The wrapper started over: the totals went down
+    LatencyHistogram restarted;
+    memset(&restarted, 0, sizeof(restarted));
+    record(&restarted, 10, 1);
+    latency_histogram_since(&restarted, &now, &interval);
+    CHECK(interval.count == 1 && interval.max_ns == 10);
+}
+
+void test_format() {
+    printf("\n[TEST] A histogram on one line\n");
+    LatencyHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    record(&histogram, 48, 100);
+    char line[160];
+    latency_histogram_format(&histogram, line, sizeof(line));
+    CHECK(strncmp(line, "100 samples, mean 48ns, p50 ", 28) == 0);
+    CHECK(strstr(line, "max 48ns") != NULL);
+}
+
+int main() {
+    printf("=== Starting test_latency_stats ===\n");
+    test_bucket_bounds();
+    test_percentiles();
+    test_interval();
+    test_format();
+    return test_result();
+}
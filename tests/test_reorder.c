@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "reorder.h"
+#include "test_check.h"
+
+/*
+ * The analyzer's reorder stage (src/analyzer/reorder.c): records pushed out of
+ * order come back by `seq`, gaps stall the stage until it is full or forced,
+ * and numbers given up on are released at once when they turn up late.
+ */
+
+static EventRecord record_with(const uint64_t seq) {
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.seq = seq;
+    record.addr = 0x1000 + seq;
+    return record;
+}
+
+static void push(ReorderBuffer* buffer, const uint64_t seq) {
+    const EventRecord record = record_with(seq);
+    CHECK(reorder_push(buffer, &record) == 1);
+}
+
+#define NOTHING UINT64_MAX
+
+/**
+ * @brief Pops the next record and checks its number, NOTHING meaning none may be released.
+ */
+static void expect_pop(ReorderBuffer* buffer, const uint64_t seq, const int force) {
+    EventRecord record;
+    const int popped = reorder_pop(buffer, &record, force);
+    CHECK(popped == (seq != NOTHING));
+    if (popped) CHECK(record.seq == seq && record.addr == 0x1000 + seq);
+}
+
+void test_out_of_order_release() {
+    printf("\n[TEST] Out-of-order records come back in sequence\n");
+    ReorderBuffer buffer;
+    reorder_init(&buffer, 16);
+
+    push(&buffer, 3);
+    expect_pop(&buffer, NOTHING, 0);  // 1 and 2 are still missing
+    push(&buffer, 1);
+    expect_pop(&buffer, 1, 0);
+    expect_pop(&buffer, NOTHING, 0);
+    push(&buffer, 2);
+    expect_pop(&buffer, 2, 0);
+    expect_pop(&buffer, 3, 0);
+    expect_pop(&buffer, NOTHING, 1);
+    CHECK(buffer.skipped == 0);
+    reorder_free(&buffer);
+}
+
+void test_unnumbered_records() {
+    printf("\n[TEST] Records without a number are released first\n");
+    ReorderBuffer buffer;
+    reorder_init(&buffer, 16);
+
+    push(&buffer, 2);
+    push(&buffer, 0);
+    expect_pop(&buffer, 0, 0);
+    expect_pop(&buffer, NOTHING, 0);
+    push(&buffer, 1);
+    expect_pop(&buffer, 1, 0);
+    expect_pop(&buffer, 2, 0);
+    CHECK(buffer.skipped == 0);
+    reorder_free(&buffer);
+}
+
+void test_gap_forced_and_late() {
+    printf("\n[TEST] A gap is given up on when forced, and the late record passes at once\n");
+    ReorderBuffer buffer;
+    reorder_init(&buffer, 16);
+
+    push(&buffer, 1);
+    push(&buffer, 4);
+    expect_pop(&buffer, 1, 0);
+    expect_pop(&buffer, NOTHING, 0);
+    expect_pop(&buffer, 4, 1);
+    CHECK(buffer.skipped == 2);
+    CHECK(buffer.next_seq == 5);
+
+    push(&buffer, 2);
+    expect_pop(&buffer, 2, 0);
+    CHECK(buffer.skipped == 1);
+    push(&buffer, 5);
+    expect_pop(&buffer, 5, 0);
+    reorder_free(&buffer);
+}
+
+void test_full_stage_gives_up() {
+    printf("\n[TEST] A full stage releases past a gap\n");
+    ReorderBuffer buffer;
+    reorder_init(&buffer, 4);
+
+    for (uint64_t seq = 2; seq <= 5; seq++) push(&buffer, seq);
+    const EventRecord extra = record_with(6);
+    CHECK(reorder_push(&buffer, &extra) == 0);  // the caller has to pop first
+
+    expect_pop(&buffer, 2, 0);
+    CHECK(buffer.skipped == 1);
+    expect_pop(&buffer, 3, 0);
+    expect_pop(&buffer, 4, 0);
+    expect_pop(&buffer, 5, 0);
+    reorder_free(&buffer);
+}
+
+void test_shuffled_run() {
+    printf("\n[TEST] A shuffled run comes back sorted\n");
+    enum { RUN = 5000 };
+    static uint64_t order[RUN];
+    for (uint64_t i = 0; i < RUN; i++) order[i] = i + 1;
+    srand(42);
+    for (size_t i = RUN - 1; i > 0; i--) {
+        const size_t j = (size_t)rand() % (i + 1);
+        const uint64_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    ReorderBuffer buffer;
+    reorder_init(&buffer, RUN);
+    uint64_t expected = 1;
+    EventRecord record;
+    for (size_t i = 0; i < RUN; i++) {
+        push(&buffer, order[i]);
+        while (reorder_pop(&buffer, &record, 0)) CHECK(record.seq == expected++);
+    }
+    CHECK(expected == RUN + 1);
+    CHECK(buffer.count == 0 && buffer.skipped == 0);
+    reorder_free(&buffer);
+}
+
+int main() {
+    printf("=== Starting test_reorder ===\n");
+    test_out_of_order_release();
+    test_unnumbered_records();
+    test_gap_forced_and_late();
+    test_full_stage_gives_up();
+    test_shuffled_run();
+    return test_result();
+}